@@ -0,0 +1,95 @@
+//
+//  asyncblockdevice.h
+//  myfs
+//
+
+#ifndef asyncblockdevice_h
+#define asyncblockdevice_h
+
+#include <vector>
+
+#include "blockdevice.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#define BD_QUEUE_DEPTH 32
+
+/// @brief Block device with asynchronous requests
+///
+/// This block device submits queued requests through an io_uring, so up to queueDepth requests are in flight on the
+/// container file at the same time. If io_uring is not available (old kernel, not Linux, blocked by a sandbox), the
+/// requests are executed synchronously like in BlockDevice.
+class AsyncBlockDevice : public BlockDevice {
+private:
+    struct Request {
+        bool isWrite;
+        off_t pos;
+        size_t size;
+        uint64_t tag;
+        uint64_t start;     // time the request was queued
+        uint32_t cause;     // cause of the thread that queued the request
+        std::vector<struct iovec> iov;
+    };
+
+    uint32_t queueDepth;
+    std::vector<Request> requests;
+    std::vector<uint32_t> freeRequests;
+
+    int ringFd;
+    void *sqRing;
+    void *cqRing;
+    void *sqeArray;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqeArraySize;
+
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqIndexArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    void *cqes;
+
+    int setupRing();
+    void teardownRing();
+    int queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    unsigned unsubmitted();
+    int enter(unsigned minComplete);
+    int reap();
+    int inFlight();
+
+public:
+    /// @brief Create a new asynchronous block device.
+    ///
+    /// \param blockSize Block size.
+    /// \param queueDepth Maximum number of requests in flight.
+    AsyncBlockDevice(uint32_t blockSize, uint32_t queueDepth = BD_QUEUE_DEPTH);
+
+    virtual ~AsyncBlockDevice();
+
+    /// @brief Check whether requests are really executed asynchronously.
+    ///
+    /// \return true if io_uring is used, false if requests fall back to synchronous execution.
+    bool isAsync();
+
+    /// @brief Get the queue depth.
+    ///
+    /// \return Maximum number of requests in flight.
+    uint32_t getQueueDepth();
+
+    virtual int close();
+
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int submit();
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+    virtual int drain();
+};
+
+#endif /* asyncblockdevice_h */
@@ -0,0 +1,234 @@
+//
+//  blockcache.h
+//  myfs
+//
+
+#ifndef blockcache_h
+#define blockcache_h
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "blockdevice.h"
+
+#define BC_DEFAULT_CAPACITY 256
+#define BC_DEFAULT_DIRTY_AGE 5000   // ms a block may stay dirty in write-back mode
+#define BC_DEFAULT_DIRTY_RATIO 50   // percentage of the capacity that may be dirty before the flusher starts
+#define BC_PREFETCH_TAG (1ULL << 63) // marks the tags of prefetch requests
+
+/// @brief Replacement policy of a block cache.
+enum BlockCachePolicy {
+    CACHE_LRU,  // least recently used
+    CACHE_ARC   // adaptive replacement cache (Megiddo & Modha), balances recency and frequency
+};
+
+/// @brief Counters of a block cache.
+struct BlockCacheStats {
+    uint64_t hits;          // requested blocks found in the cache
+    uint64_t misses;        // requested blocks read from the device (or allocated for overwriting)
+    uint64_t ghostHits;     // misses on blocks that were evicted recently (ARC only)
+    uint64_t evictions;     // blocks dropped to make room
+    uint64_t writebacks;    // dirty blocks written to the device
+    uint64_t prefetched;    // blocks read by prefetch()
+    uint64_t prefetchHits;  // prefetched blocks that were requested before being evicted
+    uint32_t resident;      // blocks currently in the cache
+    uint32_t pinned;        // blocks currently pinned
+    uint32_t dirty;         // blocks currently dirty
+};
+
+/// @brief Size-bounded cache of device blocks
+///
+/// The cache keeps copies of recently used blocks of a block device, keyed by block number. Callers work on the cached
+/// copies in place: pin() makes a set of blocks resident and returns pointers to them, unpin() releases them. Pinned
+/// blocks are never evicted, so a request larger than the cache temporarily grows it. Blocks that are not resident
+/// are read with queued requests, consecutive blocks with a single request. Changed blocks are written to the device
+/// by writeBack().
+class BlockCache {
+private:
+    enum ListId { T1, T2, NONE };
+
+    struct Entry {
+        uint32_t blockNo;
+        char *data;
+        int pinCount;
+        ListId list;
+        std::list<Entry *>::iterator pos;
+        bool loading;       // prefetch in flight, the block is pinned until it finishes
+        bool loadFailed;    // prefetch failed, the content is invalid
+        bool prefetched;    // prefetched and not requested yet
+        bool dirty;
+        std::chrono::steady_clock::time_point dirtySince;
+        std::list<Entry *>::iterator dirtyPos;
+    };
+
+    BlockDevice *device;
+    uint32_t blockSize;
+    uint32_t capacity;
+    BlockCachePolicy policy;
+
+    std::unordered_map<uint32_t, Entry *> entries;
+    std::list<Entry *> t1;  // resident, seen once recently (LRU: all resident blocks), front is most recent
+    std::list<Entry *> t2;  // resident, seen at least twice recently
+    std::list<uint32_t> b1; // ghosts evicted from t1
+    std::list<uint32_t> b2; // ghosts evicted from t2
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> ghosts1;
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> ghosts2;
+    uint32_t target;        // ARC: target size of t1
+    std::vector<char *> freeFrames;
+
+    bool writeBackMode;
+    uint32_t maxDirtyAge;   // ms
+    uint32_t dirtyLimit;    // blocks
+    std::list<Entry *> dirtyBlocks;  // front is most recently dirtied
+    int writeError;         // first failed writeback not reported yet
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> prefetchRuns;  // blocks of prefetch requests in flight
+    uint64_t nextPrefetchTag;
+
+    std::mutex lock;
+    std::condition_variable flusherWake;
+    std::thread flusher;
+    bool flusherStop;
+
+    BlockCacheStats stats;
+
+    Entry *lookup(uint32_t blockNo);
+    Entry *insert(uint32_t blockNo);
+    void touch(Entry *entry);
+    void moveTo(Entry *entry, ListId list);
+    Entry *victim(std::list<Entry *> &list);
+    bool replace(bool inB2);
+    bool evict(Entry *entry, ListId ghostList);
+    void dropGhost(std::list<uint32_t> &list, std::unordered_map<uint32_t, std::list<uint32_t>::iterator> &index);
+    void shrink();
+    int queueRuns(bool isWrite, const uint32_t *blockNos, char *const *frames, const std::vector<int> &which);
+    bool finishPrefetch(const BlockCompletion &done);
+    void reapPrefetches(bool wait);
+    void waitLoading(Entry *entry);
+    int pinBlocks(const uint32_t *blockNos, int count, char **frames, const bool *fetch);
+    void unpinBlocks(const uint32_t *blockNos, int count);
+    void discardBlock(uint32_t blockNo);
+    void setDirty(Entry *entry, bool dirty);
+    int writeDirty(std::vector<Entry *> &dirtyEntries);
+    int takeWriteError();
+    void flusherMain();
+    void stopFlusher();
+
+public:
+    /// @brief Create a block cache.
+    ///
+    /// \param device Block device whose blocks are cached.
+    /// \param blockSize Block size of the device.
+    /// \param capacity Maximum number of blocks kept when no blocks are pinned.
+    /// \param policy Replacement policy.
+    BlockCache(BlockDevice *device, uint32_t blockSize, uint32_t capacity, BlockCachePolicy policy);
+
+    ~BlockCache();
+
+    /// @brief Pin blocks.
+    ///
+    /// Makes the blocks resident and pins them. Blocks that are not resident are read from the device, unless fetch
+    /// says otherwise for a block because the caller overwrites it completely.
+    /// \param [in] blockNos Numbers of the blocks.
+    /// \param [in] count Number of blocks.
+    /// \param [out] frames Pointers to the cached content of the blocks, valid until unpin().
+    /// \param [in] fetch For each block whether a missing block must be read, nullptr to read all missing blocks.
+    /// \return 0 on success, -ERRNO on failure (nothing is pinned then).
+    int pin(const uint32_t *blockNos, int count, char **frames, const bool *fetch = nullptr);
+
+    /// @brief Unpin blocks.
+    ///
+    /// \param [in] blockNos Numbers of the blocks, pinned before by pin().
+    /// \param [in] count Number of blocks.
+    void unpin(const uint32_t *blockNos, int count);
+
+    /// @brief Store changes of pinned blocks.
+    ///
+    /// In write-through mode the blocks are written to the device, in write-back mode they are marked dirty.
+    /// \param [in] blockNos Numbers of the blocks, must be pinned.
+    /// \param [in] count Number of blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    int commit(const uint32_t *blockNos, int count);
+
+    /// @brief Read blocks in the background.
+    ///
+    /// Blocks that are not resident are added to the cache and read with one request per run of consecutive blocks,
+    /// without waiting for the requests. Stops early instead of pushing the cache over its capacity.
+    /// \param [in] blockNos Numbers of the blocks.
+    /// \param [in] count Number of blocks.
+    /// \return Number of blocks that are being read, -ERRNO on failure.
+    int prefetch(const uint32_t *blockNos, int count);
+
+    /// @brief Write dirty blocks to the device.
+    ///
+    /// Blocks that are not cached or not dirty are skipped. The blocks are written ordered by block number, consecutive
+    /// blocks with a single request.
+    /// \param [in] blockNos Numbers of the blocks.
+    /// \param [in] count Number of blocks.
+    /// \return 0 on success, -ERRNO on failure, also if an earlier writeback by the flusher failed.
+    int flush(const uint32_t *blockNos, int count);
+
+    /// @brief Write all dirty blocks to the device.
+    ///
+    /// \return 0 on success, -ERRNO on failure, also if an earlier writeback by the flusher failed.
+    int flushAll();
+
+    /// @brief Switch between write-through and write-back mode.
+    ///
+    /// Enabling write-back mode starts the flusher thread. Disabling it stops the flusher and writes all dirty blocks.
+    /// Dirty blocks left when the cache is destroyed are lost.
+    /// \param [in] enable true for write-back mode.
+    /// \param [in] maxDirtyAge Time in ms after which the flusher writes a dirty block.
+    /// \param [in] dirtyLimit Number of dirty blocks above which the flusher writes the oldest blocks until half of
+    /// them are left, 0 for BC_DEFAULT_DIRTY_RATIO percent of the capacity.
+    /// \return 0 on success, -ERRNO if writing the dirty blocks failed.
+    int setWriteBack(bool enable, uint32_t maxDirtyAge = BC_DEFAULT_DIRTY_AGE, uint32_t dirtyLimit = 0);
+
+    /// @brief Check whether the cache is in write-back mode.
+    ///
+    /// \return true in write-back mode.
+    bool isWriteBack();
+
+    /// @brief Read a block through the cache.
+    ///
+    /// \param [in] blockNo Number of the block.
+    /// \param [out] buffer Buffer for the content of the block.
+    /// \return 0 on success, -ERRNO on failure.
+    int read(uint32_t blockNo, char *buffer);
+
+    /// @brief Write a block through the cache.
+    ///
+    /// \param [in] blockNo Number of the block.
+    /// \param [in] buffer Content of the block.
+    /// \return 0 on success, -ERRNO on failure.
+    int write(uint32_t blockNo, const char *buffer);
+
+    /// @brief Drop a block from the cache.
+    ///
+    /// Used when the block is freed and its content does not matter anymore. A dirty block is dropped without writing it.
+    /// \param [in] blockNo Number of the block, must not be pinned.
+    void discard(uint32_t blockNo);
+
+    /// @brief Get the counters of the cache.
+    ///
+    /// \return Copy of the counters.
+    BlockCacheStats getStats();
+
+    /// @brief Get the replacement policy.
+    ///
+    /// \return The replacement policy.
+    BlockCachePolicy getPolicy();
+
+    /// @brief Get the capacity.
+    ///
+    /// \return Maximum number of blocks kept when no blocks are pinned.
+    uint32_t getCapacity();
+};
+
+#endif /* blockcache_h */
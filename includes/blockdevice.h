@@ -13,18 +13,74 @@
 
 #include <stdio.h>
 #include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #define BD_BLOCK_SIZE 512
+#define BD_DIRECT_BUFFER_SIZE (64 * 1024)
+#define BD_DIRECT_BUFFER_COUNT 4
+#define BD_LATENCY_BUCKETS 32   // latency histogram buckets, bucket i counts latencies from 2^i to 2^(i+1)-1 ns
+#define BD_MAX_CAUSES 32        // number of distinct causes requests can be attributed to
+
+class AlignedBufferPool;
+
+/// @brief Kinds of block device requests in the statistics.
+enum BlockDeviceOp {
+    BD_OP_READ,
+    BD_OP_WRITE,
+    BD_OP_FLUSH,
+    BD_OP_DISCARD,
+    BD_OP_COUNT
+};
+
+/// @brief Statistics of a block device.
+struct BlockDeviceStats {
+    uint64_t requests[BD_OP_COUNT];                     // number of requests
+    uint64_t bytes[BD_OP_COUNT];                        // bytes read, written or discarded
+    uint64_t sequential[BD_OP_COUNT];                   // reads and writes starting where the previous one ended
+    uint64_t latencyNs[BD_OP_COUNT];                    // sum of the latencies of all requests
+    uint64_t latency[BD_OP_COUNT][BD_LATENCY_BUCKETS];  // latency histogram, log2 of nanoseconds
+    uint64_t causeRequests[BD_MAX_CAUSES];              // reads and writes per cause, see setCause()
+};
+
+/// @brief Result of a queued block device request.
+struct BlockCompletion {
+    uint64_t tag;   // tag given when the request was queued
+    int result;     // 0 on success, -ERRNO on failure
+};
 
 /// @brief Emulate a block device
 ///
 /// This class emulates access to a generic block device (e.g. a hard disc or USB drive partition) using the
 /// local file system.
 class BlockDevice {
-private:
+protected:
     uint32_t blockSize;
     int contFile;
     // uint32_t size;
+
+    std::deque<BlockCompletion> completions;
+
+    std::mutex statsMutex;    // requests are also issued by the flusher thread of the block cache
+    BlockDeviceStats stats;
+    off_t nextPos[BD_OP_COUNT];   // end of the previous request of each kind
+    static thread_local uint32_t cause;
+
+    bool directIO;
+    size_t directAlign;       // alignment of file offsets and lengths required for direct I/O
+    size_t directMemAlign;    // alignment of buffers required for direct I/O
+    AlignedBufferPool *bufferPool;
+
+    int openContainer(const char *path, int flags);
+    bool isDirectAligned(off_t pos, const struct iovec *iov, int iovcnt);
+    int transfer(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt);
+    int transferUnrecorded(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt);
+    void record(BlockDeviceOp op, off_t pos, size_t size, uint64_t startNs, uint32_t cause);
+    static uint64_t clockNs();
+    int transferBounced(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt);
     
 public:
     /// @brief Create a new block device.
@@ -33,12 +89,33 @@ public:
     /// \param blockSize Block size.
     BlockDevice(uint32_t blockSize);
 
+    virtual ~BlockDevice();
+
+    /// @brief Enable direct I/O.
+    ///
+    /// With direct I/O the container file is opened with O_DIRECT, so its content is not kept in the page cache of
+    /// the host. Requests whose buffers, positions or lengths do not meet the alignment required by the host file
+    /// system are staged through a pool of aligned buffers. Must be called before open() or create(); if the host
+    /// file system does not support direct I/O, the container file is opened normally.
+    /// \param directIO true to enable direct I/O.
+    void setDirectIO(bool directIO);
+
+    /// @brief Get the block size.
+    ///
+    /// \return Block size in bytes.
+    uint32_t getBlockSize();
+
+    /// @brief Check whether direct I/O is used.
+    ///
+    /// \return true if the container file is opened for direct I/O.
+    bool isDirectIO();
+
     /// @brief Open an existing container file.
     ///
     /// This methods opens an existing container file and attaches it to the block device object.
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int open(const char* path);
+    virtual int open(const char* path);
 
     /// @brief Create a new container file.
     ///
@@ -47,13 +124,13 @@ public:
     ///
     /// \param path Path of the container file.
     /// \return 0 on success, -ERRNO on failure.
-    int create(const char* path);
+    virtual int create(const char* path);
 
     /// @brief Close a container file.
     ///
     /// This method closes a container file.
     /// \return 0 on success, -ERRNO on failure.
-    int close();
+    virtual int close();
 
     /// @brief Read a block.
     ///
@@ -62,7 +139,7 @@ public:
     /// \param [in] blockNo Number of the block to read.
     /// \param [out] buffer Buffer for storing the content of the block.
     /// \return 0 on success, -ERRNO on failure.
-    int read(uint32_t blockNo, char *buffer);
+    virtual int read(uint32_t blockNo, char *buffer);
 
     /// @brief Write a block
     ///
@@ -71,7 +148,170 @@ public:
     /// \param [in] blockNo Number of the block to write.
     /// \param [out] buffer Buffer storing the content to write.
     /// \return 0 on success, -ERRNO on failure.
-    int write(uint32_t blockNo, char *buffer);
+    virtual int write(uint32_t blockNo, char *buffer);
+
+    /// @brief Read a run of consecutive blocks.
+    ///
+    /// This method reads count blocks starting with block firstBlockNo from the container file using a single
+    /// system call (unless the transfer is interrupted). Note that the size of the buffer must be at least count
+    /// blocks.
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] count Number of blocks to read.
+    /// \param [out] buffer Buffer for storing the content of the blocks.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Write a run of consecutive blocks.
+    ///
+    /// This method writes count blocks starting with block firstBlockNo into the container file using a single
+    /// system call (unless the transfer is interrupted). Note that the size of the buffer must be at least count
+    /// blocks.
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] count Number of blocks to write.
+    /// \param [in] buffer Buffer storing the content to write.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+
+    /// @brief Read a run of consecutive blocks into scattered buffers.
+    ///
+    /// The blocks starting with firstBlockNo are filled into the buffers described by iov, in order. The total
+    /// length of all buffers must be a multiple of the block size.
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] iov Buffers for storing the content of the blocks.
+    /// \param [in] iovcnt Number of entries in iov.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+
+    /// @brief Write a run of consecutive blocks from scattered buffers.
+    ///
+    /// The content of the buffers described by iov is written, in order, to the blocks starting with firstBlockNo.
+    /// The total length of all buffers must be a multiple of the block size.
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] iov Buffers storing the content to write.
+    /// \param [in] iovcnt Number of entries in iov.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+
+    /// @brief Grow the container file.
+    ///
+    /// Space for the new blocks is reserved on the host with fallocate(), so writing them later does not fail for
+    /// lack of space. If the host file system cannot reserve space, the container file is only extended.
+    /// \param [in] blockCount New size of the container in blocks, ignored if the container is already larger.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int grow(uint32_t blockCount);
+
+    /// @brief Discard blocks.
+    ///
+    /// The blocks are punched out of the container file with fallocate(FALLOC_FL_PUNCH_HOLE), so they no longer take
+    /// space on the host. Discarded blocks read as zeros. The size of the container file does not change.
+    /// \param [in] firstBlockNo Number of the first block.
+    /// \param [in] count Number of blocks.
+    /// \return 0 on success, -EOPNOTSUPP if the host file system cannot punch holes, -ERRNO on other failures.
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+
+    /// @brief Find blocks that were never written.
+    ///
+    /// Blocks lying completely in a hole of the container file, or beyond its end, are reported as holes. They read as
+    /// zeros without touching the disc.
+    /// \param [in] firstBlockNo Number of the first block.
+    /// \param [in] count Number of blocks.
+    /// \param [out] holes Receives count flags, true for blocks in holes.
+    /// \return 0 on success, -ERRNO on failure, e.g. if the host file system cannot report holes. holes is all false then.
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+
+    /// @brief Get direct access to blocks.
+    ///
+    /// Devices that keep the container file mapped into memory return a pointer to the blocks, so callers can use
+    /// them in place instead of copying them with read() and write(). Changes made through the pointer are persisted
+    /// like writes, flush() forces them to the container file.
+    /// \param [in] firstBlockNo Number of the first block.
+    /// \param [in] count Number of blocks that must be accessible through the pointer.
+    /// \return Pointer to the first block, nullptr if the device does not support direct access to these blocks.
+    virtual char *getBlockPointer(uint32_t firstBlockNo, uint32_t count);
+
+    /// @brief Write blocks back to the container file.
+    ///
+    /// \param [in] firstBlockNo Number of the first block.
+    /// \param [in] count Number of blocks, 0 for all blocks of the device.
+    /// \param [in] wait true to return only after the blocks are stored, false to only start writing them.
+    /// \return 0 on success, -ERRNO on failure.
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+
+    /// @brief Get the statistics of the block device.
+    ///
+    /// Every request is counted once with its latency, queued requests from queueing to completion.
+    /// \return Copy of the statistics.
+    virtual BlockDeviceStats getStats();
+
+    /// @brief Reset the statistics of the block device.
+    virtual void resetStats();
+
+    /// @brief Print the statistics.
+    ///
+    /// Prints counters, mean and percentile latencies and the latency histograms of all kinds of requests.
+    /// \param [in] out Stream to print to.
+    /// \param [in] causeNames Names of the causes, causeCount entries; nullptr to print cause numbers.
+    /// \param [in] causeCount Number of entries in causeNames.
+    void printStats(FILE *out, const char *const *causeNames = nullptr, uint32_t causeCount = 0);
+
+    /// @brief Estimate a latency percentile from a histogram.
+    ///
+    /// \param [in] histogram Latency histogram with BD_LATENCY_BUCKETS buckets.
+    /// \param [in] fraction Fraction of requests, e.g. 0.99.
+    /// \return Upper bound of the bucket containing the percentile in nanoseconds, 0 for an empty histogram.
+    static uint64_t latencyPercentile(const uint64_t *histogram, double fraction);
+
+    /// @brief Set the cause of the requests issued by the calling thread.
+    ///
+    /// Reads and writes are counted per cause, e.g. per file system operation. Threads start with cause 0.
+    /// \param [in] cause Cause, less than BD_MAX_CAUSES.
+    static void setCause(uint32_t cause);
+
+    /// @brief Get the cause of the requests issued by the calling thread.
+    ///
+    /// \return The cause set by setCause().
+    static uint32_t getCause();
+
+    /// @brief Queue a read of consecutive blocks.
+    ///
+    /// The request is started by submit() (or earlier) and finishes in any order with respect to other queued
+    /// requests; its result is reported by complete() or drain(). The buffers described by iov must stay valid until
+    /// then. This implementation executes the request synchronously.
+    /// \param [in] firstBlockNo Number of the first block to read.
+    /// \param [in] iov Buffers for storing the content of the blocks.
+    /// \param [in] iovcnt Number of entries in iov.
+    /// \param [in] tag Value reported with the completion of the request.
+    /// \return 0 if the request was queued, -ERRNO on failure.
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+
+    /// @brief Queue a write of consecutive blocks.
+    ///
+    /// See queueRead().
+    /// \param [in] firstBlockNo Number of the first block to write.
+    /// \param [in] iov Buffers storing the content to write.
+    /// \param [in] iovcnt Number of entries in iov.
+    /// \param [in] tag Value reported with the completion of the request.
+    /// \return 0 if the request was queued, -ERRNO on failure.
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+
+    /// @brief Start all queued requests.
+    ///
+    /// \return Number of requests started, -ERRNO on failure.
+    virtual int submit();
+
+    /// @brief Collect finished requests.
+    ///
+    /// \param [out] done Array receiving the completions.
+    /// \param [in] maxDone Size of done.
+    /// \param [in] wait Block until at least one request has finished if none is available yet.
+    /// \return Number of completions stored in done, -ERRNO on failure.
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+
+    /// @brief Wait for all queued requests.
+    ///
+    /// Submits all queued requests, waits until they are finished and discards their completions.
+    /// \return 0 if all requests succeeded, otherwise the error of the first failed request.
+    virtual int drain();
 };
 
 #endif /* blockdevice_h */
@@ -0,0 +1,57 @@
+//
+//  bufferpool.h
+//  myfs
+//
+
+#ifndef bufferpool_h
+#define bufferpool_h
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/// @brief Pool of aligned I/O buffers
+///
+/// Direct I/O on the container file needs buffers aligned to the page (or sector) size. The pool allocates a fixed
+/// number of such buffers once and hands them out again and again, so no aligned allocation is needed per request.
+class AlignedBufferPool {
+private:
+    size_t bufferSize;
+    size_t alignment;
+    std::vector<char *> buffers;
+    std::vector<char *> freeBuffers;
+    std::mutex poolMutex;    // buffers are also taken by the flusher thread of the block cache
+
+public:
+    /// @brief Create a buffer pool.
+    ///
+    /// \param bufferSize Size of each buffer in bytes.
+    /// \param count Number of buffers allocated in advance.
+    /// \param alignment Alignment of the buffers, 0 for the page size.
+    AlignedBufferPool(size_t bufferSize, unsigned int count, size_t alignment = 0);
+
+    ~AlignedBufferPool();
+
+    /// @brief Take a buffer from the pool.
+    ///
+    /// If all buffers are in use, the pool grows by one buffer.
+    /// \return An aligned buffer of getBufferSize() bytes, nullptr if out of memory.
+    char *acquire();
+
+    /// @brief Return a buffer to the pool.
+    ///
+    /// \param buffer Buffer obtained by acquire().
+    void release(char *buffer);
+
+    /// @brief Get the size of the buffers.
+    ///
+    /// \return Size of each buffer in bytes.
+    size_t getBufferSize();
+
+    /// @brief Get the alignment of the buffers.
+    ///
+    /// \return Alignment in bytes.
+    size_t getAlignment();
+};
+
+#endif /* bufferpool_h */
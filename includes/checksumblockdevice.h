@@ -0,0 +1,105 @@
+//
+//  checksumblockdevice.h
+//  myfs
+//
+
+#ifndef checksumblockdevice_h
+#define checksumblockdevice_h
+
+#include <vector>
+
+#include "blockdevice.h"
+
+/// @brief Block device verifying a CRC32C checksum of every block
+///
+/// This decorator keeps a checksum of every block it has written and checks it whenever the block is read again; a
+/// mismatch fails the read with -EIO. The checksums are stored in a region of the device (see setRegion()), which is
+/// written when dirty by writeChecksums() and flush(). Blocks without a known checksum (never written, block 0, blocks
+/// of the region itself) are not verified; the checksum 0 marks them. Direct access to blocks is not offered, as
+/// changes through a pointer would bypass the checksums.
+class ChecksumBlockDevice : public BlockDevice {
+private:
+    struct Pending {
+        bool isWrite;
+        uint32_t firstBlockNo;
+        uint64_t tag;
+        std::vector<struct iovec> iov;
+        std::vector<uint32_t> sums;     // checksums of the blocks being written
+    };
+
+    BlockDevice *device;
+    std::mutex sumMutex;    // requests are also issued by the flusher thread of the block cache
+    std::vector<uint32_t> sums;
+    std::vector<bool> dirty;            // blocks of the region with changed checksums
+    uint32_t regionAddress;
+    uint32_t regionBlocks;
+    uint32_t zeroSum;                   // checksum of a block of zeros
+    std::vector<Pending> pending;
+    std::vector<uint32_t> freePending;
+    uint32_t pendingCount;
+    uint64_t verified;
+    uint64_t mismatches;
+
+    void computeSums(const struct iovec *iov, int iovcnt, std::vector<uint32_t> &out);
+    int verify(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    void setSum(uint32_t blockNo, uint32_t sum);
+    int writeDirty();
+    int queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    int finish(Pending &p, int result);
+
+public:
+    /// @brief Create a checksumming block device.
+    ///
+    /// \param device Block device the requests are passed on to, deleted with the checksumming device.
+    ChecksumBlockDevice(BlockDevice *device);
+
+    virtual ~ChecksumBlockDevice();
+
+    /// @brief Set the region storing the checksums.
+    ///
+    /// The region holds one checksum of 4 bytes for each block of the device. Checksums already known are kept; the
+    /// whole region is written by the next writeChecksums().
+    /// \param address First block of the region.
+    /// \param blocks Number of blocks of the region.
+    void setRegion(uint32_t address, uint32_t blocks);
+
+    /// @brief Read the checksums from the region.
+    ///
+    /// \return 0 on success, -ERRNO on failure.
+    int loadChecksums();
+
+    /// @brief Write the changed checksums to the region.
+    ///
+    /// \return 0 on success, -ERRNO on failure.
+    int writeChecksums();
+
+    /// @brief Get the number of blocks whose checksum was verified.
+    uint64_t getVerified();
+
+    /// @brief Get the number of blocks that failed verification.
+    uint64_t getMismatches();
+
+    virtual int open(const char *path);
+    virtual int create(const char *path);
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int grow(uint32_t blockCount);
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int submit();
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+    virtual int drain();
+
+    virtual BlockDeviceStats getStats();
+    virtual void resetStats();
+};
+
+#endif /* checksumblockdevice_h */
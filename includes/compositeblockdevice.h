@@ -0,0 +1,110 @@
+//
+//  compositeblockdevice.h
+//  myfs
+//
+
+#ifndef compositeblockdevice_h
+#define compositeblockdevice_h
+
+#include <string>
+#include <vector>
+
+#include "blockdevice.h"
+
+/// @brief Block device built from several member devices
+///
+/// Each request is turned into parts on the members by queueParts(). All parts are queued first and then submitted
+/// together, so the members transfer them in parallel; the request is finished once all of its parts are. Use members
+/// with asynchronous requests (AsyncBlockDevice) to benefit from this. Subclasses decide how blocks are placed on the
+/// members.
+class CompositeBlockDevice : public BlockDevice {
+protected:
+    struct Request {
+        bool sync;          // issued by readBlocks()/writeBlocks(), which wait for it
+        bool finished;
+        bool isWrite;
+        uint32_t firstBlockNo;
+        off_t pos;
+        size_t size;
+        uint64_t tag;
+        uint64_t start;     // time the request was queued
+        uint32_t cause;     // cause of the thread that queued the request
+        uint32_t pending;   // parts not finished yet
+        int result;         // first error of a part
+        uint32_t tried;     // members a part was sent to, one bit per member
+        uint32_t succeeded; // parts finished without error
+        std::vector<struct iovec> iov;  // buffers of the request, if queueParts() keeps them
+    };
+
+    std::vector<BlockDevice *> members;
+    std::vector<std::string> paths;
+    std::vector<uint32_t> outstanding;  // parts queued on each member and not collected yet
+    std::vector<Request> requests;
+    std::vector<uint32_t> freeRequests;
+    uint32_t asyncPending;              // requests queued with queueRead()/queueWrite() and not finished yet
+
+    int queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag,
+                     bool sync);
+    int queuePart(uint32_t index, uint32_t member, uint32_t blockNo, const struct iovec *iov, int iovcnt);
+    void finishRequest(uint32_t index);
+    int submitMembers();
+    int collect(bool wait);
+    int waitFor(uint32_t index);
+
+    /// @brief Queue the parts of a request on the members with queuePart().
+    ///
+    /// \param index Index of the request in requests.
+    /// \param iov Buffers of the request.
+    /// \param iovcnt Number of entries in iov.
+    virtual void queueParts(uint32_t index, const struct iovec *iov, int iovcnt) = 0;
+
+    /// @brief Handle a finished part.
+    ///
+    /// This implementation keeps the first error and finishes the request with its last part.
+    /// \param member Member the part was queued on.
+    /// \param index Index of the request in requests.
+    /// \param result Result of the part.
+    virtual void partDone(uint32_t member, uint32_t index, int result);
+
+public:
+    /// @brief Create a composite block device.
+    ///
+    /// \param members Member devices, all with the same block size; deleted with the composite device.
+    /// \param paths Container files of the members, in the same order.
+    CompositeBlockDevice(const std::vector<BlockDevice *> &members, const std::vector<std::string> &paths);
+
+    virtual ~CompositeBlockDevice();
+
+    /// @brief Get the number of member devices.
+    uint32_t getMemberCount();
+
+    /// @brief Get a member device, e.g. for its statistics.
+    ///
+    /// \param member Index of the member.
+    BlockDevice *getMember(uint32_t member);
+
+    /// @brief Open the container files of all members.
+    ///
+    /// \param path Ignored, the paths given to the constructor are used.
+    virtual int open(const char *path);
+
+    /// @brief Create the container files of all members.
+    ///
+    /// \param path Ignored, the paths given to the constructor are used.
+    virtual int create(const char *path);
+
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int submit();
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+    virtual int drain();
+};
+
+#endif /* compositeblockdevice_h */
@@ -0,0 +1,32 @@
+//
+//  crc32c.h
+//  myfs
+//
+
+#ifndef crc32c_h
+#define crc32c_h
+
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Compute a CRC32C (Castagnoli) checksum.
+///
+/// Uses the CRC32 instructions of SSE 4.2 or ARMv8 if the CPU has them, otherwise a table-driven implementation.
+/// A checksum over several pieces of data is computed by passing the result for the previous pieces as crc.
+/// \param [in] crc Checksum of the preceding data, 0 to start.
+/// \param [in] data The data.
+/// \param [in] size Number of bytes.
+/// \return The checksum.
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
+
+/// @brief Compute a CRC32C checksum without CPU instructions.
+///
+/// Same result as crc32c(), used where the instructions are missing.
+uint32_t crc32cSoftware(uint32_t crc, const void *data, size_t size);
+
+/// @brief Check whether crc32c() uses CPU instructions.
+///
+/// \return true if the checksums are computed by SSE 4.2 or ARMv8 instructions.
+bool crc32cHardware();
+
+#endif /* crc32c_h */
@@ -0,0 +1,82 @@
+//
+//  dentrycache.h
+//  myfs
+//
+
+#ifndef dentrycache_h
+#define dentrycache_h
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#define DC_DEFAULT_CAPACITY 65536
+
+/// @brief Counters of a dentry cache.
+struct DentryCacheStats {
+    uint64_t hits;          // lookups answered with a slot
+    uint64_t negativeHits;  // lookups answered with "does not exist"
+    uint64_t misses;        // lookups the cache could not answer
+    uint64_t evictions;     // entries dropped to make room
+    uint32_t resident;      // entries currently in the cache
+};
+
+/// @brief Size-bounded cache of path components.
+///
+/// Maps a name within a directory, identified by the slot of the directory, to the slot of the entry and whether it
+/// is a directory itself. Names known not to exist are kept as negative entries, so repeated lookups of missing files
+/// are answered without searching the directory either. When the cache is full the least recently used entry is
+/// dropped. The cache only remembers what it is told: every change of a directory must be reported with insert() or
+/// remove().
+class DentryCache {
+private:
+    struct Dentry {
+        std::string key;    // slot of the directory followed by the name
+        int slot;           // -1 for a negative entry
+        bool isDir;
+    };
+
+    std::list<Dentry> lru;  // most recently used first
+    std::unordered_map<std::string, std::list<Dentry>::iterator> entries;
+    size_t capacity;
+    DentryCacheStats stats;
+
+    static std::string makeKey(int parent, const char *name);
+
+public:
+    explicit DentryCache(size_t capacity = DC_DEFAULT_CAPACITY);
+
+    /// @brief Look up a name in a directory.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name within the directory.
+    /// \param [out] slot Slot of the entry, -1 if the name is known not to exist.
+    /// \param [out] isDir Whether the entry is a directory.
+    /// \return true if the cache knows the name, false if the directory has to be searched.
+    bool lookup(int parent, const char *name, int *slot, bool *isDir);
+
+    /// @brief Remember the result of a lookup or a change of a directory.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name within the directory.
+    /// \param [in] slot Slot of the entry, -1 to remember that the name does not exist.
+    /// \param [in] isDir Whether the entry is a directory.
+    void insert(int parent, const char *name, int slot, bool isDir);
+
+    /// @brief Forget a name, the next lookup searches the directory again.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name within the directory.
+    void remove(int parent, const char *name);
+
+    /// @brief Forget all names.
+    void clear();
+
+    /// @brief Get the counters of the cache.
+    ///
+    /// \return The counters.
+    DentryCacheStats getStats() const;
+};
+
+#endif /* dentrycache_h */
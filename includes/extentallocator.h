@@ -0,0 +1,76 @@
+//
+//  extentallocator.h
+//  myfs
+//
+
+#ifndef extentallocator_h
+#define extentallocator_h
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+
+/// @brief Free space of the data region as runs of consecutive free blocks.
+///
+/// Every free extent is kept twice: by its first block, to find the extent a block lies in and its neighbours, and by
+/// its length, to find the largest one. Releasing blocks merges them with free neighbours, reserving blocks splits
+/// the extent they lie in, so the extents are always as long as possible. The allocator only knows what it is told:
+/// every block marked used or free in the dmap must be reported with reserve() or release().
+class ExtentAllocator {
+private:
+    std::map<int, int> byStart;             // first block of each free extent -> its length
+    std::set<std::pair<int, int>> bySize;   // (length, first block) of each free extent
+    int64_t freeCount;                      // free blocks in all extents
+
+    void add(int start, int length);
+    void erase(std::map<int, int>::iterator it);
+
+public:
+    ExtentAllocator();
+
+    /// @brief Build the extents from a bitmap.
+    ///
+    /// \param [in] bitmap One bit per block, set if the block is used; 64 blocks per word, the lowest bit first.
+    /// \param [in] blocks Number of blocks.
+    void rebuild(const uint64_t *bitmap, int blocks);
+
+    /// @brief Mark blocks as used.
+    ///
+    /// \param [in] start First block.
+    /// \param [in] count Number of blocks, blocks that are not free are skipped.
+    void reserve(int start, int count);
+
+    /// @brief Mark blocks as free.
+    ///
+    /// \param [in] start First block.
+    /// \param [in] count Number of blocks, they must not be free yet.
+    void release(int start, int count);
+
+    /// @brief Choose a run of free blocks, without reserving it.
+    ///
+    /// If the block preferred is free the run starts there, so a file growing at its end stays contiguous. Otherwise
+    /// the run starts at the largest extent.
+    /// \param [in] preferred Block to continue at, -1 for none.
+    /// \param [in] want Number of blocks wanted.
+    /// \param [out] count Number of blocks in the run, at least 1 and at most want.
+    /// \return First block of the run, -1 if no block is free.
+    int find(int preferred, int want, int *count) const;
+
+    /// @brief Get the number of free blocks.
+    ///
+    /// \return Free blocks in all extents.
+    int64_t freeBlocks() const;
+
+    /// @brief Get the number of free extents.
+    ///
+    /// \return Number of extents.
+    size_t extents() const;
+
+    /// @brief Get the length of the largest free extent.
+    ///
+    /// \return Its length in blocks, 0 if no block is free.
+    int largest() const;
+};
+
+#endif /* extentallocator_h */
@@ -0,0 +1,65 @@
+//
+//  extentmap.h
+//  myfs
+//
+
+#ifndef extentmap_h
+#define extentmap_h
+
+#include <cstddef>
+#include <vector>
+
+/// @brief Blocks of a file as runs of consecutive blocks.
+///
+/// Block k of the file is found with a binary search over the runs instead of following k links of a chain. A file
+/// whose blocks lie one behind the other is a single run, however large it is. The map only knows what it is told:
+/// blocks appended to the chain must be reported with append(), blocks cut off with truncate().
+class ExtentMap {
+private:
+    struct Extent {
+        int logical;    // first block of the run in the file
+        int physical;   // its block in the container
+        int length;     // blocks in the run
+    };
+
+    std::vector<Extent> extents;    // by logical, without gaps
+
+public:
+    /// @brief Add blocks at the end of the file.
+    ///
+    /// \param [in] physical First block in the container, it is merged into the last run if it continues it.
+    /// \param [in] count Number of consecutive blocks.
+    void append(int physical, int count);
+
+    /// @brief Find a block of the file.
+    ///
+    /// \param [in] logical Index of the block in the file.
+    /// \param [out] run Number of blocks from there on that follow it in the container, at least 1.
+    /// \return Its block in the container, -1 if the file has fewer blocks.
+    int lookup(int logical, int *run) const;
+
+    /// @brief Cut the file short.
+    ///
+    /// \param [in] blocks Number of blocks the file keeps.
+    void truncate(int blocks);
+
+    /// @brief Forget all blocks.
+    void clear();
+
+    /// @brief Get the number of blocks of the file.
+    ///
+    /// \return Number of blocks.
+    int blocks() const;
+
+    /// @brief Get the last block of the file.
+    ///
+    /// \return Its block in the container, -1 if the file has no blocks.
+    int last() const;
+
+    /// @brief Get the number of runs.
+    ///
+    /// \return Number of runs.
+    size_t size() const;
+};
+
+#endif /* extentmap_h */
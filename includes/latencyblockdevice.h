@@ -0,0 +1,121 @@
+//
+//  latencyblockdevice.h
+//  myfs
+//
+
+#ifndef latencyblockdevice_h
+#define latencyblockdevice_h
+
+#include <random>
+#include <vector>
+
+#include "blockdevice.h"
+
+/// @brief Kinds of storage a LatencyBlockDevice emulates.
+enum LatencyKind {
+    LATENCY_HDD,        // seek time growing with the distance, rotational delay, media transfer rate
+    LATENCY_SSD,        // fixed service time per request, transfer rate shared by all requests
+    LATENCY_NETWORK     // round trip per request, link bandwidth shared by all requests
+};
+
+/// @brief Timing of an emulated device.
+///
+/// LatencyBlockDevice::getDefaultModel() returns typical values for each kind.
+struct LatencyModel {
+    LatencyKind kind;
+    uint64_t serviceNs;     // SSD: time to serve a request, network: round-trip time
+    uint64_t jitterNs;      // SSD, network: largest random time added to serviceNs
+    uint64_t seekMinNs;     // HDD: seek to a neighbouring position
+    uint64_t seekMaxNs;     // HDD: seek across strokeBytes or more
+    uint64_t strokeBytes;   // HDD: distance of a full-stroke seek
+    uint64_t rotationNs;    // HDD: one revolution, a random part of it passes after each seek
+    uint64_t bytesPerSec;   // transfer rate, 0 for unlimited
+    uint64_t seed;          // seed of the random number generator
+};
+
+/// @brief Block device adding the latency of a modelled storage device
+///
+/// This decorator passes every request on to another block device and delays its completion until the modelled
+/// device would have finished it. The modelled device serves one transfer at a time: a request starts when the
+/// previous one has left it, is busy for the time of its transfer (on a hard disc also for the seek and the rotational
+/// delay) and completes after that, on an SSD or a network disc only after the service time or round trip, which
+/// overlaps with other requests. A request starting where the previous one ended needs no seek. Random parts of the
+/// timing come from a generator with a fixed seed, so runs can be repeated. Direct access to blocks is not offered, as
+/// accesses through a pointer would take no time. The statistics of this device include the added latency.
+class LatencyBlockDevice : public BlockDevice {
+private:
+    struct Pending {
+        uint64_t tag;
+        uint64_t dueNs;         // time the modelled device finishes the request
+        uint64_t startNs;
+        bool isWrite;
+        off_t pos;
+        size_t size;
+        uint32_t cause;
+        int result;
+    };
+
+    BlockDevice *device;
+    LatencyModel model;
+    std::mutex modelMutex;      // requests are also issued by the flusher thread of the block cache
+    std::mt19937_64 random;
+    uint64_t busyUntilNs;       // time the modelled device is done with the requests issued so far
+    uint64_t headPos;           // byte behind the previous request
+    uint64_t delayNs;           // total time added to requests
+    std::mutex pendingMutex;
+    std::vector<Pending> pending;
+    std::vector<uint32_t> freePending;
+    std::vector<uint32_t> finished;     // queued requests the device has finished, waiting for their time
+    uint32_t pendingCount;              // queued requests the device has not finished yet
+
+    uint64_t schedule(uint32_t firstBlockNo, uint64_t bytes, uint64_t nowNs);
+    static void waitUntil(uint64_t ns);
+    int transfer(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    int queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    int collect(bool wait);
+    void deliver(uint32_t index);
+
+public:
+    /// @brief Create a latency-emulating block device.
+    ///
+    /// \param device Block device the requests are passed on to, deleted with the latency-emulating device.
+    /// \param model Timing of the emulated device.
+    LatencyBlockDevice(BlockDevice *device, const LatencyModel &model);
+
+    virtual ~LatencyBlockDevice();
+
+    /// @brief Get typical timing of a kind of device.
+    ///
+    /// A 7200 rpm hard disc, a SATA SSD or a network disc behind a 1 Gbit/s link, seed 1.
+    /// \param kind Kind of device.
+    /// \return The timing.
+    static LatencyModel getDefaultModel(LatencyKind kind);
+
+    /// @brief Get the total time added to requests.
+    ///
+    /// \return Sum of the delays in nanoseconds.
+    uint64_t getDelayNs();
+
+    virtual int open(const char *path);
+    virtual int create(const char *path);
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int grow(uint32_t blockCount);
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int submit();
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+    virtual int drain();
+
+    virtual void resetStats();
+};
+
+#endif /* latencyblockdevice_h */
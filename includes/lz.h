@@ -0,0 +1,32 @@
+//
+//  lz.h
+//  myfs
+//
+
+#ifndef lz_h
+#define lz_h
+
+#include <cstddef>
+
+/// @brief Compress data with a fast LZ77 codec.
+///
+/// The output is a sequence of literal runs and back references of at least 4 bytes into the previous 64 KiB, in the
+/// block format of LZ4. Repetitive data shrinks well; random data does not and is reported as not fitting.
+/// \param [in] src The data.
+/// \param [in] srcSize Number of bytes.
+/// \param [out] dst Buffer for the compressed data.
+/// \param [in] dstCapacity Size of dst in bytes.
+/// \return Number of compressed bytes, 0 if they do not fit into dstCapacity.
+size_t lzCompress(const char *src, size_t srcSize, char *dst, size_t dstCapacity);
+
+/// @brief Decompress data compressed by lzCompress().
+///
+/// Damaged input is detected where it would read or write outside the buffers.
+/// \param [in] src The compressed data.
+/// \param [in] srcSize Number of compressed bytes.
+/// \param [out] dst Buffer for the data.
+/// \param [in] dstCapacity Size of dst in bytes.
+/// \return Number of bytes stored in dst, -EIO if the input is damaged or does not fit.
+int lzDecompress(const char *src, size_t srcSize, char *dst, size_t dstCapacity);
+
+#endif /* lz_h */
@@ -0,0 +1,58 @@
+//
+//  mappedblockdevice.h
+//  myfs
+//
+
+#ifndef mappedblockdevice_h
+#define mappedblockdevice_h
+
+#include "blockdevice.h"
+
+#define MBD_DEFAULT_RESERVE (1ULL << 40) // address space reserved for growing the mapping if no limit is given
+
+/// @brief Block device on a memory-mapped container file
+///
+/// The first blockCount blocks of the container file are mapped into memory. Reads and writes are plain memory copies
+/// and getBlockPointer() hands out pointers into the mapping, so callers can work on the blocks in place. Changes
+/// reach the container file when the host writes back the mapping or when flush() is called. Blocks beyond the mapping
+/// and devices whose file cannot be mapped are served by the BlockDevice implementation.
+///
+/// Address space for maxBlockCount blocks is reserved when the container is mapped, so the mapping grows in place and
+/// pointers returned by getBlockPointer() stay valid when the container is grown.
+class MappedBlockDevice : public BlockDevice {
+private:
+    uint32_t blockCount;
+    uint32_t maxBlockCount;
+    char *mapping;
+    size_t mappingSize;
+    size_t reservedSize;
+
+    int mapContainer();
+    void unmapContainer();
+    bool isMapped(uint32_t firstBlockNo, size_t size);
+
+public:
+    /// @brief Create a new memory-mapped block device.
+    ///
+    /// \param blockSize Block size.
+    /// \param blockCount Number of blocks to map, the container file is extended to this size.
+    /// \param maxBlockCount Largest size the container may grow to in blocks, 0 to reserve MBD_DEFAULT_RESERVE bytes.
+    MappedBlockDevice(uint32_t blockSize, uint32_t blockCount, uint32_t maxBlockCount = 0);
+
+    virtual ~MappedBlockDevice();
+
+    virtual int open(const char *path);
+    virtual int create(const char *path);
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+
+    virtual int grow(uint32_t blockCount);
+    virtual char *getBlockPointer(uint32_t firstBlockNo, uint32_t count);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+};
+
+#endif /* mappedblockdevice_h */
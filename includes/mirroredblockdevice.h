@@ -0,0 +1,60 @@
+//
+//  mirroredblockdevice.h
+//  myfs
+//
+
+#ifndef mirroredblockdevice_h
+#define mirroredblockdevice_h
+
+#include "compositeblockdevice.h"
+
+/// @brief Statistics of one replica of a mirrored block device.
+struct ReplicaStats {
+    uint64_t reads;             // reads sent to the replica
+    uint64_t writes;            // writes sent to the replica
+    uint64_t readErrors;        // failed reads, retried on another replica
+    uint64_t writeErrors;       // failed writes
+    uint64_t queueDepthSum;     // sum of the requests in flight on the replica when a request was sent to it
+    uint32_t queueDepthMax;     // largest number of requests in flight on the replica
+    bool failed;                // a write failed, the replica is no longer used
+};
+
+/// @brief Block device mirrored over several container files
+///
+/// Every member holds a complete copy of the blocks (RAID 1). Writes are sent to all replicas in parallel and succeed
+/// if at least one replica stored them; a replica whose write failed is out of date and no longer used. A read is sent
+/// to the replica with the fewest requests in flight, among those to the one whose previous request ended closest to
+/// the read. A failed read is retried on another replica.
+class MirroredBlockDevice : public CompositeBlockDevice {
+private:
+    std::vector<ReplicaStats> replicaStats;
+    std::vector<off_t> lastPos;     // end of the previous request of each replica
+
+    int pickReplica(uint32_t index);
+    void sendTo(uint32_t index, uint32_t member);
+
+protected:
+    virtual void queueParts(uint32_t index, const struct iovec *iov, int iovcnt);
+    virtual void partDone(uint32_t member, uint32_t index, int result);
+
+public:
+    /// @brief Create a mirrored block device.
+    ///
+    /// \param members Member devices, all with the same block size; deleted with the mirrored device.
+    /// \param paths Container files of the members, in the same order.
+    MirroredBlockDevice(const std::vector<BlockDevice *> &members, const std::vector<std::string> &paths);
+
+    /// @brief Get the statistics of a replica.
+    ///
+    /// \param member Index of the replica.
+    /// \return Copy of the statistics.
+    ReplicaStats getReplicaStats(uint32_t member);
+
+    virtual int grow(uint32_t blockCount);
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+    virtual void resetStats();
+};
+
+#endif /* mirroredblockdevice_h */
@@ -11,9 +11,38 @@
 #ifndef myfs_info_h
 #define myfs_info_h
 
+#define MAX_CONTAINER_FILES 16
+
 struct MyFsInfo {
     char *logFile;
     char *contFile;
+    char *contFiles[MAX_CONTAINER_FILES]; // all container files, contFile is the first one
+    unsigned int contFileCount; // number of container files, blocks are striped over several ones
+    unsigned int stripeSize;    // blocks per stripe unit of a new striped container, 0 for default
+    int mirror;                 // keep a copy of all blocks in each container file instead of striping
+    int noChecksums;            // create the container without a checksum region
+    int compress;               // store the file data of a new container compressed
+    unsigned int chunkSize;     // bytes of file data compressed together, 0 for default
+    int dedup;                  // store identical data blocks of a new container only once
+    unsigned int queueDepth;    // maximum number of container requests in flight, 0 for default
+    int directIO;               // bypass the page cache of the host for the container file
+    int memoryMapped;           // access the container file through a memory mapping
+    unsigned int cacheSize;     // number of blocks in the block cache, 0 for default
+    char *cachePolicy;          // replacement policy of the block cache ("lru" or "arc"), NULL for default
+    int writeBack;              // keep written blocks in the block cache and write them back later
+    unsigned int dirtyAge;      // ms a block may stay dirty in write-back mode, 0 for default
+    unsigned int dirtyLimit;    // number of dirty blocks that starts writing back, 0 for default
+    unsigned int readahead;     // largest readahead window in blocks, 0 for default
+    int noReadahead;            // disable readahead
+    unsigned int blockSize;     // block size of a new container in bytes, 0 for default
+    unsigned int deviceSize;    // number of blocks of a new container, 0 for default
+    unsigned int maxDeviceSize; // number of blocks the container may grow to, 0 for no limit
+    unsigned int growSize;      // number of blocks added when the container grows, 0 for default
+    char *traceFile;            // file recording all requests to the container, NULL for no trace
+    char *latency;              // emulated storage ("hdd", "ssd" or "net"), NULL for the plain container
+    unsigned int latencyUs;     // longest seek (hdd) or service time (ssd, net) in microseconds, 0 for default
+    unsigned int bandwidth;     // transfer rate of the emulated storage in MB/s, 0 for default
+    unsigned int latencySeed;   // seed of the emulated timing, 0 for default
 };
 
 #endif /* myfs_info_h */
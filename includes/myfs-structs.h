@@ -10,10 +10,22 @@
 #define myfs_structs_h
 
 #define NAME_LENGTH 255
-#define BLOCK_SIZE 512
+#define BLOCK_SIZE 512 // Standard-Blockgröße neuer Container
+#define MIN_BLOCK_SIZE 512
+#define MAX_BLOCK_SIZE 65536
 #define NUM_DIR_ENTRIES 64
 #define NUM_OPEN_FILES 64
-#define BLOCK_DEVICE_SIZE 1024
+#define BLOCK_DEVICE_SIZE 1024 // Standard-Größe neuer Container in Blöcken
+#define SUPERBLOCK_MAGIC 0x5346794d // "MyFS", Container mit gespeicherter Geometrie
+// Format der Container, ältere werden abgelehnt; 2: Eintrag "/" in root[ROOT_SLOT], 3: dmap mit einem Bit je Block
+#define SUPERBLOCK_VERSION 3
+#define MAX_CHUNK_SIZE (1024 * 1024) // größte Chunk-Größe komprimierter Container
+#define CMAP_RAW 0x80000000u // Eintrag in der cmap: Chunk unkomprimiert gespeichert
+#define NO_LOCATION (-1) // Eintrag in der Dedup-Map: Block der Kette hat noch keinen Inhalt (liest Nullen)
+#define DIR_INDEX_MAGIC 0x78646944 // "Didx", Kopf des Verzeichnisindex
+#define DIR_MAX_DEPTH 24 // größte globale Tiefe des Verzeichnisindex (2^24 Buckets)
+#define DMAP_WORD_BITS 64 // Datenblöcke je Wort der dmap, ein Bit je Block
+#define ROOT_SLOT 0 // Eintrag des Wurzelverzeichnisses "/", parent der Einträge direkt darin
 
 struct file {
     char name[NAME_LENGTH] = ""; //255 bytes lang max
@@ -21,27 +33,80 @@ struct file {
     uid_t user; //insigned int
     gid_t group; //unsigned int
     mode_t mode; //unsigned int
+    int parent = ROOT_SLOT; // Eintrag des Verzeichnisses, in dem die Datei liegt
     time_t atime; //long
     time_t mtime;
     time_t ctime; //letzte Statusänderung
     char *data; //64bit für Pointer in 64-bit Betriebssystem = 8 bytes
     int fat_data;
+    int firstChild = -1; // bei Verzeichnissen: erster Eintrag darin, -1 wenn leer
+    int prevEntry = -1; // Nachbarn in der Liste der Einträge des Verzeichnisses parent, -1 am Rand
+    int nextEntry = -1;
     bool open; //1bit bzw < 1byte
-}; // 320 bytes laut sizeof. 320 * 64 /512 = 40 Blöcke für file root[64]
+}; // 336 bytes laut sizeof. 336 * 64 /512 = 42 Blöcke für file root[64]
 
 struct superblock {
     int dmapAddress; // = 1
     int fatAddress; // = 3
-    int rootAddress; // = 11 // 320 bytes laut sizeof. 320 * 64 /512 = 40 Blöcke für file root[64]
-    int dataAddress; //ab Block 52 Filesystem
+    int rootAddress; // = 11 // 336 bytes laut sizeof. 336 * 64 /512 = 42 Blöcke für file root[64]
+    int dataAddress; //ab Block 54 Filesystem
     int blockDeviceSize; //= 1024 (including metadata(fat, root, ...))
     int dataSize; //1012
+    uint32_t magic; // SUPERBLOCK_MAGIC
+    uint32_t blockSize; // Blockgröße in Bytes, Zweierpotenz von MIN_BLOCK_SIZE bis MAX_BLOCK_SIZE
+    int dmapBlocks; // Länge der dmap in Blöcken
+    int fatBlocks; // Länge der FAT in Blöcken
+    uint32_t stripeCount; // Anzahl der Container-Dateien, über die die Blöcke verteilt sind, 0 bei einer Datei
+    uint32_t stripeSize; // Blöcke je Stripe-Einheit bei mehreren Container-Dateien
+    uint32_t mirrorCount; // Anzahl der Container-Dateien, die alle Blöcke enthalten, 0 ohne Spiegelung
+    uint32_t chunkSize; // Dateidaten komprimiert in Chunks dieser Größe in Bytes, 0 ohne Kompression
+    int cmapAddress; // cmap: gespeicherte Länge des Chunks, der an einem Datenblock beginnt, direkt hinter der FAT
+    int cmapBlocks; // Länge der cmap in Blöcken, 0 ohne Kompression
+    int dedupAddress; // Dedup-Map: ein dedupEntry je Datenblock, hinter FAT und cmap
+    int dedupBlocks; // Länge der Dedup-Map in Blöcken, 0 ohne Deduplizierung
+    int sumAddress; // Prüfsummen (CRC32C) aller Blöcke, hinter FAT, cmap und Dedup-Map
+    int sumBlocks; // Länge der Prüfsummen in Blöcken, 0 ohne Prüfsummen
+    uint32_t checksum; // CRC32C des Superblocks mit checksum = 0, 0 bei Containern ohne Prüfsumme
+    int dirIndex; // erster Datenblock des Verzeichnisindex, -1 solange die 64 Einträge in root reichen
+    uint32_t version; // Format des Containers, SUPERBLOCK_VERSION; 0 bei Containern vor dem Verzeichnisindex
+};
+
+// Kopf des Verzeichnisindex, im ersten Block seiner Kette; ab dem zweiten Block folgt das Bucket-Verzeichnis
+// (2^depth Bucket-Nummern, ausgewählt mit den unteren depth Bits des Hashs eines Namens)
+struct dirIndexHeader {
+    uint32_t magic; // DIR_INDEX_MAGIC
+    uint32_t depth; // globale Tiefe des Bucket-Verzeichnisses
+    int buckets; // Anzahl der Buckets, Bucket b ist Block b der Bucket-Kette
+    int bucketChain; // erster Datenblock der Bucket-Kette
+    int entryChain; // erster Datenblock der Kette mit den Einträgen ab NUM_DIR_ENTRIES, -1 ohne
+    int slots; // Einträge in der Eintragskette, benutzt oder frei
+    int freeSlot; // erster freier Eintrag, weitere über fat_data verkettet, -1 ohne
+    int files; // belegte Einträge in der Eintragskette
+};
+
+// Kopf eines Buckets, gefolgt von count Einträgen
+struct dirBucketHeader {
+    uint32_t depth; // lokale Tiefe: so viele untere Bits des Hashs haben alle Namen im Bucket gemeinsam
+    uint32_t count;
+};
+
+struct dirBucketEntry {
+    uint32_t hash; // PathIndex::hash des Verzeichnisses und Namens
+    int slot; // Nummer des Eintrags, ab NUM_DIR_ENTRIES in der Eintragskette
+};
+
+// Eintrag der Dedup-Map, location gehört zum Block i der FAT-Kette, hash zum Datenblock i
+struct dedupEntry {
+    int location; // Datenblock mit dem Inhalt dieses Kettenblocks, NO_LOCATION ohne Inhalt
+    uint32_t hash; // CRC32C des Inhalts dieses Datenblocks, solange Kettenblöcke auf ihn zeigen, sonst 0
 };
 
 struct OpenFile {
-    char buffer[BLOCK_SIZE];
-    int blockNo = -1;
     bool isOpen = false;
+    off_t nextOffset = 0; // Position, an der ein sequentielles Lesen weitergeht
+    int sequentialReads = 0; // Anzahl direkt aufeinanderfolgender Lesezugriffe
+    uint32_t raWindow = 0; // aktuelle Readahead-Fenstergröße in Blöcken
+    uint32_t raEnd = 0; // Dateiblock hinter dem zuletzt vorausgelesenen Block
 };
 
 #endif /* myfs_structs_h */
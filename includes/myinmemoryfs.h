@@ -12,6 +12,7 @@
 #include "myfs.h"
 #include "blockdevice.h"
 #include "myfs-structs.h"
+#include "pathindex.h"
 
 /// @brief In-memory implementation of a simple file system.
 class MyInMemoryFS : public MyFS {
@@ -26,6 +27,7 @@ public:
     static MyInMemoryFS *Instance();
 
     file myFiles[NUM_DIR_ENTRIES];
+    PathIndex pathIndex; // slot in myFiles of each file name
     MyInMemoryFS();
     ~MyInMemoryFS();
 
@@ -7,19 +7,156 @@
 #define MYFS_MYONDISKFS_H
 
 #include "myfs.h"
+#include "blockcache.h"
+#include "compositeblockdevice.h"
+#include "mirroredblockdevice.h"
+#include "checksumblockdevice.h"
+#include "latencyblockdevice.h"
+#include "pathindex.h"
+#include "dentrycache.h"
+#include "extentallocator.h"
+#include "extentmap.h"
 #include <map>
+#include <unordered_map>
+#include <vector>
 using namespace std;
 
+#define READAHEAD_MIN_WINDOW 8      // blocks read ahead when a sequential stream is detected
+#define READAHEAD_MAX_WINDOW 128    // default limit of the readahead window in blocks
+#define CONTAINER_GROW_SIZE (4 * 1024 * 1024) // default size in bytes the container grows by when it is full
+#define STRIPE_SIZE (64 * 1024)     // default size in bytes of a stripe unit when striping over several containers
+#define CHUNK_SIZE (64 * 1024)      // default size in bytes of the chunks file data is compressed in
+#define DIR_CACHE_ENTRIES 1024      // directory entries beyond the root region kept in memory between operations
+
+/// @brief File system operations, the causes of block device requests.
+///
+/// Requests issued by other threads, e.g. the flusher of the block cache, have cause FS_OP_BACKGROUND.
+enum FsOp {
+    FS_OP_BACKGROUND,
+    FS_OP_INIT,
+    FS_OP_DESTROY,
+    FS_OP_GETATTR,
+    FS_OP_MKNOD,
+    FS_OP_UNLINK,
+    FS_OP_RENAME,
+    FS_OP_CHMOD,
+    FS_OP_CHOWN,
+    FS_OP_TRUNCATE,
+    FS_OP_OPEN,
+    FS_OP_READ,
+    FS_OP_WRITE,
+    FS_OP_RELEASE,
+    FS_OP_FLUSH,
+    FS_OP_FSYNC,
+    FS_OP_READDIR,
+    FS_OP_MKDIR,
+    FS_OP_RMDIR,
+    FS_OP_OPENDIR,
+    FS_OP_COUNT
+};
+
+extern const char *const fsOpNames[FS_OP_COUNT];
+
+/// @brief Uncompressed copy of one chunk of a file in a compressed container.
+///
+/// Writes change the copy; it is compressed and stored when another chunk of the file is needed or the file is
+/// flushed. It also remembers where the last chunk found starts, so walking the chain to a later chunk continues there.
+struct ChunkBuffer {
+    int chunk = -1;         // index of the chunk in the file, -1 if the buffer is empty
+    bool dirty = false;     // the buffer differs from the stored chunk
+    std::vector<char> data; // chunkSize bytes
+    int walkChunk = -1;     // index of the chunk found last, -1 if none
+    int walkIndex = EOF;    // its first data block
+    int walkLast = EOF;     // the data block before it in the chain, EOF for the first chunk
+};
+
+/// @brief Directory entry beyond the root region, kept in memory while it is used.
+///
+/// Files found in the directory index are returned as pointers to their cached entry, so the entry must stay the first
+/// member.
+struct CachedEntry {
+    file entry;
+    int slot;               // number of the entry, NUM_DIR_ENTRIES or more
+};
+
 /// @brief On-disk implementation of a simple file system.
 class MyOnDiskFS : public MyFS {
 private:
+    friend class FsOpScope;
+
     virtual bool fileExists(const char *path);
     virtual file* findFile(const char *name);
-    virtual void writeFatToDisc();
-    virtual void writeDmapToDisc();
+    virtual int writeFatToDisc();
+    virtual int writeDmapToDisc();
     virtual void writeRootToDisc();
+    virtual int writeDirtyBlocks(int address, const void *data, size_t size, std::vector<bool> &dirty);
+    virtual void setFat(int index, int next);
+    virtual bool isUsed(int index);
+    virtual void setUsed(int index, bool used);
+    virtual void setChunkEntry(int block, uint32_t entry);
+    virtual int readFromDisc(int address, void *data, size_t size);
+    virtual int writeToDisc(int address, const void *data, size_t size);
+    virtual int transferData(const ExtentMap &extents, int logical, size_t blockOffset, char *buf, size_t size,
+                             bool isWrite, OpenFile *handle);
+    virtual int transferBlocks(const int *indices, size_t blockOffset, char *buf, size_t size, bool isWrite);
+    virtual int readSuperblock(const char *path);
+    virtual void allocMetadata();
+    virtual void mapMetadata();
+    virtual int flushFile(file *myFile, bool wait);
+    virtual ExtentMap &extentsOf(file *myFile);
+    virtual void freeDataBlock(int index);
+    virtual void punchHoles();
+    virtual void readahead(file *myFile, OpenFile *handle, off_t offset, size_t size);
+    virtual int writeCmapToDisc();
+    virtual int findChunk(file *myFile, int chunk, int *last, int *found);
+    virtual int loadChunk(file *myFile, int chunk, char *data);
+    virtual int storeChunk(file *myFile, int chunk, const char *data, size_t size);
+    virtual int flushChunk(file *myFile);
+    virtual int transferChunks(file *myFile, char *buf, size_t size, off_t offset, bool isWrite);
+    virtual int truncateChunks(file *myFile, off_t newSize);
+    virtual int writeDedupMapToDisc();
+    virtual int dataBlockOf(int fatIndex);
+    virtual int readDataBlock(int block, char *data);
+    virtual bool isStoredIn(int block, const char *data, const std::map<int, const char *> &pending);
+    virtual int writeDedup(const int *indices, size_t blockOffset, const char *buf, size_t size);
+    virtual void setLocation(int fatIndex, int block);
+    virtual void setBlockHash(int block, uint32_t hash);
+    virtual void releaseDataBlock(int block);
+    virtual int findFreeDataBlock(int preferred);
+    virtual BlockDevice *emulateLatency(BlockDevice *device, unsigned int member);
+    virtual int slotOf(file *myFile);
+    virtual file *loadEntry(int slot);
+    virtual int writeEntry(file *myFile);
+    virtual int dirTransfer(const std::vector<int> &blocks, size_t pos, void *buf, size_t size, bool isWrite);
+    virtual int readChain(int first, std::vector<int> &blocks);
+    virtual int growChain(int *first, std::vector<int> &blocks, size_t size);
+    virtual int createDirIndex();
+    virtual int loadDirIndex();
+    virtual int writeDirHeader();
+    virtual int findInIndex(int parent, const char *name);
+    virtual int insertName(int parent, const char *name, int slot);
+    virtual int removeName(int parent, const char *name, int slot);
+    virtual int splitBucket(int bucket);
+    virtual int allocSlot();
+    virtual int releaseSlot(int slot);
+    virtual void dirBlocksOf(file *myFile, std::vector<int> &blocks);
+    virtual void trimEntryCache();
+    virtual file *entryOf(int slot);
+    virtual int readEntry(int slot, file *myFile);
+    virtual int lookup(int parent, const char *name, bool *isDir);
+    virtual int resolveParent(const char *path, const char **leaf);
+    virtual int findSlot(const char *path, bool *isDir);
+    virtual int createEntry(const char *path, mode_t mode);
+    virtual int removeEntry(file *myFile);
+    virtual int freeEntry(file *myFile);
+    virtual int linkEntry(int dir, int slot);
+    virtual int unlinkEntry(int slot);
 
-    virtual int findEmptyDataBlock();
+    virtual int findEmptyDataBlocks(int preferred, int want, int *count);
+    virtual int appendBlocks(file *myFile, int count);
+    virtual void cutBlocks(file *myFile, int keep);
+    virtual int growContainer();
+    virtual int writeSuperblock();
 
 protected:
     //BlockDevice blockDevice; (Eig mit *)
@@ -28,13 +165,63 @@ public:
     static MyOnDiskFS *Instance();
 
     // TODO: [PART 2] Add attributes of your file system here
-    size_t FATSIZE = 1012 * sizeof(int);
-    size_t DMAPSIZE = 1012 * sizeof(bool);
+    size_t FATSIZE = 0; // aus der Geometrie im Superblock berechnet
+    size_t DMAPSIZE = 0;
     size_t ROOTSIZE = NUM_DIR_ENTRIES * sizeof(file);
     int *fat;
-    bool *dmap;
+    uint64_t *dmap; // one bit per data block, set if the block is used
+    uint32_t *cmap = nullptr; // stored length of the chunk starting at each data block, 0 for other blocks
+    size_t CMAPSIZE = 0;
+    dedupEntry *dedupMap = nullptr; // data block holding each block of a chain and the hash of each data block
+    size_t DEDUPSIZE = 0;
     file *root;
+    std::vector<bool> dmapDirty;        // blocks of the dmap changed since they were written
+    std::vector<bool> fatDirty;         // blocks of the FAT changed since they were written
+    std::vector<bool> cmapDirty;        // blocks of the cmap changed since they were written
+    std::vector<bool> dedupDirty;       // blocks of the dedup map changed since they were written
+    uint64_t metadataBlocksWritten = 0; // blocks of dmap, FAT, cmap and dedup map written
+    PathIndex pathIndex;                // slot in root of each name within its directory
+    DentryCache dentries;               // slot of recently resolved path components, or that they do not exist
+    dirIndexHeader dirHeader = {};      // header of the directory index, if the container has one
+    std::vector<int> dirIndexBlocks;    // chain holding the header and the bucket directory
+    std::vector<int> dirBucketBlocks;   // chain holding the buckets, one per block
+    std::vector<int> dirEntryBlocks;    // chain holding the entries from NUM_DIR_ENTRIES on
+    std::vector<int> dirBuckets;        // bucket of each slot of the bucket directory
+    std::unordered_map<int, CachedEntry> entryCache; // entries from NUM_DIR_ENTRIES on read since the last trim
+    uint64_t bucketSplits = 0;          // number of buckets of the directory index split
     superblock sBlock;
+    bool metadataMapped = false;
+    BlockCache *cache;
+    CompositeBlockDevice *compositeDevice = nullptr; // blockDevice or the device it wraps if several containers are used
+    MirroredBlockDevice *mirroredDevice = nullptr;   // compositeDevice if the containers are mirrored
+    ChecksumBlockDevice *checksumDevice = nullptr;   // blockDevice if the container has checksums
+    uint32_t readaheadMax = 0;          // largest readahead window in blocks, 0 disables readahead
+    uint64_t readaheadWindows = 0;      // number of readahead windows started
+    uint64_t readaheadBlocks = 0;       // blocks requested by readahead
+    uint32_t readaheadLargest = 0;      // largest window used
+    uint32_t maxDeviceSize = 0;         // largest container size in blocks, 0 for no limit
+    uint32_t growSize = 0;              // blocks added when the container grows, 0 for CONTAINER_GROW_SIZE
+    uint32_t containerGrowths = 0;      // number of times the container was grown
+    ExtentAllocator freeExtents;        // runs of free data blocks, kept in step with the dmap
+    std::unordered_map<int, ExtentMap> extentMaps; // blocks of open files by directory entry, from their chains
+    uint64_t extentMapsBuilt = 0;       // number of chains walked to build an extent map
+    uint64_t fsOpCalls[FS_OP_COUNT] = {}; // number of calls of each file system operation
+    std::vector<bool> unwritten;        // data blocks never written since they were created or punched out
+    std::vector<int> freedBlocks;       // data blocks freed since the last punchHoles()
+    bool punchHolesSupported = true;    // false once the container file system rejected a hole
+    uint64_t holesPunched = 0;          // number of data blocks punched out of the container file
+    std::unordered_map<int, ChunkBuffer> chunkBuffers; // by directory entry if the container is compressed
+    uint64_t chunksStored = 0;          // number of chunks compressed and stored
+    uint64_t chunksLoaded = 0;          // number of stored chunks read and decompressed
+    uint64_t chunkBytesIn = 0;          // uncompressed bytes of the chunks stored
+    uint64_t chunkBytesOut = 0;         // bytes the stored chunks take in the container
+    std::vector<int> refCounts;         // number of chain blocks stored in each data block if deduplicating
+    std::unordered_map<uint32_t, int> dedupIndex; // data block holding the content with a hash
+    int freeDataHint = 0;               // no data block before this index is free if deduplicating
+    uint64_t blocksDeduplicated = 0;    // blocks written whose content was stored already
+    uint64_t blocksCopied = 0;          // blocks copied on write as they were shared
+    uint64_t hashCollisions = 0;        // blocks whose hash was found with a different content
+    std::vector<LatencyBlockDevice *> latencyDevices; // one per container file if its storage is emulated
     OpenFile openFiles[NUM_OPEN_FILES];
 
     MyOnDiskFS();
@@ -43,13 +230,18 @@ public:
 
     static void SetInstance();
 
+    static int computeLayout(superblock *sb, uint32_t blockSize, int deviceSize, bool checksums = true,
+                             uint32_t chunkSize = 0, bool dedup = false);
+
     // --- Methods called by FUSE ---
     // For Documentation see https://libfuse.github.io/doxygen/structfuse__operations.html
     virtual int fuseGetattr(const char *path, struct stat *statbuf);
 
     virtual int fuseMknod(const char *path, mode_t mode, dev_t dev);
+    virtual int fuseMkdir(const char *path, mode_t mode);
 
     virtual int fuseUnlink(const char *path);
+    virtual int fuseRmdir(const char *path);
     virtual int fuseRename(const char *path, const char *newpath);
     virtual int fuseChmod(const char *path, mode_t mode);
     virtual int fuseChown(const char *path, uid_t uid, gid_t gid);
@@ -58,7 +250,10 @@ public:
     virtual int fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseRelease(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFlush(const char *path, struct fuse_file_info *fileInfo);
+    virtual int fuseFsync(const char *path, int datasync, struct fuse_file_info *fi);
     virtual void* fuseInit(struct fuse_conn_info *conn);
+    virtual int fuseOpendir(const char *path, struct fuse_file_info *fileInfo);
     virtual int fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fileInfo);
     virtual int fuseTruncate(const char *path, off_t offset, struct fuse_file_info *fileInfo);
     virtual void fuseDestroy();
@@ -0,0 +1,79 @@
+//
+//  pathindex.h
+//  myfs
+//
+
+#ifndef pathindex_h
+#define pathindex_h
+
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+#include <vector>
+
+#include "myfs-structs.h"
+
+/// @brief Hash table from file names to their slots in a directory array.
+///
+/// A file is identified by the slot of the directory it is in (its parent) and its name within that directory.
+/// Open addressing with linear probing. A bucket keeps the slot and the hash of parent and name, the names themselves
+/// stay in the directory array and are compared only when the hashes are equal. Removed entries leave a tombstone until
+/// the table is rebuilt, which happens when live entries and tombstones fill three quarters of it.
+class PathIndex {
+private:
+    struct Bucket {
+        uint32_t hash;
+        int slot;       // PI_EMPTY, PI_REMOVED or the slot in the directory array
+    };
+
+    std::vector<Bucket> buckets;    // a power of two of them
+    uint32_t used;                  // live entries
+    uint32_t removed;               // tombstones
+
+    void resize(uint32_t capacity);
+
+public:
+    PathIndex();
+
+    /// @brief Hash a file name within its directory.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name of the file.
+    /// \return CRC32C of parent and name.
+    static uint32_t hash(int parent, const char *name);
+
+    /// @brief Index all used slots of a directory array.
+    ///
+    /// \param [in] entries The directory array, slots with an empty name are free.
+    /// \param [in] count Number of slots.
+    void rebuild(const file *entries, int count);
+
+    /// @brief Find the slot of a file.
+    ///
+    /// \param [in] entries The directory array the index belongs to.
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name of the file.
+    /// \return The slot, -1 if the directory has no file of this name.
+    int find(const file *entries, int parent, const char *name) const;
+
+    /// @brief Add a file, its name must not be in the index yet.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name of the file.
+    /// \param [in] slot Its slot in the directory array.
+    void insert(int parent, const char *name, int slot);
+
+    /// @brief Remove a file, call it before its name or parent in the directory array changes.
+    ///
+    /// \param [in] parent Slot of the directory.
+    /// \param [in] name Name of the file.
+    /// \param [in] slot Its slot in the directory array.
+    void remove(int parent, const char *name, int slot);
+
+    /// @brief Get the number of files in the index.
+    ///
+    /// \return Number of entries.
+    uint32_t size() const;
+};
+
+#endif /* pathindex_h */
@@ -0,0 +1,53 @@
+//
+//  stripedblockdevice.h
+//  myfs
+//
+
+#ifndef stripedblockdevice_h
+#define stripedblockdevice_h
+
+#include "compositeblockdevice.h"
+
+/// @brief Block device striped over several container files
+///
+/// The blocks are distributed round-robin over the member devices in stripe units of stripeSize blocks (RAID 0):
+/// stripe unit s is stored on member s % n. Requests spanning several stripe units are split, so the members transfer
+/// their parts in parallel.
+class StripedBlockDevice : public CompositeBlockDevice {
+private:
+    struct Segment {
+        uint32_t member;    // member device
+        uint32_t blockNo;   // first block on the member
+        uint32_t count;     // number of blocks
+    };
+
+    uint32_t stripeSize;
+
+    void split(uint32_t firstBlockNo, uint32_t count, std::vector<Segment> &segments);
+
+protected:
+    virtual void queueParts(uint32_t index, const struct iovec *iov, int iovcnt);
+
+public:
+    /// @brief Create a striped block device.
+    ///
+    /// \param members Member devices, all with the same block size; deleted with the striped device.
+    /// \param paths Container files of the members, in the same order.
+    /// \param stripeSize Number of consecutive blocks stored on one member.
+    StripedBlockDevice(const std::vector<BlockDevice *> &members, const std::vector<std::string> &paths,
+                       uint32_t stripeSize);
+
+    /// @brief Get the number of blocks a member holds of a device with the given size.
+    ///
+    /// \param member Index of the member.
+    /// \param blockCount Size of the striped device in blocks.
+    /// \return Number of blocks of the member.
+    uint32_t memberBlockCount(uint32_t member, uint32_t blockCount);
+
+    virtual int grow(uint32_t blockCount);
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+};
+
+#endif /* stripedblockdevice_h */
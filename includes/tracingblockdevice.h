@@ -0,0 +1,128 @@
+//
+//  tracingblockdevice.h
+//  myfs
+//
+
+#ifndef tracingblockdevice_h
+#define tracingblockdevice_h
+
+#include <string>
+#include <vector>
+
+#include "blockdevice.h"
+
+#define TRACE_MAGIC "MYFSTRC1"
+#define TRACE_VERSION 1
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+/// @brief Kinds of requests in a block I/O trace.
+enum TraceOp {
+    TRACE_READ,
+    TRACE_WRITE,
+    TRACE_FLUSH,
+    TRACE_DISCARD,
+    TRACE_GROW
+};
+
+#define TRACE_QUEUED 0x01   // request was queued with queueRead() or queueWrite()
+#define TRACE_WAIT 0x02     // flush waited until the blocks were stored
+
+/// @brief One request in a block I/O trace.
+///
+/// Records are stored in the trace file as they are, 24 bytes each, after the header.
+struct TraceRecord {
+    uint64_t timeNs;    // time the request was issued, relative to the start of the trace
+    uint32_t blockNo;   // first block (for TRACE_GROW: new number of blocks)
+    uint32_t count;     // number of blocks
+    uint8_t op;         // TraceOp
+    uint8_t cause;      // cause of the issuing thread, see BlockDevice::setCause()
+    uint16_t flags;     // TRACE_QUEUED, TRACE_WAIT
+    uint32_t reserved;
+};
+
+/// @brief Block device recording a trace of all requests
+///
+/// This decorator passes every request on to another block device and appends a record for it to a trace file. The
+/// trace starts with a header holding the block size and the names of the causes, so it can be replayed without
+/// knowing the file system that recorded it (see replay.myfs). Direct access to blocks is not offered, so that every
+/// access to the container shows up in the trace.
+class TracingBlockDevice : public BlockDevice {
+private:
+    BlockDevice *device;
+    FILE *traceFile;
+    uint64_t startNs;
+    std::mutex traceMutex;    // requests are also issued by the flusher thread of the block cache
+
+    void trace(TraceOp op, uint32_t blockNo, uint64_t bytes, uint16_t flags);
+
+public:
+    /// @brief Create a tracing block device.
+    ///
+    /// \param device Block device the requests are passed on to, deleted with the tracing block device.
+    /// \param tracePath Path of the trace file, an existing trace is overwritten.
+    /// \param causeNames Names of the causes stored in the trace, causeCount entries; nullptr for none.
+    /// \param causeCount Number of entries in causeNames.
+    TracingBlockDevice(BlockDevice *device, const char *tracePath, const char *const *causeNames = nullptr,
+                       uint32_t causeCount = 0);
+
+    virtual ~TracingBlockDevice();
+
+    /// @brief Check whether the trace file could be created.
+    ///
+    /// \return true if requests are recorded.
+    bool isTracing();
+
+    virtual int open(const char *path);
+    virtual int create(const char *path);
+    virtual int close();
+
+    virtual int readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer);
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt);
+    virtual int grow(uint32_t blockCount);
+    virtual int discard(uint32_t firstBlockNo, uint32_t count);
+    virtual int findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes);
+    virtual int flush(uint32_t firstBlockNo, uint32_t count, bool wait);
+
+    virtual int queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag);
+    virtual int submit();
+    virtual int complete(BlockCompletion *done, int maxDone, bool wait);
+    virtual int drain();
+
+    virtual BlockDeviceStats getStats();
+    virtual void resetStats();
+};
+
+/// @brief Reader for block I/O traces
+class TraceReader {
+private:
+    FILE *traceFile;
+    uint32_t blockSize;
+    std::vector<std::string> causeNames;
+
+public:
+    TraceReader();
+    ~TraceReader();
+
+    /// @brief Open a trace file and read its header.
+    ///
+    /// \param path Path of the trace file.
+    /// \return 0 on success, -EINVAL if the file is no trace, -ERRNO on other failures.
+    int open(const char *path);
+
+    /// @brief Read the next record.
+    ///
+    /// \param [out] record The record.
+    /// \return true if a record was read, false at the end of the trace.
+    bool next(TraceRecord &record);
+
+    /// @brief Get the block size of the traced device.
+    uint32_t getBlockSize();
+
+    /// @brief Get the names of the causes.
+    const std::vector<std::string> &getCauseNames();
+};
+
+#endif /* tracingblockdevice_h */
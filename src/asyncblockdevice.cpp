@@ -0,0 +1,309 @@
+//
+//  asyncblockdevice.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "asyncblockdevice.h"
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+AsyncBlockDevice::AsyncBlockDevice(uint32_t blockSize, uint32_t queueDepth) : BlockDevice(blockSize) {
+    this->queueDepth = queueDepth > 0 ? queueDepth : 1;
+    this->ringFd = -1;
+    this->sqRing = this->cqRing = this->sqeArray = nullptr;
+
+    requests.resize(this->queueDepth);
+    for (uint32_t i = this->queueDepth; i > 0; i--)
+        freeRequests.push_back(i - 1);
+
+    if (setupRing() < 0)
+        teardownRing(); // use the synchronous implementation
+}
+
+AsyncBlockDevice::~AsyncBlockDevice() {
+    if (isAsync())
+        drain();
+    teardownRing();
+}
+
+bool AsyncBlockDevice::isAsync() {
+    return ringFd >= 0;
+}
+
+uint32_t AsyncBlockDevice::getQueueDepth() {
+    return queueDepth;
+}
+
+int AsyncBlockDevice::close() {
+    // requests must not run on a closed (or reused) file descriptor
+    int ret = drain();
+    int closeRet = BlockDevice::close();
+    return closeRet < 0 ? closeRet : ret;
+}
+
+int AsyncBlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    if (!isAsync())
+        return BlockDevice::queueRead(firstBlockNo, iov, iovcnt, tag);
+    return queueRequest(false, firstBlockNo, iov, iovcnt, tag);
+}
+
+int AsyncBlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    if (!isAsync())
+        return BlockDevice::queueWrite(firstBlockNo, iov, iovcnt, tag);
+    return queueRequest(true, firstBlockNo, iov, iovcnt, tag);
+}
+
+int AsyncBlockDevice::submit() {
+    if (!isAsync())
+        return BlockDevice::submit();
+    return enter(0);
+}
+
+int AsyncBlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    if (isAsync()) {
+        int ret = reap();
+        if (ret < 0)
+            return ret;
+        if (wait && completions.empty() && inFlight() > 0) {
+            ret = enter(1);
+            if (ret < 0)
+                return ret;
+            reap();
+        }
+    }
+    return BlockDevice::complete(done, maxDone, wait);
+}
+
+int AsyncBlockDevice::drain() {
+    while (isAsync() && inFlight() > 0) {
+        int ret = enter(1);
+        if (ret < 0)
+            return ret;
+        reap();
+    }
+    return BlockDevice::drain();
+}
+
+int AsyncBlockDevice::inFlight() {
+    return (int) (queueDepth - freeRequests.size());
+}
+
+#ifdef HAVE_IO_URING
+
+int AsyncBlockDevice::setupRing() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = (int) syscall(__NR_io_uring_setup, queueDepth, &params);
+    if (ringFd < 0)
+        return -errno;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cqRingSize > sqRingSize)
+            sqRingSize = cqRingSize;
+        cqRingSize = 0;
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return -errno;
+    }
+    if (cqRingSize > 0) {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            cqRing = nullptr;
+            return -errno;
+        }
+    }
+    sqeArraySize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqeArray = mmap(nullptr, sqeArraySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                    IORING_OFF_SQES);
+    if (sqeArray == MAP_FAILED) {
+        sqeArray = nullptr;
+        return -errno;
+    }
+
+    char *sq = (char *) sqRing;
+    char *cq = cqRing != nullptr ? (char *) cqRing : (char *) sqRing;
+    sqHead = (unsigned *) (sq + params.sq_off.head);
+    sqTail = (unsigned *) (sq + params.sq_off.tail);
+    sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    sqIndexArray = (unsigned *) (sq + params.sq_off.array);
+    cqHead = (unsigned *) (cq + params.cq_off.head);
+    cqTail = (unsigned *) (cq + params.cq_off.tail);
+    cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+
+    return 0;
+}
+
+void AsyncBlockDevice::teardownRing() {
+    if (sqeArray != nullptr)
+        munmap(sqeArray, sqeArraySize);
+    if (cqRing != nullptr)
+        munmap(cqRing, cqRingSize);
+    if (sqRing != nullptr)
+        munmap(sqRing, sqRingSize);
+    if (ringFd >= 0)
+        ::close(ringFd);
+    sqRing = cqRing = sqeArray = nullptr;
+    ringFd = -1;
+}
+
+int AsyncBlockDevice::queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt,
+                                   uint64_t tag) {
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (size % this->blockSize != 0 || iovcnt > IOV_MAX)
+        return -EINVAL;
+
+    // unaligned direct I/O has to be staged through the buffer pool, which is done synchronously
+    if (this->directIO && !isDirectAligned((off_t) firstBlockNo * this->blockSize, iov, iovcnt)) {
+        if (isWrite)
+            return BlockDevice::queueWrite(firstBlockNo, iov, iovcnt, tag);
+        return BlockDevice::queueRead(firstBlockNo, iov, iovcnt, tag);
+    }
+
+    // all requests busy: wait until one is finished
+    while (freeRequests.empty()) {
+        int ret = enter(1);
+        if (ret < 0)
+            return ret;
+        reap();
+    }
+
+    uint32_t index = freeRequests.back();
+    freeRequests.pop_back();
+    Request &r = requests[index];
+    r.isWrite = isWrite;
+    r.pos = (off_t) firstBlockNo * this->blockSize;
+    r.size = size;
+    r.tag = tag;
+    r.start = clockNs();
+    r.cause = cause;
+    r.iov.assign(iov, iov + iovcnt);
+
+    // the ring has as many entries as there are requests, so there is always a free entry
+    unsigned tail = *sqTail;
+    unsigned slot = tail & *sqMask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *) sqeArray)[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = this->contFile;
+    sqe->addr = (uint64_t) (uintptr_t) r.iov.data();
+    sqe->len = (uint32_t) iovcnt;
+    sqe->off = (uint64_t) r.pos;
+    sqe->user_data = index;
+    sqIndexArray[slot] = slot;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+unsigned AsyncBlockDevice::unsubmitted() {
+    return *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+}
+
+// submit all queued requests and wait for at least minComplete finished ones
+int AsyncBlockDevice::enter(unsigned minComplete) {
+    for (;;) {
+        unsigned toSubmit = unsubmitted();
+        if (toSubmit == 0 && minComplete == 0)
+            return 0;
+        unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        long ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0);
+        if (ret >= 0)
+            return (int) ret;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+// move finished requests from the completion ring to the completion list
+int AsyncBlockDevice::reap() {
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    int n = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &((struct io_uring_cqe *) cqes)[head & *cqMask];
+        uint32_t index = (uint32_t) cqe->user_data;
+        Request &r = requests[index];
+
+        BlockCompletion c;
+        c.tag = r.tag;
+        c.result = cqe->res < 0 ? cqe->res : 0;
+        if (cqe->res >= 0 && (size_t) cqe->res < r.size) {
+            // short transfer (e.g. end of container file): finish the rest synchronously
+            size_t done = (size_t) cqe->res;
+            size_t i = 0;
+            while (done >= r.iov[i].iov_len) {
+                done -= r.iov[i].iov_len;
+                i++;
+            }
+            r.iov[i].iov_base = (char *) r.iov[i].iov_base + done;
+            r.iov[i].iov_len -= done;
+            if (this->directIO && !r.isWrite) {
+                // the unaligned end of the file has been reached
+                for (; i < r.iov.size(); i++)
+                    memset(r.iov[i].iov_base, 0, r.iov[i].iov_len);
+            } else {
+                c.result = transferUnrecorded(r.isWrite, r.pos + cqe->res, &r.iov[i], (int) (r.iov.size() - i));
+            }
+        }
+        if (c.result == 0)
+            record(r.isWrite ? BD_OP_WRITE : BD_OP_READ, r.pos, r.size, r.start, r.cause);
+        completions.push_back(c);
+        freeRequests.push_back(index);
+
+        head++;
+        n++;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+#else
+
+int AsyncBlockDevice::setupRing() {
+    return -ENOSYS;
+}
+
+void AsyncBlockDevice::teardownRing() {
+    ringFd = -1;
+}
+
+int AsyncBlockDevice::queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt,
+                                   uint64_t tag) {
+    return -ENOSYS;
+}
+
+unsigned AsyncBlockDevice::unsubmitted() {
+    return 0;
+}
+
+int AsyncBlockDevice::enter(unsigned minComplete) {
+    return -ENOSYS;
+}
+
+int AsyncBlockDevice::reap() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,653 @@
+//
+//  blockcache.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <limits.h>
+
+#include "blockcache.h"
+
+BlockCache::BlockCache(BlockDevice *device, uint32_t blockSize, uint32_t capacity, BlockCachePolicy policy) {
+    this->device = device;
+    this->blockSize = blockSize;
+    this->capacity = capacity > 0 ? capacity : 1;
+    this->policy = policy;
+    this->target = 0;
+    this->writeBackMode = false;
+    this->maxDirtyAge = BC_DEFAULT_DIRTY_AGE;
+    this->dirtyLimit = 0;
+    this->writeError = 0;
+    this->flusherStop = false;
+    this->nextPrefetchTag = 0;
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+BlockCache::~BlockCache() {
+    stopFlusher();
+    reapPrefetches(true);
+    for (auto &it : entries) {
+        free(it.second->data);
+        delete it.second;
+    }
+    for (char *frame : freeFrames)
+        free(frame);
+}
+
+// find a resident block and record the access
+BlockCache::Entry *BlockCache::lookup(uint32_t blockNo) {
+    auto it = entries.find(blockNo);
+    if (it == entries.end())
+        return nullptr;
+    stats.hits++;
+    if (it->second->prefetched) {
+        // the first request of a prefetched block does not make it frequently used
+        stats.prefetchHits++;
+        it->second->prefetched = false;
+        moveTo(it->second, T1);
+    } else {
+        touch(it->second);
+    }
+    return it->second;
+}
+
+// a resident block was accessed again
+void BlockCache::touch(Entry *entry) {
+    // LRU keeps all blocks in t1, ARC promotes blocks seen twice to t2
+    moveTo(entry, policy == CACHE_ARC ? T2 : T1);
+}
+
+void BlockCache::moveTo(Entry *entry, ListId list) {
+    if (entry->list == T1)
+        t1.erase(entry->pos);
+    else if (entry->list == T2)
+        t2.erase(entry->pos);
+    std::list<Entry *> &to = list == T1 ? t1 : t2;
+    to.push_front(entry);
+    entry->pos = to.begin();
+    entry->list = list;
+}
+
+// least recently used block of a list that is not pinned
+BlockCache::Entry *BlockCache::victim(std::list<Entry *> &list) {
+    for (auto it = list.rbegin(); it != list.rend(); ++it) {
+        if ((*it)->pinCount == 0)
+            return *it;
+    }
+    return nullptr;
+}
+
+// drop a block, writing it first if it is dirty
+bool BlockCache::evict(Entry *entry, ListId ghostList) {
+    if (entry->dirty) {
+        std::vector<Entry *> dirtyEntries(1, entry);
+        if (writeDirty(dirtyEntries) < 0)
+            return false;
+    }
+
+    if (entry->list == T1)
+        t1.erase(entry->pos);
+    else
+        t2.erase(entry->pos);
+    if (ghostList == T1) {
+        b1.push_front(entry->blockNo);
+        ghosts1[entry->blockNo] = b1.begin();
+    } else if (ghostList == T2) {
+        b2.push_front(entry->blockNo);
+        ghosts2[entry->blockNo] = b2.begin();
+    }
+    entries.erase(entry->blockNo);
+    freeFrames.push_back(entry->data);
+    delete entry;
+    stats.evictions++;
+
+    // pinned blocks can push the cache over its capacity, keep the history bounded anyway
+    while (b1.size() + b2.size() > capacity) {
+        if (b1.size() > b2.size())
+            dropGhost(b1, ghosts1);
+        else
+            dropGhost(b2, ghosts2);
+    }
+    return true;
+}
+
+void BlockCache::dropGhost(std::list<uint32_t> &list,
+                           std::unordered_map<uint32_t, std::list<uint32_t>::iterator> &index) {
+    if (list.empty())
+        return;
+    index.erase(list.back());
+    list.pop_back();
+}
+
+// ARC: make room for one block, evicting from t1 or t2 depending on the target size of t1
+bool BlockCache::replace(bool inB2) {
+    if (t1.size() + t2.size() < capacity)
+        return true;
+
+    Entry *fromT1 = victim(t1);
+    Entry *fromT2 = victim(t2);
+    if (fromT1 != nullptr && (t1.size() > target || (inB2 && t1.size() == target) || fromT2 == nullptr))
+        return evict(fromT1, T1);
+    if (fromT2 != nullptr)
+        return evict(fromT2, T2);
+    return false;
+}
+
+// add a block that is not resident, making room according to the policy
+BlockCache::Entry *BlockCache::insert(uint32_t blockNo) {
+    ListId list = T1;
+
+    if (policy == CACHE_LRU) {
+        if (t1.size() >= capacity) {
+            Entry *old = victim(t1);
+            if (old != nullptr)
+                evict(old, NONE);
+        }
+    } else {
+        auto ghost1 = ghosts1.find(blockNo);
+        auto ghost2 = ghosts2.find(blockNo);
+        if (ghost1 != ghosts1.end()) {
+            // recently evicted from t1: t1 was too small
+            stats.ghostHits++;
+            uint32_t delta = b1.size() >= b2.size() ? 1 : b2.size() / b1.size();
+            target = target + delta < capacity ? target + delta : capacity;
+            b1.erase(ghost1->second);
+            ghosts1.erase(ghost1);
+            replace(false);
+            list = T2;
+        } else if (ghost2 != ghosts2.end()) {
+            // recently evicted from t2: t2 was too small
+            stats.ghostHits++;
+            uint32_t delta = b2.size() >= b1.size() ? 1 : b1.size() / b2.size();
+            target = target > delta ? target - delta : 0;
+            b2.erase(ghost2->second);
+            ghosts2.erase(ghost2);
+            replace(true);
+            list = T2;
+        } else if (t1.size() + b1.size() >= capacity) {
+            if (t1.size() < capacity) {
+                dropGhost(b1, ghosts1);
+                replace(false);
+            } else {
+                Entry *old = victim(t1);
+                if (old == nullptr || !evict(old, NONE))
+                    replace(false);
+            }
+        } else if (t1.size() + t2.size() + b1.size() + b2.size() >= capacity) {
+            if (t1.size() + t2.size() + b1.size() + b2.size() >= 2 * capacity)
+                dropGhost(b2, ghosts2);
+            replace(false);
+        }
+    }
+
+    Entry *entry = new Entry();
+    entry->blockNo = blockNo;
+    entry->pinCount = 0;
+    entry->list = NONE;
+    entry->loading = false;
+    entry->loadFailed = false;
+    entry->prefetched = false;
+    entry->dirty = false;
+    if (!freeFrames.empty()) {
+        entry->data = freeFrames.back();
+        freeFrames.pop_back();
+    } else if (posix_memalign((void **) &entry->data, blockSize, blockSize) != 0) {
+        delete entry;
+        return nullptr;
+    }
+    entries[blockNo] = entry;
+    moveTo(entry, list);
+    return entry;
+}
+
+// evict unpinned blocks until the cache is back within its capacity
+void BlockCache::shrink() {
+    while (t1.size() + t2.size() > capacity) {
+        if (policy == CACHE_LRU) {
+            Entry *old = victim(t1);
+            if (old == nullptr || !evict(old, NONE))
+                return;
+        } else if (!replace(false)) {
+            return;
+        }
+    }
+    while (freeFrames.size() > capacity / 8) {
+        free(freeFrames.back());
+        freeFrames.pop_back();
+    }
+}
+
+// read or write the blocks listed in which, consecutive blocks with one request, and wait for all of them
+int BlockCache::queueRuns(bool isWrite, const uint32_t *blockNos, char *const *frames, const std::vector<int> &which) {
+    std::vector<struct iovec> iov(which.size());
+    int ret = 0;
+    size_t runStart = 0;
+    int pending = 0;
+    for (size_t j = 0; j < which.size() && ret == 0; j++) {
+        iov[j].iov_base = frames[which[j]];
+        iov[j].iov_len = blockSize;
+        bool last = j + 1 == which.size() || blockNos[which[j + 1]] != blockNos[which[j]] + 1 ||
+                    j + 1 - runStart == IOV_MAX;
+        if (!last)
+            continue;
+        int iovcnt = (int) (j + 1 - runStart);
+        if (isWrite)
+            ret = device->queueWrite(blockNos[which[runStart]], &iov[runStart], iovcnt, pending);
+        else
+            ret = device->queueRead(blockNos[which[runStart]], &iov[runStart], iovcnt, pending);
+        if (ret == 0)
+            pending++;
+        runStart = j + 1;
+    }
+
+    // prefetches may finish in between, they are handled on the way
+    BlockCompletion done[16];
+    while (pending > 0) {
+        int n = device->complete(done, 16, true);
+        if (n <= 0) {
+            ret = ret < 0 ? ret : (n < 0 ? n : -EIO);
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (finishPrefetch(done[i]))
+                continue;
+            pending--;
+            if (ret == 0 && done[i].result < 0)
+                ret = done[i].result;
+        }
+    }
+    return ret;
+}
+
+// handle the completion of a prefetch request, false if the completion belongs to another request
+bool BlockCache::finishPrefetch(const BlockCompletion &done) {
+    if ((done.tag & BC_PREFETCH_TAG) == 0)
+        return false;
+    auto run = prefetchRuns.find(done.tag);
+    if (run == prefetchRuns.end())
+        return true;
+    for (uint32_t blockNo : run->second) {
+        auto it = entries.find(blockNo);
+        if (it == entries.end())
+            continue;
+        Entry *entry = it->second;
+        entry->loading = false;
+        entry->pinCount--;
+        if (done.result < 0) {
+            entry->loadFailed = true;
+            entry->prefetched = false;
+            if (entry->pinCount == 0)
+                discardBlock(blockNo);
+        }
+    }
+    prefetchRuns.erase(run);
+    return true;
+}
+
+// collect finished prefetches, with wait until all of them are finished
+void BlockCache::reapPrefetches(bool wait) {
+    BlockCompletion done[16];
+    while (!prefetchRuns.empty()) {
+        int n = device->complete(done, 16, wait);
+        if (n <= 0)
+            break;
+        for (int i = 0; i < n; i++)
+            finishPrefetch(done[i]);
+    }
+    if (wait) {
+        // the device lost requests, give up on them
+        while (!prefetchRuns.empty()) {
+            BlockCompletion lost = { prefetchRuns.begin()->first, -EIO };
+            finishPrefetch(lost);
+        }
+    }
+}
+
+// wait until a block that is being prefetched has arrived
+void BlockCache::waitLoading(Entry *entry) {
+    BlockCompletion done[16];
+    while (entry->loading) {
+        int n = device->complete(done, 16, true);
+        if (n <= 0) {
+            reapPrefetches(true);
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            finishPrefetch(done[i]);
+    }
+}
+
+void BlockCache::setDirty(Entry *entry, bool dirty) {
+    if (entry->dirty == dirty)
+        return;
+    if (dirty) {
+        dirtyBlocks.push_front(entry);
+        entry->dirtyPos = dirtyBlocks.begin();
+        entry->dirtySince = std::chrono::steady_clock::now();
+    } else {
+        dirtyBlocks.erase(entry->dirtyPos);
+    }
+    entry->dirty = dirty;
+}
+
+// write dirty blocks ordered by block number and mark them clean
+int BlockCache::writeDirty(std::vector<Entry *> &dirtyEntries) {
+    if (dirtyEntries.empty())
+        return 0;
+    std::sort(dirtyEntries.begin(), dirtyEntries.end(),
+              [](const Entry *a, const Entry *b) { return a->blockNo < b->blockNo; });
+    std::vector<uint32_t> blockNos(dirtyEntries.size());
+    std::vector<char *> frames(dirtyEntries.size());
+    std::vector<int> which(dirtyEntries.size());
+    for (size_t i = 0; i < dirtyEntries.size(); i++) {
+        blockNos[i] = dirtyEntries[i]->blockNo;
+        frames[i] = dirtyEntries[i]->data;
+        which[i] = (int) i;
+    }
+
+    int ret = queueRuns(true, blockNos.data(), frames.data(), which);
+    if (ret < 0) {
+        if (writeError == 0)
+            writeError = ret;
+        return ret;
+    }
+    for (Entry *entry : dirtyEntries)
+        setDirty(entry, false);
+    stats.writebacks += dirtyEntries.size();
+    return 0;
+}
+
+// report a failed writeback once
+int BlockCache::takeWriteError() {
+    int ret = writeError;
+    writeError = 0;
+    return ret;
+}
+
+int BlockCache::pinBlocks(const uint32_t *blockNos, int count, char **frames, const bool *fetch) {
+    std::vector<int> inserted;
+    std::vector<int> missing;
+    int ret = 0;
+    int pinned = 0;
+    reapPrefetches(false);
+    for (; pinned < count; pinned++) {
+        Entry *entry = lookup(blockNos[pinned]);
+        if (entry == nullptr) {
+            stats.misses++;
+            entry = insert(blockNos[pinned]);
+            if (entry == nullptr) {
+                ret = -ENOMEM;
+                break;
+            }
+            inserted.push_back(pinned);
+            if (fetch == nullptr || fetch[pinned])
+                missing.push_back(pinned);
+        }
+        entry->pinCount++;
+        frames[pinned] = entry->data;
+        if (entry->loading)
+            waitLoading(entry);
+        if (entry->loadFailed) { // read it again
+            entry->loadFailed = false;
+            inserted.push_back(pinned);
+            if (fetch == nullptr || fetch[pinned])
+                missing.push_back(pinned);
+        }
+    }
+
+    if (ret == 0 && !missing.empty())
+        ret = queueRuns(false, blockNos, frames, missing);
+    if (ret < 0) {
+        // blocks added here hold no valid content
+        unpinBlocks(blockNos, pinned);
+        for (int i : inserted)
+            discardBlock(blockNos[i]);
+    }
+    return ret;
+}
+
+void BlockCache::unpinBlocks(const uint32_t *blockNos, int count) {
+    for (int i = 0; i < count; i++) {
+        auto it = entries.find(blockNos[i]);
+        if (it != entries.end() && it->second->pinCount > 0)
+            it->second->pinCount--;
+    }
+    shrink();
+}
+
+void BlockCache::discardBlock(uint32_t blockNo) {
+    auto it = entries.find(blockNo);
+    if (it != entries.end() && it->second->pinCount == 0) {
+        Entry *entry = it->second;
+        setDirty(entry, false);
+        if (entry->list == T1)
+            t1.erase(entry->pos);
+        else
+            t2.erase(entry->pos);
+        freeFrames.push_back(entry->data);
+        entries.erase(it);
+        delete entry;
+    }
+    auto ghost1 = ghosts1.find(blockNo);
+    if (ghost1 != ghosts1.end()) {
+        b1.erase(ghost1->second);
+        ghosts1.erase(ghost1);
+    }
+    auto ghost2 = ghosts2.find(blockNo);
+    if (ghost2 != ghosts2.end()) {
+        b2.erase(ghost2->second);
+        ghosts2.erase(ghost2);
+    }
+}
+
+int BlockCache::pin(const uint32_t *blockNos, int count, char **frames, const bool *fetch) {
+    std::lock_guard<std::mutex> guard(lock);
+    return pinBlocks(blockNos, count, frames, fetch);
+}
+
+void BlockCache::unpin(const uint32_t *blockNos, int count) {
+    std::lock_guard<std::mutex> guard(lock);
+    unpinBlocks(blockNos, count);
+}
+
+int BlockCache::commit(const uint32_t *blockNos, int count) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<char *> frames(count);
+    std::vector<int> which(count);
+    for (int i = 0; i < count; i++) {
+        auto it = entries.find(blockNos[i]);
+        if (it == entries.end())
+            return -EINVAL;
+        frames[i] = it->second->data;
+        which[i] = i;
+    }
+
+    if (!writeBackMode)
+        return queueRuns(true, blockNos, frames.data(), which);
+
+    for (int i = 0; i < count; i++)
+        setDirty(entries[blockNos[i]], true);
+    if (dirtyBlocks.size() > dirtyLimit)
+        flusherWake.notify_one();
+    return 0;
+}
+
+int BlockCache::prefetch(const uint32_t *blockNos, int count) {
+    std::lock_guard<std::mutex> guard(lock);
+    reapPrefetches(false);
+
+    std::vector<uint32_t> fetchNos;
+    std::vector<struct iovec> iov;
+    for (int i = 0; i < count; i++) {
+        if (entries.find(blockNos[i]) != entries.end())
+            continue;
+        if (entries.size() >= capacity && victim(t1) == nullptr && victim(t2) == nullptr)
+            break;
+        Entry *entry = insert(blockNos[i]);
+        if (entry == nullptr)
+            break;
+        entry->loading = true;
+        entry->prefetched = true;
+        entry->pinCount++;
+        fetchNos.push_back(blockNos[i]);
+        iov.push_back({entry->data, blockSize});
+    }
+
+    int ret = 0;
+    size_t runStart = 0;
+    for (size_t j = 0; j < fetchNos.size(); j++) {
+        bool last = j + 1 == fetchNos.size() || fetchNos[j + 1] != fetchNos[j] + 1 || j + 1 - runStart == IOV_MAX;
+        if (!last)
+            continue;
+        uint64_t tag = BC_PREFETCH_TAG | nextPrefetchTag++;
+        prefetchRuns[tag].assign(fetchNos.begin() + runStart, fetchNos.begin() + j + 1);
+        if (ret == 0)
+            ret = device->queueRead(fetchNos[runStart], &iov[runStart], (int) (j + 1 - runStart), tag);
+        if (ret < 0) {
+            BlockCompletion failed = { tag, ret };
+            finishPrefetch(failed);
+        }
+        runStart = j + 1;
+    }
+    int submitted = device->submit();
+    if (ret == 0 && submitted < 0)
+        ret = submitted;
+    stats.prefetched += fetchNos.size();
+    return ret < 0 ? ret : (int) fetchNos.size();
+}
+
+int BlockCache::flush(const uint32_t *blockNos, int count) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<Entry *> dirtyEntries;
+    for (int i = 0; i < count; i++) {
+        auto it = entries.find(blockNos[i]);
+        if (it != entries.end() && it->second->dirty)
+            dirtyEntries.push_back(it->second);
+    }
+    int ret = writeDirty(dirtyEntries);
+    int earlier = takeWriteError();
+    return ret < 0 ? ret : earlier;
+}
+
+int BlockCache::flushAll() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<Entry *> dirtyEntries(dirtyBlocks.begin(), dirtyBlocks.end());
+    int ret = writeDirty(dirtyEntries);
+    int earlier = takeWriteError();
+    return ret < 0 ? ret : earlier;
+}
+
+// write back dirty blocks that are too old, and the oldest blocks while too many are dirty
+void BlockCache::flusherMain() {
+    std::unique_lock<std::mutex> guard(lock);
+    uint32_t interval = maxDirtyAge / 4 > 10 ? maxDirtyAge / 4 : 10;
+    while (!flusherStop) {
+        flusherWake.wait_for(guard, std::chrono::milliseconds(interval));
+        if (flusherStop)
+            break;
+
+        auto now = std::chrono::steady_clock::now();
+        size_t keep = dirtyBlocks.size() > dirtyLimit ? dirtyLimit / 2 : dirtyBlocks.size();
+        size_t left = dirtyBlocks.size();
+        std::vector<Entry *> dirtyEntries;
+        for (auto it = dirtyBlocks.rbegin(); it != dirtyBlocks.rend(); ++it) {
+            bool old = now - (*it)->dirtySince >= std::chrono::milliseconds(maxDirtyAge);
+            if (!old && left <= keep)
+                break;
+            // pinned blocks may be changed right now, they are written next time
+            if ((*it)->pinCount == 0) {
+                dirtyEntries.push_back(*it);
+                left--;
+            }
+        }
+        writeDirty(dirtyEntries);
+    }
+}
+
+void BlockCache::stopFlusher() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        flusherStop = true;
+    }
+    flusherWake.notify_one();
+    if (flusher.joinable())
+        flusher.join();
+    flusherStop = false;
+}
+
+int BlockCache::setWriteBack(bool enable, uint32_t maxDirtyAge, uint32_t dirtyLimit) {
+    stopFlusher();
+
+    std::lock_guard<std::mutex> guard(lock);
+    this->maxDirtyAge = maxDirtyAge;
+    this->dirtyLimit = dirtyLimit > 0 ? dirtyLimit : capacity * BC_DEFAULT_DIRTY_RATIO / 100;
+    this->writeBackMode = enable;
+    if (enable) {
+        flusher = std::thread(&BlockCache::flusherMain, this);
+        return 0;
+    }
+
+    reapPrefetches(true);
+    std::vector<Entry *> dirtyEntries(dirtyBlocks.begin(), dirtyBlocks.end());
+    int ret = writeDirty(dirtyEntries);
+    int earlier = takeWriteError();
+    return ret < 0 ? ret : earlier;
+}
+
+bool BlockCache::isWriteBack() {
+    std::lock_guard<std::mutex> guard(lock);
+    return writeBackMode;
+}
+
+int BlockCache::read(uint32_t blockNo, char *buffer) {
+    char *frame;
+    int ret = pin(&blockNo, 1, &frame);
+    if (ret < 0)
+        return ret;
+    memcpy(buffer, frame, blockSize);
+    unpin(&blockNo, 1);
+    return 0;
+}
+
+int BlockCache::write(uint32_t blockNo, const char *buffer) {
+    char *frame;
+    bool fetch = false;
+    int ret = pin(&blockNo, 1, &frame, &fetch);
+    if (ret < 0)
+        return ret;
+    memcpy(frame, buffer, blockSize);
+    ret = commit(&blockNo, 1);
+    unpin(&blockNo, 1);
+    if (ret < 0)
+        discard(blockNo);
+    return ret;
+}
+
+void BlockCache::discard(uint32_t blockNo) {
+    std::lock_guard<std::mutex> guard(lock);
+    discardBlock(blockNo);
+}
+
+BlockCacheStats BlockCache::getStats() {
+    std::lock_guard<std::mutex> guard(lock);
+    BlockCacheStats current = stats;
+    current.resident = (uint32_t) entries.size();
+    current.pinned = 0;
+    for (auto &it : entries) {
+        if (it.second->pinCount > 0)
+            current.pinned++;
+    }
+    current.dirty = (uint32_t) dirtyBlocks.size();
+    return current;
+}
+
+BlockCachePolicy BlockCache::getPolicy() {
+    return policy;
+}
+
+uint32_t BlockCache::getCapacity() {
+    return capacity;
+}
@@ -14,17 +14,82 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include "macros.h"
 
 #include "blockdevice.h"
+#include "bufferpool.h"
 
 #undef DEBUG
 
+thread_local uint32_t BlockDevice::cause= 0;
+
 BlockDevice::BlockDevice(uint32_t blockSize) {
     assert(blockSize % 512 == 0);
     this->blockSize= blockSize;
+    this->contFile= -1;
+    this->directIO= false;
+    this->directAlign= 1;
+    this->directMemAlign= 1;
+    this->bufferPool= nullptr;
+    resetStats();
+}
+
+BlockDevice::~BlockDevice() {
+    delete this->bufferPool;
+}
+
+void BlockDevice::setDirectIO(bool directIO) {
+    this->directIO= directIO;
+}
+
+uint32_t BlockDevice::getBlockSize() {
+    return this->blockSize;
+}
+
+bool BlockDevice::isDirectIO() {
+    return this->directIO;
+}
+
+// Open the container file, with O_DIRECT if direct I/O is enabled. Falls back to buffered I/O if the host file
+// system rejects O_DIRECT.
+int BlockDevice::openContainer(const char *path, int flags) {
+    int fd= -1;
+    if (this->directIO) {
+#ifdef O_DIRECT
+        fd= ::open(path, flags | O_DIRECT, 0666);
+        if (fd < 0 && errno == EINVAL)
+            this->directIO= false;
+        else if (fd < 0)
+            return fd;
+#else
+        fd= ::open(path, flags, 0666);
+        if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) < 0)
+            this->directIO= false;
+        return fd;
+#endif
+    }
+    if (!this->directIO)
+        return ::open(path, flags, 0666);
+
+    // ask the host file system for its alignment requirements, use the page size if it cannot tell
+    long pageSize= sysconf(_SC_PAGESIZE);
+    this->directAlign= pageSize;
+    this->directMemAlign= pageSize;
+#if defined(STATX_DIOALIGN)
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) &&
+        stx.stx_dio_offset_align > 0) {
+        this->directAlign= stx.stx_dio_offset_align;
+        this->directMemAlign= stx.stx_dio_mem_align;
+    }
+#endif
+    if (this->bufferPool == nullptr)
+        this->bufferPool= new AlignedBufferPool(BD_DIRECT_BUFFER_SIZE, BD_DIRECT_BUFFER_COUNT);
+    return fd;
 }
 
 int BlockDevice::create(const char *path) {
@@ -32,12 +97,12 @@ int BlockDevice::create(const char *path) {
     int ret= 0;
 
     // Open Container file
-    contFile = ::open(path, O_EXCL | O_RDWR | O_CREAT, 0666);
+    contFile = openContainer(path, O_EXCL | O_RDWR | O_CREAT);
     if (contFile < 0) {
         if (errno == EEXIST) {
             // file already exists, we must open & truncate
             LOG("WARNING: container file already exists, truncating")
-            contFile = ::open(path, O_EXCL | O_RDWR | O_TRUNC);
+            contFile = openContainer(path, O_EXCL | O_RDWR | O_TRUNC);
         }
 
         if(contFile < 0) {
@@ -56,7 +121,7 @@ int BlockDevice::open(const char *path) {
     int ret= 0;
 
     // Open Container file
-    contFile = ::open(path, O_EXCL | O_RDWR);
+    contFile = openContainer(path, O_EXCL | O_RDWR);
     if (contFile < 0) {
         if (errno == ENOENT)
             LOG("ERROR: container file does not exists");
@@ -77,6 +142,7 @@ int BlockDevice::close() {
 
     if(::close(this->contFile) < 0)
         ret= -errno;
+    this->contFile= -1;
     
     return ret;
 }
@@ -86,18 +152,7 @@ int BlockDevice::read(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Reading block %d\n", blockNo);
 #endif
-    off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
-        return -errno;
-    
-    int size = (this->blockSize);
-    ssize_t r = ::read(this->contFile, buffer, size);
-    if (r < 0)
-        return -errno;
-    if (r < size)
-        memset(buffer + r, 0, size - r);
-
-    return 0;
+    return readBlocks(blockNo, 1, buffer);
 }
 
 // this method returns 0 if successful, -errno otherwise
@@ -105,17 +160,395 @@ int BlockDevice::write(uint32_t blockNo, char *buffer) {
 #ifdef DEBUG
     fprintf(stderr, "BlockDevice: Writing block %d\n", blockNo);
 #endif
-    off_t pos = (off_t) blockNo * this->blockSize;
-    if (lseek (this->contFile, pos, SEEK_SET) != pos)
+    return writeBlocks(blockNo, 1, buffer);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) count * this->blockSize;
+    return transfer(false, (off_t) firstBlockNo * this->blockSize, &iov, 1);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) count * this->blockSize;
+    return transfer(true, (off_t) firstBlockNo * this->blockSize, &iov, 1);
+}
+
+// returns true if the buffers in iov add up to whole blocks
+static bool isBlockMultiple(const struct iovec *iov, int iovcnt, uint32_t blockSize) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+    return total % blockSize == 0;
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    if (!isBlockMultiple(iov, iovcnt, this->blockSize))
+        return -EINVAL;
+    return transfer(false, (off_t) firstBlockNo * this->blockSize, iov, iovcnt);
+}
+
+// this method returns 0 if successful, -errno otherwise
+int BlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    if (!isBlockMultiple(iov, iovcnt, this->blockSize))
+        return -EINVAL;
+    return transfer(true, (off_t) firstBlockNo * this->blockSize, iov, iovcnt);
+}
+
+int BlockDevice::grow(uint32_t blockCount) {
+    struct stat st;
+    if (fstat(this->contFile, &st) < 0)
         return -errno;
+    off_t size = (off_t) blockCount * this->blockSize;
+    if (st.st_size >= size)
+        return 0;
 
-    int size = (this->blockSize);
-    ssize_t w = ::write(this->contFile, buffer, size);
-    if (w < 0)
+    if (fallocate(this->contFile, 0, st.st_size, size - st.st_size) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP)
+        return -errno;
+    // host file system without fallocate(), new blocks are allocated on first write
+    if (ftruncate(this->contFile, size) < 0)
         return -errno;
-    if (w < size)
-        return -ENOSPC;
+    return 0;
+}
 
+int BlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    uint64_t start = clockNs();
+    if (fallocate(this->contFile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) firstBlockNo * this->blockSize,
+                  (off_t) count * this->blockSize) < 0)
+        return -errno;
+    record(BD_OP_DISCARD, (off_t) firstBlockNo * this->blockSize, (size_t) count * this->blockSize, start, cause);
     return 0;
 }
 
+// walk the data and hole ranges with SEEK_DATA and SEEK_HOLE
+int BlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    holes.assign(count, false);
+    off_t start = (off_t) firstBlockNo * this->blockSize;
+    off_t end = start + (off_t) count * this->blockSize;
+    off_t pos = start;
+    while (pos < end) {
+        off_t data = lseek(this->contFile, pos, SEEK_DATA);
+        if (data < 0 && errno != ENXIO) {   // ENXIO: nothing but holes up to the end of the file
+            int ret = -errno;
+            holes.assign(count, false);
+            return ret;
+        }
+        if (data < 0 || data > end)
+            data = end;
+
+        // blocks completely within [pos, data)
+        for (off_t b = (pos - start + this->blockSize - 1) / this->blockSize;
+             (b + 1) * this->blockSize <= data - start; b++)
+            holes[b] = true;
+        if (data >= end)
+            break;
+
+        pos = lseek(this->contFile, data, SEEK_HOLE);
+        if (pos < 0) {
+            int ret = -errno;
+            holes.assign(count, false);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+char *BlockDevice::getBlockPointer(uint32_t firstBlockNo, uint32_t count) {
+    return nullptr;
+}
+
+// writes go to the container file right away, so flushing means syncing the whole file
+int BlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    if (!wait)
+        return 0;
+    uint64_t start = clockNs();
+    if (fdatasync(this->contFile) < 0)
+        return -errno;
+    record(BD_OP_FLUSH, 0, 0, start, cause);
+    return 0;
+}
+
+BlockDeviceStats BlockDevice::getStats() {
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    return this->stats;
+}
+
+void BlockDevice::resetStats() {
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    memset(&this->stats, 0, sizeof(this->stats));
+    for (int op = 0; op < BD_OP_COUNT; op++)
+        this->nextPos[op] = -1;
+}
+
+void BlockDevice::setCause(uint32_t cause) {
+    BlockDevice::cause= cause < BD_MAX_CAUSES ? cause : 0;
+}
+
+uint32_t BlockDevice::getCause() {
+    return BlockDevice::cause;
+}
+
+uint64_t BlockDevice::clockNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+// count a finished request that was started at startNs
+void BlockDevice::record(BlockDeviceOp op, off_t pos, size_t size, uint64_t startNs, uint32_t cause) {
+    uint64_t latency = clockNs() - startNs;
+    int bucket = 0;
+    while (bucket < BD_LATENCY_BUCKETS - 1 && latency >> (bucket + 1) != 0)
+        bucket++;
+
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    this->stats.requests[op]++;
+    this->stats.bytes[op] += size;
+    this->stats.latencyNs[op] += latency;
+    this->stats.latency[op][bucket]++;
+    if (op == BD_OP_READ || op == BD_OP_WRITE) {
+        if (pos == this->nextPos[op])
+            this->stats.sequential[op]++;
+        this->nextPos[op] = pos + (off_t) size;
+        this->stats.causeRequests[cause]++;
+    }
+}
+
+uint64_t BlockDevice::latencyPercentile(const uint64_t *histogram, double fraction) {
+    uint64_t total = 0;
+    for (int b = 0; b < BD_LATENCY_BUCKETS; b++)
+        total += histogram[b];
+    if (total == 0)
+        return 0;
+    uint64_t seen = 0;
+    for (int b = 0; b < BD_LATENCY_BUCKETS; b++) {
+        seen += histogram[b];
+        if (seen >= fraction * total)
+            return (2ULL << b) - 1;
+    }
+    return (2ULL << (BD_LATENCY_BUCKETS - 1)) - 1;
+}
+
+void BlockDevice::printStats(FILE *out, const char *const *causeNames, uint32_t causeCount) {
+    static const char *opNames[BD_OP_COUNT] = { "read", "write", "flush", "discard" };
+    BlockDeviceStats s = getStats();
+
+    for (int op = 0; op < BD_OP_COUNT; op++) {
+        if (s.requests[op] == 0)
+            continue;
+        fprintf(out, "\tBlock device %s: %lu requests, %lu bytes", opNames[op], (unsigned long) s.requests[op],
+                (unsigned long) s.bytes[op]);
+        if (op == BD_OP_READ || op == BD_OP_WRITE)
+            fprintf(out, ", %lu sequential, %lu random", (unsigned long) s.sequential[op],
+                    (unsigned long) (s.requests[op] - s.sequential[op]));
+        fprintf(out, "; latency mean %lu ns, p50 %lu ns, p99 %lu ns\n",
+                (unsigned long) (s.latencyNs[op] / s.requests[op]),
+                (unsigned long) latencyPercentile(s.latency[op], 0.5),
+                (unsigned long) latencyPercentile(s.latency[op], 0.99));
+        fprintf(out, "\t\tlatency histogram:");
+        for (int b = 0; b < BD_LATENCY_BUCKETS; b++) {
+            if (s.latency[op][b] > 0)
+                fprintf(out, " <%lu ns: %lu", (unsigned long) (2ULL << b), (unsigned long) s.latency[op][b]);
+        }
+        fprintf(out, "\n");
+    }
+    for (uint32_t c = 0; c < BD_MAX_CAUSES; c++) {
+        if (s.causeRequests[c] == 0)
+            continue;
+        if (c < causeCount && causeNames != nullptr)
+            fprintf(out, "\tBlock device requests by %s: %lu\n", causeNames[c], (unsigned long) s.causeRequests[c]);
+        else
+            fprintf(out, "\tBlock device requests by cause %u: %lu\n", c, (unsigned long) s.causeRequests[c]);
+    }
+}
+
+// The synchronous device executes queued requests right away and only keeps their results.
+
+int BlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    BlockCompletion c;
+    c.tag = tag;
+    c.result = readBlocks(firstBlockNo, iov, iovcnt);
+    completions.push_back(c);
+    return 0;
+}
+
+int BlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    BlockCompletion c;
+    c.tag = tag;
+    c.result = writeBlocks(firstBlockNo, iov, iovcnt);
+    completions.push_back(c);
+    return 0;
+}
+
+int BlockDevice::submit() {
+    return 0;
+}
+
+int BlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    int n = 0;
+    while (n < maxDone && !completions.empty()) {
+        done[n++] = completions.front();
+        completions.pop_front();
+    }
+    return n;
+}
+
+int BlockDevice::drain() {
+    int ret = 0;
+    for (size_t i = 0; i < completions.size(); i++) {
+        if (ret == 0 && completions[i].result < 0)
+            ret = completions[i].result;
+    }
+    completions.clear();
+    return ret;
+}
+
+// a transfer counted in the statistics
+int BlockDevice::transfer(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt) {
+    uint64_t start = clockNs();
+    int ret = transferUnrecorded(isWrite, pos, iov, iovcnt);
+    if (ret == 0) {
+        size_t size = 0;
+        for (int i = 0; i < iovcnt; i++)
+            size += iov[i].iov_len;
+        record(isWrite ? BD_OP_WRITE : BD_OP_READ, pos, size, start, cause);
+    }
+    return ret;
+}
+
+// Move the bytes starting at pos from or to the buffers in iov with preadv()/pwritev(). Short transfers are resumed
+// where they stopped; reading beyond the end of the container file yields zeros.
+int BlockDevice::transferUnrecorded(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt) {
+#ifdef DEBUG
+    fprintf(stderr, "BlockDevice: %s at position %ld\n", isWrite ? "Writing" : "Reading", (long) pos);
+#endif
+    if (this->directIO && !isDirectAligned(pos, iov, iovcnt))
+        return transferBounced(isWrite, pos, iov, iovcnt);
+
+    // preadv()/pwritev() may consume only part of the vector, so work on a copy we can advance
+    struct iovec *cur = new struct iovec[iovcnt];
+    memcpy(cur, iov, iovcnt * sizeof(struct iovec));
+
+    struct iovec *next = cur;
+    int remaining = iovcnt;
+    int ret = 0;
+    while (remaining > 0) {
+        int n = remaining < IOV_MAX ? remaining : IOV_MAX;
+        size_t requested = 0;
+        for (int i = 0; i < n; i++)
+            requested += next[i].iov_len;
+        ssize_t done = isWrite ? ::pwritev(this->contFile, next, n, pos) : ::preadv(this->contFile, next, n, pos);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = -errno;
+            break;
+        }
+        // with direct I/O the file end may not be aligned, so do not resume a short read there
+        if (done == 0 || (this->directIO && !isWrite && (size_t) done < requested)) {
+            if (isWrite) {
+                ret = -ENOSPC;
+            } else {
+                while (remaining > 0 && (size_t) done >= next->iov_len) {
+                    done -= next->iov_len;
+                    next++;
+                    remaining--;
+                }
+                for (int i = 0; i < remaining; i++) {
+                    memset((char *) next[i].iov_base + done, 0, next[i].iov_len - done);
+                    done = 0;
+                }
+            }
+            break;
+        }
+
+        pos += done;
+        while (remaining > 0 && (size_t) done >= next->iov_len) {
+            done -= next->iov_len;
+            next++;
+            remaining--;
+        }
+        if (done > 0) {
+            next->iov_base = (char *) next->iov_base + done;
+            next->iov_len -= done;
+        }
+    }
+
+    delete [] cur;
+    return ret;
+}
+
+// returns true if a request can be passed to the container file opened with O_DIRECT as it is
+bool BlockDevice::isDirectAligned(off_t pos, const struct iovec *iov, int iovcnt) {
+    if (pos % this->directAlign != 0)
+        return false;
+    for (int i = 0; i < iovcnt; i++) {
+        if ((uintptr_t) iov[i].iov_base % this->directMemAlign != 0 || iov[i].iov_len % this->directAlign != 0)
+            return false;
+    }
+    return true;
+}
+
+// copy len bytes between buffer and the bytes starting at offset in the buffers described by iov
+static void copyIov(const struct iovec *iov, int iovcnt, size_t offset, char *buffer, size_t len, bool toIov) {
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        if (offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            continue;
+        }
+        size_t n = iov[i].iov_len - offset < len ? iov[i].iov_len - offset : len;
+        if (toIov)
+            memcpy((char *) iov[i].iov_base + offset, buffer, n);
+        else
+            memcpy(buffer, (char *) iov[i].iov_base + offset, n);
+        buffer += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+// Direct I/O for a request that is not aligned: move the aligned range covering it through buffers from the pool,
+// reading partially covered units first when writing. Only the request itself is counted, not the bounce transfers.
+int BlockDevice::transferBounced(bool isWrite, off_t pos, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    off_t start = pos - pos % this->directAlign;
+    off_t end = pos + total;
+    if (end % this->directAlign != 0)
+        end += this->directAlign - end % this->directAlign;
+
+    char *buffer = this->bufferPool->acquire();
+    if (buffer == nullptr)
+        return -ENOMEM;
+
+    int ret = 0;
+    size_t chunk = this->bufferPool->getBufferSize() - this->bufferPool->getBufferSize() % this->directAlign;
+    while (start < end && ret == 0) {
+        size_t len = (size_t) (end - start) < chunk ? (size_t) (end - start) : chunk;
+        off_t from = pos > start ? pos : start;
+        off_t to = (off_t) (pos + total) < (off_t) (start + len) ? (off_t) (pos + total) : (off_t) (start + len);
+        struct iovec bounce = {buffer, len};
+
+        if (!isWrite || from > start || to < (off_t) (start + len))
+            ret = transferUnrecorded(false, start, &bounce, 1);
+        if (ret == 0) {
+            copyIov(iov, iovcnt, from - pos, buffer + (from - start), to - from, !isWrite);
+            if (isWrite)
+                ret = transferUnrecorded(true, start, &bounce, 1);
+        }
+        start += len;
+    }
+
+    this->bufferPool->release(buffer);
+    return ret;
+}
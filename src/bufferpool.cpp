@@ -0,0 +1,52 @@
+//
+//  bufferpool.cpp
+//  myfs
+//
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "bufferpool.h"
+
+AlignedBufferPool::AlignedBufferPool(size_t bufferSize, unsigned int count, size_t alignment) {
+    this->bufferSize = bufferSize;
+    this->alignment = alignment > 0 ? alignment : (size_t) sysconf(_SC_PAGESIZE);
+    for (unsigned int i = 0; i < count; i++) {
+        char *buffer = acquire();
+        if (buffer != nullptr)
+            freeBuffers.push_back(buffer);
+    }
+}
+
+AlignedBufferPool::~AlignedBufferPool() {
+    for (size_t i = 0; i < buffers.size(); i++)
+        free(buffers[i]);
+}
+
+char *AlignedBufferPool::acquire() {
+    std::lock_guard<std::mutex> lock(this->poolMutex);
+    if (!freeBuffers.empty()) {
+        char *buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+    }
+
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, bufferSize) != 0)
+        return nullptr;
+    buffers.push_back((char *) buffer);
+    return (char *) buffer;
+}
+
+void AlignedBufferPool::release(char *buffer) {
+    std::lock_guard<std::mutex> lock(this->poolMutex);
+    freeBuffers.push_back(buffer);
+}
+
+size_t AlignedBufferPool::getBufferSize() {
+    return bufferSize;
+}
+
+size_t AlignedBufferPool::getAlignment() {
+    return alignment;
+}
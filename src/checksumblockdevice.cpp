@@ -0,0 +1,340 @@
+//
+//  checksumblockdevice.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+
+#include "checksumblockdevice.h"
+#include "crc32c.h"
+
+#define SUM_UNKNOWN 0   // checksum of a block that is not verified
+
+// a computed checksum never marks a block as unknown
+static uint32_t knownSum(uint32_t sum) {
+    return sum == SUM_UNKNOWN ? 1 : sum;
+}
+
+ChecksumBlockDevice::ChecksumBlockDevice(BlockDevice *device) : BlockDevice(device->getBlockSize()) {
+    this->device = device;
+    this->regionAddress = 0;
+    this->regionBlocks = 0;
+    this->pendingCount = 0;
+    this->verified = 0;
+    this->mismatches = 0;
+
+    std::vector<char> zeros(this->blockSize, 0);
+    this->zeroSum = knownSum(crc32c(0, zeros.data(), zeros.size()));
+}
+
+ChecksumBlockDevice::~ChecksumBlockDevice() {
+    delete this->device;
+}
+
+void ChecksumBlockDevice::setRegion(uint32_t address, uint32_t blocks) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    uint32_t perBlock = this->blockSize / sizeof(uint32_t);
+    uint32_t oldAddress = this->regionAddress;
+    uint32_t oldBlocks = this->regionBlocks;
+
+    this->sums.resize((size_t) blocks * perBlock, SUM_UNKNOWN);
+    this->dirty.assign(blocks, true);
+    this->regionAddress = address;
+    this->regionBlocks = blocks;
+
+    // blocks of a previous region hold no valid checksum
+    for (uint32_t b = oldAddress; b < oldAddress + oldBlocks && b < this->sums.size(); b++)
+        this->sums[b] = SUM_UNKNOWN;
+    for (uint32_t b = address; b < address + blocks && b < this->sums.size(); b++)
+        this->sums[b] = SUM_UNKNOWN;
+}
+
+int ChecksumBlockDevice::loadChecksums() {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    if (this->regionBlocks == 0)
+        return 0;
+    int ret = this->device->readBlocks(this->regionAddress, this->regionBlocks, (char *) this->sums.data());
+    if (ret < 0)
+        return ret;
+    for (uint32_t b = this->regionAddress; b < this->regionAddress + this->regionBlocks && b < this->sums.size(); b++)
+        this->sums[b] = SUM_UNKNOWN;
+    if (!this->sums.empty())
+        this->sums[0] = SUM_UNKNOWN;
+    this->dirty.assign(this->regionBlocks, false);
+    return 0;
+}
+
+int ChecksumBlockDevice::writeChecksums() {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    return writeDirty();
+}
+
+// write runs of dirty blocks of the region, sumMutex is held
+int ChecksumBlockDevice::writeDirty() {
+    uint32_t perBlock = this->blockSize / sizeof(uint32_t);
+    uint32_t i = 0;
+    while (i < this->regionBlocks) {
+        if (!this->dirty[i]) {
+            i++;
+            continue;
+        }
+        uint32_t run = 1;
+        while (i + run < this->regionBlocks && this->dirty[i + run])
+            run++;
+        int ret = this->device->writeBlocks(this->regionAddress + i, run,
+                                            (char *) (this->sums.data() + (size_t) i * perBlock));
+        if (ret < 0)
+            return ret;
+        for (uint32_t j = i; j < i + run; j++)
+            this->dirty[j] = false;
+        i += run;
+    }
+    return 0;
+}
+
+uint64_t ChecksumBlockDevice::getVerified() {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    return this->verified;
+}
+
+uint64_t ChecksumBlockDevice::getMismatches() {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    return this->mismatches;
+}
+
+// checksums of the blocks in iov, which may be split over the buffers at any byte
+void ChecksumBlockDevice::computeSums(const struct iovec *iov, int iovcnt, std::vector<uint32_t> &out) {
+    out.clear();
+    uint32_t crc = 0;
+    size_t filled = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const char *data = (const char *) iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+        while (left > 0) {
+            size_t len = std::min(left, (size_t) this->blockSize - filled);
+            crc = crc32c(crc, data, len);
+            data += len;
+            left -= len;
+            filled += len;
+            if (filled == this->blockSize) {
+                out.push_back(knownSum(crc));
+                crc = 0;
+                filled = 0;
+            }
+        }
+    }
+}
+
+// keep the checksum of a block written successfully, sumMutex is held
+void ChecksumBlockDevice::setSum(uint32_t blockNo, uint32_t sum) {
+    if (blockNo == 0 || blockNo >= this->sums.size() ||
+        (blockNo >= this->regionAddress && blockNo < this->regionAddress + this->regionBlocks))
+        return;
+    if (this->sums[blockNo] != sum) {
+        this->sums[blockNo] = sum;
+        this->dirty[blockNo / (this->blockSize / sizeof(uint32_t))] = true;
+    }
+}
+
+// compare the blocks read to their checksums, sumMutex is held
+int ChecksumBlockDevice::verify(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    std::vector<uint32_t> read;
+    computeSums(iov, iovcnt, read);
+    int ret = 0;
+    for (uint32_t i = 0; i < read.size(); i++) {
+        uint32_t blockNo = firstBlockNo + i;
+        if (blockNo >= this->sums.size() || this->sums[blockNo] == SUM_UNKNOWN)
+            continue;
+        this->verified++;
+        if (this->sums[blockNo] != read[i]) {
+            this->mismatches++;
+            ret = -EIO;
+        }
+    }
+    return ret;
+}
+
+int ChecksumBlockDevice::open(const char *path) {
+    return this->device->open(path);
+}
+
+int ChecksumBlockDevice::create(const char *path) {
+    return this->device->create(path);
+}
+
+int ChecksumBlockDevice::close() {
+    int ret;
+    {
+        std::lock_guard<std::mutex> lock(this->sumMutex);
+        ret = writeDirty();
+    }
+    int closeRet = this->device->close();
+    return ret < 0 ? ret : closeRet;
+}
+
+int ChecksumBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov = {buffer, (size_t) count * this->blockSize};
+    return readBlocks(firstBlockNo, &iov, 1);
+}
+
+int ChecksumBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov = {buffer, (size_t) count * this->blockSize};
+    return writeBlocks(firstBlockNo, &iov, 1);
+}
+
+int ChecksumBlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    int ret = this->device->readBlocks(firstBlockNo, iov, iovcnt);
+    if (ret < 0)
+        return ret;
+    return verify(firstBlockNo, iov, iovcnt);
+}
+
+int ChecksumBlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    std::vector<uint32_t> written;
+    computeSums(iov, iovcnt, written);
+
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    int ret = this->device->writeBlocks(firstBlockNo, iov, iovcnt);
+    if (ret < 0)
+        return ret;
+    for (uint32_t i = 0; i < written.size(); i++)
+        setSum(firstBlockNo + i, written[i]);
+    return 0;
+}
+
+int ChecksumBlockDevice::grow(uint32_t blockCount) {
+    return this->device->grow(blockCount);
+}
+
+int ChecksumBlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    int ret = this->device->discard(firstBlockNo, count);
+    if (ret < 0)
+        return ret;
+    // discarded blocks read as zeros
+    for (uint32_t i = 0; i < count; i++)
+        setSum(firstBlockNo + i, this->zeroSum);
+    return 0;
+}
+
+int ChecksumBlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    return this->device->findHoles(firstBlockNo, count, holes);
+}
+
+int ChecksumBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    int ret;
+    {
+        std::lock_guard<std::mutex> lock(this->sumMutex);
+        ret = writeDirty();
+    }
+    if (ret < 0)
+        return ret;
+    // the checksums are outside the range of blocks to flush
+    if (count > 0 && this->regionBlocks > 0)
+        return this->device->flush(0, 0, wait);
+    return this->device->flush(firstBlockNo, count, wait);
+}
+
+// queue a request under an own tag that finds it again on completion, sumMutex is held
+int ChecksumBlockDevice::queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt,
+                                      uint64_t tag) {
+    uint32_t index;
+    if (this->freePending.empty()) {
+        index = (uint32_t) this->pending.size();
+        this->pending.emplace_back();
+    } else {
+        index = this->freePending.back();
+        this->freePending.pop_back();
+    }
+    Pending &p = this->pending[index];
+    p.isWrite = isWrite;
+    p.firstBlockNo = firstBlockNo;
+    p.tag = tag;
+    p.iov.assign(iov, iov + iovcnt);
+    if (isWrite)
+        computeSums(iov, iovcnt, p.sums);
+
+    int ret = isWrite ? this->device->queueWrite(firstBlockNo, iov, iovcnt, index)
+                      : this->device->queueRead(firstBlockNo, iov, iovcnt, index);
+    if (ret < 0) {
+        this->freePending.push_back(index);
+        return ret;
+    }
+    this->pendingCount++;
+    return 0;
+}
+
+// apply the result of a queued request to the checksums, sumMutex is held
+int ChecksumBlockDevice::finish(Pending &p, int result) {
+    if (result < 0)
+        return result;
+    if (!p.isWrite)
+        return verify(p.firstBlockNo, p.iov.data(), (int) p.iov.size());
+    for (uint32_t i = 0; i < p.sums.size(); i++)
+        setSum(p.firstBlockNo + i, p.sums[i]);
+    return 0;
+}
+
+int ChecksumBlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    return queueRequest(false, firstBlockNo, iov, iovcnt, tag);
+}
+
+int ChecksumBlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    return queueRequest(true, firstBlockNo, iov, iovcnt, tag);
+}
+
+int ChecksumBlockDevice::submit() {
+    return this->device->submit();
+}
+
+int ChecksumBlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    int n = this->device->complete(done, maxDone, wait);
+    for (int i = 0; i < n; i++) {
+        uint32_t index = (uint32_t) done[i].tag;
+        Pending &p = this->pending[index];
+        done[i].result = finish(p, done[i].result);
+        done[i].tag = p.tag;
+        this->freePending.push_back(index);
+        this->pendingCount--;
+    }
+    return n;
+}
+
+int ChecksumBlockDevice::drain() {
+    std::lock_guard<std::mutex> lock(this->sumMutex);
+    // the completions are needed for the checksums, so collect them instead of letting the device discard them
+    int ret = this->device->submit();
+    BlockCompletion done[64];
+    while (this->pendingCount > 0) {
+        int n = this->device->complete(done, 64, true);
+        if (n <= 0) {
+            if (ret == 0)
+                ret = n < 0 ? n : -EIO;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            uint32_t index = (uint32_t) done[i].tag;
+            int result = finish(this->pending[index], done[i].result);
+            if (ret == 0 && result < 0)
+                ret = result;
+            this->freePending.push_back(index);
+            this->pendingCount--;
+        }
+    }
+    int drainRet = this->device->drain();
+    return ret < 0 ? ret : drainRet;
+}
+
+BlockDeviceStats ChecksumBlockDevice::getStats() {
+    return this->device->getStats();
+}
+
+void ChecksumBlockDevice::resetStats() {
+    if (this->device != nullptr)
+        this->device->resetStats();
+}
@@ -0,0 +1,258 @@
+//
+//  compositeblockdevice.cpp
+//  myfs
+//
+
+#include <errno.h>
+
+#include "compositeblockdevice.h"
+
+CompositeBlockDevice::CompositeBlockDevice(const std::vector<BlockDevice *> &members,
+                                           const std::vector<std::string> &paths)
+        : BlockDevice(members[0]->getBlockSize()) {
+    this->members = members;
+    this->paths = paths;
+    this->outstanding.assign(members.size(), 0);
+    this->asyncPending = 0;
+}
+
+CompositeBlockDevice::~CompositeBlockDevice() {
+    for (BlockDevice *member : this->members)
+        delete member;
+}
+
+uint32_t CompositeBlockDevice::getMemberCount() {
+    return (uint32_t) this->members.size();
+}
+
+BlockDevice *CompositeBlockDevice::getMember(uint32_t member) {
+    return this->members[member];
+}
+
+int CompositeBlockDevice::open(const char *path) {
+    for (size_t m = 0; m < this->members.size(); m++) {
+        int ret = this->members[m]->open(this->paths[m].c_str());
+        if (ret < 0) {
+            while (m-- > 0)
+                this->members[m]->close();
+            return ret;
+        }
+    }
+    this->directIO = this->members[0]->isDirectIO();
+    return 0;
+}
+
+int CompositeBlockDevice::create(const char *path) {
+    for (size_t m = 0; m < this->members.size(); m++) {
+        int ret = this->members[m]->create(this->paths[m].c_str());
+        if (ret < 0) {
+            while (m-- > 0)
+                this->members[m]->close();
+            return ret;
+        }
+    }
+    this->directIO = this->members[0]->isDirectIO();
+    return 0;
+}
+
+int CompositeBlockDevice::close() {
+    int ret = drain();
+    for (BlockDevice *member : this->members) {
+        int closeRet = member->close();
+        if (ret == 0)
+            ret = closeRet;
+    }
+    return ret;
+}
+
+// Set up a request and queue its parts. Returns the index of the request or -ERRNO.
+int CompositeBlockDevice::queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt,
+                                       uint64_t tag, bool sync) {
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (size % this->blockSize != 0)
+        return -EINVAL;
+
+    if (this->freeRequests.empty()) {
+        this->freeRequests.push_back((uint32_t) this->requests.size());
+        this->requests.emplace_back();
+    }
+    uint32_t index = this->freeRequests.back();
+    this->freeRequests.pop_back();
+    Request &r = this->requests[index];
+    r.sync = sync;
+    r.finished = false;
+    r.isWrite = isWrite;
+    r.firstBlockNo = firstBlockNo;
+    r.pos = (off_t) firstBlockNo * this->blockSize;
+    r.size = size;
+    r.tag = tag;
+    r.start = clockNs();
+    r.cause = cause;
+    r.pending = 0;
+    r.result = 0;
+    r.tried = 0;
+    r.succeeded = 0;
+    r.iov.clear();
+    if (!sync)
+        this->asyncPending++;
+
+    queueParts(index, iov, iovcnt);
+    if (this->requests[index].pending == 0)
+        finishRequest(index);
+    return (int) index;
+}
+
+// queue one part of a request on a member
+int CompositeBlockDevice::queuePart(uint32_t index, uint32_t member, uint32_t blockNo, const struct iovec *iov,
+                                    int iovcnt) {
+    Request &r = this->requests[index];
+    r.tried |= 1u << member;
+    int ret = r.isWrite ? this->members[member]->queueWrite(blockNo, iov, iovcnt, index)
+                        : this->members[member]->queueRead(blockNo, iov, iovcnt, index);
+    if (ret < 0) {
+        if (r.result == 0)
+            r.result = ret;
+        return ret;
+    }
+    r.pending++;
+    this->outstanding[member]++;
+    return 0;
+}
+
+void CompositeBlockDevice::partDone(uint32_t member, uint32_t index, int result) {
+    Request &r = this->requests[index];
+    if (result < 0 && r.result == 0)
+        r.result = result;
+    else if (result == 0)
+        r.succeeded++;
+    if (--r.pending == 0)
+        finishRequest(index);
+}
+
+// all parts of a request are done: count it and report its completion
+void CompositeBlockDevice::finishRequest(uint32_t index) {
+    Request &r = this->requests[index];
+    if (r.result == 0)
+        record(r.isWrite ? BD_OP_WRITE : BD_OP_READ, r.pos, r.size, r.start, r.cause);
+    if (r.sync) {
+        r.finished = true;  // released by waitFor()
+        return;
+    }
+    BlockCompletion c;
+    c.tag = r.tag;
+    c.result = r.result;
+    this->completions.push_back(c);
+    this->asyncPending--;
+    this->freeRequests.push_back(index);
+}
+
+int CompositeBlockDevice::submitMembers() {
+    int submitted = 0;
+    for (BlockDevice *member : this->members) {
+        int ret = member->submit();
+        if (ret < 0)
+            return ret;
+        submitted += ret;
+    }
+    return submitted;
+}
+
+// Collect the finished parts from the members. With wait, block until at least one part is finished if any is
+// outstanding. Returns the number of parts collected or -ERRNO.
+int CompositeBlockDevice::collect(bool wait) {
+    BlockCompletion done[16];
+    int collected = 0;
+    for (int pass = 0; pass < 2 && collected == 0; pass++) {
+        bool blocking = pass == 1;
+        if (blocking && !wait)
+            break;
+        for (uint32_t m = 0; m < this->members.size(); m++) {
+            if (this->outstanding[m] == 0)
+                continue;
+            int n = this->members[m]->complete(done, 16, blocking);
+            if (n < 0)
+                return n;
+            for (int k = 0; k < n; k++) {
+                this->outstanding[m]--;
+                partDone(m, (uint32_t) done[k].tag, done[k].result);
+            }
+            collected += n;
+            if (blocking && collected > 0)
+                break;      // any member may have finished in the meantime, poll them again
+        }
+    }
+    return collected;
+}
+
+// wait for a request of readBlocks()/writeBlocks() and release it
+int CompositeBlockDevice::waitFor(uint32_t index) {
+    int ret = submitMembers();
+    while (ret >= 0 && !this->requests[index].finished)
+        ret = collect(true);
+    if (ret < 0)
+        return ret;
+    ret = this->requests[index].result;
+    this->freeRequests.push_back(index);
+    return ret;
+}
+
+int CompositeBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) count * this->blockSize;
+    return readBlocks(firstBlockNo, &iov, 1);
+}
+
+int CompositeBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = (size_t) count * this->blockSize;
+    return writeBlocks(firstBlockNo, &iov, 1);
+}
+
+int CompositeBlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    int index = queueRequest(false, firstBlockNo, iov, iovcnt, 0, true);
+    if (index < 0)
+        return index;
+    return waitFor((uint32_t) index);
+}
+
+int CompositeBlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    int index = queueRequest(true, firstBlockNo, iov, iovcnt, 0, true);
+    if (index < 0)
+        return index;
+    return waitFor((uint32_t) index);
+}
+
+int CompositeBlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    int index = queueRequest(false, firstBlockNo, iov, iovcnt, tag, false);
+    return index < 0 ? index : 0;
+}
+
+int CompositeBlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    int index = queueRequest(true, firstBlockNo, iov, iovcnt, tag, false);
+    return index < 0 ? index : 0;
+}
+
+int CompositeBlockDevice::submit() {
+    return submitMembers();
+}
+
+int CompositeBlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    int ret = collect(false);
+    while (ret >= 0 && wait && this->completions.empty() && this->asyncPending > 0)
+        ret = collect(true);
+    if (ret < 0)
+        return ret;
+    return BlockDevice::complete(done, maxDone, wait);
+}
+
+int CompositeBlockDevice::drain() {
+    int ret = submitMembers();
+    while (ret >= 0 && this->asyncPending > 0)
+        ret = collect(true);
+    int drained = BlockDevice::drain();
+    return ret < 0 ? ret : drained;
+}
@@ -0,0 +1,242 @@
+//
+//  crc32c.cpp
+//  myfs
+//
+
+#include <cstring>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__GNUC__) && defined(__linux__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_CRC32C_ARMV8
+#endif
+
+#define CRC32C_POLY 0x82f63b78      // reversed Castagnoli polynomial
+
+// tables for processing 8 bytes per step ("slicing-by-8"), table[0] is the classic byte-wise table
+static uint32_t crcTable[8][256];
+
+static void initTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crcTable[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++)
+            crcTable[t][i] = (crcTable[t - 1][i] >> 8) ^ crcTable[0][crcTable[t - 1][i] & 0xff];
+    }
+}
+
+
+uint32_t crc32cSoftware(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+    while (size > 0 && ((uintptr_t) p & 7) != 0) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+        size--;
+    }
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);    // little endian, as on all hosts we run on
+        word ^= crc;
+        crc = crcTable[7][word & 0xff] ^ crcTable[6][(word >> 8) & 0xff] ^ crcTable[5][(word >> 16) & 0xff] ^
+              crcTable[4][(word >> 24) & 0xff] ^ crcTable[3][(word >> 32) & 0xff] ^
+              crcTable[2][(word >> 40) & 0xff] ^ crcTable[1][(word >> 48) & 0xff] ^ crcTable[0][word >> 56];
+        p += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+        size--;
+    }
+    return ~crc;
+}
+
+// Shifting a checksum over runs of zeros, used to combine the checksums of three interleaved streams. The CRC32
+// instructions take 3 cycles but can start one per cycle, so three independent streams run three times as fast as one.
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+static uint32_t crcLong[4][256];    // shift by CRC32C_LONG zero bytes
+static uint32_t crcShort[4][256];   // shift by CRC32C_SHORT zero bytes
+
+// multiply a vector by a matrix over GF(2)
+static uint32_t gf2Times(const uint32_t *mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2Square(uint32_t *square, const uint32_t *mat) {
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2Times(mat, mat[n]);
+}
+
+// the operator appending len zero bytes to a checksum, len a power of two
+static void zerosOperator(uint32_t *even, size_t len) {
+    uint32_t odd[32];
+    odd[0] = CRC32C_POLY;       // one zero bit
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2Square(even, odd);       // two zero bits
+    gf2Square(odd, even);       // four zero bits, then one byte, two bytes, ...
+    do {
+        gf2Square(even, odd);
+        len >>= 1;
+        if (len == 0)
+            return;
+        gf2Square(odd, even);
+        len >>= 1;
+    } while (len);
+    memcpy(even, odd, sizeof(odd));
+}
+
+static void zerosTable(uint32_t zeros[4][256], size_t len) {
+    uint32_t op[32];
+    zerosOperator(op, len);
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2Times(op, n);
+        zeros[1][n] = gf2Times(op, n << 8);
+        zeros[2][n] = gf2Times(op, n << 16);
+        zeros[3][n] = gf2Times(op, n << 24);
+    }
+}
+
+static uint32_t shift(uint32_t zeros[4][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+#if defined(HAVE_CRC32C_SSE42)
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    uint64_t c0 = ~crc;
+    while (size > 0 && ((uintptr_t) p & 7) != 0) {
+        c0 = _mm_crc32_u8((uint32_t) c0, *p++);
+        size--;
+    }
+    size_t lengths[2] = { CRC32C_LONG, CRC32C_SHORT };
+    for (int l = 0; l < 2; l++) {
+        size_t len = lengths[l];
+        while (size >= 3 * len) {
+            uint64_t c1 = 0;
+            uint64_t c2 = 0;
+            const unsigned char *end = p + len;
+            do {
+                c0 = _mm_crc32_u64(c0, *(const uint64_t *) p);
+                c1 = _mm_crc32_u64(c1, *(const uint64_t *) (p + len));
+                c2 = _mm_crc32_u64(c2, *(const uint64_t *) (p + 2 * len));
+                p += 8;
+            } while (p < end);
+            c0 = shift(l == 0 ? crcLong : crcShort, (uint32_t) c0) ^ (uint32_t) c1;
+            c0 = shift(l == 0 ? crcLong : crcShort, (uint32_t) c0) ^ (uint32_t) c2;
+            p += 2 * len;
+            size -= 3 * len;
+        }
+    }
+    while (size >= 8) {
+        c0 = _mm_crc32_u64(c0, *(const uint64_t *) p);
+        p += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        c0 = _mm_crc32_u8((uint32_t) c0, *p++);
+        size--;
+    }
+    return ~(uint32_t) c0;
+}
+
+static bool detectHw() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(HAVE_CRC32C_ARMV8)
+
+__attribute__((target("+crc")))
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *) data;
+    uint32_t c0 = ~crc;
+    while (size > 0 && ((uintptr_t) p & 7) != 0) {
+        c0 = __crc32cb(c0, *p++);
+        size--;
+    }
+    size_t lengths[2] = { CRC32C_LONG, CRC32C_SHORT };
+    for (int l = 0; l < 2; l++) {
+        size_t len = lengths[l];
+        while (size >= 3 * len) {
+            uint32_t c1 = 0;
+            uint32_t c2 = 0;
+            const unsigned char *end = p + len;
+            do {
+                c0 = __crc32cd(c0, *(const uint64_t *) p);
+                c1 = __crc32cd(c1, *(const uint64_t *) (p + len));
+                c2 = __crc32cd(c2, *(const uint64_t *) (p + 2 * len));
+                p += 8;
+            } while (p < end);
+            c0 = shift(l == 0 ? crcLong : crcShort, c0) ^ c1;
+            c0 = shift(l == 0 ? crcLong : crcShort, c0) ^ c2;
+            p += 2 * len;
+            size -= 3 * len;
+        }
+    }
+    while (size >= 8) {
+        c0 = __crc32cd(c0, *(const uint64_t *) p);
+        p += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        c0 = __crc32cb(c0, *p++);
+        size--;
+    }
+    return ~c0;
+}
+
+static bool detectHw() {
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+static uint32_t crc32cHw(uint32_t crc, const void *data, size_t size) {
+    return crc32cSoftware(crc, data, size);
+}
+
+static bool detectHw() {
+    return false;
+}
+
+#endif
+
+static bool init() {
+    initTable();
+    zerosTable(crcLong, CRC32C_LONG);
+    zerosTable(crcShort, CRC32C_SHORT);
+    return detectHw();
+}
+
+static const bool hwAvailable = init();
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+    return hwAvailable ? crc32cHw(crc, data, size) : crc32cSoftware(crc, data, size);
+}
+
+bool crc32cHardware() {
+    return hwAvailable;
+}
@@ -0,0 +1,72 @@
+//
+//  dentrycache.cpp
+//  myfs
+//
+
+#include <utility>
+
+#include "dentrycache.h"
+
+DentryCache::DentryCache(size_t capacity) {
+    this->capacity = capacity > 0 ? capacity : 1;
+    this->stats = DentryCacheStats();
+}
+
+std::string DentryCache::makeKey(int parent, const char *name) {
+    std::string key((const char *) &parent, sizeof(parent));
+    key.append(name);
+    return key;
+}
+
+bool DentryCache::lookup(int parent, const char *name, int *slot, bool *isDir) {
+    auto it = this->entries.find(makeKey(parent, name));
+    if (it == this->entries.end()) {
+        this->stats.misses++;
+        return false;
+    }
+    this->lru.splice(this->lru.begin(), this->lru, it->second);
+    *slot = it->second->slot;
+    *isDir = it->second->isDir;
+    if (*slot < 0)
+        this->stats.negativeHits++;
+    else
+        this->stats.hits++;
+    return true;
+}
+
+void DentryCache::insert(int parent, const char *name, int slot, bool isDir) {
+    std::string key = makeKey(parent, name);
+    auto it = this->entries.find(key);
+    if (it != this->entries.end()) {
+        it->second->slot = slot;
+        it->second->isDir = isDir;
+        this->lru.splice(this->lru.begin(), this->lru, it->second);
+        return;
+    }
+    if (this->entries.size() >= this->capacity) {
+        this->entries.erase(this->lru.back().key);
+        this->lru.pop_back();
+        this->stats.evictions++;
+    }
+    this->lru.push_front(Dentry{key, slot, isDir});
+    this->entries.emplace(std::move(key), this->lru.begin());
+}
+
+void DentryCache::remove(int parent, const char *name) {
+    auto it = this->entries.find(makeKey(parent, name));
+    if (it != this->entries.end()) {
+        this->lru.erase(it->second);
+        this->entries.erase(it);
+    }
+}
+
+void DentryCache::clear() {
+    this->lru.clear();
+    this->entries.clear();
+}
+
+DentryCacheStats DentryCache::getStats() const {
+    DentryCacheStats s = this->stats;
+    s.resident = (uint32_t) this->entries.size();
+    return s;
+}
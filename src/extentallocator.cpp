@@ -0,0 +1,117 @@
+//
+//  extentallocator.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <iterator>
+
+#include "extentallocator.h"
+
+// first block at or after from whose bit equals set, blocks if there is none
+static int nextBit(const uint64_t *bitmap, int blocks, int from, bool set) {
+    for (int w = from / 64; w * 64 < blocks; w++) {
+        uint64_t bits = set ? bitmap[w] : ~bitmap[w];
+        if (w == from / 64) {
+            bits &= ~(uint64_t) 0 << (from % 64);
+        }
+        if (bits != 0) {
+            return std::min(blocks, w * 64 + __builtin_ctzll(bits));
+        }
+    }
+    return blocks;
+}
+
+ExtentAllocator::ExtentAllocator() {
+    this->freeCount = 0;
+}
+
+void ExtentAllocator::add(int start, int length) {
+    this->byStart[start] = length;
+    this->bySize.insert(std::make_pair(length, start));
+    this->freeCount += length;
+}
+
+void ExtentAllocator::erase(std::map<int, int>::iterator it) {
+    this->bySize.erase(std::make_pair(it->second, it->first));
+    this->freeCount -= it->second;
+    this->byStart.erase(it);
+}
+
+void ExtentAllocator::rebuild(const uint64_t *bitmap, int blocks) {
+    this->byStart.clear();
+    this->bySize.clear();
+    this->freeCount = 0;
+    int start = nextBit(bitmap, blocks, 0, false);
+    while (start < blocks) {
+        int end = nextBit(bitmap, blocks, start, true);
+        add(start, end - start);
+        start = nextBit(bitmap, blocks, end, false);
+    }
+}
+
+void ExtentAllocator::reserve(int start, int count) {
+    int end = start + count;
+    auto it = this->byStart.upper_bound(start);
+    if (it != this->byStart.begin() && std::prev(it)->first + std::prev(it)->second > start) {
+        it--; // the extent start lies in
+    }
+    while (it != this->byStart.end() && it->first < end) {
+        int extentStart = it->first;
+        int extentEnd = it->first + it->second;
+        erase(it++);
+        if (extentStart < start) {
+            add(extentStart, start - extentStart);
+        }
+        if (extentEnd > end) {
+            add(end, extentEnd - end);
+        }
+    }
+}
+
+void ExtentAllocator::release(int start, int count) {
+    int end = start + count;
+    auto next = this->byStart.lower_bound(start);
+    if (next != this->byStart.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == start) { // merge with the extent before
+            start = prev->first;
+            erase(prev);
+        }
+    }
+    if (next != this->byStart.end() && next->first == end) { // merge with the extent behind
+        end += next->second;
+        erase(next);
+    }
+    add(start, end - start);
+}
+
+int ExtentAllocator::find(int preferred, int want, int *count) const {
+    if (preferred >= 0) {
+        auto it = this->byStart.upper_bound(preferred);
+        if (it != this->byStart.begin() && std::prev(it)->first + std::prev(it)->second > preferred) {
+            it--;
+            *count = std::min(want, it->first + it->second - preferred);
+            return preferred;
+        }
+    }
+    if (this->bySize.empty()) {
+        return -1;
+    }
+    // the first of the largest extents
+    auto largest = this->bySize.lower_bound(std::make_pair(this->bySize.rbegin()->first, 0));
+    *count = std::min(want, largest->first);
+    return largest->second;
+}
+
+int64_t ExtentAllocator::freeBlocks() const {
+    return this->freeCount;
+}
+
+size_t ExtentAllocator::extents() const {
+    return this->byStart.size();
+}
+
+int ExtentAllocator::largest() const {
+    return this->bySize.empty() ? 0 : this->bySize.rbegin()->first;
+}
@@ -0,0 +1,60 @@
+//
+//  extentmap.cpp
+//  myfs
+//
+
+#include <algorithm>
+
+#include "extentmap.h"
+
+void ExtentMap::append(int physical, int count) {
+    if (count <= 0) {
+        return;
+    }
+    if (!this->extents.empty()) {
+        Extent &tail = this->extents.back();
+        if (tail.physical + tail.length == physical) { // continues the last run
+            tail.length += count;
+            return;
+        }
+    }
+    this->extents.push_back(Extent{blocks(), physical, count});
+}
+
+int ExtentMap::lookup(int logical, int *run) const {
+    if (logical < 0 || logical >= blocks()) {
+        return -1;
+    }
+    // the last run starting at or before logical
+    auto it = std::upper_bound(this->extents.begin(), this->extents.end(), logical,
+                               [](int l, const Extent &e) { return l < e.logical; });
+    it--;
+    *run = it->logical + it->length - logical;
+    return it->physical + (logical - it->logical);
+}
+
+void ExtentMap::truncate(int blocks) {
+    while (!this->extents.empty() && this->extents.back().logical >= blocks) {
+        this->extents.pop_back();
+    }
+    if (!this->extents.empty()) {
+        Extent &tail = this->extents.back();
+        tail.length = std::min(tail.length, blocks - tail.logical);
+    }
+}
+
+void ExtentMap::clear() {
+    this->extents.clear();
+}
+
+int ExtentMap::blocks() const {
+    return this->extents.empty() ? 0 : this->extents.back().logical + this->extents.back().length;
+}
+
+int ExtentMap::last() const {
+    return this->extents.empty() ? -1 : this->extents.back().physical + this->extents.back().length - 1;
+}
+
+size_t ExtentMap::size() const {
+    return this->extents.size();
+}
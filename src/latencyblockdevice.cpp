@@ -0,0 +1,310 @@
+//
+//  latencyblockdevice.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <time.h>
+
+#include "latencyblockdevice.h"
+
+LatencyBlockDevice::LatencyBlockDevice(BlockDevice *device, const LatencyModel &model)
+        : BlockDevice(device->getBlockSize()), random(model.seed) {
+    this->device = device;
+    this->model = model;
+    this->busyUntilNs = 0;
+    this->headPos = 0;
+    this->delayNs = 0;
+    this->pendingCount = 0;
+}
+
+LatencyBlockDevice::~LatencyBlockDevice() {
+    delete this->device;
+}
+
+LatencyModel LatencyBlockDevice::getDefaultModel(LatencyKind kind) {
+    LatencyModel model = {};
+    model.kind = kind;
+    model.seed = 1;
+    switch (kind) {
+        case LATENCY_HDD:
+            model.seekMinNs = 500000;
+            model.seekMaxNs = 15000000;
+            model.strokeBytes = 1ULL << 40;
+            model.rotationNs = 8333333;     // 7200 rpm
+            model.bytesPerSec = 150000000;
+            break;
+        case LATENCY_SSD:
+            model.serviceNs = 80000;
+            model.jitterNs = 20000;
+            model.bytesPerSec = 500000000;
+            break;
+        case LATENCY_NETWORK:
+            model.serviceNs = 500000;
+            model.jitterNs = 200000;
+            model.bytesPerSec = 125000000;  // 1 Gbit/s
+            break;
+    }
+    return model;
+}
+
+uint64_t LatencyBlockDevice::getDelayNs() {
+    std::lock_guard<std::mutex> lock(this->modelMutex);
+    return this->delayNs;
+}
+
+// enter a request into the timeline of the modelled device, return the time it finishes
+uint64_t LatencyBlockDevice::schedule(uint32_t firstBlockNo, uint64_t bytes, uint64_t nowNs) {
+    std::lock_guard<std::mutex> lock(this->modelMutex);
+    uint64_t startNs = nowNs > this->busyUntilNs ? nowNs : this->busyUntilNs;
+    uint64_t busyNs = this->model.bytesPerSec > 0 ? bytes * 1000000000ULL / this->model.bytesPerSec : 0;
+    uint64_t afterNs = 0;
+    std::uniform_real_distribution<double> fraction(0.0, 1.0);
+    uint64_t pos = (uint64_t) firstBlockNo * this->blockSize;
+    if (this->model.kind == LATENCY_HDD) {
+        uint64_t distance = pos > this->headPos ? pos - this->headPos : this->headPos - pos;
+        if (distance > 0) { // Suchzeit wächst mit der Wurzel der Entfernung, dann im Mittel eine halbe Umdrehung
+            double stroke = this->model.strokeBytes > 0 ? (double) this->model.strokeBytes : 1.0;
+            double part = distance < this->model.strokeBytes ? std::sqrt(distance / stroke) : 1.0;
+            busyNs += this->model.seekMinNs + (uint64_t) ((this->model.seekMaxNs - this->model.seekMinNs) * part);
+            busyNs += (uint64_t) (this->model.rotationNs * fraction(this->random));
+        }
+    } else {
+        afterNs = this->model.serviceNs + (uint64_t) (this->model.jitterNs * fraction(this->random));
+    }
+    this->headPos = pos + bytes;
+    this->busyUntilNs = startNs + busyNs;
+    this->delayNs += this->busyUntilNs + afterNs - nowNs;
+    return this->busyUntilNs + afterNs;
+}
+
+void LatencyBlockDevice::waitUntil(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (ns / 1000000000ULL);
+    ts.tv_nsec = (long) (ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+// total length of the buffers in iov
+static uint64_t iovSize(const struct iovec *iov, int iovcnt) {
+    uint64_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    return size;
+}
+
+int LatencyBlockDevice::transfer(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    uint64_t startNs = clockNs();
+    uint64_t size = iovSize(iov, iovcnt);
+    uint64_t dueNs = schedule(firstBlockNo, size, startNs);
+    int ret = isWrite ? this->device->writeBlocks(firstBlockNo, iov, iovcnt)
+                      : this->device->readBlocks(firstBlockNo, iov, iovcnt);
+    waitUntil(dueNs);
+    if (ret == 0)
+        record(isWrite ? BD_OP_WRITE : BD_OP_READ, (off_t) firstBlockNo * this->blockSize, size, startNs, cause);
+    return ret;
+}
+
+int LatencyBlockDevice::open(const char *path) {
+    return this->device->open(path);
+}
+
+int LatencyBlockDevice::create(const char *path) {
+    return this->device->create(path);
+}
+
+int LatencyBlockDevice::close() {
+    return this->device->close();
+}
+
+int LatencyBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov = { buffer, (size_t) count * this->blockSize };
+    return transfer(false, firstBlockNo, &iov, 1);
+}
+
+int LatencyBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    struct iovec iov = { buffer, (size_t) count * this->blockSize };
+    return transfer(true, firstBlockNo, &iov, 1);
+}
+
+int LatencyBlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    return transfer(false, firstBlockNo, iov, iovcnt);
+}
+
+int LatencyBlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    return transfer(true, firstBlockNo, iov, iovcnt);
+}
+
+int LatencyBlockDevice::grow(uint32_t blockCount) {
+    return this->device->grow(blockCount);
+}
+
+int LatencyBlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    uint64_t startNs = clockNs();
+    int ret = this->device->discard(firstBlockNo, count);
+    if (ret == 0)
+        record(BD_OP_DISCARD, (off_t) firstBlockNo * this->blockSize, (size_t) count * this->blockSize, startNs,
+               cause);
+    return ret;
+}
+
+int LatencyBlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    return this->device->findHoles(firstBlockNo, count, holes);
+}
+
+// a flush that waits returns when the modelled device has finished all requests issued before
+int LatencyBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    uint64_t startNs = clockNs();
+    int ret = this->device->flush(firstBlockNo, count, wait);
+    if (!wait || ret < 0)
+        return ret;
+    uint64_t busyUntilNs;
+    {
+        std::lock_guard<std::mutex> lock(this->modelMutex);
+        busyUntilNs = this->busyUntilNs;
+    }
+    waitUntil(busyUntilNs);
+    record(BD_OP_FLUSH, 0, 0, startNs, cause);
+    return 0;
+}
+
+int LatencyBlockDevice::queueRequest(bool isWrite, uint32_t firstBlockNo, const struct iovec *iov, int iovcnt,
+                                     uint64_t tag) {
+    uint64_t startNs = clockNs();
+    uint64_t size = iovSize(iov, iovcnt);
+    std::lock_guard<std::mutex> lock(this->pendingMutex);
+    uint32_t index;
+    if (this->freePending.empty()) {
+        index = (uint32_t) this->pending.size();
+        this->pending.emplace_back();
+    } else {
+        index = this->freePending.back();
+        this->freePending.pop_back();
+    }
+    int ret = isWrite ? this->device->queueWrite(firstBlockNo, iov, iovcnt, index)
+                      : this->device->queueRead(firstBlockNo, iov, iovcnt, index);
+    if (ret < 0) {
+        this->freePending.push_back(index);
+        return ret;
+    }
+    Pending &p = this->pending[index];
+    p.tag = tag;
+    p.dueNs = schedule(firstBlockNo, size, startNs);
+    p.startNs = startNs;
+    p.isWrite = isWrite;
+    p.pos = (off_t) firstBlockNo * this->blockSize;
+    p.size = size;
+    p.cause = cause;
+    p.result = 0;
+    this->pendingCount++;
+    return 0;
+}
+
+int LatencyBlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    return queueRequest(false, firstBlockNo, iov, iovcnt, tag);
+}
+
+int LatencyBlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    return queueRequest(true, firstBlockNo, iov, iovcnt, tag);
+}
+
+int LatencyBlockDevice::submit() {
+    return this->device->submit();
+}
+
+// move requests the device has finished to the finished list, pendingMutex is held
+int LatencyBlockDevice::collect(bool wait) {
+    BlockCompletion done[64];
+    int n = this->device->complete(done, 64, wait);
+    for (int i = 0; i < n; i++) {
+        uint32_t index = (uint32_t) done[i].tag;
+        this->pending[index].result = done[i].result;
+        this->finished.push_back(index);
+        this->pendingCount--;
+    }
+    return n;
+}
+
+// count a finished request whose time has come and release its entry, pendingMutex is held
+void LatencyBlockDevice::deliver(uint32_t index) {
+    Pending &p = this->pending[index];
+    if (p.result == 0)
+        record(p.isWrite ? BD_OP_WRITE : BD_OP_READ, p.pos, p.size, p.startNs, p.cause);
+    this->freePending.push_back(index);
+}
+
+int LatencyBlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    std::unique_lock<std::mutex> lock(this->pendingMutex);
+    while (true) {
+        int ret = collect(false);
+        if (ret < 0)
+            return ret;
+
+        // fertige Requests, deren Zeit gekommen ist, melden
+        uint64_t nowNs = clockNs();
+        uint64_t nextNs = UINT64_MAX;
+        int n = 0;
+        for (size_t i = 0; i < this->finished.size() && n < maxDone;) {
+            uint32_t index = this->finished[i];
+            if (this->pending[index].dueNs <= nowNs) {
+                done[n].tag = this->pending[index].tag;
+                done[n].result = this->pending[index].result;
+                n++;
+                deliver(index);
+                this->finished[i] = this->finished.back();
+                this->finished.pop_back();
+            } else {
+                nextNs = std::min(nextNs, this->pending[index].dueNs);
+                i++;
+            }
+        }
+        if (n > 0 || !wait || (this->finished.empty() && this->pendingCount == 0))
+            return n;
+
+        if (this->finished.empty()) {
+            ret = collect(true);
+            if (ret < 0)
+                return ret;
+        } else {
+            lock.unlock();
+            waitUntil(nextNs);
+            lock.lock();
+        }
+    }
+}
+
+int LatencyBlockDevice::drain() {
+    std::lock_guard<std::mutex> lock(this->pendingMutex);
+    // the completions carry the times, so collect them instead of letting the device discard them
+    int ret = this->device->submit();
+    ret = ret < 0 ? ret : 0;
+    while (this->pendingCount > 0) {
+        int n = collect(true);
+        if (n <= 0) {
+            if (ret == 0)
+                ret = n < 0 ? n : -EIO;
+            break;
+        }
+    }
+    uint64_t lastNs = 0;
+    for (uint32_t index : this->finished)
+        lastNs = std::max(lastNs, this->pending[index].dueNs);
+    waitUntil(lastNs);
+    for (uint32_t index : this->finished) {
+        if (ret == 0 && this->pending[index].result < 0)
+            ret = this->pending[index].result;
+        deliver(index);
+    }
+    this->finished.clear();
+    int drainRet = this->device->drain();
+    return ret < 0 ? ret : drainRet;
+}
+
+void LatencyBlockDevice::resetStats() {
+    BlockDevice::resetStats();
+    if (this->device != nullptr)
+        this->device->resetStats();
+}
@@ -0,0 +1,190 @@
+//
+//  lz.cpp
+//  myfs
+//
+
+#include <cstdint>
+#include <cstring>
+#include <errno.h>
+
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_LOG 12
+#define LZ_LAST_LITERALS 5      // the format ends with literals, matches stop this far before the end
+#define LZ_MATCH_LIMIT 12       // no match starts in the last bytes
+
+static inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read64(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+// length continued in bytes of 255 after the 4 bits of the token
+static inline char *putLength(char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = (char) 255;
+        len -= 255;
+    }
+    *op++ = (char) len;
+    return op;
+}
+
+size_t lzCompress(const char *src, size_t srcSize, char *dst, size_t dstCapacity) {
+    const char *ip = src;
+    const char *anchor = src;
+    const char *end = src + srcSize;
+    char *op = dst;
+    char *opEnd = dst + dstCapacity;
+    uint32_t table[1 << LZ_HASH_LOG];   // position + 1 of the last occurrence of a hash, 0 for none
+    memset(table, 0, sizeof(table));
+
+    if (srcSize >= LZ_MATCH_LIMIT) {
+        const char *matchLimit = end - LZ_MATCH_LIMIT;
+        const char *lastMatchEnd = end - LZ_LAST_LITERALS;
+        uint32_t skip = 1 << 6;
+        while (ip <= matchLimit) {
+            uint32_t h = hash32(read32(ip));
+            const char *ref = table[h] > 0 ? src + table[h] - 1 : nullptr;
+            table[h] = (uint32_t) (ip - src) + 1;
+            if (ref == nullptr || ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+                ip += skip++ >> 6;  // incompressible stretches are crossed faster
+                continue;
+            }
+            skip = 1 << 6;
+
+            // extend the match backwards over pending literals and forwards as far as allowed
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const char *matchEnd = ip + LZ_MIN_MATCH;
+            const char *refEnd = ref + LZ_MIN_MATCH;
+            uint64_t diff = 0;
+            while (matchEnd + 8 <= lastMatchEnd) {  // eight bytes at a time, the lowest differing byte ends the match
+                diff = read64(matchEnd) ^ read64(refEnd);
+                if (diff != 0) {
+                    matchEnd += __builtin_ctzll(diff) >> 3;
+                    break;
+                }
+                matchEnd += 8;
+                refEnd += 8;
+            }
+            while (diff == 0 && matchEnd < lastMatchEnd && *matchEnd == *refEnd) {
+                matchEnd++;
+                refEnd++;
+            }
+
+            size_t literals = ip - anchor;
+            size_t matchLen = matchEnd - ip - LZ_MIN_MATCH;
+            if ((size_t) (opEnd - op) < 1 + literals + literals / 255 + 1 + 2 + matchLen / 255 + 1) {
+                return 0;
+            }
+            char *token = op++;
+            *token = (char) ((literals >= 15 ? 15 : literals) << 4);
+            if (literals >= 15) {
+                op = putLength(op, literals - 15);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+            uint16_t offset = (uint16_t) (ip - ref);
+            *op++ = (char) (offset & 0xff);
+            *op++ = (char) (offset >> 8);
+            *token |= (char) (matchLen >= 15 ? 15 : matchLen);
+            if (matchLen >= 15) {
+                op = putLength(op, matchLen - 15);
+            }
+
+            ip = matchEnd;
+            anchor = ip;
+            if (ip - 2 >= src && ip - 2 <= matchLimit) {
+                table[hash32(read32(ip - 2))] = (uint32_t) (ip - 2 - src) + 1;
+            }
+        }
+    }
+
+    // the rest as literals
+    size_t literals = end - anchor;
+    if ((size_t) (opEnd - op) < 1 + literals + literals / 255 + 1) {
+        return 0;
+    }
+    *op++ = (char) ((literals >= 15 ? 15 : literals) << 4);
+    if (literals >= 15) {
+        op = putLength(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    return op - dst;
+}
+
+// read a length continued in bytes of 255, false if the input ends first
+static inline bool getLength(const uint8_t *&ip, const uint8_t *end, size_t &len) {
+    uint8_t b;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+int lzDecompress(const char *src, size_t srcSize, char *dst, size_t dstCapacity) {
+    const uint8_t *ip = (const uint8_t *) src;
+    const uint8_t *end = ip + srcSize;
+    char *op = dst;
+    char *opEnd = dst + dstCapacity;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(ip, end, literals)) {
+            return -EIO;
+        }
+        if ((size_t) (end - ip) < literals || (size_t) (opEnd - op) < literals) {
+            return -EIO;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end) { // the last sequence has no match
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -EIO;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !getLength(ip, end, matchLen)) {
+            return -EIO;
+        }
+        matchLen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || (size_t) (opEnd - op) < matchLen) {
+            return -EIO;
+        }
+        const char *ref = op - offset;
+        if (offset >= matchLen) {
+            memcpy(op, ref, matchLen);
+            op += matchLen;
+        } else { // overlapping copy repeats the last offset bytes
+            for (size_t i = 0; i < matchLen; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return (int) (op - dst);
+}
@@ -0,0 +1,192 @@
+//
+//  mappedblockdevice.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mappedblockdevice.h"
+
+MappedBlockDevice::MappedBlockDevice(uint32_t blockSize, uint32_t blockCount, uint32_t maxBlockCount)
+        : BlockDevice(blockSize) {
+    this->blockCount = blockCount;
+    this->maxBlockCount = maxBlockCount;
+    this->mapping = nullptr;
+    this->mappingSize = 0;
+    this->reservedSize = 0;
+}
+
+MappedBlockDevice::~MappedBlockDevice() {
+    unmapContainer();
+}
+
+int MappedBlockDevice::open(const char *path) {
+    int ret = BlockDevice::open(path);
+    if (ret >= 0)
+        mapContainer();
+    return ret;
+}
+
+int MappedBlockDevice::create(const char *path) {
+    int ret = BlockDevice::create(path);
+    if (ret >= 0)
+        mapContainer();
+    return ret;
+}
+
+int MappedBlockDevice::close() {
+    unmapContainer();
+    return BlockDevice::close();
+}
+
+// Map the container file, extending it to the device size first. The mapping is placed at the start of a reserved
+// range of address space, so it can grow without moving. On failure the device keeps working without the mapping.
+int MappedBlockDevice::mapContainer() {
+    size_t size = (size_t) this->blockCount * this->blockSize;
+    struct stat st;
+    if (fstat(this->contFile, &st) < 0)
+        return -errno;
+    if ((size_t) st.st_size < size && ftruncate(this->contFile, size) < 0)
+        return -errno;
+
+    size_t reserved = this->maxBlockCount > 0 ? (size_t) this->maxBlockCount * this->blockSize : MBD_DEFAULT_RESERVE;
+    if (reserved < size)
+        reserved = size;
+    void *r = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED)
+        return -errno;
+    void *p = mmap(r, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, this->contFile, 0);
+    if (p == MAP_FAILED) {
+        int ret = -errno;
+        munmap(r, reserved);
+        return ret;
+    }
+    this->mapping = (char *) p;
+    this->mappingSize = size;
+    this->reservedSize = reserved;
+    return 0;
+}
+
+void MappedBlockDevice::unmapContainer() {
+    if (this->mapping != nullptr) {
+        msync(this->mapping, this->mappingSize, MS_SYNC);
+        munmap(this->mapping, this->reservedSize);
+    }
+    this->mapping = nullptr;
+    this->mappingSize = 0;
+    this->reservedSize = 0;
+}
+
+// The new blocks are mapped behind the existing mapping, starting at the page holding the old end.
+int MappedBlockDevice::grow(uint32_t blockCount) {
+    int ret = BlockDevice::grow(blockCount);
+    if (ret < 0 || blockCount <= this->blockCount)
+        return ret;
+    size_t size = (size_t) blockCount * this->blockSize;
+    if (this->mapping != nullptr) {
+        if (size > this->reservedSize)
+            return -ENOSPC;
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+        size_t start = this->mappingSize - this->mappingSize % pageSize;
+        void *p = mmap(this->mapping + start, size - start, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                       this->contFile, start);
+        if (p == MAP_FAILED)
+            return -errno;
+        this->mappingSize = size;
+    }
+    this->blockCount = blockCount;
+    return 0;
+}
+
+bool MappedBlockDevice::isMapped(uint32_t firstBlockNo, size_t size) {
+    return this->mapping != nullptr && (size_t) firstBlockNo * this->blockSize + size <= this->mappingSize;
+}
+
+int MappedBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    size_t size = (size_t) count * this->blockSize;
+    if (!isMapped(firstBlockNo, size))
+        return BlockDevice::readBlocks(firstBlockNo, count, buffer);
+    uint64_t start = clockNs();
+    memcpy(buffer, this->mapping + (size_t) firstBlockNo * this->blockSize, size);
+    record(BD_OP_READ, (off_t) firstBlockNo * this->blockSize, size, start, cause);
+    return 0;
+}
+
+int MappedBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    size_t size = (size_t) count * this->blockSize;
+    if (!isMapped(firstBlockNo, size))
+        return BlockDevice::writeBlocks(firstBlockNo, count, buffer);
+    uint64_t start = clockNs();
+    memcpy(this->mapping + (size_t) firstBlockNo * this->blockSize, buffer, size);
+    record(BD_OP_WRITE, (off_t) firstBlockNo * this->blockSize, size, start, cause);
+    return 0;
+}
+
+int MappedBlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (size % this->blockSize != 0)
+        return -EINVAL;
+    if (!isMapped(firstBlockNo, size))
+        return BlockDevice::readBlocks(firstBlockNo, iov, iovcnt);
+
+    uint64_t start = clockNs();
+    char *p = this->mapping + (size_t) firstBlockNo * this->blockSize;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, p, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    record(BD_OP_READ, (off_t) firstBlockNo * this->blockSize, size, start, cause);
+    return 0;
+}
+
+int MappedBlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    size_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    if (size % this->blockSize != 0)
+        return -EINVAL;
+    if (!isMapped(firstBlockNo, size))
+        return BlockDevice::writeBlocks(firstBlockNo, iov, iovcnt);
+
+    uint64_t start = clockNs();
+    char *p = this->mapping + (size_t) firstBlockNo * this->blockSize;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    record(BD_OP_WRITE, (off_t) firstBlockNo * this->blockSize, size, start, cause);
+    return 0;
+}
+
+char *MappedBlockDevice::getBlockPointer(uint32_t firstBlockNo, uint32_t count) {
+    if (!isMapped(firstBlockNo, (size_t) count * this->blockSize))
+        return nullptr;
+    return this->mapping + (size_t) firstBlockNo * this->blockSize;
+}
+
+int MappedBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    if (this->mapping == nullptr)
+        return BlockDevice::flush(firstBlockNo, count, wait);
+
+    size_t start = (size_t) firstBlockNo * this->blockSize;
+    size_t end = count == 0 ? this->mappingSize : start + (size_t) count * this->blockSize;
+    if (end > this->mappingSize)
+        end = this->mappingSize;
+    if (start >= end)
+        return 0;
+
+    // msync() needs a page aligned start address
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    start -= start % pageSize;
+    uint64_t startNs = clockNs();
+    if (msync(this->mapping + start, end - start, wait ? MS_SYNC : MS_ASYNC) < 0)
+        return -errno;
+    record(BD_OP_FLUSH, (off_t) start, end - start, startNs, cause);
+    return 0;
+}
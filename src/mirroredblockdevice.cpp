@@ -0,0 +1,201 @@
+//
+//  mirroredblockdevice.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+
+#include "mirroredblockdevice.h"
+
+MirroredBlockDevice::MirroredBlockDevice(const std::vector<BlockDevice *> &members,
+                                         const std::vector<std::string> &paths) : CompositeBlockDevice(members, paths) {
+    this->replicaStats.resize(members.size());
+    this->lastPos.assign(members.size(), 0);
+    resetStats();
+}
+
+ReplicaStats MirroredBlockDevice::getReplicaStats(uint32_t member) {
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    return this->replicaStats[member];
+}
+
+void MirroredBlockDevice::resetStats() {
+    BlockDevice::resetStats();
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    for (ReplicaStats &s : this->replicaStats) {
+        bool failed = s.failed;
+        memset(&s, 0, sizeof(s));
+        s.failed = failed;
+    }
+}
+
+// The replica for a read: fewest requests in flight, then closest to the previous request. -EIO if every working
+// replica has been tried already.
+int MirroredBlockDevice::pickReplica(uint32_t index) {
+    Request &r = this->requests[index];
+    int best = -1;
+    off_t bestDistance = 0;
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        if (this->replicaStats[m].failed || (r.tried & (1u << m)) != 0)
+            continue;
+        off_t distance = this->lastPos[m] > r.pos ? this->lastPos[m] - r.pos : r.pos - this->lastPos[m];
+        if (best < 0 || this->outstanding[m] < this->outstanding[best] ||
+            (this->outstanding[m] == this->outstanding[best] && distance < bestDistance)) {
+            best = (int) m;
+            bestDistance = distance;
+        }
+    }
+    return best >= 0 ? best : -EIO;
+}
+
+// queue the request on a replica and account for it
+void MirroredBlockDevice::sendTo(uint32_t index, uint32_t member) {
+    Request &r = this->requests[index];
+    int ret = queuePart(index, member, r.firstBlockNo, r.iov.data(), (int) r.iov.size());
+    std::lock_guard<std::mutex> lock(this->statsMutex);
+    ReplicaStats &s = this->replicaStats[member];
+    if (ret < 0) {
+        if (r.isWrite) {
+            s.writeErrors++;
+            s.failed = true;
+        } else {
+            s.readErrors++;
+        }
+        return;
+    }
+    this->lastPos[member] = r.pos + (off_t) r.size;
+    if (r.isWrite)
+        s.writes++;
+    else
+        s.reads++;
+    s.queueDepthSum += this->outstanding[member];
+    if (this->outstanding[member] > s.queueDepthMax)
+        s.queueDepthMax = this->outstanding[member];
+}
+
+void MirroredBlockDevice::queueParts(uint32_t index, const struct iovec *iov, int iovcnt) {
+    Request &r = this->requests[index];
+    r.iov.assign(iov, iov + iovcnt);    // kept for retries
+    if (r.isWrite) {
+        for (uint32_t m = 0; m < this->members.size(); m++) {
+            if (!this->replicaStats[m].failed)
+                sendTo(index, m);
+        }
+        if (r.succeeded == 0 && r.pending == 0 && r.result == 0)
+            r.result = -EIO;    // no replica left
+        return;
+    }
+
+    // try the replicas until one accepts the read
+    while (r.pending == 0) {
+        int member = pickReplica(index);
+        if (member < 0) {
+            if (r.result == 0)
+                r.result = member;
+            return;
+        }
+        sendTo(index, (uint32_t) member);
+    }
+    r.result = 0;   // errors of replicas that did not accept the read
+}
+
+void MirroredBlockDevice::partDone(uint32_t member, uint32_t index, int result) {
+    Request &r = this->requests[index];
+    if (result < 0) {
+        std::lock_guard<std::mutex> lock(this->statsMutex);
+        if (r.isWrite) {
+            this->replicaStats[member].writeErrors++;
+            this->replicaStats[member].failed = true;
+        } else {
+            this->replicaStats[member].readErrors++;
+        }
+    }
+
+    if (!r.isWrite && result < 0) {
+        // retry on the next replica
+        int next = pickReplica(index);
+        while (next >= 0) {
+            sendTo(index, (uint32_t) next);
+            if (r.pending > 1) {
+                this->members[next]->submit();
+                r.pending--;    // the failed part
+                return;
+            }
+            next = pickReplica(index);
+        }
+    }
+
+    if (r.isWrite) {
+        // the write succeeds as long as one replica has stored it
+        if (result == 0)
+            r.succeeded++;
+        else if (r.result == 0)
+            r.result = result;
+        if (--r.pending == 0) {
+            if (r.succeeded > 0)
+                r.result = 0;
+            finishRequest(index);
+        }
+        return;
+    }
+    if (result == 0)
+        r.result = 0;   // errors of the replicas tried before
+    CompositeBlockDevice::partDone(member, index, result);
+}
+
+int MirroredBlockDevice::grow(uint32_t blockCount) {
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        if (this->replicaStats[m].failed)
+            continue;
+        int ret = this->members[m]->grow(blockCount);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int MirroredBlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    uint64_t start = clockNs();
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        if (this->replicaStats[m].failed)
+            continue;
+        int ret = this->members[m]->discard(firstBlockNo, count);
+        if (ret < 0)
+            return ret;
+    }
+    record(BD_OP_DISCARD, (off_t) firstBlockNo * this->blockSize, (size_t) count * this->blockSize, start, cause);
+    return 0;
+}
+
+int MirroredBlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    // blocks are holes only if they are holes on every replica
+    std::vector<bool> replicaHoles;
+    holes.assign(count, true);
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        if (this->replicaStats[m].failed)
+            continue;
+        int ret = this->members[m]->findHoles(firstBlockNo, count, replicaHoles);
+        if (ret < 0) {
+            holes.assign(count, false);
+            return ret;
+        }
+        for (uint32_t b = 0; b < count; b++)
+            holes[b] = holes[b] && replicaHoles[b];
+    }
+    return 0;
+}
+
+int MirroredBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    uint64_t start = clockNs();
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        if (this->replicaStats[m].failed)
+            continue;
+        int ret = this->members[m]->flush(firstBlockNo, count, wait);
+        if (ret < 0)
+            return ret;
+    }
+    if (wait)
+        record(BD_OP_FLUSH, 0, 0, start, cause);
+    return 0;
+}
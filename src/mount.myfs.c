@@ -21,22 +21,74 @@
 struct fuse_operations myfs_oper;
 
 struct myfs_config {
-    char *containerFileName;
+    char *containerFileNames[MAX_CONTAINER_FILES];
+    unsigned int containerFileCount;
+    unsigned int stripeSize;
+    int mirror;
+    int noChecksums;
+    int compress;
+    unsigned int chunkSize;
+    int dedup;
     char *logFileName;
+    unsigned int queueDepth;
+    int directIO;
+    int memoryMapped;
+    unsigned int cacheSize;
+    char *cachePolicy;
+    int writeBack;
+    unsigned int dirtyAge;
+    unsigned int dirtyLimit;
+    unsigned int readahead;
+    int noReadahead;
+    unsigned int blockSize;
+    unsigned int deviceSize;
+    unsigned int maxDeviceSize;
+    unsigned int growSize;
+    char *traceFileName;
+    char *latency;
+    unsigned int latencyUs;
+    unsigned int bandwidth;
+    unsigned int latencySeed;
 };
 enum {
     KEY_HELP,
     KEY_VERSION,
+    KEY_CONTAINER,
 };
 
 #define MYFS_OPT(t, p, v) { t, offsetof(struct myfs_config, p), v }
 
 static struct fuse_opt myfs_opts[] = {
-        MYFS_OPT("-c %s",             containerFileName, 0),
-        MYFS_OPT("containerfile=%s",  containerFileName, 0),
         MYFS_OPT("-l %s",             logFileName, 0),
         MYFS_OPT("logfile=%s",        logFileName, 0),
+        MYFS_OPT("queuedepth=%u",     queueDepth, 0),
+        MYFS_OPT("directio",          directIO, 1),
+        MYFS_OPT("mmap",              memoryMapped, 1),
+        MYFS_OPT("cachesize=%u",      cacheSize, 0),
+        MYFS_OPT("cachepolicy=%s",    cachePolicy, 0),
+        MYFS_OPT("writeback",         writeBack, 1),
+        MYFS_OPT("dirtyage=%u",       dirtyAge, 0),
+        MYFS_OPT("dirtylimit=%u",     dirtyLimit, 0),
+        MYFS_OPT("readahead=%u",      readahead, 0),
+        MYFS_OPT("noreadahead",       noReadahead, 1),
+        MYFS_OPT("blocksize=%u",      blockSize, 0),
+        MYFS_OPT("devicesize=%u",     deviceSize, 0),
+        MYFS_OPT("maxdevicesize=%u",  maxDeviceSize, 0),
+        MYFS_OPT("growsize=%u",       growSize, 0),
+        MYFS_OPT("trace=%s",          traceFileName, 0),
+        MYFS_OPT("stripesize=%u",     stripeSize, 0),
+        MYFS_OPT("mirror",            mirror, 1),
+        MYFS_OPT("nochecksums",       noChecksums, 1),
+        MYFS_OPT("compress",          compress, 1),
+        MYFS_OPT("dedup",             dedup, 1),
+        MYFS_OPT("chunksize=%u",      chunkSize, 0),
+        MYFS_OPT("latency=%s",        latency, 0),
+        MYFS_OPT("latencyus=%u",      latencyUs, 0),
+        MYFS_OPT("bandwidth=%u",      bandwidth, 0),
+        MYFS_OPT("latencyseed=%u",    latencySeed, 0),
 
+        FUSE_OPT_KEY("-c ",            KEY_CONTAINER),
+        FUSE_OPT_KEY("containerfile=", KEY_CONTAINER),
         FUSE_OPT_KEY("-V",             KEY_VERSION),
         FUSE_OPT_KEY("--version",      KEY_VERSION),
         FUSE_OPT_KEY("-h",             KEY_HELP),
@@ -46,7 +98,18 @@ static struct fuse_opt myfs_opts[] = {
 
 static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
 {
+    struct myfs_config *conf = data;
+
     switch (key) {
+        case KEY_CONTAINER:
+            // arg is "-cFILE" or "containerfile=FILE"
+            if (conf->containerFileCount == MAX_CONTAINER_FILES) {
+                fprintf(stderr, "Error: At most %d container files can be given\n", MAX_CONTAINER_FILES);
+                exit(EXIT_FAILURE);
+            }
+            conf->containerFileNames[conf->containerFileCount++] = strdup(arg[0] == '-' ? arg + 2 : strchr(arg, '=') + 1);
+            return 0;
+
         case KEY_HELP:
             fuse_opt_add_arg(outargs, "-h");
             fuse_main(outargs->argc, outargs->argv, &myfs_oper, NULL);
@@ -55,8 +118,34 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
                     "Myfs options:\n"
                     "    -o containerfile=FILE\n"
                     "    -c FILE            same as '-o containerfile=FILE'\n"
+                    "                       give several container files to stripe the blocks over them\n"
                     "    -o logfile=FILE\n"
-                    "    -l FILE            same as '-o logfile=FILE'\n");
+                    "    -l FILE            same as '-o logfile=FILE'\n"
+                    "    -o queuedepth=N    number of container requests in flight (default 32)\n"
+                    "    -o directio        open the container file with O_DIRECT\n"
+                    "    -o mmap            access the container file through a memory mapping\n"
+                    "    -o cachesize=N     number of blocks in the block cache (default 256)\n"
+                    "    -o cachepolicy=P   replacement policy of the block cache, lru or arc (default arc)\n"
+                    "    -o writeback       keep written blocks in the block cache and write them back later\n"
+                    "    -o dirtyage=MS     write back blocks dirty for more than MS milliseconds (default 5000)\n"
+                    "    -o dirtylimit=N    write back when more than N blocks are dirty (default half the cache)\n"
+                    "    -o readahead=N     read up to N blocks ahead of sequential reads (default 128)\n"
+                    "    -o noreadahead     do not read ahead\n"
+                    "    -o blocksize=N     block size of a new container, 512 to 65536 bytes (default 512)\n"
+                    "    -o devicesize=N    number of blocks of a new container (default 1024)\n"
+                    "    -o maxdevicesize=N let the container grow up to N blocks (default no limit)\n"
+                    "    -o growsize=N      grow the container by at least N blocks (default 4 MiB)\n"
+                    "    -o trace=FILE      record all requests to the container in FILE (see replay.myfs)\n"
+                    "    -o stripesize=N    blocks per stripe unit of new striped containers (default 64 KiB)\n"
+                    "    -o mirror          keep a copy of all blocks in each of several new container files\n"
+                    "    -o nochecksums     create the container without checksums of its blocks\n"
+                    "    -o compress        store file data of a new container compressed\n"
+                    "    -o chunksize=N     bytes compressed together with -o compress (default 64 KiB)\n"
+                    "    -o dedup           store identical data blocks of a new container only once\n"
+                    "    -o latency=M       delay requests to the container like storage M, hdd, ssd or net\n"
+                    "    -o latencyus=N     longest seek (hdd) or time per request (ssd, net) in microseconds\n"
+                    "    -o bandwidth=N     transfer rate of the emulated storage in MB/s\n"
+                    "    -o latencyseed=N   seed of the random parts of the emulated timing (default 1)\n");
             exit(1);
 
         case KEY_VERSION:
@@ -68,6 +157,41 @@ static int myfs_opt_proc(void *data, const char *arg, int key, struct fuse_args
     return 1;
 }
 
+// Resolve the path of a container file, which need not exist yet. Exits if it cannot be accessed.
+static char *resolveContainerFile(const char *name) {
+    char *containerFileName= realpath(name, NULL);
+
+    if(containerFileName == NULL) {
+        // container file does not exist, check if path is writable
+        char *containerFileNameCpy= malloc(strlen(name)+1);
+        strcpy(containerFileNameCpy, name);
+        char *dirName= dirname(containerFileNameCpy);
+        char *containerPathName= realpath(dirName, NULL);
+        // free(dirName);
+        if (containerPathName == NULL || access(containerPathName, R_OK | W_OK) != 0 ) {
+            fprintf(stderr, "Error: Cannot access container directory %s\n", containerPathName == NULL ? "" : containerPathName);
+            exit(EXIT_FAILURE);
+        }
+        containerFileName= (char *) malloc(PATH_MAX);
+        strcpy(containerFileNameCpy, name);
+        char *containerBaseName= basename(containerFileNameCpy);
+        strcpy(containerFileName, containerPathName);
+        strcat(containerFileName, "/");
+        strcat(containerFileName, containerBaseName);
+        // free(containerBaseName);
+        free(containerPathName);
+        free(containerFileNameCpy);
+    } else {
+        // container file does exit, check if it is writable
+        if (containerFileName == NULL || access(containerFileName, R_OK | W_OK) != 0 ) {
+            fprintf(stderr, "Error: Cannot access container file %s\n", containerFileName);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return containerFileName;
+}
+
 int main(int argc, char *argv[]) {
     int fuse_stat;
 
@@ -105,7 +229,9 @@ int main(int argc, char *argv[]) {
     myfs_oper.destroy = wrap_destroy;
 
     char* containerFileName= NULL;
+    char* containerFileNames[MAX_CONTAINER_FILES]= { NULL };
     char* logFileName= NULL;
+    char* traceFileName= NULL;
 
     // parse arguments
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
@@ -118,37 +244,13 @@ int main(int argc, char *argv[]) {
     // FsInfo will be used to pass information to fuse functions
     struct MyFsInfo *FsInfo;
     FsInfo= malloc(sizeof(struct MyFsInfo));
-    // check if container file is accessible
-    if(conf.containerFileName != NULL) {
-        containerFileName= realpath(conf.containerFileName, NULL);
-
-        if(containerFileName == NULL) {
-            // container file does not exist, check if path is writable
-            char *containerFileNameCpy= malloc(strlen(conf.containerFileName)+1);
-            strcpy(containerFileNameCpy, conf.containerFileName);
-            char *dirName= dirname(containerFileNameCpy);
-            char *containerPathName= realpath(dirName, NULL);
-            // free(dirName);
-            if (containerPathName == NULL || access(containerPathName, R_OK | W_OK) != 0 ) {
-                fprintf(stderr, "Error: Cannot access container directory %s\n", containerPathName == NULL ? "" : containerPathName);
-                exit(EXIT_FAILURE);
-            }
-            containerFileName= (char *) malloc(PATH_MAX);
-            strcpy(containerFileNameCpy, conf.containerFileName);
-            char *containerBaseName= basename(containerFileNameCpy);
-            strcpy(containerFileName, containerPathName);
-            strcat(containerFileName, "/");
-            strcat(containerFileName, containerBaseName);
-            // free(containerBaseName);
-            free(containerPathName);
-            free(containerFileNameCpy);
-        } else {
-            // container file does exit, check if it is writable
-            if (containerFileName == NULL || access(containerFileName, R_OK | W_OK) != 0 ) {
-                fprintf(stderr, "Error: Cannot access container file %s\n", containerFileName);
-                exit(EXIT_FAILURE);
-            }
+    // check if container files are accessible
+    if(conf.containerFileCount > 0) {
+        for (unsigned int i= 0; i < conf.containerFileCount; i++) {
+            containerFileNames[i]= resolveContainerFile(conf.containerFileNames[i]);
+            free(conf.containerFileNames[i]);
         }
+        containerFileName= containerFileNames[0];
 
         // container file is used, so we are not in memory!
         setInstance(1);
@@ -171,10 +273,78 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // check if trace file can be accessed
+    if (conf.traceFileName != NULL) {
+        FILE *traceFile = fopen(conf.traceFileName, "w+");
+
+        if (traceFile == NULL || (traceFileName = realpath(conf.traceFileName, NULL)) == NULL) {
+            fprintf(stderr, "Error: Cannot access trace file %s\n", conf.traceFileName);
+            exit(EXIT_FAILURE);
+        }
+
+        fclose(traceFile);
+    }
+
+    // check block cache options
+    if (conf.cachePolicy != NULL && strcmp(conf.cachePolicy, "lru") != 0 && strcmp(conf.cachePolicy, "arc") != 0) {
+        fprintf(stderr, "Error: Unknown cache policy %s (use lru or arc)\n", conf.cachePolicy);
+        exit(EXIT_FAILURE);
+    }
+
+    // check geometry options, they are used for new containers only
+    if (conf.blockSize != 0 && (conf.blockSize < 512 || conf.blockSize > 65536 ||
+                                (conf.blockSize & (conf.blockSize - 1)) != 0)) {
+        fprintf(stderr, "Error: Invalid block size %u (use a power of two from 512 to 65536)\n", conf.blockSize);
+        exit(EXIT_FAILURE);
+    }
+    if (conf.deviceSize != 0 && (conf.deviceSize < 64 || conf.deviceSize > INT_MAX)) {
+        fprintf(stderr, "Error: Invalid device size %u (use at least 64 blocks)\n", conf.deviceSize);
+        exit(EXIT_FAILURE);
+    }
+
+    // check latency emulation options
+    if (conf.latency != NULL && strcmp(conf.latency, "hdd") != 0 && strcmp(conf.latency, "ssd") != 0 &&
+        strcmp(conf.latency, "net") != 0) {
+        fprintf(stderr, "Error: Unknown storage model %s (use hdd, ssd or net)\n", conf.latency);
+        exit(EXIT_FAILURE);
+    }
+
+    if (conf.maxDeviceSize > INT_MAX || conf.growSize > INT_MAX) {
+        fprintf(stderr, "Error: Container sizes are limited to %d blocks\n", INT_MAX);
+        exit(EXIT_FAILURE);
+    }
+
     // everything ok, lets go
     // container & log file name will be passed to fuse functions
     FsInfo->contFile= containerFileName;
+    memcpy(FsInfo->contFiles, containerFileNames, sizeof(containerFileNames));
+    FsInfo->contFileCount= conf.containerFileCount;
+    FsInfo->stripeSize= conf.stripeSize;
+    FsInfo->mirror= conf.mirror;
+    FsInfo->noChecksums= conf.noChecksums;
+    FsInfo->compress= conf.compress;
+    FsInfo->chunkSize= conf.chunkSize;
+    FsInfo->dedup= conf.dedup;
     FsInfo->logFile= logFileName;
+    FsInfo->queueDepth= conf.queueDepth;
+    FsInfo->directIO= conf.directIO;
+    FsInfo->memoryMapped= conf.memoryMapped;
+    FsInfo->cacheSize= conf.cacheSize;
+    FsInfo->cachePolicy= conf.cachePolicy;
+    FsInfo->writeBack= conf.writeBack;
+    FsInfo->dirtyAge= conf.dirtyAge;
+    FsInfo->dirtyLimit= conf.dirtyLimit;
+    FsInfo->readahead= conf.readahead;
+    FsInfo->noReadahead= conf.noReadahead;
+    FsInfo->blockSize= conf.blockSize;
+    FsInfo->deviceSize= conf.deviceSize;
+    FsInfo->maxDeviceSize= conf.maxDeviceSize;
+    FsInfo->growSize= conf.growSize;
+    FsInfo->traceFile= traceFileName;
+    FsInfo->latency= conf.latency;
+    FsInfo->latencyUs= conf.latencyUs;
+    FsInfo->bandwidth= conf.bandwidth;
+    FsInfo->latencySeed= conf.latencySeed;
 
     // add additoinal "-s"
     fuse_opt_add_arg(&args, "-s");
@@ -186,8 +356,10 @@ int main(int argc, char *argv[]) {
 
     // cleanup
     free(FsInfo);
-    free(containerFileName);
+    for (unsigned int i= 0; i < conf.containerFileCount; i++)
+        free(containerFileNames[i]);
     free(logFileName);
+    free(traceFileName);
 
     return fuse_stat;
 }
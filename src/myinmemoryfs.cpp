@@ -85,13 +85,14 @@ int MyInMemoryFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     }
 
     int i = 0;
-    while ((myFiles[i].name[0] != '\0') && (i < NUM_DIR_ENTRIES)) {
+    while ((i < NUM_DIR_ENTRIES) && (myFiles[i].name[0] != '\0')) {
         i++;
     }
     strcpy(myFiles[i].name, path);
     myFiles[i].mode = mode;
     myFiles[i].atime = time(NULL);
     myFiles[i].mtime = time(NULL);
+    pathIndex.insert(ROOT_SLOT, myFiles[i].name, i);
     actualFiles++;
     RETURN(0);
 }
@@ -115,6 +116,7 @@ int MyInMemoryFS::fuseUnlink(const char *path) {
     free(foundFile->data);
     foundFile->data = nullptr;
     foundFile->dataSize=0;
+    pathIndex.remove(ROOT_SLOT, foundFile->name, foundFile - myFiles);
     foundFile->name[0] = '\0';
     actualFiles--;
     RETURN(0);
@@ -146,7 +148,9 @@ int MyInMemoryFS::fuseRename(const char *path, const char *newpath) {
         }
         fuseUnlink(newpath);
     }
+    pathIndex.remove(ROOT_SLOT, foundFile->name, foundFile - myFiles);
     strcpy(foundFile->name, newpath);
+    pathIndex.insert(ROOT_SLOT, foundFile->name, foundFile - myFiles);
     foundFile->mtime = time(NULL);
     RETURN(0);
 }
@@ -487,6 +491,7 @@ void *MyInMemoryFS::fuseInit(struct fuse_conn_info *conn) {
             myFiles[i].data = nullptr;
             myFiles[i].dataSize=0;
         }
+        pathIndex.rebuild(myFiles, NUM_DIR_ENTRIES);
 
     }
 
@@ -509,25 +514,12 @@ void MyInMemoryFS::fuseDestroy() {
 // Additional methods:
 
 bool MyInMemoryFS::fileExists(const char *path) {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFiles[i].name[0] == '/') {
-            if (strcmp(myFiles[i].name, path) == 0) {
-                return true;
-            }
-        }
-    }
-    return false;
+    return pathIndex.find(myFiles, ROOT_SLOT, path) >= 0;
 }
 
 file *MyInMemoryFS::findFile(const char *path) {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (myFiles[i].name[0] != '\0') {
-            if (strcmp(myFiles[i].name, path) == 0) {
-                return &myFiles[i];
-            }
-        }
-    }
-    return nullptr;
+    int slot = pathIndex.find(myFiles, ROOT_SLOT, path);
+    return slot >= 0 ? &myFiles[slot] : nullptr;
 }
 
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
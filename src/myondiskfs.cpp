@@ -17,37 +17,104 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
 //Bei Problemen mit memcpy vll #include <cstring> wieder hinzufügen (ist eig ähnlich wie <string.h>)
 
 #include "macros.h"
 #include "myfs.h"
 #include "myfs-info.h"
 #include "blockdevice.h"
+#include "blockcache.h"
+#include "asyncblockdevice.h"
+#include "mappedblockdevice.h"
+#include "tracingblockdevice.h"
+#include "stripedblockdevice.h"
+#include "mirroredblockdevice.h"
+#include "checksumblockdevice.h"
+#include "crc32c.h"
+#include "lz.h"
+
+
+const char *const fsOpNames[FS_OP_COUNT] = {
+        "background", "init", "destroy", "getattr", "mknod", "unlink", "rename", "chmod", "chown", "truncate", "open",
+        "read", "write", "release", "flush", "fsync", "readdir", "mkdir", "rmdir", "opendir"
+};
+
+// Block device requests issued during a file system operation are counted for it. Operations called by other
+// operations (e.g. the truncate of a write) count for the outer one. Cached directory entries found by earlier
+// operations are dropped before an outer operation starts, never while one holds pointers to them.
+class FsOpScope {
+public:
+    FsOpScope(MyOnDiskFS *fs, FsOp op) : outer(BlockDevice::getCause() == FS_OP_BACKGROUND) {
+        if (outer) {
+            BlockDevice::setCause(op);
+            fs->fsOpCalls[op]++;
+            fs->trimEntryCache();
+        }
+    }
+
+    ~FsOpScope() {
+        if (outer) {
+            BlockDevice::setCause(FS_OP_BACKGROUND);
+        }
+    }
+
+private:
+    bool outer;
+};
+
+// Metadata regions are page aligned, so they can be written with direct I/O without staging.
+static void *allocAligned(size_t size) {
+    void *p = nullptr;
+    if (posix_memalign(&p, sysconf(_SC_PAGESIZE), size) != 0) {
+        return nullptr;
+    }
+    return p;
+}
+
+// Size of a dmap with one bit for each of dataSize blocks, in whole 64-bit words.
+static size_t dmapSize(int64_t dataSize) {
+    return (size_t) (dataSize + DMAP_WORD_BITS - 1) / DMAP_WORD_BITS * sizeof(uint64_t);
+}
 
+// Blocks of a metadata region holding the bytes from first to end - 1 have to be written.
+static void markDirty(std::vector<bool> &dirty, size_t first, size_t end, uint32_t blockSize) {
+    for (size_t b = first / blockSize; b < dirty.size() && b * blockSize < end; b++) {
+        dirty[b] = true;
+    }
+}
 
 /// @brief Constructor of the on-disk file system class.
 ///
 /// You may add your own constructor code here.
 MyOnDiskFS::MyOnDiskFS() : MyFS() {
-    // create a block device object
-    this->blockDevice = new BlockDevice(BLOCK_SIZE);
-    fat = (int *) malloc(FATSIZE); //Muss man ändern wenn man Blocksize ändern will
-    dmap = (bool *) malloc(DMAPSIZE); //Muss man ändern wenn man Blocksize ändern will. Man kann 1012 hier nicht
-    //abhängig von Blockdevicesize berechnen. Weil Kreisreferenzierung
-    root = (file *) malloc(ROOTSIZE);
+    // the block device object is created in fuseInit(), when the mount options are known
+    this->blockDevice = nullptr;
+    this->cache = nullptr;
+    // dmap, FAT and root are allocated in fuseInit(), when the geometry of the container is known
+    fat = nullptr;
+    dmap = nullptr;
+    root = nullptr;
 }
 
 /// @brief Destructor of the on-disk file system class.
 ///
 /// You may add your own destructor code here.
 MyOnDiskFS::~MyOnDiskFS() {
-    // free block device object
+    // free block cache and block device object
+    delete this->cache;
     delete this->blockDevice;
 
 
-    free(fat);
-    free(dmap);
-    free(root);
+    if (!metadataMapped) {
+        free(fat);
+        free(dmap);
+        free(root);
+    }
+    free(cmap);
+    free(dedupMap);
 
 }
 
@@ -61,31 +128,25 @@ MyOnDiskFS::~MyOnDiskFS() {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
     LOGM();
+    FsOpScope scope(this, FS_OP_MKNOD);
 
+    int ret = createEntry(path, mode);
+    RETURN(ret);
+}
 
-    if (actualFiles >= NUM_DIR_ENTRIES) {
-        RETURN(-ENOSPC);
-    }
-    int i = 0;
-    while ((root[i].name[0] != '\0') && (i < NUM_DIR_ENTRIES)) {
-        i++;
-    }
-    size_t pathLength = strlen(path);
-    if (pathLength > NAME_LENGTH) {
-        RETURN(-ENAMETOOLONG);
-    } else if (fileExists(path)) {
-        RETURN(-EEXIST);
-    } else {
-        strcpy(root[i].name, path);
-        root[i].mode = mode;
-        root[i].atime = time(NULL);
-        root[i].mtime = time(NULL);
-
-        //write root to disc
-        writeRootToDisc();
-    }
+/// @brief Create a directory.
+///
+/// Create a new, empty directory with given name and permissions.
+/// You do not have to check file permissions, but can assume that it is always ok to access the directory.
+/// \param [in] path Name of the directory, starting with "/".
+/// \param [in] mode Permissions for directory access.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseMkdir(const char *path, mode_t mode) {
+    LOGM();
+    FsOpScope scope(this, FS_OP_MKDIR);
 
-    RETURN(0);
+    int ret = createEntry(path, S_IFDIR | (mode & 07777));
+    RETURN(ret);
 }
 
 /// @brief Delete a file.
@@ -96,6 +157,7 @@ int MyOnDiskFS::fuseMknod(const char *path, mode_t mode, dev_t dev) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseUnlink(const char *path) {
     LOGM();
+    FsOpScope scope(this, FS_OP_UNLINK);
 
 
     file *foundFile = findFile(path);
@@ -105,30 +167,45 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
     if (foundFile->open) {
         RETURN(-EACCES);
     }
-
-
-    if (foundFile->fat_data != -1) {
-        int i = foundFile->fat_data;
-        while (fat[i] != EOF) {
-            int index = fat[i];
-            fat[i] = INT32_MAX;
-            dmap[i] = false;
-            i = index;
-        }
-        fat[i] = INT32_MAX;
-        dmap[i] = false;
+    if (S_ISDIR(foundFile->mode)) {
+        RETURN(-EISDIR);
     }
 
-    foundFile->fat_data = -1;
-    foundFile->dataSize = 0;
-    foundFile->name[0] = '\0';
+    int ret = removeEntry(foundFile);
+    RETURN(ret);
+}
 
-    writeFatToDisc();
-    writeDmapToDisc();
-    writeRootToDisc();
+/// @brief Delete a directory.
+///
+/// Delete an empty directory with given name from the file system.
+/// You do not have to check file permissions, but can assume that it is always ok to access the directory.
+/// \param [in] path Name of the directory, starting with "/".
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseRmdir(const char *path) {
+    LOGM();
+    FsOpScope scope(this, FS_OP_RMDIR);
 
-    actualFiles--;
-    RETURN(0);
+    bool isDir;
+    int slot = findSlot(path, &isDir);
+    if (slot < 0) {
+        RETURN(slot);
+    }
+    if (!isDir) {
+        RETURN(-ENOTDIR);
+    }
+    if (slot == ROOT_SLOT) {
+        RETURN(-EBUSY);
+    }
+    file *foundFile = entryOf(slot);
+    if (foundFile == nullptr) {
+        RETURN(-EIO);
+    }
+    if (foundFile->firstChild >= 0) {
+        RETURN(-ENOTEMPTY);
+    }
+
+    int ret = removeEntry(foundFile);
+    RETURN(ret);
 }
 
 /// @brief Rename a file.
@@ -142,6 +219,7 @@ int MyOnDiskFS::fuseUnlink(const char *path) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
     LOGM();
+    FsOpScope scope(this, FS_OP_RENAME);
 
 
     file *foundFile = findFile(path);
@@ -151,18 +229,91 @@ int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
     if (foundFile->open) {
         RETURN(-EACCES);
     }
-    file *otherFile = findFile(newpath);
-    if (otherFile != nullptr) {
-        if (otherFile->open) {
+    int slot = slotOf(foundFile);
+    const char *leaf;
+    int newParent = resolveParent(newpath, &leaf);
+    if (newParent < 0) {
+        RETURN(newParent);
+    }
+    if (slot == ROOT_SLOT || leaf[0] == '\0') {
+        RETURN(-EBUSY);
+    }
+    if (strlen(leaf) >= NAME_LENGTH) {
+        RETURN(-ENAMETOOLONG);
+    }
+    bool isDir = S_ISDIR(foundFile->mode);
+    for (int dir = newParent; isDir && dir != ROOT_SLOT;) { // nicht in sich selbst verschieben
+        if (dir == slot) {
+            RETURN(-EINVAL);
+        }
+        file *dirFile = entryOf(dir);
+        if (dirFile == nullptr) {
+            RETURN(-EIO);
+        }
+        dir = dirFile->parent;
+    }
+    bool otherIsDir;
+    int other = lookup(newParent, leaf, &otherIsDir);
+    file *otherFile = nullptr;
+    if (other == slot) {
+        RETURN(0);
+    } else if (other >= 0) {
+        if (isDir != otherIsDir) {
+            RETURN(isDir ? -ENOTDIR : -EISDIR);
+        }
+        otherFile = entryOf(other);
+        if (otherFile == nullptr) {
+            RETURN(-EIO);
+        }
+        if (!otherIsDir && otherFile->open) {
             RETURN(-EACCES);
         }
-        fuseUnlink(newpath);
+        if (otherIsDir && otherFile->firstChild >= 0) {
+            RETURN(-ENOTEMPTY);
+        }
+    } else if (other != -ENOENT) {
+        RETURN(other);
+    }
+
+    int oldParent = foundFile->parent;
+    char oldName[NAME_LENGTH];
+    strcpy(oldName, foundFile->name);
+    int ret = 0;
+    if (slot >= NUM_DIR_ENTRIES) { // neuer Name zuerst, bei vollem Verzeichnisindex bleibt alles beim Alten
+        ret = insertName(newParent, leaf, slot);
+        if (ret < 0) {
+            RETURN(ret);
+        }
+    }
+    if (otherFile != nullptr) { // Ziel erst löschen, wenn der neue Name sicher ist
+        ret = removeEntry(otherFile);
+        if (ret < 0) {
+            if (slot >= NUM_DIR_ENTRIES) {
+                removeName(newParent, leaf, slot);
+            }
+            RETURN(ret);
+        }
+    }
+    if (slot < NUM_DIR_ENTRIES) {
+        pathIndex.remove(oldParent, oldName, slot);
+        pathIndex.insert(newParent, leaf, slot);
+    } else {
+        removeName(oldParent, oldName, slot);
+    }
+    if (newParent != oldParent) { // in die Liste des neuen Verzeichnisses umhängen
+        ret = unlinkEntry(slot);
+        foundFile->parent = newParent;
+        if (ret == 0) {
+            ret = linkEntry(newParent, slot);
+        }
     }
-    strcpy(foundFile->name, newpath);
+    strcpy(foundFile->name, leaf);
     foundFile->mtime = time(NULL);
-    writeRootToDisc();
+    int writeRet = writeEntry(foundFile);
+    dentries.insert(oldParent, oldName, -1, false);
+    dentries.insert(newParent, leaf, slot, isDir);
 
-    RETURN(0);
+    RETURN(ret < 0 ? ret : writeRet);
 }
 
 /// @brief Get file meta data.
@@ -173,6 +324,7 @@ int MyOnDiskFS::fuseRename(const char *path, const char *newpath) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
     LOGM();
+    FsOpScope scope(this, FS_OP_GETATTR);
 
 
     LOGF("\tAttributes of %s requested\n", path);
@@ -208,7 +360,7 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
         myFile->mtime = time(NULL);
 
         statbuf->st_mode = myFile->mode;
-        statbuf->st_nlink = 1;
+        statbuf->st_nlink = S_ISDIR(myFile->mode) ? 2 : 1;
         statbuf->st_size = myFile->dataSize;
     } else {
         RETURN(-ENOENT);
@@ -226,6 +378,7 @@ int MyOnDiskFS::fuseGetattr(const char *path, struct stat *statbuf) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
     LOGM();
+    FsOpScope scope(this, FS_OP_CHMOD);
 
     file *myFile = findFile(path);
     if (myFile != nullptr) {
@@ -237,7 +390,7 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
     } else {
         RETURN(-ENOENT);
     }
-    writeRootToDisc();
+    writeEntry(myFile);
 
     RETURN(0);
 }
@@ -252,6 +405,7 @@ int MyOnDiskFS::fuseChmod(const char *path, mode_t mode) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
     LOGM();
+    FsOpScope scope(this, FS_OP_CHOWN);
 
     file *myFile = findFile(path);
     if (myFile != nullptr) {
@@ -264,7 +418,7 @@ int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
     } else {
         RETURN(-ENOENT);
     }
-    writeRootToDisc();
+    writeEntry(myFile);
     RETURN(0);
 }
 
@@ -279,6 +433,7 @@ int MyOnDiskFS::fuseChown(const char *path, uid_t uid, gid_t gid) {
 
 int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_OPEN);
 
 
     file *myFile = findFile(path);
@@ -294,6 +449,7 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
                         i++;
                     }
                 }
+                openFiles[i] = OpenFile();
                 openFiles[i].isOpen = true;
                 fileInfo->fh = i;
                 myFile->atime = time(NULL);
@@ -306,7 +462,7 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
         RETURN(-ENOENT);
     }
 
-    writeRootToDisc();
+    writeEntry(myFile);
 
     RETURN(0);
 }
@@ -330,6 +486,7 @@ int MyOnDiskFS::fuseOpen(const char *path, struct fuse_file_info *fileInfo) {
 /// -ERRNO on failure.
 int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_READ);
 
 
     LOGF("--> Trying to read %s, %lu, %lu\n", path, (unsigned long) offset, size);
@@ -337,60 +494,32 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
     file *myFile = findFile(path);
     if (myFile != nullptr) {
         if (myFile->open) {
-            if (myFile->fat_data != -1) {
-                int calculatedSize;
-                if (myFile->dataSize <= size + offset) {
-                    calculatedSize = myFile->dataSize - offset;
-                } else {
-                    calculatedSize = size;
+            if (sBlock.chunkSize > 0) { // komprimierter Container: Chunks entpacken
+                if ((size_t) offset >= myFile->dataSize) {
+                    RETURN(0);
                 }
-
-                int firstBlockIndex = (offset / BLOCK_SIZE);//0
-                int firstBlockOffset = 0;
-                if (offset % BLOCK_SIZE != 0) {
-                    firstBlockOffset = offset - (firstBlockIndex * BLOCK_SIZE);
+                size_t readSize = std::min(size, myFile->dataSize - offset);
+                int ret = transferChunks(myFile, buf, readSize, offset, false);
+                RETURN(ret < 0 ? ret : (int) readSize);
+            }
+            if (myFile->fat_data != -1) {
+                if ((size_t) offset >= myFile->dataSize) {
+                    RETURN(0);
                 }
-                int fatIndex = myFile->fat_data;
-                for (int i = 0; i < firstBlockIndex; i++) {
-                    fatIndex = fat[fatIndex];
+                size_t calculatedSize = myFile->dataSize - offset;
+                if (size < calculatedSize) {
+                    calculatedSize = size;
                 }
 
-                char *dataBlock = new char[BLOCK_SIZE];
-
-                size_t offsetBuf = 0;
-                size_t bytesToRead = calculatedSize;
-                while (bytesToRead > 0) {
-                    if (fatIndex == openFiles[fileInfo->fh].blockNo) {
-                        memcpy(dataBlock, openFiles[fileInfo->fh].buffer, BLOCK_SIZE);
-                    } else {
-                        blockDevice->read(sBlock.dataAddress + fatIndex, dataBlock);
-                    }
-                    if (bytesToRead == calculatedSize) {
-                        if (bytesToRead > BLOCK_SIZE - firstBlockOffset) {
-                            memcpy(buf, dataBlock + offset, BLOCK_SIZE - firstBlockOffset);
-                            bytesToRead -= BLOCK_SIZE - firstBlockOffset;
-                            offsetBuf += BLOCK_SIZE - firstBlockOffset;
-                        } else {
-                            memcpy(buf, dataBlock + firstBlockOffset, bytesToRead);
-                            bytesToRead = 0;
-                        }
-                    } else {
-                        if (bytesToRead < BLOCK_SIZE) {
-                            memcpy(buf + offsetBuf, dataBlock, bytesToRead);
-                            bytesToRead = 0;
-                        } else {
-                            memcpy(buf + offsetBuf, dataBlock, BLOCK_SIZE);
-                            offsetBuf += BLOCK_SIZE;
-                            bytesToRead -= BLOCK_SIZE;
-                        }
-                    }
-                    if (bytesToRead != 0) fatIndex = fat[fatIndex];
+                int firstBlockIndex = (offset / sBlock.blockSize);
+                int ret = transferData(extentsOf(myFile), firstBlockIndex, offset % sBlock.blockSize, buf,
+                                       calculatedSize, false, &openFiles[fileInfo->fh]);
+                if (ret < 0) {
+                    RETURN(ret);
                 }
-                memcpy(openFiles[fileInfo->fh].buffer, dataBlock, BLOCK_SIZE);
-                openFiles[fileInfo->fh].blockNo = fatIndex;
-                delete[] dataBlock;
+                readahead(myFile, &openFiles[fileInfo->fh], offset, calculatedSize);
 
-                RETURN(calculatedSize);
+                RETURN((int) calculatedSize);
             } else {
                 RETURN(-EBADF);
             }
@@ -420,62 +549,40 @@ int MyOnDiskFS::fuseRead(const char *path, char *buf, size_t size, off_t offset,
 int
 MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_WRITE);
 
 
     file *myFile = findFile(path);
     if (myFile != nullptr) {
         if (myFile->open) {
-            if (myFile->dataSize < (size + offset)) {
-                fuseTruncate(path, size + offset, fileInfo);
-            }
-
-            int firstBlockIndex = (offset / BLOCK_SIZE); //Anzahl der vollständigen Blöcke vor dem unvollständigen Block 8
-            int firstBlockOffset = 0;
-            if (offset % BLOCK_SIZE != 0) {
-                firstBlockOffset = offset - (firstBlockIndex * BLOCK_SIZE); //Offset im unvollständigen Block
+            if (sBlock.chunkSize > 0) { // komprimierter Container: in den Chunk-Puffer schreiben
+                size_t oldSize = myFile->dataSize;
+                myFile->dataSize = std::max(oldSize, size + offset);
+                int ret = transferChunks(myFile, (char *) buf, size, offset, true);
+                if (ret < 0) {
+                    myFile->dataSize = oldSize;
+                    RETURN(ret);
+                }
+                myFile->mtime = time(NULL);
+                writeEntry(myFile);
+                RETURN((int) size);
             }
-            int fatIndex = myFile->fat_data;
-            for (int i = 0; i < firstBlockIndex; ++i) {
-                fatIndex = fat[fatIndex];
+            if (myFile->dataSize < (size + offset)) {
+                int ret = fuseTruncate(path, size + offset, fileInfo);
+                if (ret < 0) { // z.B. Container voll und darf nicht wachsen
+                    RETURN(ret);
+                }
             }
 
-            char *dataBlock = (char *) malloc(BLOCK_SIZE);
-            size_t offsetBuf = 0;
-            size_t bytesToWrite = size;
-            while (bytesToWrite > 0) {
-                if (fatIndex == openFiles[fileInfo->fh].blockNo) {  //Pufferlesen
-                    memcpy(dataBlock, openFiles[fileInfo->fh].buffer, BLOCK_SIZE);
-                } else {
-                    blockDevice->read(sBlock.dataAddress + fatIndex, dataBlock);
-                }
-                if (bytesToWrite == size) { // if bytesToWrite > BLOCK_SIZE
-                    if (bytesToWrite > BLOCK_SIZE - firstBlockOffset) {
-                        memcpy(dataBlock + firstBlockOffset, buf, BLOCK_SIZE - firstBlockOffset);
-                        offsetBuf += BLOCK_SIZE - firstBlockOffset;
-                        bytesToWrite -= BLOCK_SIZE - firstBlockOffset;
-                    } else {
-                        memcpy(dataBlock + firstBlockOffset, buf, bytesToWrite);
-                        bytesToWrite = 0;
-                    }
-                } else {
-                    if (bytesToWrite < BLOCK_SIZE) {
-                        memcpy(dataBlock, buf + offsetBuf, bytesToWrite);
-                        bytesToWrite = 0;
-                    } else {
-                        memcpy(dataBlock, buf + offsetBuf, BLOCK_SIZE);
-                        offsetBuf += BLOCK_SIZE;
-                        bytesToWrite -= BLOCK_SIZE;
-                    }
-                }
-                blockDevice->write(sBlock.dataAddress + fatIndex, dataBlock);
-                if (bytesToWrite != 0) fatIndex = fat[fatIndex];
+            int firstBlockIndex = (offset / sBlock.blockSize); //Anzahl der vollständigen Blöcke vor dem unvollständigen Block 8
+            int ret = transferData(extentsOf(myFile), firstBlockIndex, offset % sBlock.blockSize, (char *) buf, size,
+                                   true, &openFiles[fileInfo->fh]);
+            if (ret < 0) {
+                RETURN(ret);
             }
-            memcpy(openFiles[fileInfo->fh].buffer, dataBlock, BLOCK_SIZE);
-            openFiles[fileInfo->fh].blockNo = fatIndex;
-            free(dataBlock);
 
             myFile->mtime = time(NULL);
-            writeRootToDisc();
+            writeEntry(myFile);
             RETURN(size);
         } else {
             RETURN(-EBADF);
@@ -489,125 +596,91 @@ MyOnDiskFS::fuseWrite(const char *path, const char *buf, size_t size, off_t offs
 
 /// @brief Close a file.
 ///
+/// Dirty blocks of the file are written back to the container file.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in] File handel for the file set by fuseOpen.
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseRelease(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_RELEASE);
 
     file *myFile = findFile(path);
     if (myFile != nullptr) {
         if (myFile->open == true) {
             myFile->open = false;
-            openFiles[fileInfo->fh].blockNo = -1;
             openFiles[fileInfo->fh].isOpen = false;
             openFilesCount--;
         }
     } else {
         RETURN(-ENOENT);
     }
-    writeRootToDisc();
+    writeEntry(myFile);
 
-    RETURN(0);
+    // geschlossene Dateien bleiben nicht im Write-back-Cache liegen
+    int ret = flushFile(myFile, false);
+    if (ret == 0 && sBlock.chunkSize > 0) { // auch nicht im Chunk-Puffer
+        chunkBuffers.erase(slotOf(myFile));
+    }
+    extentMaps.erase(slotOf(myFile));
+    RETURN(ret);
 }
 
-/// @brief Truncate a file.
+/// @brief Flush a file.
 ///
-/// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
-/// the new size is larger than the old size, the new bytes may be random.
-/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// Called on every close() of a file descriptor. Starts writing back the blocks of the file without waiting for them.
 /// \param [in] path Name of the file, starting with "/".
-/// \param [in] newSize New size of the file.
+/// \param [in] fileInfo Can be ignored.
 /// \return 0 on success, -ERRNO on failure.
-int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
+int MyOnDiskFS::fuseFlush(const char *path, struct fuse_file_info *fileInfo) {
     LOGM();
-    LOGF("--> Trying to truncate %s, %ld\n", path, newSize);
-
+    FsOpScope scope(this, FS_OP_FLUSH);
 
     file *myFile = findFile(path);
     if (myFile == nullptr) {
         RETURN(-ENOENT);
     }
 
-    int oldBlockCount = ceil((double) myFile->dataSize / BLOCK_SIZE);
-    int newBlockCount = ceil((double) newSize / BLOCK_SIZE);
-    int allocateCount = abs(newBlockCount - oldBlockCount);//8
-    if (newSize > myFile->dataSize) { //Vergroessern
-        if (allocateCount > 0) { // Wenn neue Size außerhalb der alten Blockgrenze liegt
-            int actualIndex = 0;
-            int i = 0;
-            if (myFile->dataSize == 0) {   //Leeres file
-                int index = findEmptyDataBlock();
-                if (index < 0) {
-                    RETURN(index); //=ENOSPACE
-                }
-                fat[index] = EOF;
-                dmap[index] = true;
-                actualIndex = index;
-                myFile->fat_data = actualIndex;
-                i++;
-            } else { //normales, nichtleeres file: actualIndex bestimmen
-                actualIndex = myFile->fat_data;
-                while (fat[actualIndex] != EOF) {
-                    actualIndex = fat[actualIndex];
-                }
-            }
-            while (i < allocateCount) {
-                int index = findEmptyDataBlock();
-                if (index < 0) {
-                    RETURN(index); //=ENOSPACE
-                }
-                fat[index] = EOF;
-                dmap[index] = true;
-                fat[actualIndex] = index;
-                actualIndex = index;
-                i++;
-            }
-        }
-    } else { //Verkleinern
-        if (allocateCount > 0) {
-            int startToDelete = oldBlockCount - allocateCount;
-
-            //wo ist der letzte Block (actualIndex)
-            int actualIndex = myFile->fat_data;
-            int blocks = 0;
-            while (blocks < startToDelete) {
-                actualIndex = fat[actualIndex];
-                blocks++;
-            }
-
-            //verkleinern ausfuehren
-            int index = fat[actualIndex];//Index hinter neuem letztem Block
-            if (startToDelete == 0) {
-                if (fat[actualIndex] != EOF) {
-                    fat[actualIndex] = INT32_MAX;
-                    dmap[actualIndex] = false;
-                }
-            }
-            while (fat[index] != EOF) {
-                actualIndex = index;
-                index = fat[actualIndex];
-                fat[actualIndex] = INT32_MAX;
-                dmap[actualIndex] = false;
-            }
-            fat[actualIndex] = INT32_MAX;
-            dmap[actualIndex] = false;
-        }
+    RETURN(flushFile(myFile, false));
+}
+
+/// @brief Synchronize a file.
+///
+/// Return only after the content and the metadata of the file are stored in the container file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] datasync Can be ignored.
+/// \param [in] fi Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseFsync(const char *path, int datasync, struct fuse_file_info *fi) {
+    LOGM();
+    FsOpScope scope(this, FS_OP_FSYNC);
+
+    file *myFile = findFile(path);
+    if (myFile == nullptr) {
+        RETURN(-ENOENT);
     }
-    myFile->dataSize = newSize;
-    myFile->mtime = time(NULL);
 
-    writeRootToDisc();
-    writeDmapToDisc();
-    writeFatToDisc();
-    RETURN(0);
+    RETURN(flushFile(myFile, true));
+}
+
+/// @brief Truncate a file.
+///
+/// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
+/// the new size is larger than the old size, the new bytes may be random.
+/// You do not have to check file permissions, but can assume that it is always ok to access the file.
+/// \param [in] path Name of the file, starting with "/".
+/// \param [in] newSize New size of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
+    LOGM();
+    int ret = fuseTruncate(path, newSize, nullptr);
+    RETURN(ret);
 }
 
 /// @brief Truncate a file.
 ///
 /// Set the size of a file to the new size. If the new size is smaller than the old size, spare bytes are removed. If
 /// the new size is larger than the old size, the new bytes may be random. This function is called for files that are
-/// open.
+/// open, and by the overload without fileInfo for files that are not.
 /// You do not have to check file permissions, but can assume that it is always ok to access the file.
 /// \param [in] path Name of the file, starting with "/".
 /// \param [in] newSize New size of the file.
@@ -615,101 +688,72 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize) {
 /// \return 0 on success, -ERRNO on failure.
 int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_TRUNCATE);
     LOGF("--> Trying to truncate %s, %ld\n", path, newSize);
 
     file *myFile = findFile(path);
     if (myFile == nullptr) {
         RETURN(-ENOENT);
     }
+    if (sBlock.chunkSize > 0) {
+        RETURN(truncateChunks(myFile, newSize));
+    }
 
-    int oldBlockCount = ceil((double) myFile->dataSize / BLOCK_SIZE);
-    int newBlockCount = ceil((double) newSize / BLOCK_SIZE);
-    int allocateCount = newBlockCount - oldBlockCount;
-    if (newSize > myFile->dataSize) { //Vergroessern
-        if (allocateCount > 0) {
-            int actualIndex = 0;
-            int i = 0;
-            if (myFile->dataSize == 0) {   //Leeres file
-                int index = findEmptyDataBlock();
-                if (index < 0) {
-                    RETURN(index); //=ENOSPACE
-                }
-                fat[index] = EOF;
-                dmap[index] = true;
-                actualIndex = index;
-                myFile->fat_data = actualIndex;
-                i++;
-            } else { //normales, nichtleeres file: actualIndex bestimmen
-                actualIndex = myFile->fat_data;
-                while (fat[actualIndex] != EOF) {
-                    actualIndex = fat[actualIndex];
-                }
-            }
-            while (i < allocateCount) {
-                int index = findEmptyDataBlock();
-                if (index < 0) {
-                    RETURN(index); //=ENOSPACE
-                }
-                fat[index] = EOF;
-                dmap[index] = true;
-                fat[actualIndex] = index;
-                actualIndex = index;
-                i++;
-            }
-        }
-    } else { //Verkleinern
-        if (allocateCount > 0) {
-            int startToDelete = oldBlockCount - allocateCount;
-
-            //wo ist der letzte Block (actualIndex)
-            int actualIndex = myFile->fat_data;
-            int blocks = 0;
-            while (blocks < startToDelete) {
-                actualIndex = fat[actualIndex];
-                blocks++;
-            }
-
-            //verkleinern ausfuehren
-            int index = fat[actualIndex];//Index hinter neuem letztem Block
-            if (startToDelete == 0) {
-                if (fat[actualIndex] != EOF) {
-                    if (openFiles[fileInfo->fh].blockNo == actualIndex) {
-                        openFiles[fileInfo->fh].blockNo = -1;
-                    }
-                    fat[actualIndex] = INT32_MAX;
-                    dmap[actualIndex] = false;
-                }
-            }
-            while (fat[index] != EOF) {
-                if (openFiles[fileInfo->fh].blockNo == index) {
-                    openFiles[fileInfo->fh].blockNo = -1;
-                }
-                actualIndex = index;
-                index = fat[actualIndex];
-                fat[actualIndex] = INT32_MAX;
-                dmap[actualIndex] = false;
-            }
-            if (openFiles[fileInfo->fh].blockNo == actualIndex) {
-                openFiles[fileInfo->fh].blockNo = -1;
-            }
-            fat[actualIndex] = INT32_MAX;
-            dmap[actualIndex] = false;
+    int oldBlockCount = ceil((double) myFile->dataSize / sBlock.blockSize);
+    int newBlockCount = ceil((double) newSize / sBlock.blockSize);
+    if (newBlockCount > oldBlockCount) { //Vergroessern über die alte Blockgrenze hinaus
+        int ret = appendBlocks(myFile, newBlockCount - oldBlockCount);
+        if (ret < 0) {
+            RETURN(ret); //=ENOSPACE
         }
+    } else if (newBlockCount < oldBlockCount) { //Verkleinern
+        cutBlocks(myFile, newBlockCount);
     }
     myFile->dataSize = newSize;
     myFile->mtime = time(NULL);
-    writeRootToDisc();
-    writeDmapToDisc();
-    writeFatToDisc();
+    if (!myFile->open) { // Extent-Maps nur für geöffnete Dateien behalten
+        extentMaps.erase(slotOf(myFile));
+    }
 
-    RETURN(0);
+    int ret = writeEntry(myFile);
+    if (ret == 0) {
+        ret = writeDmapToDisc();
+    }
+    if (ret == 0) {
+        ret = writeFatToDisc();
+    }
+    if (ret == 0) {
+        ret = writeDedupMapToDisc();
+    }
+    punchHoles();
+    RETURN(ret);
+}
+
+/// @brief Open a directory.
+///
+/// Check that a directory with given name exists.
+/// You do not have to check file permissions, but can assume that it is always ok to access the directory.
+/// \param [in] path Name of the directory, starting with "/".
+/// \param [in] fileInfo Can be ignored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::fuseOpendir(const char *path, struct fuse_file_info *fileInfo) {
+    LOGM();
+    FsOpScope scope(this, FS_OP_OPENDIR);
+
+    bool isDir;
+    int slot = findSlot(path, &isDir);
+    if (slot < 0) {
+        RETURN(slot);
+    }
+    RETURN(isDir ? 0 : -ENOTDIR);
 }
 
 /// @brief Read a directory.
 ///
-/// Read the content of the (only) directory.
+/// Read the content of a directory by following the list of its entries. The names listed are remembered in the
+/// dentry cache, as they are usually looked up next.
 /// You do not have to check file permissions, but can assume that it is always ok to access the directory.
-/// \param [in] path Path of the directory. Should be "/" in our case.
+/// \param [in] path Path of the directory, starting with "/".
 /// \param [out] buf A buffer for storing the directory entries.
 /// \param [in] filler A function for putting entries into the buffer.
 /// \param [in] offset Can be ignored.
@@ -718,22 +762,40 @@ int MyOnDiskFS::fuseTruncate(const char *path, off_t newSize, struct fuse_file_i
 int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
                             struct fuse_file_info *fileInfo) {
     LOGM();
+    FsOpScope scope(this, FS_OP_READDIR);
 
     LOGF("--> Getting The List of Files of %s\n", path);
 
+    bool isDir;
+    int dir = findSlot(path, &isDir);
+    if (dir < 0) {
+        RETURN(dir);
+    }
+    if (!isDir) {
+        RETURN(-ENOTDIR);
+    }
+    file *dirFile = entryOf(dir);
+    if (dirFile == nullptr) {
+        RETURN(-EIO);
+    }
+
     filler(buf, ".", NULL, 0); // Current Directory
     filler(buf, "..", NULL, 0); // Parent Directory
 
-    if (strcmp(path, "/") ==
-        0) { // If the user is trying to show the files/directories of the root directory show the following
-        for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-            if (root[i].name[0] == '/') {
-                //char tmp[NAME_LENGTH] = "";
-                //strcpy(tmp, myFiles[i].name + 1);
-                filler(buf, root[i].name, NULL, 0);
-                LOGF("Found file: %s", root[i].name);
-            }
+    file entry;
+    int count = 0;
+    for (int slot = dirFile->firstChild; slot >= 0; slot = entry.nextEntry) {
+        int ret = readEntry(slot, &entry);
+        if (ret < 0) {
+            RETURN(ret);
+        }
+        if (++count > actualFiles || entry.parent != dir) { // Liste kaputt oder im Kreis
+            LOGF("ERROR: List of entries of %s is damaged at entry %d", path, slot);
+            RETURN(-EIO);
         }
+        filler(buf, entry.name, NULL, 0);
+        dentries.insert(dir, entry.name, slot, S_ISDIR(entry.mode));
+        LOGF("Found file: %s", entry.name);
     }
 
     RETURN(0);
@@ -745,6 +807,8 @@ int MyOnDiskFS::fuseReaddir(const char *path, void *buf, fuse_fill_dir_t filler,
 /// \param [in] conn Can be ignored.
 /// \return 0.
 void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
+    FsOpScope scope(this, FS_OP_INIT);
+
     // Open logfile
     this->logFile = fopen(((MyFsInfo *) fuse_get_context()->private_data)->logFile, "w+");
     if (this->logFile == NULL) {
@@ -758,113 +822,306 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
         LOG("Using on-disk mode");
 
         LOGF("Container file name: %s", ((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        unsigned int containerCount = ((MyFsInfo *) fuse_get_context()->private_data)->contFileCount;
+        containerCount = containerCount > 0 ? containerCount : 1;
+        for (unsigned int i = 1; i < containerCount; i++) {
+            LOGF("Container file name: %s", ((MyFsInfo *) fuse_get_context()->private_data)->contFiles[i]);
+        }
 
-        int ret = this->blockDevice->open(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        // Container wächst bei Bedarf bis zur Grenze aus den Mount-Optionen
+        this->maxDeviceSize = ((MyFsInfo *) fuse_get_context()->private_data)->maxDeviceSize;
+        this->growSize = ((MyFsInfo *) fuse_get_context()->private_data)->growSize;
+
+        // Geometrie: aus dem Superblock eines vorhandenen Containers, sonst aus den Mount-Optionen
+        int ret = readSuperblock(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        bool create = ret == -ENOENT;
+        if (ret == -EBADMSG) {
+            LOG("ERROR: Superblock does not match its checksum");
+        } else if (ret == -EPROTO) {
+            LOG("ERROR: Container has an older format, it cannot be mounted");
+        }
+        if (create) {
+            unsigned int blockSize = ((MyFsInfo *) fuse_get_context()->private_data)->blockSize;
+            unsigned int deviceSize = ((MyFsInfo *) fuse_get_context()->private_data)->deviceSize;
+            blockSize = blockSize > 0 ? blockSize : BLOCK_SIZE;
+            unsigned int chunkSize = 0;
+            if (((MyFsInfo *) fuse_get_context()->private_data)->compress) { // Chunks aus ganzen Blöcken
+                chunkSize = ((MyFsInfo *) fuse_get_context()->private_data)->chunkSize;
+                chunkSize = chunkSize > 0 ? chunkSize : CHUNK_SIZE;
+                chunkSize = (chunkSize + blockSize - 1) / blockSize * blockSize;
+            }
+            ret = computeLayout(&sBlock, blockSize, deviceSize > 0 ? deviceSize : BLOCK_DEVICE_SIZE,
+                                !((MyFsInfo *) fuse_get_context()->private_data)->noChecksums, chunkSize,
+                                ((MyFsInfo *) fuse_get_context()->private_data)->dedup != 0);
+            if (containerCount > 1 && ((MyFsInfo *) fuse_get_context()->private_data)->mirror) {
+                sBlock.mirrorCount = containerCount; // jeder Container enthält alle Blöcke
+            } else if (containerCount > 1) { // Blöcke werden reihum auf die Container verteilt
+                unsigned int stripeSize = ((MyFsInfo *) fuse_get_context()->private_data)->stripeSize;
+                sBlock.stripeCount = containerCount;
+                sBlock.stripeSize = stripeSize > 0 ? stripeSize : std::max(1u, STRIPE_SIZE / sBlock.blockSize);
+            }
+        } else if (ret >= 0 && (((MyFsInfo *) fuse_get_context()->private_data)->blockSize > 0 ||
+                                ((MyFsInfo *) fuse_get_context()->private_data)->deviceSize > 0)) {
+            LOG("Container file does exist, ignoring block size and device size options");
+        }
+        if (ret >= 0 && std::max(std::max(sBlock.stripeCount, sBlock.mirrorCount), 1u) != containerCount) {
+            LOGF("ERROR: Container consists of %u files, %u given",
+                 std::max(std::max(sBlock.stripeCount, sBlock.mirrorCount), 1u), containerCount);
+            ret = -EINVAL;
+        } else if (ret >= 0 && !create && sBlock.mirrorCount == 0 &&
+                   ((MyFsInfo *) fuse_get_context()->private_data)->mirror) {
+            LOG("Container is not mirrored, ignoring mirror option");
+        }
 
         if (ret >= 0) {
-            LOG("Container file does exist, reading");
+            LOGF("Geometry: %u bytes per block, %d blocks, %d data blocks", sBlock.blockSize, sBlock.blockDeviceSize,
+                 sBlock.dataSize);
+            if (this->maxDeviceSize > 0) {
+                LOGF("Container grows up to %u blocks", this->maxDeviceSize);
+            }
+            if (sBlock.chunkSize > 0) {
+                LOGF("Compression: file data in chunks of %u bytes", sBlock.chunkSize);
+            }
+            if (sBlock.dedupBlocks > 0) {
+                LOG("Deduplication: identical data blocks are stored once");
+            }
 
-            // Read existing structures form file
+            // create a block device object
+            if (containerCount > 1) {
+                // one asynchronous device per container file, the parts of a request are transferred in parallel
+                if (((MyFsInfo *) fuse_get_context()->private_data)->memoryMapped) {
+                    LOG("Memory mapping is not used with several container files");
+                }
+                unsigned int queueDepth = ((MyFsInfo *) fuse_get_context()->private_data)->queueDepth;
+                std::vector<BlockDevice *> members;
+                std::vector<std::string> paths;
+                for (unsigned int i = 0; i < containerCount; i++) {
+                    members.push_back(new AsyncBlockDevice(sBlock.blockSize,
+                                                           queueDepth > 0 ? queueDepth : BD_QUEUE_DEPTH));
+                    members.back()->setDirectIO(((MyFsInfo *) fuse_get_context()->private_data)->directIO != 0);
+                    members.back() = emulateLatency(members.back(), i);
+                    paths.push_back(((MyFsInfo *) fuse_get_context()->private_data)->contFiles[i]);
+                }
+                if (sBlock.mirrorCount > 1) {
+                    LOGF("Mirroring over %u container files", sBlock.mirrorCount);
+                    this->mirroredDevice = new MirroredBlockDevice(members, paths);
+                    this->compositeDevice = this->mirroredDevice;
+                } else {
+                    LOGF("Striping over %u container files, %u blocks per stripe unit", sBlock.stripeCount,
+                         sBlock.stripeSize);
+                    this->compositeDevice = new StripedBlockDevice(members, paths, sBlock.stripeSize);
+                }
+                this->blockDevice = this->compositeDevice;
+            } else if (((MyFsInfo *) fuse_get_context()->private_data)->memoryMapped) {
+                LOG("Using memory-mapped container file");
+                this->blockDevice = new MappedBlockDevice(sBlock.blockSize, sBlock.blockDeviceSize, maxDeviceSize);
+                this->blockDevice = emulateLatency(this->blockDevice, 0);
+            } else {
+                unsigned int queueDepth = ((MyFsInfo *) fuse_get_context()->private_data)->queueDepth;
+                AsyncBlockDevice *device = new AsyncBlockDevice(sBlock.blockSize,
+                                                                queueDepth > 0 ? queueDepth : BD_QUEUE_DEPTH);
+                LOGF("Queue depth: %u (%s)", device->getQueueDepth(), device->isAsync() ? "io_uring" : "synchronous");
+                this->blockDevice = device;
+                this->blockDevice->setDirectIO(((MyFsInfo *) fuse_get_context()->private_data)->directIO != 0);
+                this->blockDevice = emulateLatency(this->blockDevice, 0);
+            }
 
-            //Blocksize 512
-            char puffer[BLOCK_SIZE];
-            blockDevice->read(0, puffer); //Block 0 = superblock (immer, per def.) lesen
-            memcpy(&sBlock, puffer, sizeof(superblock));
-            // Read dmap
-            int i = 0;
-            while (i < DMAPSIZE / BLOCK_SIZE) {
-                blockDevice->read(sBlock.dmapAddress + i, puffer); //Block 1 = dmapAddress lesen
-                memcpy(&dmap + i * BLOCK_SIZE, puffer, BLOCK_SIZE);
-                i++;
-            }
-            if ((DMAPSIZE % BLOCK_SIZE) != 0) {
-                blockDevice->read(sBlock.dmapAddress + i, puffer);
-                memcpy(&dmap + i * BLOCK_SIZE, puffer, DMAPSIZE - i * BLOCK_SIZE);
-            }
-            // Read fat
-            i = 0;
-            while (i < FATSIZE / BLOCK_SIZE) {
-                blockDevice->read(sBlock.fatAddress + i, puffer); //Block 3ff. = fatAddress lesen
-                memcpy(&fat + i * BLOCK_SIZE, puffer, BLOCK_SIZE);
-                i++;
-            }
-            if ((FATSIZE % BLOCK_SIZE) != 0) {
-                blockDevice->read(sBlock.fatAddress + i, puffer);
-                memcpy(&fat + i * BLOCK_SIZE, puffer, FATSIZE - i * BLOCK_SIZE);
-            }
-            // Read root
-            i = 0;
-            while (i < ROOTSIZE / BLOCK_SIZE) {
-                blockDevice->read(sBlock.rootAddress + i, puffer); //Block 11ff. = rootAddress lesen
-                memcpy(&root + i * BLOCK_SIZE, puffer, BLOCK_SIZE);
-                i++;
-            }
-            if ((ROOTSIZE % BLOCK_SIZE) != 0) { //unreachable, da immer 20480/512=40 mit jetziger Konfig.
-                blockDevice->read(sBlock.rootAddress + i, puffer);
-                memcpy(&root + i * BLOCK_SIZE, puffer, ROOTSIZE - i * BLOCK_SIZE);
-            }
-
-        } else if (ret == -ENOENT) {
-            LOG("Container file does not exist, creating a new one");
+            // record all requests to the container if a trace file is given
+            const char *traceFile = ((MyFsInfo *) fuse_get_context()->private_data)->traceFile;
+            if (traceFile != NULL) {
+                TracingBlockDevice *tracer = new TracingBlockDevice(this->blockDevice, traceFile, fsOpNames,
+                                                                    FS_OP_COUNT);
+                if (tracer->isTracing()) {
+                    LOGF("Tracing block I/O to %s", traceFile);
+                } else {
+                    LOGF("Cannot write trace file %s", traceFile);
+                }
+                this->blockDevice = tracer;
+            }
+
+            // verify every block read against its checksum, unless the container has none
+            if (sBlock.sumBlocks > 0) {
+                this->checksumDevice = new ChecksumBlockDevice(this->blockDevice);
+                this->checksumDevice->setRegion(sBlock.sumAddress, sBlock.sumBlocks);
+                LOGF("Checksums: CRC32C of every block (%s)", crc32cHardware() ? "CPU instructions" : "table-driven");
+                if (((MyFsInfo *) fuse_get_context()->private_data)->memoryMapped) {
+                    LOG("Blocks are copied out of the memory mapping to verify their checksums");
+                }
+                this->blockDevice = this->checksumDevice;
+            }
+
+            // create the block cache
+            unsigned int cacheSize = ((MyFsInfo *) fuse_get_context()->private_data)->cacheSize;
+            const char *cachePolicy = ((MyFsInfo *) fuse_get_context()->private_data)->cachePolicy;
+            BlockCachePolicy policy = cachePolicy != NULL && strcmp(cachePolicy, "lru") == 0 ? CACHE_LRU : CACHE_ARC;
+            this->cache = new BlockCache(this->blockDevice, sBlock.blockSize,
+                                         cacheSize > 0 ? cacheSize : BC_DEFAULT_CAPACITY, policy);
+            LOGF("Block cache: %u blocks (%s)", this->cache->getCapacity(), policy == CACHE_LRU ? "LRU" : "ARC");
+            if (((MyFsInfo *) fuse_get_context()->private_data)->writeBack) {
+                unsigned int dirtyAge = ((MyFsInfo *) fuse_get_context()->private_data)->dirtyAge;
+                this->cache->setWriteBack(true, dirtyAge > 0 ? dirtyAge : BC_DEFAULT_DIRTY_AGE,
+                                          ((MyFsInfo *) fuse_get_context()->private_data)->dirtyLimit);
+                LOGF("Write-back caching, dirty blocks are written after %u ms",
+                     dirtyAge > 0 ? dirtyAge : BC_DEFAULT_DIRTY_AGE);
+            }
+
+            // readahead windows must leave room for the blocks being read
+            if (!((MyFsInfo *) fuse_get_context()->private_data)->noReadahead) {
+                unsigned int readahead = ((MyFsInfo *) fuse_get_context()->private_data)->readahead;
+                this->readaheadMax = readahead > 0 ? readahead : READAHEAD_MAX_WINDOW;
+                if (this->readaheadMax > this->cache->getCapacity() / 4) {
+                    this->readaheadMax = this->cache->getCapacity() / 4;
+                }
+                LOGF("Readahead window: up to %u blocks", this->readaheadMax);
+            }
+
+            allocMetadata();
+            if (create) {
+                ret = this->blockDevice->create(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+            } else {
+                ret = this->blockDevice->open(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+                if (ret >= 0 && this->checksumDevice != nullptr) {
+                    ret = this->checksumDevice->loadChecksums();
+                }
+            }
+        }
 
-            ret = this->blockDevice->create(((MyFsInfo *) fuse_get_context()->private_data)->contFile);
+        if (ret >= 0 && !create) {
+            LOG("Container file does exist, reading");
 
+            // Read existing structures form file
+            mapMetadata();
+            ret = readFromDisc(sBlock.dmapAddress, dmap, DMAPSIZE);
+            if (ret >= 0) {
+                ret = readFromDisc(sBlock.fatAddress, fat, FATSIZE);
+            }
+            if (ret >= 0 && cmap != nullptr) {
+                ret = readFromDisc(sBlock.cmapAddress, cmap, CMAPSIZE);
+            }
+            if (ret >= 0 && dedupMap != nullptr) {
+                ret = readFromDisc(sBlock.dedupAddress, dedupMap, DEDUPSIZE);
+            }
             if (ret >= 0) {
-                // Create empty structures in file
-
-                LOGF("FATSIZE: %f", (double) FATSIZE / BLOCK_SIZE);
-                LOGF("DMAPSIZE: %f", (double) DMAPSIZE / BLOCK_SIZE);
-                LOGF("ROOTSIZE: %f", (double) ROOTSIZE / BLOCK_SIZE);
-
-                //(superblockAdress = Block 0)
-                int dmapAddress = 1;
-                int fatAddress = dmapAddress + ceil((double) DMAPSIZE / BLOCK_SIZE);
-                int rootAddress = fatAddress + ceil((double) FATSIZE / BLOCK_SIZE);
-                int dataAddress = rootAddress + ceil((double) ROOTSIZE / BLOCK_SIZE);
-                int dataSize = BLOCK_DEVICE_SIZE - dataAddress - 1;
-                sBlock.dmapAddress = 1;
-                sBlock.fatAddress = fatAddress;
-                sBlock.rootAddress = rootAddress;
-                sBlock.dataAddress = dataAddress;
-                sBlock.blockDeviceSize = BLOCK_DEVICE_SIZE;
-                sBlock.dataSize = dataSize;
-                //{1, fatAddress, rootAddress, dataAddress, BLOCK_DEVICE_SIZE,
-                //     dataSize}; //ab Block 52 Filesystem
-                //Blocksize 512
-                char puffer[BLOCK_SIZE];
-                memcpy(puffer, &sBlock, sizeof(superblock));
-                blockDevice->write(0, puffer); //Block 0 = superblock (immer, per def.) lesen
-
-                //dmap Initialisierung true
-                //dmap[sBlock.dataSize];
-                for (int i = 0; i < sBlock.blockDeviceSize - sBlock.dataAddress - 1; i++) {
-                    dmap[i] = false;
+                ret = readFromDisc(sBlock.rootAddress, root, ROOTSIZE);
+            }
+            if (ret == -EIO && checksumDevice != nullptr && checksumDevice->getMismatches() > 0) {
+                LOG("ERROR: Metadata blocks do not match their checksums, the container is damaged");
+            }
+        }
+        if (ret >= 0 && !create) {
+            // nie geschriebene Datenblöcke werden ohne I/O als Nullen gelesen
+            if (blockDevice->findHoles(sBlock.dataAddress, sBlock.dataSize, unwritten) < 0) {
+                LOG("Container file cannot report holes, reading all data blocks");
+            }
+            freeExtents.rebuild(dmap, sBlock.dataSize);
+
+            // Referenzzähler und Index der Deduplizierung aus der Dedup-Map aufbauen
+            if (dedupMap != nullptr) {
+                for (int i = 0; i < sBlock.dataSize; i++) {
+                    int location = dedupMap[i].location;
+                    if (isUsed(i) && location >= 0 && location < sBlock.dataSize) {
+                        refCounts[location]++;
+                    } else if (location != NO_LOCATION) { // Block wurde freigegeben
+                        setLocation(i, NO_LOCATION);
+                    }
                 }
-                //fat Initialisierung 0xffff..
-                //fat[sBlock.dataSize];
                 for (int i = 0; i < sBlock.dataSize; i++) {
-                    fat[i] = INT32_MAX; //Das sind 16 "f"s, je 4 bit
+                    if (refCounts[i] > 0 && dedupMap[i].hash != 0) {
+                        dedupIndex[dedupMap[i].hash] = i;
+                    } else if (refCounts[i] == 0 && dedupMap[i].hash != 0) {
+                        setBlockHash(i, 0);
+                    }
+                }
+                writeDedupMapToDisc();
+            }
+
+            actualFiles = 0;
+            openFilesCount = 0;
+            for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+                root[i].open = false;
+                if (i != ROOT_SLOT && root[i].name[0] != '\0') {
+                    actualFiles++;
                 }
+            }
+            pathIndex.rebuild(root, NUM_DIR_ENTRIES);
+            if (!S_ISDIR(root[ROOT_SLOT].mode) || strcmp(root[ROOT_SLOT].name, "/") != 0) {
+                LOG("ERROR: Container has no root directory");
+                ret = -EIO;
+            }
 
-                //root Initialisierung
-                actualFiles = 0;
-                openFilesCount = 0;
-                //root in myondiskfs.h initialisiert
-                for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-                    root[i].fat_data = -1;
-                    root[i].dataSize = 0;
+            // Einträge jenseits von root
+            if (ret >= 0) {
+                ret = loadDirIndex();
+                if (ret < 0) {
+                    LOG("ERROR: Directory index is damaged");
+                } else if (sBlock.dirIndex >= 0) {
+                    actualFiles += dirHeader.files;
+                    LOGF("Directory index: %d files beyond the root region, %d buckets", dirHeader.files,
+                         dirHeader.buckets);
                 }
+            }
+
+        } else if (ret >= 0) {
+            LOG("Container file does not exist, creating a new one");
 
-                writeDmapToDisc();
-                writeFatToDisc();
-                writeRootToDisc();
+            // Create empty structures in file
 
-                LOG("Container file created");
+            LOGF("FATSIZE: %f", (double) FATSIZE / sBlock.blockSize);
+            LOGF("DMAPSIZE: %f", (double) DMAPSIZE / sBlock.blockSize);
+            LOGF("ROOTSIZE: %f", (double) ROOTSIZE / sBlock.blockSize);
+
+            writeSuperblock(); //Block 0 = superblock (immer, per def.) schreiben
+            mapMetadata();
+
+            //dmap Initialisierung: alle Bits 0
+            memset(dmap, 0, DMAPSIZE);
+            freeExtents.rebuild(dmap, sBlock.dataSize);
+            unwritten.assign(sBlock.dataSize, true);
+            //fat Initialisierung 0xffff..
+            for (int i = 0; i < sBlock.dataSize; i++) {
+                fat[i] = INT32_MAX; //Das sind 16 "f"s, je 4 bit
+            }
+            if (cmap != nullptr) {
+                memset(cmap, 0, CMAPSIZE);
+            }
+            dmapDirty.assign(dmapDirty.size(), true);
+            fatDirty.assign(fatDirty.size(), true);
+            cmapDirty.assign(cmapDirty.size(), true);
+            for (int i = 0; dedupMap != nullptr && i < sBlock.dataSize; i++) {
+                dedupMap[i].hash = 0;
+                setLocation(i, NO_LOCATION);
             }
+
+            //root Initialisierung
+            actualFiles = 0;
+            openFilesCount = 0;
+            //root in myondiskfs.h initialisiert
+            for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
+                root[i] = file();
+                root[i].fat_data = -1;
+                root[i].dataSize = 0;
+            }
+            strcpy(root[ROOT_SLOT].name, "/"); // Wurzelverzeichnis, alle Einträge hängen darunter
+            root[ROOT_SLOT].mode = S_IFDIR | 0755;
+            root[ROOT_SLOT].parent = -1;
+            root[ROOT_SLOT].atime = time(NULL);
+            root[ROOT_SLOT].mtime = time(NULL);
+            pathIndex.rebuild(root, NUM_DIR_ENTRIES);
+
+            writeDmapToDisc();
+            writeFatToDisc();
+            writeDedupMapToDisc();
+            writeCmapToDisc();
+            writeRootToDisc();
+
+            LOG("Container file created");
         }
 
-        if (ret < 0) {
-            LOGF("ERROR: Access to container file failed with error %d", ret);
+        if (ret < 0) { // nicht mit unvollständigen Strukturen weiterarbeiten
+            LOGF("ERROR: Access to container file failed with error %d, mount aborted", ret);
+            fuse_exit(fuse_get_context()->fuse);
+        } else if (((MyFsInfo *) fuse_get_context()->private_data)->directIO) {
+            LOGF("%s", this->blockDevice->isDirectIO() ? "Using direct I/O" : "Direct I/O not supported, using page cache");
         }
     }
 
@@ -876,85 +1133,2526 @@ void *MyOnDiskFS::fuseInit(struct fuse_conn_info *conn) {
 /// This function is called when the file system is unmounted. You may add some cleanup code here.
 void MyOnDiskFS::fuseDestroy() {
     LOGM();
+    FsOpScope scope(this, FS_OP_DESTROY);
+
+    if (cache != nullptr) {
+        // geänderte Chunks noch offener Dateien packen
+        for (auto &buffer : chunkBuffers) {
+            file *myFile = buffer.first < NUM_DIR_ENTRIES ? &root[buffer.first] : loadEntry(buffer.first);
+            int ret = myFile != nullptr ? flushChunk(myFile) : -EIO;
+            if (ret < 0) {
+                LOGF("ERROR: Storing the chunk buffer of entry %d failed with error %d", buffer.first, ret);
+            }
+        }
+
+        // stops the flusher and writes the remaining dirty blocks
+        int ret = cache->setWriteBack(false);
+        if (ret < 0) {
+            LOGF("ERROR: Writing back cached blocks failed with error %d", ret);
+        }
+
+        BlockCacheStats stats = cache->getStats();
+        LOGF("Block cache: %lu hits, %lu misses, %lu ghost hits, %lu evictions, %lu writebacks",
+             (unsigned long) stats.hits, (unsigned long) stats.misses, (unsigned long) stats.ghostHits,
+             (unsigned long) stats.evictions, (unsigned long) stats.writebacks);
+        LOGF("Readahead: %lu windows, %lu blocks, largest window %u blocks, %lu of %lu prefetched blocks used",
+             (unsigned long) readaheadWindows, (unsigned long) readaheadBlocks, readaheadLargest,
+             (unsigned long) stats.prefetchHits, (unsigned long) stats.prefetched);
+        LOGF("Container: %d blocks after growing %u times, %lu blocks punched out",
+             sBlock.blockDeviceSize, containerGrowths, (unsigned long) holesPunched);
+        LOGF("Metadata: %lu blocks of dmap, FAT, cmap and dedup map written", (unsigned long) metadataBlocksWritten);
+        int64_t usedBlocks = 0;
+        for (size_t w = 0; w < DMAPSIZE / sizeof(uint64_t); w++) {
+            usedBlocks += __builtin_popcountll(dmap[w]);
+        }
+        LOGF("Data: %ld of %d data blocks used, dmap of %lu bytes, %lu free extents, largest %d blocks",
+             (long) usedBlocks, sBlock.dataSize, (unsigned long) DMAPSIZE, (unsigned long) freeExtents.extents(),
+             freeExtents.largest());
+        LOGF("Extent maps: %lu built from chains", (unsigned long) extentMapsBuilt);
+        if (sBlock.chunkSize > 0) {
+            LOGF("Compression: %lu chunks stored, %lu bytes in %lu bytes (ratio %.2f), %lu chunks loaded",
+                 (unsigned long) chunksStored, (unsigned long) chunkBytesIn, (unsigned long) chunkBytesOut,
+                 chunkBytesOut > 0 ? (double) chunkBytesIn / chunkBytesOut : 0.0, (unsigned long) chunksLoaded);
+        }
+        if (dedupMap != nullptr) {
+            int stored = 0;
+            int used = 0;
+            for (int i = 0; i < sBlock.dataSize; i++) {
+                stored += isUsed(i) && dedupMap[i].location >= 0 ? 1 : 0;
+                used += refCounts[i] > 0 ? 1 : 0;
+            }
+            LOGF("Deduplication: %d blocks of files in %d data blocks, %lu blocks written were stored already, "
+                 "%lu copied on write, %lu hash collisions", stored, used, (unsigned long) blocksDeduplicated,
+                 (unsigned long) blocksCopied, (unsigned long) hashCollisions);
+        }
+        if (sBlock.dirIndex >= 0) {
+            LOGF("Directory index: %d files beyond the root region, %d buckets, depth %u, %lu splits",
+                 dirHeader.files, dirHeader.buckets, dirHeader.depth, (unsigned long) bucketSplits);
+        }
+        DentryCacheStats dentryStats = dentries.getStats();
+        LOGF("Dentry cache: %lu hits, %lu negative hits, %lu misses, %lu evictions, %u entries",
+             (unsigned long) dentryStats.hits, (unsigned long) dentryStats.negativeHits,
+             (unsigned long) dentryStats.misses, (unsigned long) dentryStats.evictions, dentryStats.resident);
+    }
+    if (blockDevice != nullptr) {
+        punchHoles();
+        blockDevice->flush(0, 0, true);
+
+        // wie viele Block-Requests kostet eine Operation?
+        if (this->logFile != NULL) {
+            blockDevice->printStats(this->logFile, fsOpNames, FS_OP_COUNT);
+        }
+        BlockDeviceStats stats = blockDevice->getStats();
+        for (int op = FS_OP_INIT; op < FS_OP_COUNT; op++) {
+            if (fsOpCalls[op] > 0) {
+                LOGF("%s: %lu calls, %.2f block requests per call", fsOpNames[op], (unsigned long) fsOpCalls[op],
+                     (double) stats.causeRequests[op] / fsOpCalls[op]);
+            }
+        }
+        // Verteilung der Last auf die Container
+        for (uint32_t i = 0; compositeDevice != nullptr && i < compositeDevice->getMemberCount(); i++) {
+            BlockDeviceStats member = compositeDevice->getMember(i)->getStats();
+            LOGF("Container file %u: %lu reads, %lu bytes read, %lu writes, %lu bytes written", i,
+                 (unsigned long) member.requests[BD_OP_READ], (unsigned long) member.bytes[BD_OP_READ],
+                 (unsigned long) member.requests[BD_OP_WRITE], (unsigned long) member.bytes[BD_OP_WRITE]);
+            if (mirroredDevice != nullptr) {
+                ReplicaStats replica = mirroredDevice->getReplicaStats(i);
+                LOGF("Replica %u: %lu reads, %lu writes, %lu read errors, %lu write errors, queue depth mean %.2f, "
+                     "max %u%s", i, (unsigned long) replica.reads, (unsigned long) replica.writes,
+                     (unsigned long) replica.readErrors, (unsigned long) replica.writeErrors,
+                     replica.reads + replica.writes > 0 ?
+                     (double) replica.queueDepthSum / (replica.reads + replica.writes) : 0.0,
+                     replica.queueDepthMax, replica.failed ? ", FAILED" : "");
+            }
+        }
+        for (size_t i = 0; i < latencyDevices.size(); i++) {
+            LOGF("Emulated storage %lu: %.3f s of latency added", (unsigned long) i,
+                 latencyDevices[i]->getDelayNs() / 1e9);
+        }
+        if (checksumDevice != nullptr) {
+            LOGF("Checksums: %lu blocks verified, %lu mismatches", (unsigned long) checksumDevice->getVerified(),
+                 (unsigned long) checksumDevice->getMismatches());
+        }
+        blockDevice->close();
+    }
+
+}
 
-    // Implement this!
-
-}
-
 
 // Additional methods:
 
 bool MyOnDiskFS::fileExists(const char *path) {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (root[i].name[0] != '\0') {
-            if (strcmp(root[i].name, path) == 0) {
-                return true;
+    return findFile(path) != nullptr;
+}
+
+file *MyOnDiskFS::findFile(const char *path) {
+    bool isDir;
+    int slot = findSlot(path, &isDir);
+    return slot >= 0 ? entryOf(slot) : nullptr;
+}
+
+/// @brief Write the changed blocks of the FAT.
+///
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeFatToDisc() {
+    return writeDirtyBlocks(sBlock.fatAddress, fat, FATSIZE, fatDirty);
+}
+
+void MyOnDiskFS::writeRootToDisc() {
+    writeToDisc(sBlock.rootAddress, root, ROOTSIZE);
+}
+
+/// @brief Write the changed blocks of the dmap.
+///
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeDmapToDisc() {
+    return writeDirtyBlocks(sBlock.dmapAddress, dmap, DMAPSIZE, dmapDirty);
+}
+
+/// @brief Write the changed blocks of the cmap.
+///
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeCmapToDisc() {
+    if (cmap == nullptr) {
+        return 0;
+    }
+    return writeDirtyBlocks(sBlock.cmapAddress, cmap, CMAPSIZE, cmapDirty);
+}
+
+/// @brief Write the changed blocks of the dedup map.
+///
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeDedupMapToDisc() {
+    if (dedupMap == nullptr) {
+        return 0;
+    }
+    return writeDirtyBlocks(sBlock.dedupAddress, dedupMap, DEDUPSIZE, dedupDirty);
+}
+
+/// @brief Write the changed blocks of a metadata region.
+///
+/// Runs of consecutive changed blocks are written with one writeToDisc() each, then the blocks count as unchanged.
+/// \param [in] address Number of the first block of the region.
+/// \param [in] data The region.
+/// \param [in] size Size of the region in bytes.
+/// \param [in,out] dirty Whether each block of the region was changed since it was written.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeDirtyBlocks(int address, const void *data, size_t size, std::vector<bool> &dirty) {
+    int ret = 0;
+    size_t blockCount = std::min(dirty.size(), (size + sBlock.blockSize - 1) / sBlock.blockSize);
+    for (size_t b = 0; b < blockCount; b++) {
+        if (!dirty[b]) {
+            continue;
+        }
+        size_t end = b + 1;
+        while (end < blockCount && dirty[end]) {
+            end++;
+        }
+        size_t first = b * sBlock.blockSize;
+        int runRet = writeToDisc(address + (int) b, (const char *) data + first,
+                                 std::min(size, end * sBlock.blockSize) - first);
+        ret = ret < 0 ? ret : runRet;
+        metadataBlocksWritten += end - b;
+        for (; b < end; b++) {
+            dirty[b] = false;
+        }
+    }
+    return ret;
+}
+
+/// @brief Change an entry of the FAT.
+///
+/// \param [in] index Index of the data block.
+/// \param [in] next The next data block of the chain, EOF at its end or INT32_MAX for a free block.
+void MyOnDiskFS::setFat(int index, int next) {
+    if (fat[index] != next) {
+        fat[index] = next;
+        markDirty(fatDirty, index * sizeof(int), (index + 1) * sizeof(int), sBlock.blockSize);
+    }
+}
+
+/// @brief Check the entry of a data block in the dmap.
+///
+/// \param [in] index Index of the data block.
+/// \return Whether the block is used.
+bool MyOnDiskFS::isUsed(int index) {
+    return (dmap[index / DMAP_WORD_BITS] >> (index % DMAP_WORD_BITS)) & 1;
+}
+
+/// @brief Change an entry of the dmap.
+///
+/// \param [in] index Index of the data block.
+/// \param [in] used Whether the block is used.
+void MyOnDiskFS::setUsed(int index, bool used) {
+    uint64_t bit = (uint64_t) 1 << (index % DMAP_WORD_BITS);
+    uint64_t &word = dmap[index / DMAP_WORD_BITS];
+    if (((word & bit) != 0) != used) {
+        word ^= bit;
+        if (used) {
+            freeExtents.reserve(index, 1);
+        } else {
+            freeExtents.release(index, 1);
+        }
+        size_t offset = index / DMAP_WORD_BITS * sizeof(uint64_t);
+        markDirty(dmapDirty, offset, offset + sizeof(uint64_t), sBlock.blockSize);
+    }
+}
+
+/// @brief Change an entry of the cmap.
+///
+/// \param [in] block Index of the data block.
+/// \param [in] entry Stored length of the chunk starting at the block, with CMAP_RAW if it is not compressed.
+void MyOnDiskFS::setChunkEntry(int block, uint32_t entry) {
+    if (cmap[block] != entry) {
+        cmap[block] = entry;
+        markDirty(cmapDirty, block * sizeof(uint32_t), (block + 1) * sizeof(uint32_t), sBlock.blockSize);
+    }
+}
+
+/// @brief Read a metadata region.
+///
+/// Read size bytes stored in the consecutive blocks starting at address through the block cache. Blocks that are not
+/// cached are read with a single block device request.
+/// \param [in] address Number of the first block of the region.
+/// \param [out] data Buffer for storing the region, at least size bytes.
+/// \param [in] size Size of the region in bytes.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::readFromDisc(int address, void *data, size_t size) {
+    if (data == blockDevice->getBlockPointer(address, 1)) { // Region liegt im gemappten Container
+        return 0;
+    }
+    int blockCount = (size + sBlock.blockSize - 1) / sBlock.blockSize;
+    std::vector<uint32_t> blockNos(blockCount);
+    std::vector<char *> frames(blockCount);
+    for (int k = 0; k < blockCount; k++) {
+        blockNos[k] = address + k;
+    }
+    int ret = cache->pin(blockNos.data(), blockCount, frames.data());
+    if (ret < 0) {
+        return ret;
+    }
+    for (int k = 0; k < blockCount; k++) {
+        size_t n = size - k * sBlock.blockSize < sBlock.blockSize ? size - k * sBlock.blockSize : sBlock.blockSize;
+        memcpy((char *) data + k * sBlock.blockSize, frames[k], n);
+    }
+    cache->unpin(blockNos.data(), blockCount);
+    return 0;
+}
+
+/// @brief Write a metadata region.
+///
+/// Write size bytes to the consecutive blocks starting at address through the block cache. In write-through mode the
+/// cache writes them with a single block device request, in write-back mode they are written later. The unused rest of
+/// the last block is filled with zeros. In write-through mode the changed checksums are stored along with them.
+/// \param [in] address Number of the first block of the region.
+/// \param [in] data The region to write.
+/// \param [in] size Size of the region in bytes.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeToDisc(int address, const void *data, size_t size) {
+    if (data == blockDevice->getBlockPointer(address, 1)) { // Region liegt im gemappten Container
+        return 0;
+    }
+    int blockCount = (size + sBlock.blockSize - 1) / sBlock.blockSize;
+    std::vector<uint32_t> blockNos(blockCount);
+    std::vector<char *> frames(blockCount);
+    std::unique_ptr<bool[]> fetch(new bool[blockCount]());
+    for (int k = 0; k < blockCount; k++) {
+        blockNos[k] = address + k;
+    }
+    int ret = cache->pin(blockNos.data(), blockCount, frames.data(), fetch.get());
+    if (ret < 0) {
+        return ret;
+    }
+    for (int k = 0; k < blockCount; k++) {
+        size_t n = size - k * sBlock.blockSize < sBlock.blockSize ? size - k * sBlock.blockSize : sBlock.blockSize;
+        memcpy(frames[k], (const char *) data + k * sBlock.blockSize, n);
+        memset(frames[k] + n, 0, sBlock.blockSize - n);
+    }
+    ret = cache->commit(blockNos.data(), blockCount);
+    cache->unpin(blockNos.data(), blockCount);
+    if (ret < 0) { // Cache soll nicht vom Container abweichen
+        for (int k = 0; k < blockCount; k++) {
+            cache->discard(blockNos[k]);
+        }
+    } else if (checksumDevice != nullptr && !cache->isWriteBack()) {
+        // Prüfsummen der bis hierher geschriebenen Blöcke mit den Metadaten sichern
+        ret = checksumDevice->writeChecksums();
+    }
+    return ret;
+}
+
+/// @brief Transfer file data between a buffer and the data blocks of a file.
+///
+/// The blocks holding the bytes are taken from the extent map of the file, run by run, instead of following the FAT
+/// chain, and passed to transferBlocks().
+/// \param [in] extents Extent map of the file.
+/// \param [in] logical Index of the block of the file containing the first byte.
+/// \param [in] blockOffset Position of the first byte within that block.
+/// \param [in,out] buf Source (isWrite) or destination of the data, at least size bytes.
+/// \param [in] size Number of bytes to transfer.
+/// \param [in] isWrite true to write buf to the file, false to read from the file into buf.
+/// \param [in] handle Open file the transfer belongs to.
+/// \return 0 on success, -EIO if the file has fewer blocks, -ERRNO on other failures.
+int MyOnDiskFS::transferData(const ExtentMap &extents, int logical, size_t blockOffset, char *buf, size_t size,
+                             bool isWrite, OpenFile *handle) {
+    int blockCount = (blockOffset + size + sBlock.blockSize - 1) / sBlock.blockSize;
+    std::vector<int> indices(blockCount);
+    for (int k = 0; k < blockCount;) {
+        int run = 0;
+        int index = extents.lookup(logical + k, &run);
+        if (index < 0) {
+            return -EIO;
+        }
+        for (; run > 0 && k < blockCount; run--, k++) {
+            indices[k] = index++;
+        }
+    }
+    return transferBlocks(indices.data(), blockOffset, buf, size, isWrite);
+}
+
+/// @brief Transfer data between a buffer and data blocks.
+///
+/// Move size bytes, beginning at blockOffset within the first block, between buf and the cached copies of the blocks.
+/// The block cache reads missing blocks with one request per run of consecutive blocks; blocks that are overwritten
+/// completely are not read at all. Written blocks are committed to the cache, which stores them in the container file
+/// right away or, in write-back mode, later. In a deduplicating container the blocks are read from the data blocks
+/// holding their content and written by writeDedup().
+/// \param [in] indices Indices of the blocks in the FAT, one for each block the bytes touch.
+/// \param [in] blockOffset Position of the first byte within the first block.
+/// \param [in,out] buf Source (isWrite) or destination of the data, at least size bytes.
+/// \param [in] size Number of bytes to transfer.
+/// \param [in] isWrite true to write buf to the blocks, false to read from the blocks into buf.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::transferBlocks(const int *indices, size_t blockOffset, char *buf, size_t size, bool isWrite) {
+    if (size == 0) {
+        return 0;
+    }
+    if (isWrite && dedupMap != nullptr) {
+        return writeDedup(indices, blockOffset, buf, size);
+    }
+
+    // gemappter Container: direkt kopieren, ohne Cache und ohne Block-Requests
+    char *mapped = blockDevice->getBlockPointer(sBlock.dataAddress, sBlock.dataSize);
+    if (mapped != nullptr) {
+        size_t done = 0;
+        for (int k = 0; done < size; k++) {
+            size_t n = sBlock.blockSize - blockOffset < size - done ? sBlock.blockSize - blockOffset : size - done;
+            int dataBlock = dataBlockOf(indices[k]);
+            if (dataBlock < 0) { // Kettenblock ohne Inhalt
+                memset(buf + done, 0, n);
+            } else if (isWrite) {
+                memcpy(mapped + (size_t) dataBlock * sBlock.blockSize + blockOffset, buf + done, n);
+                unwritten[dataBlock] = false;
+            } else {
+                memcpy(buf + done, mapped + (size_t) dataBlock * sBlock.blockSize + blockOffset, n);
+            }
+            done += n;
+            blockOffset = 0;
+        }
+        return 0;
+    }
+
+    // nie geschriebene Blöcke werden nicht gelesen: beim Lesen gar nicht gepinnt, beim Schreiben mit Nullen gefüllt
+    int blockCount = (blockOffset + size + sBlock.blockSize - 1) / sBlock.blockSize;
+    size_t tailBytes = (blockOffset + size) % sBlock.blockSize;
+    std::vector<int> dataBlocks(blockCount);
+    std::vector<uint32_t> blockNos;
+    std::vector<char *> frames(blockCount, nullptr);
+    std::unique_ptr<bool[]> fetch(new bool[blockCount]);
+    for (int k = 0; k < blockCount; k++) {
+        dataBlocks[k] = dataBlockOf(indices[k]);
+        bool zeros = dataBlocks[k] < 0 || unwritten[dataBlocks[k]];
+        if (isWrite || !zeros) {
+            // beim Schreiben nur Teilblöcke lesen (read-modify-write)
+            fetch[blockNos.size()] = !zeros &&
+                                     (!isWrite || (k == 0 && blockOffset != 0) || (k == blockCount - 1 && tailBytes != 0));
+            blockNos.push_back(sBlock.dataAddress + dataBlocks[k]);
+        }
+    }
+
+    std::vector<char *> pinned(blockNos.size());
+    int ret = cache->pin(blockNos.data(), blockNos.size(), pinned.data(), fetch.get());
+    if (ret < 0) {
+        return ret;
+    }
+    for (int k = 0, p = 0; k < blockCount; k++) {
+        if (isWrite || (dataBlocks[k] >= 0 && !unwritten[dataBlocks[k]])) {
+            frames[k] = pinned[p++];
+        }
+    }
+
+    size_t done = 0;
+    for (int k = 0; k < blockCount; k++) {
+        size_t n = sBlock.blockSize - blockOffset < size - done ? sBlock.blockSize - blockOffset : size - done;
+        if (isWrite) {
+            if (unwritten[dataBlocks[k]] && n < sBlock.blockSize) {
+                memset(frames[k], 0, sBlock.blockSize);
             }
+            memcpy(frames[k] + blockOffset, buf + done, n);
+        } else if (frames[k] == nullptr) {
+            memset(buf + done, 0, n);
+        } else {
+            memcpy(buf + done, frames[k] + blockOffset, n);
+        }
+        done += n;
+        blockOffset = 0;
+    }
+
+    if (isWrite) {
+        ret = cache->commit(blockNos.data(), blockNos.size());
+    }
+    cache->unpin(blockNos.data(), blockNos.size());
+    if (ret < 0) { // Cache soll nicht vom Container abweichen
+        for (size_t k = 0; k < blockNos.size(); k++) {
+            cache->discard(blockNos[k]);
+        }
+    } else if (isWrite) {
+        for (int k = 0; k < blockCount; k++) {
+            unwritten[dataBlocks[k]] = false;
         }
     }
-    return false;
+    return ret;
 }
 
-file *MyOnDiskFS::findFile(const char *path) {
-    for (int i = 0; i < NUM_DIR_ENTRIES; i++) {
-        if (root[i].name[0] != '\0') {
-            if (strcmp(root[i].name, path) == 0) {
-                return &root[i];
+/// @brief Read the superblock of a container file.
+///
+/// The superblock is read with the smallest block size, before the block device for the container is set up. Only
+/// containers in the current format are accepted: older ones keep one byte per block in the dmap instead of one bit,
+/// or even lack the entry of "/" and have smaller directory entries in root. A superblock carrying a checksum must
+/// match it.
+/// \param [in] path Path of the container file.
+/// \return 0 on success, -ENOENT if the container file does not exist, -EPROTO if the container has another format,
+/// -EBADMSG if the checksum does not match, -EINVAL if a region lies outside the container or is too small for the data
+/// blocks, -ERRNO on other failures.
+int MyOnDiskFS::readSuperblock(const char *path) {
+    BlockDevice probe(MIN_BLOCK_SIZE);
+    int ret = probe.open(path);
+    if (ret < 0) {
+        return ret;
+    }
+    char puffer[MIN_BLOCK_SIZE];
+    ret = probe.read(0, puffer);
+    probe.close();
+    if (ret < 0) {
+        return ret;
+    }
+
+    memcpy(&sBlock, puffer, sizeof(superblock));
+    if (sBlock.magic != SUPERBLOCK_MAGIC || sBlock.version != SUPERBLOCK_VERSION) {
+        return -EPROTO; // anderes Format, dmap oder root passen nicht
+    }
+    if (sBlock.checksum != 0) {
+        uint32_t stored = sBlock.checksum;
+        sBlock.checksum = 0;
+        if (crc32c(0, &sBlock, sizeof(superblock)) != stored) {
+            return -EBADMSG;
+        }
+    }
+    if (sBlock.blockSize < MIN_BLOCK_SIZE || sBlock.blockSize > MAX_BLOCK_SIZE ||
+        (sBlock.blockSize & (sBlock.blockSize - 1)) != 0 || sBlock.dataAddress + sBlock.dataSize > sBlock.blockDeviceSize ||
+        sBlock.fatAddress + sBlock.fatBlocks > sBlock.blockDeviceSize ||
+        sBlock.dataSize < 0 || sBlock.fatBlocks < 0 || sBlock.dmapBlocks < 0 ||
+        (size_t) sBlock.fatBlocks * sBlock.blockSize < sBlock.dataSize * sizeof(int) ||
+        (size_t) sBlock.dmapBlocks * sBlock.blockSize < dmapSize(sBlock.dataSize) ||
+        sBlock.dmapAddress + sBlock.dmapBlocks > sBlock.blockDeviceSize ||
+        (sBlock.stripeCount > 0 && sBlock.stripeSize == 0) || (sBlock.stripeCount > 0 && sBlock.mirrorCount > 0) ||
+        sBlock.sumBlocks < 0 || sBlock.sumAddress + sBlock.sumBlocks > sBlock.blockDeviceSize ||
+        sBlock.chunkSize % sBlock.blockSize != 0 || sBlock.chunkSize > MAX_CHUNK_SIZE ||
+        (sBlock.chunkSize > 0 && (size_t) sBlock.cmapBlocks * sBlock.blockSize < sBlock.dataSize * sizeof(uint32_t)) ||
+        sBlock.cmapAddress + sBlock.cmapBlocks > sBlock.blockDeviceSize || sBlock.dedupBlocks < 0 ||
+        (sBlock.dedupBlocks > 0 &&
+         (size_t) sBlock.dedupBlocks * sBlock.blockSize < sBlock.dataSize * sizeof(dedupEntry)) ||
+        sBlock.dedupAddress + sBlock.dedupBlocks > sBlock.blockDeviceSize ||
+        (sBlock.sumBlocks > 0 && (size_t) sBlock.sumBlocks * sBlock.blockSize / sizeof(uint32_t) <
+                                 (size_t) sBlock.blockDeviceSize) ||
+        sBlock.dirIndex < -1 || sBlock.dirIndex >= sBlock.dataSize ||
+        (size_t) (sBlock.dataAddress - sBlock.rootAddress) * sBlock.blockSize < NUM_DIR_ENTRIES * sizeof(file)) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/// @brief Compute the layout of a new container.
+///
+/// Block 0 holds the superblock, followed by the dmap, the FAT, the checksums and the root directory. The remaining
+/// blocks hold file data; their number is chosen as large as possible while dmap and FAT still have an entry for each
+/// of them. A compressed container has a cmap with an entry for each data block between the FAT and the checksums,
+/// a deduplicating container a dedup map behind it. The checksum region holds a CRC32C for every block of the
+/// container.
+/// \param [out] sb Superblock receiving the layout.
+/// \param [in] blockSize Block size in bytes, a power of two from MIN_BLOCK_SIZE to MAX_BLOCK_SIZE.
+/// \param [in] deviceSize Size of the container in blocks.
+/// \param [in] checksums false to leave out the checksum region.
+/// \param [in] chunkSize Size in bytes of the chunks file data is compressed in, a multiple of the block size up to
+/// MAX_CHUNK_SIZE, 0 to store file data uncompressed.
+/// \param [in] dedup true to store identical data blocks only once.
+/// \return 0 on success, -EINVAL if the block size or chunk size is invalid or the container is too small.
+int MyOnDiskFS::computeLayout(superblock *sb, uint32_t blockSize, int deviceSize, bool checksums, uint32_t chunkSize,
+                              bool dedup) {
+    if (blockSize < MIN_BLOCK_SIZE || blockSize > MAX_BLOCK_SIZE || (blockSize & (blockSize - 1)) != 0 ||
+        chunkSize % blockSize != 0 || chunkSize > MAX_CHUNK_SIZE) {
+        return -EINVAL;
+    }
+
+    int rootBlocks = (NUM_DIR_ENTRIES * sizeof(file) + blockSize - 1) / blockSize;
+    int sumBlocks = checksums ? (int) (((int64_t) deviceSize * sizeof(uint32_t) + blockSize - 1) / blockSize) : 0;
+    int dataSize = deviceSize - 1 - sumBlocks - rootBlocks;
+    int dmapBlocks = 0;
+    int fatBlocks = 0;
+    int cmapBlocks = 0;
+    int dedupBlocks = 0;
+    while (dataSize > 0) {
+        dmapBlocks = (dmapSize(dataSize) + blockSize - 1) / blockSize;
+        fatBlocks = (dataSize * sizeof(int) + blockSize - 1) / blockSize;
+        cmapBlocks = chunkSize > 0 ? (dataSize * sizeof(uint32_t) + blockSize - 1) / blockSize : 0;
+        dedupBlocks = dedup ? (dataSize * sizeof(dedupEntry) + blockSize - 1) / blockSize : 0;
+        int fit = deviceSize - 1 - dmapBlocks - fatBlocks - cmapBlocks - dedupBlocks - sumBlocks - rootBlocks;
+        if (fit >= dataSize) {
+            break;
+        }
+        dataSize = fit;
+    }
+    if (dataSize <= 0) {
+        return -EINVAL;
+    }
+
+    // Blöcke, die beim Verkleinern übrig bleiben, nutzen, soweit dmap und FAT noch Einträge für sie haben
+    int dataAddress = 1 + dmapBlocks + fatBlocks + cmapBlocks + dedupBlocks + sumBlocks + rootBlocks;
+    dataSize = std::min((size_t) (deviceSize - dataAddress),
+                        std::min((size_t) dmapBlocks * blockSize * 8, fatBlocks * blockSize / sizeof(int)));
+    if (dedup) {
+        dataSize = std::min((size_t) dataSize, dedupBlocks * blockSize / sizeof(dedupEntry));
+    }
+
+    sb->magic = SUPERBLOCK_MAGIC;
+    sb->blockSize = blockSize;
+    sb->dmapAddress = 1;
+    sb->dmapBlocks = dmapBlocks;
+    sb->fatBlocks = fatBlocks;
+    sb->fatAddress = sb->dmapAddress + dmapBlocks;
+    sb->chunkSize = chunkSize;
+    sb->cmapAddress = chunkSize > 0 ? sb->fatAddress + fatBlocks : 0;
+    sb->cmapBlocks = cmapBlocks;
+    sb->dedupAddress = dedup ? sb->fatAddress + fatBlocks + cmapBlocks : 0;
+    sb->dedupBlocks = dedupBlocks;
+    sb->sumAddress = sb->fatAddress + fatBlocks + cmapBlocks + dedupBlocks;
+    sb->sumBlocks = sumBlocks;
+    sb->rootAddress = sb->sumAddress + sumBlocks;
+    sb->dataAddress = sb->rootAddress + rootBlocks;
+    sb->blockDeviceSize = deviceSize;
+    sb->dataSize = dataSize;
+    sb->stripeCount = 0;
+    sb->stripeSize = 0;
+    sb->mirrorCount = 0;
+    sb->checksum = 0;
+    sb->dirIndex = -1;
+    sb->version = SUPERBLOCK_VERSION;
+    return 0;
+}
+
+/// @brief Allocate dmap, FAT and root, and cmap and dedup map if the container has them.
+///
+/// The arrays span their whole regions, so they can be read and written block by block.
+void MyOnDiskFS::allocMetadata() {
+    DMAPSIZE = dmapSize(sBlock.dataSize);
+    FATSIZE = sBlock.dataSize * sizeof(int);
+    ROOTSIZE = NUM_DIR_ENTRIES * sizeof(file);
+    dmap = (uint64_t *) allocAligned((size_t) sBlock.dmapBlocks * sBlock.blockSize);
+    fat = (int *) allocAligned((size_t) sBlock.fatBlocks * sBlock.blockSize);
+    root = (file *) allocAligned((size_t) (sBlock.dataAddress - sBlock.rootAddress) * sBlock.blockSize);
+    dmapDirty.assign(sBlock.dmapBlocks, false);
+    fatDirty.assign(sBlock.fatBlocks, false);
+    cmapDirty.assign(sBlock.cmapBlocks, false);
+    dedupDirty.assign(sBlock.dedupBlocks, false);
+    if (sBlock.cmapBlocks > 0) {
+        CMAPSIZE = sBlock.dataSize * sizeof(uint32_t);
+        cmap = (uint32_t *) allocAligned((size_t) sBlock.cmapBlocks * sBlock.blockSize);
+    }
+    if (sBlock.dedupBlocks > 0) {
+        DEDUPSIZE = sBlock.dataSize * sizeof(dedupEntry);
+        dedupMap = (dedupEntry *) allocAligned((size_t) sBlock.dedupBlocks * sBlock.blockSize);
+        refCounts.assign(sBlock.dataSize, 0);
+    }
+}
+
+/// @brief Use the metadata regions in place.
+///
+/// If the block device maps the container file into memory, the dmap, FAT and root arrays are pointed to the mapped
+/// regions instead of keeping copies. Reading and writing the regions then costs no copies at all.
+void MyOnDiskFS::mapMetadata() {
+    char *dmapBlocks = blockDevice->getBlockPointer(sBlock.dmapAddress, sBlock.dmapBlocks);
+    char *fatBlocks = blockDevice->getBlockPointer(sBlock.fatAddress, sBlock.fatBlocks);
+    char *rootBlocks = blockDevice->getBlockPointer(sBlock.rootAddress, sBlock.dataAddress - sBlock.rootAddress);
+    if (metadataMapped || dmapBlocks == nullptr || fatBlocks == nullptr || rootBlocks == nullptr) {
+        return;
+    }
+
+    free(fat);
+    free(dmap);
+    free(root);
+    dmap = (uint64_t *) dmapBlocks;
+    fat = (int *) fatBlocks;
+    root = (file *) rootBlocks;
+    metadataMapped = true;
+}
+
+/// @brief Write back a file.
+///
+/// The chunk buffer of a file in a compressed container is stored first. With a memory-mapped container only the data
+/// blocks of the file and the metadata regions are written back, range by range. Otherwise the dirty blocks of the
+/// file and the metadata regions are written from the block cache, and the container file is synced as a whole if
+/// requested. For a file beyond the root region the blocks of the directory index leading to its entry are written
+/// back as well.
+/// \param [in] myFile The file.
+/// \param [in] wait true to wait until the blocks are stored.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::flushFile(file *myFile, bool wait) {
+    int ret = sBlock.chunkSize > 0 ? flushChunk(myFile) : 0;
+    if (ret < 0) {
+        return ret;
+    }
+    ExtentMap &extents = extentsOf(myFile);
+    std::vector<int> dirBlocks;
+    dirBlocksOf(myFile, dirBlocks);
+
+    if (blockDevice->getBlockPointer(sBlock.dataAddress, sBlock.dataSize) == nullptr) {
+        std::vector<uint32_t> blockNos;
+        // dmap, FAT, cmap und Dedup-Map
+        for (int b = 0; b < sBlock.dmapBlocks + sBlock.fatBlocks + sBlock.cmapBlocks + sBlock.dedupBlocks; b++) {
+            blockNos.push_back(sBlock.dmapAddress + b);
+        }
+        for (int b = sBlock.rootAddress; b < sBlock.dataAddress; b++) { // root
+            blockNos.push_back(b);
+        }
+        for (int block : dirBlocks) {
+            blockNos.push_back(sBlock.dataAddress + block);
+        }
+        int run = 0;
+        for (int logical = 0; logical < extents.blocks(); logical += run) {
+            int index = extents.lookup(logical, &run);
+            for (int k = index; k < index + run; k++) {
+                if (dataBlockOf(k) >= 0) {
+                    blockNos.push_back(sBlock.dataAddress + dataBlockOf(k));
+                }
+            }
+        }
+        ret = cache->flush(blockNos.data(), blockNos.size());
+        if (ret == 0 && wait) {
+            ret = blockDevice->flush(0, 0, true);
+        }
+        return ret;
+    }
+
+    int run = 0;
+    for (int logical = 0; logical < extents.blocks() && ret == 0; logical += run) {
+        int index = extents.lookup(logical, &run);
+        // ein Lauf der Kette, im Dedup-Container liegen seine Datenblöcke nicht unbedingt hintereinander
+        for (int k = index; k < index + run && ret == 0;) {
+            int runStart = dataBlockOf(k);
+            int runLength = 1;
+            while (runStart >= 0 && k + runLength < index + run && dataBlockOf(k + runLength) == runStart + runLength) {
+                runLength++;
+            }
+            if (runStart >= 0) {
+                ret = blockDevice->flush(sBlock.dataAddress + runStart, runLength, wait);
             }
+            k += runLength;
         }
     }
-    return nullptr;
+    for (size_t k = 0; k < dirBlocks.size() && ret == 0; k++) {
+        ret = blockDevice->flush(sBlock.dataAddress + dirBlocks[k], 1, wait);
+    }
+    if (ret == 0) {
+        ret = blockDevice->flush(0, sBlock.dataAddress, wait); // superblock und root, dmap und FAT falls davor
+    }
+    if (ret == 0 && sBlock.dmapAddress > sBlock.dataAddress) { // verschobene dmap, FAT, cmap und Dedup-Map
+        ret = blockDevice->flush(sBlock.dmapAddress,
+                                 sBlock.dmapBlocks + sBlock.fatBlocks + sBlock.cmapBlocks + sBlock.dedupBlocks, wait);
+    }
+    return ret;
 }
 
-void MyOnDiskFS::writeFatToDisc() {
-    char puffer[BLOCK_SIZE];
-    int i = 0;
-    while (i < FATSIZE / BLOCK_SIZE) {
-        memcpy(puffer, &fat + i * BLOCK_SIZE, BLOCK_SIZE);
-        blockDevice->write(sBlock.fatAddress + i, puffer); //Block 3ff. = fatAddress lesen
-        i++;
+/// @brief Get the extent map of a file.
+///
+/// The map is built by walking the chain of the file once, when the file is first read, written, truncated or flushed
+/// after it was opened. Afterwards a block of the file is found without following the chain, and its end without
+/// walking to it. The map is dropped when the file is closed or deleted, and in a compressed container whenever a chunk
+/// changes the chain.
+/// \param [in] myFile The file.
+/// \return The map of the blocks of its chain.
+ExtentMap &MyOnDiskFS::extentsOf(file *myFile) {
+    int slot = slotOf(myFile);
+    auto it = extentMaps.find(slot);
+    if (it != extentMaps.end()) {
+        return it->second;
     }
-    if ((FATSIZE % BLOCK_SIZE) != 0) {
-        memcpy(puffer, &fat + i * BLOCK_SIZE, FATSIZE - i * BLOCK_SIZE);
-        blockDevice->write(sBlock.fatAddress + i, puffer);
+    ExtentMap &extents = extentMaps[slot];
+    int index = myFile->dataSize > 0 ? myFile->fat_data : EOF;
+    while (index != EOF && index >= 0 && index < sBlock.dataSize && extents.blocks() < sBlock.dataSize) {
+        extents.append(index, 1);
+        index = fat[index];
     }
+    extentMapsBuilt++;
+    return extents;
 }
 
-void MyOnDiskFS::writeRootToDisc() {
-    char puffer[BLOCK_SIZE];
-    int i = 0;
-    while (i < ROOTSIZE / BLOCK_SIZE) {
-        memcpy(puffer, &root + i * BLOCK_SIZE, BLOCK_SIZE);
-        blockDevice->write(sBlock.rootAddress + i, puffer);
-        i++;
+/// @brief Read ahead after a read.
+///
+/// A handle whose reads continue where the previous read stopped is read sequentially. For such a stream the blocks
+/// of the file following the read are prefetched into the block cache. The next window is started when the reads
+/// reach the middle of the current one, and each window is twice as large as the previous one up to readaheadMax
+/// blocks. A read elsewhere in the file ends the stream.
+/// \param [in] myFile The file.
+/// \param [in,out] handle Open file handle of the read, keeps the state of the stream.
+/// \param [in] offset Position of the read.
+/// \param [in] size Number of bytes read.
+void MyOnDiskFS::readahead(file *myFile, OpenFile *handle, off_t offset, size_t size) {
+    if (readaheadMax == 0 || size == 0 || blockDevice->getBlockPointer(sBlock.dataAddress, sBlock.dataSize) != nullptr) {
+        return;
     }
-    if ((ROOTSIZE % BLOCK_SIZE) != 0) { //unreachable, da immer 20480/512=40 mit jetziger Konfig.
-        memcpy(puffer, &root + i * BLOCK_SIZE, ROOTSIZE - i * BLOCK_SIZE);
-        blockDevice->write(sBlock.rootAddress + i, puffer);
+
+    if (offset == handle->nextOffset) {
+        handle->sequentialReads++;
+    } else { // neuer Strom
+        handle->sequentialReads = 1;
+        handle->raWindow = 0;
+        handle->raEnd = 0;
+    }
+    handle->nextOffset = offset + size;
+    if (handle->sequentialReads < 2) {
+        return;
+    }
+
+    uint32_t firstBlock = offset / sBlock.blockSize;
+    uint32_t endBlock = (offset + size + sBlock.blockSize - 1) / sBlock.blockSize;
+    uint32_t fileBlocks = (myFile->dataSize + sBlock.blockSize - 1) / sBlock.blockSize;
+    uint32_t window;
+    if (handle->raWindow == 0 || handle->raEnd < endBlock) {
+        handle->raEnd = endBlock;
+        window = 2 * (endBlock - firstBlock) > READAHEAD_MIN_WINDOW ? 2 * (endBlock - firstBlock) : READAHEAD_MIN_WINDOW;
+    } else if (endBlock + handle->raWindow / 2 < handle->raEnd) {
+        return; // noch genug vorausgelesen
+    } else {
+        window = 2 * handle->raWindow;
+    }
+    if (window > readaheadMax) {
+        window = readaheadMax;
+    }
+
+    uint32_t start = handle->raEnd;
+    uint32_t end = start + window < fileBlocks ? start + window : fileBlocks;
+    if (start >= end) {
+        return;
+    }
+
+    std::vector<uint32_t> blockNos;
+    ExtentMap &extents = extentsOf(myFile);
+    uint32_t b = start;
+    while (b < end) {
+        int run = 0;
+        int fatIndex = extents.lookup(b, &run);
+        if (fatIndex < 0) {
+            break;
+        }
+        for (int k = 0; k < run && b < end; k++, b++) {
+            int dataBlock = dataBlockOf(fatIndex + k);
+            if (dataBlock >= 0 && !unwritten[dataBlock]) {
+                blockNos.push_back(sBlock.dataAddress + dataBlock);
+            }
+        }
+    }
+    cache->prefetch(blockNos.data(), blockNos.size());
+
+    handle->raEnd = end;
+    handle->raWindow = window;
+    readaheadWindows++;
+    readaheadBlocks += blockNos.size();
+    if (window > readaheadLargest) {
+        readaheadLargest = window;
     }
 }
 
-void MyOnDiskFS::writeDmapToDisc() {
-    char puffer[BLOCK_SIZE];
-    int i = 0;
-    while (i < DMAPSIZE / BLOCK_SIZE) {
-        memcpy(puffer, &dmap + i * BLOCK_SIZE, BLOCK_SIZE);
-        blockDevice->write(sBlock.dmapAddress + i, puffer); //Block 1 = dmapAddress lesen
-        i++;
+/// @brief Find a chunk of a file in a compressed container.
+///
+/// Walk the chain of the file, skipping the blocks each chunk takes according to the cmap. The walk continues at the
+/// chunk found last unless that lies behind the chunk searched for.
+/// \param [in] myFile The file.
+/// \param [in] chunk Index of the chunk in the file.
+/// \param [out] last The data block before the chunk in the chain, or the last block of the chain if the chunk is not
+/// stored; EOF if there is none.
+/// \param [out] found Number of chunks stored before the chunk, less than chunk if the chain ends earlier.
+/// \return Index of the first data block of the chunk, EOF if the chunk is not stored.
+int MyOnDiskFS::findChunk(file *myFile, int chunk, int *last, int *found) {
+    ChunkBuffer &buffer = chunkBuffers[slotOf(myFile)];
+    int index = myFile->fat_data;
+    int c = 0;
+    *last = EOF;
+    if (buffer.walkChunk >= 0 && buffer.walkChunk <= chunk) {
+        index = buffer.walkIndex;
+        c = buffer.walkChunk;
+        *last = buffer.walkLast;
     }
-    if ((DMAPSIZE % BLOCK_SIZE) != 0) {
-        memcpy(puffer, &dmap + i * BLOCK_SIZE, DMAPSIZE - i * BLOCK_SIZE);
-        blockDevice->write(sBlock.dmapAddress + i, puffer);
+    while (index != EOF && c < chunk) {
+        int blocks = ((cmap[index] & ~CMAP_RAW) + sBlock.blockSize - 1) / sBlock.blockSize;
+        for (int b = 0; b < blocks && index != EOF; b++) {
+            *last = index;
+            index = fat[index];
+        }
+        c++;
+    }
+    *found = c;
+    if (index != EOF) {
+        buffer.walkChunk = chunk;
+        buffer.walkIndex = index;
+        buffer.walkLast = *last;
     }
+    return index;
 }
 
-int MyOnDiskFS::findEmptyDataBlock() {
-    for (int j = 0; j < sBlock.dataSize; ++j) {
-        if (dmap[j] == false) {
-            return j;
+/// @brief Read and decompress a chunk of a file in a compressed container.
+///
+/// A chunk that is not stored reads as zeros, as does the rest of a chunk stored with fewer bytes.
+/// \param [in] myFile The file.
+/// \param [in] chunk Index of the chunk in the file.
+/// \param [out] data Buffer for the chunk, chunkSize bytes.
+/// \return 0 on success, -EIO if the stored chunk is damaged, -ERRNO on other failures.
+int MyOnDiskFS::loadChunk(file *myFile, int chunk, char *data) {
+    int last, found;
+    int index = findChunk(myFile, chunk, &last, &found);
+    if (index == EOF) {
+        memset(data, 0, sBlock.chunkSize);
+        return 0;
+    }
+
+    uint32_t stored = cmap[index] & ~CMAP_RAW;
+    if (stored > sBlock.chunkSize) {
+        return -EIO;
+    }
+    std::vector<int> blocks; // Blöcke des Chunks
+    for (int b = index; blocks.size() * sBlock.blockSize < stored; b = fat[b]) {
+        if (b == EOF) {
+            return -EIO;
         }
+        blocks.push_back(b);
     }
-    return -ENOSPC;
+    int ret;
+    size_t size = stored;
+    if ((cmap[index] & CMAP_RAW) != 0) {
+        ret = transferBlocks(blocks.data(), 0, data, stored, false);
+    } else {
+        std::vector<char> packed(stored);
+        ret = transferBlocks(blocks.data(), 0, packed.data(), stored, false);
+        if (ret == 0) {
+            int n = lzDecompress(packed.data(), stored, data, sBlock.chunkSize);
+            ret = n < 0 ? n : 0;
+            size = n < 0 ? 0 : n;
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    memset(data + size, 0, sBlock.chunkSize - size);
+    chunksLoaded++;
+    return 0;
+}
+
+/// @brief Compress and store a chunk of a file in a compressed container.
+///
+/// The chunk is stored compressed if that saves at least one block, otherwise as it is. The blocks it took before are
+/// reused; blocks it needs in addition are allocated before anything is changed and linked in behind them, blocks it
+/// no longer needs are freed. Chunks before it that are not stored yet are stored as zeros first.
+/// \param [in] myFile The file.
+/// \param [in] chunk Index of the chunk in the file.
+/// \param [in] data Content of the chunk.
+/// \param [in] size Number of bytes of the chunk within the file, 1 to chunkSize.
+/// \return 0 on success, -ENOSPC if the container is full, -ERRNO on other failures.
+int MyOnDiskFS::storeChunk(file *myFile, int chunk, const char *data, size_t size) {
+    int last, found;
+    int index = findChunk(myFile, chunk, &last, &found);
+    if (index == EOF && found < chunk) { // Lücke vor dem Chunk
+        std::vector<char> zeros(sBlock.chunkSize, 0);
+        for (int c = found; c < chunk; c++) {
+            int ret = storeChunk(myFile, c, zeros.data(), sBlock.chunkSize);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        index = findChunk(myFile, chunk, &last, &found);
+    }
+
+    // packen, unkomprimiert speichern, wenn es keinen Block spart
+    size_t rawBlocks = (size + sBlock.blockSize - 1) / sBlock.blockSize;
+    std::vector<char> packed(rawBlocks * sBlock.blockSize, 0);
+    uint32_t entry = lzCompress(data, size, packed.data(), (rawBlocks - 1) * sBlock.blockSize);
+    if (entry == 0) {
+        memcpy(packed.data(), data, size);
+        entry = size | CMAP_RAW;
+    }
+    size_t newBlocks = ((entry & ~CMAP_RAW) + sBlock.blockSize - 1) / sBlock.blockSize;
+
+    // bisherige Blöcke des Chunks
+    std::vector<int> blocks;
+    int next = index;
+    if (index != EOF) {
+        int oldBlocks = ((cmap[index] & ~CMAP_RAW) + sBlock.blockSize - 1) / sBlock.blockSize;
+        for (int b = 0; b < oldBlocks && next != EOF; b++) {
+            blocks.push_back(next);
+            next = fat[next];
+        }
+    }
+    bool relink = blocks.size() != newBlocks;
+    size_t oldCount = blocks.size();
+    while (blocks.size() < newBlocks) {
+        int count = 0;
+        int preferred = !blocks.empty() ? blocks.back() + 1 : last != EOF ? last + 1 : -1;
+        int free = findEmptyDataBlocks(preferred, newBlocks - blocks.size(), &count);
+        if (free < 0) { // alter Chunk bleibt erhalten
+            for (size_t k = oldCount; k < blocks.size(); k++) {
+                freeDataBlock(blocks[k]);
+            }
+            return free;
+        }
+        for (int k = free; k < free + count; k++) {
+            setUsed(k, true);
+            setFat(k, EOF);
+            blocks.push_back(k);
+        }
+    }
+    while (blocks.size() > newBlocks) {
+        freeDataBlock(blocks.back());
+        blocks.pop_back();
+    }
+    for (size_t k = 0; k < blocks.size(); k++) {
+        setFat(blocks[k], k + 1 < blocks.size() ? blocks[k + 1] : next);
+    }
+    if (last == EOF) {
+        myFile->fat_data = blocks[0];
+    } else {
+        setFat(last, blocks[0]);
+    }
+    setChunkEntry(blocks[0], entry);
+    ChunkBuffer &buffer = chunkBuffers[slotOf(myFile)];
+    buffer.walkChunk = chunk;
+    buffer.walkIndex = blocks[0];
+    buffer.walkLast = last;
+
+    int ret = transferBlocks(blocks.data(), 0, packed.data(), newBlocks * sBlock.blockSize, true);
+    writeCmapToDisc();
+    if (relink) {
+        extentMaps.erase(slotOf(myFile)); // Kette geändert
+        writeFatToDisc();
+        writeDedupMapToDisc();
+        writeDmapToDisc();
+        if (index == EOF && last == EOF) { // erster Chunk der Datei
+            writeEntry(myFile);
+        }
+        punchHoles();
+    }
+    chunksStored++;
+    chunkBytesIn += size;
+    chunkBytesOut += newBlocks * sBlock.blockSize;
+    return ret;
+}
+
+/// @brief Store the chunk buffer of a file in a compressed container if it was changed.
+///
+/// \param [in] myFile The file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::flushChunk(file *myFile) {
+    ChunkBuffer &buffer = chunkBuffers[slotOf(myFile)];
+    if (buffer.chunk < 0 || !buffer.dirty) {
+        return 0;
+    }
+    size_t start = (size_t) buffer.chunk * sBlock.chunkSize;
+    int ret = 0;
+    if (start < myFile->dataSize) { // sonst abgeschnitten
+        ret = storeChunk(myFile, buffer.chunk, buffer.data.data(),
+                         std::min((size_t) sBlock.chunkSize, myFile->dataSize - start));
+    }
+    if (ret == 0) {
+        buffer.dirty = false;
+    }
+    return ret;
+}
+
+/// @brief Transfer file data between a buffer and the chunks of a file in a compressed container.
+///
+/// The data goes through the chunk buffer of the file. A chunk that is not in the buffer is loaded into it after the
+/// chunk there was stored, unless the chunk is overwritten completely.
+/// \param [in] myFile The file.
+/// \param [in,out] buf Source (isWrite) or destination of the data, at least size bytes.
+/// \param [in] size Number of bytes to transfer.
+/// \param [in] offset Position of the first byte in the file.
+/// \param [in] isWrite true to write buf to the file, false to read from the file into buf.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::transferChunks(file *myFile, char *buf, size_t size, off_t offset, bool isWrite) {
+    ChunkBuffer &buffer = chunkBuffers[slotOf(myFile)];
+    size_t done = 0;
+    while (done < size) {
+        int chunk = (offset + done) / sBlock.chunkSize;
+        size_t pos = (offset + done) % sBlock.chunkSize;
+        size_t n = std::min(size - done, sBlock.chunkSize - pos);
+        if (buffer.chunk != chunk) {
+            int ret = flushChunk(myFile);
+            if (ret < 0) {
+                return ret;
+            }
+            buffer.chunk = -1;
+            buffer.data.resize(sBlock.chunkSize);
+            if (!isWrite || n < sBlock.chunkSize) {
+                ret = loadChunk(myFile, chunk, buffer.data.data());
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            buffer.chunk = chunk;
+            buffer.dirty = false;
+        }
+        if (isWrite) {
+            memcpy(buffer.data.data() + pos, buf + done, n);
+            buffer.dirty = true;
+        } else {
+            memcpy(buf + done, buffer.data.data() + pos, n);
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/// @brief Change the size of a file in a compressed container.
+///
+/// Growing a file only changes its size, the chunks behind the stored ones read as zeros. Shrinking it frees the
+/// chunks behind the new end; the bytes behind the end in the last chunk stay until they are overwritten.
+/// \param [in] myFile The file.
+/// \param [in] newSize New size of the file.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::truncateChunks(file *myFile, off_t newSize) {
+    bool shrink = (size_t) newSize < myFile->dataSize;
+    if (shrink) {
+        int keep = (newSize + sBlock.chunkSize - 1) / sBlock.chunkSize;
+        ChunkBuffer &buffer = chunkBuffers[slotOf(myFile)];
+        if (buffer.chunk >= keep) {
+            buffer.chunk = -1;
+            buffer.dirty = false;
+        }
+        int last, found;
+        int index = findChunk(myFile, keep, &last, &found);
+        if (index != EOF) {
+            if (last == EOF) {
+                myFile->fat_data = -1;
+            } else {
+                setFat(last, EOF);
+            }
+            while (index != EOF) {
+                int next = fat[index];
+                freeDataBlock(index);
+                index = next;
+            }
+            extentMaps.erase(slotOf(myFile));
+        }
+        buffer.walkChunk = -1;
+    }
+    myFile->dataSize = newSize;
+    myFile->mtime = time(NULL);
+
+    writeEntry(myFile);
+    if (shrink) {
+        writeDmapToDisc();
+        writeFatToDisc();
+        writeDedupMapToDisc();
+        writeCmapToDisc();
+        punchHoles();
+    }
+    return 0;
+}
+
+/// @brief Get the data block holding the content of a block of a chain.
+///
+/// \param [in] fatIndex Index of the block in the FAT.
+/// \return Index of the data block, fatIndex itself unless the container is deduplicating, NO_LOCATION if the block
+/// has no content yet.
+int MyOnDiskFS::dataBlockOf(int fatIndex) {
+    return dedupMap != nullptr ? dedupMap[fatIndex].location : fatIndex;
+}
+
+/// @brief Point a block of a chain to the data block holding its content.
+///
+/// \param [in] fatIndex Index of the block in the FAT.
+/// \param [in] block Index of the data block, NO_LOCATION for none.
+void MyOnDiskFS::setLocation(int fatIndex, int block) {
+    dedupMap[fatIndex].location = block;
+    markDirty(dedupDirty, fatIndex * sizeof(dedupEntry), (fatIndex + 1) * sizeof(dedupEntry), sBlock.blockSize);
+}
+
+/// @brief Set the hash of the content of a data block and update the dedup index.
+///
+/// \param [in] block Index of the data block.
+/// \param [in] hash CRC32C of its content, never 0, or 0 to remove the block from the index.
+void MyOnDiskFS::setBlockHash(int block, uint32_t hash) {
+    auto found = dedupIndex.find(dedupMap[block].hash);
+    if (found != dedupIndex.end() && found->second == block) {
+        dedupIndex.erase(found);
+    }
+    if (hash != 0) {
+        dedupIndex[hash] = block;
+    }
+    dedupMap[block].hash = hash;
+    markDirty(dedupDirty, block * sizeof(dedupEntry), (block + 1) * sizeof(dedupEntry), sBlock.blockSize);
+}
+
+/// @brief Drop a reference to a data block of a deduplicating container.
+///
+/// A data block no block of a chain refers to any more is removed from the dedup index, dropped from the cache and
+/// punched out with the next punchHoles().
+/// \param [in] block Index of the data block.
+void MyOnDiskFS::releaseDataBlock(int block) {
+    if (--refCounts[block] > 0) {
+        return;
+    }
+    setBlockHash(block, 0);
+    cache->discard(sBlock.dataAddress + block);
+    freedBlocks.push_back(block);
+    if (block < freeDataHint) {
+        freeDataHint = block;
+    }
+}
+
+/// @brief Find a data block of a deduplicating container no block of a chain refers to.
+///
+/// A chain never has more blocks than there are data blocks, so a free one exists whenever a block of a chain needs
+/// a data block of its own.
+/// \param [in] preferred Data block to use if it is free, usually the one with the index of the block of the chain.
+/// \return Index of the data block, -ENOSPC if there is none.
+int MyOnDiskFS::findFreeDataBlock(int preferred) {
+    if (refCounts[preferred] == 0) {
+        return preferred;
+    }
+    for (int j = freeDataHint; j < sBlock.dataSize; j++) {
+        if (refCounts[j] == 0) {
+            freeDataHint = j;
+            return j;
+        }
+    }
+    return -ENOSPC;
+}
+
+/// @brief Delay the requests to a container file like the storage given with -o latency.
+///
+/// \param [in] device Block device of the container file.
+/// \param [in] member Index of the container file, varies the seed so the files do not act in lockstep.
+/// \return device if no storage is emulated, otherwise a LatencyBlockDevice wrapping it.
+BlockDevice *MyOnDiskFS::emulateLatency(BlockDevice *device, unsigned int member) {
+    MyFsInfo *info = (MyFsInfo *) fuse_get_context()->private_data;
+    if (info->latency == NULL) {
+        return device;
+    }
+    LatencyKind kind = strcmp(info->latency, "hdd") == 0 ? LATENCY_HDD :
+                       strcmp(info->latency, "ssd") == 0 ? LATENCY_SSD : LATENCY_NETWORK;
+    LatencyModel model = LatencyBlockDevice::getDefaultModel(kind);
+    if (info->latencyUs > 0) {
+        // bei der Platte bestimmt die längste Suchzeit die Latenz, sonst die Zeit pro Request
+        if (kind == LATENCY_HDD) {
+            model.seekMaxNs = std::max((uint64_t) info->latencyUs * 1000, model.seekMinNs);
+        } else {
+            model.serviceNs = (uint64_t) info->latencyUs * 1000;
+        }
+    }
+    if (info->bandwidth > 0) {
+        model.bytesPerSec = (uint64_t) info->bandwidth * 1000000;
+    }
+    model.seed = (info->latencySeed > 0 ? info->latencySeed : model.seed) + member;
+    if (member == 0) {
+        if (kind == LATENCY_HDD) {
+            LOGF("Emulated storage: hard disc, seek %.2f to %.2f ms, rotation %.2f ms, %lu MB/s",
+                 model.seekMinNs / 1e6, model.seekMaxNs / 1e6, model.rotationNs / 1e6,
+                 (unsigned long) (model.bytesPerSec / 1000000));
+        } else {
+            LOGF("Emulated storage: %s, %.3f ms per request, jitter %.3f ms, %lu MB/s",
+                 kind == LATENCY_SSD ? "SSD" : "network disc", model.serviceNs / 1e6, model.jitterNs / 1e6,
+                 (unsigned long) (model.bytesPerSec / 1000000));
+        }
+        if (info->memoryMapped) {
+            LOG("The memory mapping is not accessed directly with emulated storage");
+        }
+    }
+    LatencyBlockDevice *latencyDevice = new LatencyBlockDevice(device, model);
+    latencyDevices.push_back(latencyDevice);
+    return latencyDevice;
+}
+
+/// @brief Read the content of a data block.
+///
+/// \param [in] block Index of the data block, NO_LOCATION for a block without content.
+/// \param [out] data Buffer for the content, one block.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::readDataBlock(int block, char *data) {
+    if (block < 0 || unwritten[block]) {
+        memset(data, 0, sBlock.blockSize);
+        return 0;
+    }
+    char *mapped = blockDevice->getBlockPointer(sBlock.dataAddress + block, 1);
+    if (mapped != nullptr) {
+        memcpy(data, mapped, sBlock.blockSize);
+        return 0;
+    }
+    uint32_t blockNo = sBlock.dataAddress + block;
+    char *frame;
+    int ret = cache->pin(&blockNo, 1, &frame);
+    if (ret < 0) {
+        return ret;
+    }
+    memcpy(data, frame, sBlock.blockSize);
+    cache->unpin(&blockNo, 1);
+    return 0;
+}
+
+/// @brief Check whether a data block holds a content.
+///
+/// \param [in] block Index of the data block.
+/// \param [in] data The content, one block.
+/// \param [in] pending Content of the data blocks about to be written, by index.
+/// \return true if the content of the data block, or the content about to be written to it, equals data.
+bool MyOnDiskFS::isStoredIn(int block, const char *data, const std::map<int, const char *> &pending) {
+    auto found = pending.find(block);
+    if (found != pending.end()) {
+        return memcmp(found->second, data, sBlock.blockSize) == 0;
+    }
+    std::vector<char> stored(sBlock.blockSize);
+    return readDataBlock(block, stored.data()) == 0 && memcmp(stored.data(), data, sBlock.blockSize) == 0;
+}
+
+/// @brief Write file data to the blocks of a chain in a deduplicating container.
+///
+/// Blocks written partially are completed with their current content first. A block whose content is already stored,
+/// according to the dedup index and a comparison, is pointed to that data block without writing it. Other blocks are
+/// written to their own data block if no other block refers to it; a shared data block is left to the others and the
+/// block gets a free one (copy on write). The data blocks are written together, then the changed part of the dedup map.
+/// \param [in] indices Indices of the blocks of the chain in the FAT, one for each block the data touches.
+/// \param [in] blockOffset Position of the first byte within the first block.
+/// \param [in] buf The data, at least size bytes.
+/// \param [in] size Number of bytes to write.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeDedup(const int *indices, size_t blockOffset, const char *buf, size_t size) {
+    int blockCount = (blockOffset + size + sBlock.blockSize - 1) / sBlock.blockSize;
+    size_t tailBytes = (blockOffset + size) % sBlock.blockSize;
+
+    // Teilblöcke am Anfang und am Ende mit dem bisherigen Inhalt ergänzen
+    std::vector<char> head;
+    std::vector<char> tail;
+    if (blockOffset != 0 || (blockCount == 1 && tailBytes != 0)) {
+        head.resize(sBlock.blockSize);
+        int ret = readDataBlock(dataBlockOf(indices[0]), head.data());
+        if (ret < 0) {
+            return ret;
+        }
+        memcpy(head.data() + blockOffset, buf, std::min(size, sBlock.blockSize - blockOffset));
+    }
+    if (blockCount > 1 && tailBytes != 0) {
+        tail.resize(sBlock.blockSize);
+        int ret = readDataBlock(dataBlockOf(indices[blockCount - 1]), tail.data());
+        if (ret < 0) {
+            return ret;
+        }
+        memcpy(tail.data(), buf + size - tailBytes, tailBytes);
+    }
+
+    std::map<int, const char *> pending; // zu schreibende Datenblöcke und ihr Inhalt
+    size_t done = 0;
+    for (int k = 0; k < blockCount; k++) {
+        const char *content = buf + done;
+        if (k == 0 && !head.empty()) {
+            content = head.data();
+        } else if (k == blockCount - 1 && !tail.empty()) {
+            content = tail.data();
+        }
+        done += std::min(sBlock.blockSize - blockOffset, size - done);
+        blockOffset = 0;
+
+        uint32_t hash = crc32c(0, content, sBlock.blockSize);
+        hash = hash != 0 ? hash : 1;
+        int old = dataBlockOf(indices[k]);
+        auto found = dedupIndex.find(hash);
+        if (found != dedupIndex.end() && isStoredIn(found->second, content, pending)) { // schon gespeichert
+            if (found->second != old) {
+                refCounts[found->second]++;
+                if (old >= 0) {
+                    releaseDataBlock(old);
+                }
+                setLocation(indices[k], found->second);
+            }
+            blocksDeduplicated++;
+            continue;
+        }
+        if (found != dedupIndex.end()) {
+            hashCollisions++;
+        }
+
+        int block = old;
+        if (old < 0 || refCounts[old] > 1) { // eigener Datenblock, ein geteilter wird nicht überschrieben
+            if (old >= 0) {
+                releaseDataBlock(old);
+                blocksCopied++;
+            }
+            block = findFreeDataBlock(indices[k]);
+            if (block < 0) {
+                setLocation(indices[k], NO_LOCATION);
+                writeDedupMapToDisc();
+                return block;
+            }
+            refCounts[block] = 1;
+            setLocation(indices[k], block);
+        }
+        setBlockHash(block, hash);
+        pending[block] = content;
+    }
+
+    int ret = 0;
+    std::vector<uint32_t> blockNos;
+    for (auto &p : pending) {
+        blockNos.push_back(sBlock.dataAddress + p.first);
+    }
+    char *mapped = blockDevice->getBlockPointer(sBlock.dataAddress, sBlock.dataSize);
+    if (mapped != nullptr) {
+        for (auto &p : pending) {
+            memcpy(mapped + (size_t) p.first * sBlock.blockSize, p.second, sBlock.blockSize);
+        }
+    } else if (!blockNos.empty()) { // ganze Blöcke, nichts zu lesen
+        std::vector<char *> frames(blockNos.size());
+        std::unique_ptr<bool[]> fetch(new bool[blockNos.size()]());
+        ret = cache->pin(blockNos.data(), blockNos.size(), frames.data(), fetch.get());
+        if (ret == 0) {
+            size_t k = 0;
+            for (auto &p : pending) {
+                memcpy(frames[k++], p.second, sBlock.blockSize);
+            }
+            ret = cache->commit(blockNos.data(), blockNos.size());
+            cache->unpin(blockNos.data(), blockNos.size());
+        }
+        if (ret < 0) { // Cache soll nicht vom Container abweichen
+            for (size_t k = 0; k < blockNos.size(); k++) {
+                cache->discard(blockNos[k]);
+            }
+        }
+    }
+    if (ret == 0) {
+        for (auto &p : pending) {
+            unwritten[p.first] = false;
+        }
+    }
+    writeDedupMapToDisc();
+    return ret;
+}
+
+/// @brief Free a data block.
+///
+/// Mark the block as unused in the FAT, the dmap and the cmap and drop its cached copy. In a deduplicating container
+/// the data block holding its content is released instead.
+/// \param [in] index Index of the data block.
+void MyOnDiskFS::freeDataBlock(int index) {
+    setFat(index, INT32_MAX);
+    setUsed(index, false);
+    if (cmap != nullptr) {
+        setChunkEntry(index, 0);
+    }
+    if (dedupMap != nullptr) {
+        if (dedupMap[index].location >= 0) {
+            releaseDataBlock(dedupMap[index].location);
+        }
+        setLocation(index, NO_LOCATION);
+        return;
+    }
+    cache->discard(sBlock.dataAddress + index);
+    freedBlocks.push_back(index);
+}
+
+/// @brief Punch the freed data blocks out of the container file.
+///
+/// Blocks freed since the last call are sorted and passed to the block device as runs of consecutive blocks. Blocks
+/// that were allocated again in the meantime are skipped. Punched blocks read as zeros without I/O until they are
+/// written again. If the host file system cannot punch holes, freed blocks are no longer collected.
+void MyOnDiskFS::punchHoles() {
+    if (freedBlocks.empty()) {
+        return;
+    }
+    if (!punchHolesSupported) {
+        freedBlocks.clear();
+        return;
+    }
+    std::sort(freedBlocks.begin(), freedBlocks.end());
+    size_t k = 0;
+    while (k < freedBlocks.size()) {
+        int runStart = freedBlocks[k];
+        int runEnd = runStart;
+        while (k < freedBlocks.size() && freedBlocks[k] <= runEnd) {
+            if (freedBlocks[k] == runEnd && (dedupMap != nullptr ? refCounts[runEnd] == 0 : !isUsed(runEnd))) {
+                runEnd++;
+            }
+            k++;
+        }
+        if (runEnd == runStart) { // wieder belegt
+            continue;
+        }
+        int ret = blockDevice->discard(sBlock.dataAddress + runStart, runEnd - runStart);
+        if (ret == -EOPNOTSUPP) {
+            LOG("Container file system cannot punch holes, freed blocks stay allocated");
+            punchHolesSupported = false;
+            break;
+        }
+        if (ret == 0) {
+            for (int i = runStart; i < runEnd; i++) {
+                unwritten[i] = true;
+            }
+            holesPunched += runEnd - runStart;
+        }
+    }
+    freedBlocks.clear();
+}
+
+/// @brief Append data blocks to the chain of a file.
+///
+/// The blocks are taken in runs from findEmptyDataBlocks(), continuing right behind the last block of the chain where
+/// possible, and added to the extent map of the file.
+/// \param [in] myFile The file, not in a compressed container.
+/// \param [in] count Number of blocks to append.
+/// \return 0 on success, -ENOSPC if the container is full, -ERRNO on other failures.
+int MyOnDiskFS::appendBlocks(file *myFile, int count) {
+    ExtentMap &extents = extentsOf(myFile);
+    if (myFile->dataSize == 0) { //Leeres file: neue Kette
+        extents.clear();
+    }
+    int actualIndex = extents.last(); //letzter Block der Kette, -1 wenn leer
+    int i = 0;
+    while (i < count) {
+        // zusammenhängend direkt hinter dem letzten Block, sonst im größten freien Extent
+        int run = 0;
+        int index = findEmptyDataBlocks(actualIndex >= 0 ? actualIndex + 1 : -1, count - i, &run);
+        if (index < 0) {
+            return index;
+        }
+        for (int k = index; k < index + run; k++, i++) {
+            setFat(k, EOF);
+            setUsed(k, true);
+            if (actualIndex < 0) {
+                myFile->fat_data = k;
+            } else {
+                setFat(actualIndex, k);
+            }
+            actualIndex = k;
+        }
+        extents.append(index, run);
+    }
+    return 0;
+}
+
+/// @brief Cut the chain of a file short.
+///
+/// The chain ends behind the last block kept, the blocks behind it are freed run by run as the extent map of the file
+/// lists them, and the map is cut to the blocks kept.
+/// \param [in] myFile The file; in a compressed container only to free all of its blocks.
+/// \param [in] keep Number of blocks the file keeps.
+void MyOnDiskFS::cutBlocks(file *myFile, int keep) {
+    ExtentMap &extents = extentsOf(myFile);
+    if (keep >= extents.blocks()) {
+        return;
+    }
+    int run = 0;
+    if (keep == 0) {
+        myFile->fat_data = -1;
+    } else {
+        setFat(extents.lookup(keep - 1, &run), EOF); //neuer letzter Block
+    }
+    for (int logical = keep; logical < extents.blocks(); logical += run) {
+        int index = extents.lookup(logical, &run);
+        for (int k = index; k < index + run; k++) {
+            freeDataBlock(k);
+        }
+    }
+    extents.truncate(keep);
+}
+
+/// @brief Find a run of free data blocks.
+///
+/// A file growing at its end continues right behind its last block while the blocks there are free. Otherwise the run
+/// is taken from the largest free extent, so the blocks of a file stay together and the remaining space is split as
+/// little as possible. If no block is free, the container is grown first. The blocks are not reserved, the caller
+/// marks them as used.
+/// \param [in] preferred Block the run should start at, usually the one behind the last block of the chain; -1 for
+/// none.
+/// \param [in] want Number of blocks wanted.
+/// \param [out] count Number of blocks in the run, at least 1 and at most want.
+/// \return Index of the first data block of the run, -ERRNO if the container is full and cannot grow.
+int MyOnDiskFS::findEmptyDataBlocks(int preferred, int want, int *count) {
+    int index = freeExtents.find(preferred, want, count);
+    if (index >= 0) {
+        return index;
+    }
+    //Container voll: vergrößern, die neuen Blöcke sind frei
+    int ret = growContainer();
+    if (ret < 0) {
+        return ret;
+    }
+    return freeExtents.find(preferred, want, count);
+}
+
+/// @brief Write the superblock.
+///
+/// The superblock carries its own checksum, as block 0 is not covered by the checksum region.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeSuperblock() {
+    superblock sb = sBlock;
+    sb.checksum = 0;
+    sb.checksum = crc32c(0, &sb, sizeof(superblock));
+    std::vector<char> puffer(sBlock.blockSize, 0);
+    memcpy(puffer.data(), &sb, sizeof(superblock));
+    return blockDevice->write(0, puffer.data());
+}
+
+/// @brief Grow the container.
+///
+/// The container file is extended by growSize blocks, or by a quarter of its size if that is more, but not beyond
+/// maxDeviceSize. The new blocks are appended to the data region. If dmap and FAT cannot hold entries for all data
+/// blocks or the checksums cannot cover all blocks, these regions, the cmap and the dedup map are moved behind the new
+/// data region; blocks they occupied there before become data blocks. The superblock is written last, after the new
+/// metadata regions are stored.
+/// \return 0 on success, -ENOSPC if the container cannot grow, -ENOMEM if the moved regions cannot be allocated, -ERRNO
+/// on other failures.
+int MyOnDiskFS::growContainer() {
+    int64_t limit = maxDeviceSize > 0 ? maxDeviceSize : INT32_MAX;
+    int64_t step = growSize > 0 ? growSize : CONTAINER_GROW_SIZE / sBlock.blockSize;
+    step = std::max(step, (int64_t) sBlock.blockDeviceSize / 4);
+    int deviceSize = (int) std::min(limit, (int64_t) sBlock.blockDeviceSize + step);
+    if (deviceSize <= sBlock.blockDeviceSize) {
+        return -ENOSPC;
+    }
+
+    superblock sb = sBlock;
+    sb.blockDeviceSize = deviceSize;
+    size_t capacity = std::min((size_t) sBlock.dmapBlocks * sBlock.blockSize * 8,
+                               sBlock.fatBlocks * sBlock.blockSize / sizeof(int));
+    if (sBlock.cmapBlocks > 0) {
+        capacity = std::min(capacity, sBlock.cmapBlocks * sBlock.blockSize / sizeof(uint32_t));
+    }
+    if (sBlock.dedupBlocks > 0) {
+        capacity = std::min(capacity, sBlock.dedupBlocks * sBlock.blockSize / sizeof(dedupEntry));
+    }
+    size_t cmapEntry = sBlock.cmapBlocks > 0 ? sizeof(uint32_t) : 0;
+    size_t dedupEntrySize = sBlock.dedupBlocks > 0 ? sizeof(dedupEntry) : 0;
+    int sumBlocks = sBlock.sumBlocks > 0 ?
+                    (int) (((int64_t) deviceSize * sizeof(uint32_t) + sBlock.blockSize - 1) / sBlock.blockSize) : 0;
+    bool relocate = sBlock.dmapAddress > sBlock.dataAddress || (size_t) (deviceSize - sBlock.dataAddress) > capacity ||
+                    sumBlocks > sBlock.sumBlocks;
+    if (!relocate) { // dmap, FAT und Prüfsummen vor den Daten haben noch Platz
+        sb.dataSize = deviceSize - sBlock.dataAddress;
+    } else {
+        int space = deviceSize - sBlock.dataAddress - sumBlocks;
+        int64_t dataSize = (int64_t) space * sBlock.blockSize * 8 /
+                           (8 * (sBlock.blockSize + sizeof(int) + cmapEntry + dedupEntrySize) + 1);
+        while (dataSize > 0 && dataSize + (int64_t) (dmapSize(dataSize) + sBlock.blockSize - 1) / sBlock.blockSize +
+                               (int64_t) (dataSize * sizeof(int) + sBlock.blockSize - 1) / sBlock.blockSize +
+                               (int64_t) (dataSize * cmapEntry + sBlock.blockSize - 1) / sBlock.blockSize +
+                               (int64_t) (dataSize * dedupEntrySize + sBlock.blockSize - 1) / sBlock.blockSize >
+                               space) {
+            dataSize--;
+        }
+        sb.dataSize = (int) dataSize;
+        sb.dmapBlocks = (dmapSize(sb.dataSize) + sBlock.blockSize - 1) / sBlock.blockSize;
+        sb.fatBlocks = (sb.dataSize * sizeof(int) + sBlock.blockSize - 1) / sBlock.blockSize;
+        sb.dmapAddress = sb.dataAddress + sb.dataSize;
+        sb.fatAddress = sb.dmapAddress + sb.dmapBlocks;
+        sb.cmapBlocks = (sb.dataSize * cmapEntry + sBlock.blockSize - 1) / sBlock.blockSize;
+        sb.cmapAddress = sb.cmapBlocks > 0 ? sb.fatAddress + sb.fatBlocks : 0;
+        sb.dedupBlocks = (sb.dataSize * dedupEntrySize + sBlock.blockSize - 1) / sBlock.blockSize;
+        sb.dedupAddress = sb.dedupBlocks > 0 ? sb.fatAddress + sb.fatBlocks + sb.cmapBlocks : 0;
+        sb.sumAddress = sumBlocks > 0 ? sb.fatAddress + sb.fatBlocks + sb.cmapBlocks + sb.dedupBlocks : 0;
+        sb.sumBlocks = sumBlocks;
+    }
+    if (sb.dataSize <= sBlock.dataSize) {
+        return -ENOSPC;
+    }
+
+    // dmap und FAT im Cache müssen gespeichert sein, bevor sich die Geometrie ändert
+    int ret = cache->flushAll();
+    if (ret == 0 && checksumDevice != nullptr) { // bis zum neuen Superblock gelten die alten Prüfsummen
+        ret = checksumDevice->writeChecksums();
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    ret = blockDevice->grow(deviceSize);
+    if (ret < 0) {
+        LOGF("ERROR: Growing the container to %d blocks failed with error %d", deviceSize, ret);
+        return ret == -EFBIG ? -ENOSPC : ret;
+    }
+    char *mappedDmap = nullptr;
+    char *mappedFat = nullptr;
+    if (metadataMapped && relocate) {
+        mappedDmap = blockDevice->getBlockPointer(sb.dmapAddress, sb.dmapBlocks);
+        mappedFat = blockDevice->getBlockPointer(sb.fatAddress, sb.fatBlocks);
+        if (mappedDmap == nullptr || mappedFat == nullptr) {
+            return -ENOSPC;
+        }
+    }
+    uint64_t *newDmap = nullptr;
+    int *newFat = nullptr;
+    uint32_t *newCmap = nullptr;
+    dedupEntry *newDedupMap = nullptr;
+    if (relocate) { // alles anlegen, bevor die bisherigen Strukturen aufgegeben werden
+        newDmap = (uint64_t *) allocAligned((size_t) sb.dmapBlocks * sBlock.blockSize);
+        newFat = (int *) allocAligned((size_t) sb.fatBlocks * sBlock.blockSize);
+        if (cmap != nullptr) {
+            newCmap = (uint32_t *) allocAligned((size_t) sb.cmapBlocks * sBlock.blockSize);
+        }
+        if (dedupMap != nullptr) {
+            newDedupMap = (dedupEntry *) allocAligned((size_t) sb.dedupBlocks * sBlock.blockSize);
+        }
+        if (newDmap == nullptr || newFat == nullptr || (cmap != nullptr && newCmap == nullptr) ||
+            (dedupMap != nullptr && newDedupMap == nullptr)) {
+            free(newDmap);
+            free(newFat);
+            free(newCmap);
+            free(newDedupMap);
+            return -ENOMEM;
+        }
+    }
+    // ab hier gilt die neue Geometrie, bei Fehlern davor bleibt alles beim alten Superblock
+    if (checksumDevice != nullptr) {
+        checksumDevice->setRegion(sb.sumAddress, sb.sumBlocks);
+    }
+
+    if (relocate) {
+        memset(newDmap, 0, (size_t) sb.dmapBlocks * sBlock.blockSize);
+        memcpy(newDmap, dmap, DMAPSIZE);
+        memcpy(newFat, fat, FATSIZE);
+        if (!metadataMapped) {
+            free(dmap);
+            free(fat);
+        }
+        // alte dmap, FAT, cmap und Dedup-Map
+        for (int b = 0; b < sBlock.dmapBlocks + sBlock.fatBlocks + sBlock.cmapBlocks + sBlock.dedupBlocks; b++) {
+            cache->discard(sBlock.dmapAddress + b);
+        }
+        dmap = newDmap;
+        fat = newFat;
+        if (cmap != nullptr) {
+            memcpy(newCmap, cmap, CMAPSIZE);
+            free(cmap);
+            cmap = newCmap;
+        }
+        if (dedupMap != nullptr) {
+            memcpy(newDedupMap, dedupMap, DEDUPSIZE);
+            free(dedupMap);
+            dedupMap = newDedupMap;
+        }
+        // an neuer Stelle ganz schreiben
+        dmapDirty.assign(sb.dmapBlocks, true);
+        fatDirty.assign(sb.fatBlocks, true);
+        cmapDirty.assign(sb.cmapBlocks, true);
+        dedupDirty.assign(sb.dedupBlocks, true);
+    } else {
+        dmapDirty.resize(sb.dmapBlocks, false);
+        fatDirty.resize(sb.fatBlocks, false);
+        cmapDirty.resize(sb.cmapBlocks, false);
+        dedupDirty.resize(sb.dedupBlocks, false);
+    }
+    if (dedupMap != nullptr) {
+        refCounts.resize(sb.dataSize, 0);
+    }
+    unwritten.resize(sb.dataSize, true);
+    markDirty(dmapDirty, sBlock.dataSize / DMAP_WORD_BITS * sizeof(uint64_t), dmapSize(sb.dataSize), sBlock.blockSize);
+    markDirty(fatDirty, sBlock.dataSize * sizeof(int), sb.dataSize * sizeof(int), sBlock.blockSize);
+    markDirty(cmapDirty, sBlock.dataSize * cmapEntry, sb.dataSize * cmapEntry, sBlock.blockSize);
+    for (int i = sBlock.dataSize; i < sb.dataSize; i++) {
+        dmap[i / DMAP_WORD_BITS] &= ~((uint64_t) 1 << (i % DMAP_WORD_BITS));
+        fat[i] = INT32_MAX;
+        if (cmap != nullptr) {
+            cmap[i] = 0;
+        }
+        if (dedupMap != nullptr) {
+            dedupMap[i].hash = 0;
+            setLocation(i, NO_LOCATION);
+        }
+        int blockNo = sb.dataAddress + i;
+        if (blockNo >= sBlock.dmapAddress && blockNo < sBlock.dmapAddress + sBlock.dmapBlocks + sBlock.fatBlocks +
+                                                      sBlock.cmapBlocks + sBlock.dedupBlocks + sBlock.sumBlocks) {
+            unwritten[i] = false; // hier lagen dmap, FAT, cmap, Dedup-Map und Prüfsummen
+        }
+    }
+
+    freeExtents.release(sBlock.dataSize, sb.dataSize - sBlock.dataSize);
+
+    sBlock = sb;
+    DMAPSIZE = dmapSize(sBlock.dataSize);
+    FATSIZE = sBlock.dataSize * sizeof(int);
+    CMAPSIZE = sBlock.dataSize * cmapEntry;
+    DEDUPSIZE = sBlock.dataSize * dedupEntrySize;
+    writeDmapToDisc();
+    writeFatToDisc();
+    writeDedupMapToDisc();
+    writeCmapToDisc();
+    if (mappedDmap != nullptr) { // die Kopien stehen jetzt im gemappten Container
+        free(dmap);
+        free(fat);
+        dmap = (uint64_t *) mappedDmap;
+        fat = (int *) mappedFat;
+    }
+    ret = cache->flushAll();
+    if (ret == 0 && checksumDevice != nullptr) {
+        ret = checksumDevice->writeChecksums();
+    }
+    if (ret == 0) {
+        ret = writeSuperblock();
+    }
+    containerGrowths++;
+    LOGF("Container grown to %d blocks, %d data blocks%s", sBlock.blockDeviceSize, sBlock.dataSize,
+         relocate ? (sBlock.sumBlocks > 0 ? ", dmap, FAT and checksums moved" : ", dmap and FAT moved") : "");
+    return ret;
+}
+
+/// @brief Get the number of a directory entry.
+///
+/// \param [in] myFile Entry in root or a cached entry returned by findFile().
+/// \return Its slot in root, NUM_DIR_ENTRIES or more for an entry in the entry chain.
+int MyOnDiskFS::slotOf(file *myFile) {
+    if (myFile >= root && myFile < root + NUM_DIR_ENTRIES) {
+        return myFile - root;
+    }
+    return reinterpret_cast<CachedEntry *>(myFile)->slot;
+}
+
+/// @brief Get an entry of the entry chain.
+///
+/// An entry that is not cached is read from the chain; it stays cached until the next operation starts, or as long as
+/// the file is open.
+/// \param [in] slot Number of the entry, NUM_DIR_ENTRIES or more.
+/// \return The cached entry, nullptr if it cannot be read.
+file *MyOnDiskFS::loadEntry(int slot) {
+    auto found = entryCache.find(slot);
+    if (found != entryCache.end()) {
+        return &found->second.entry;
+    }
+    CachedEntry cached;
+    cached.slot = slot;
+    if (slot - NUM_DIR_ENTRIES < dirHeader.slots &&
+        dirTransfer(dirEntryBlocks, (size_t) (slot - NUM_DIR_ENTRIES) * sizeof(file), &cached.entry, sizeof(file),
+                    false) < 0) {
+        return nullptr;
+    }
+    cached.entry.open = false; // nur im Speicher gültig
+    cached.entry.data = nullptr;
+    return &entryCache.emplace(slot, cached).first->second.entry;
+}
+
+/// @brief Store a changed directory entry.
+///
+/// Only the one or two blocks holding the entry are written, in root or in the entry chain.
+/// \param [in] myFile Entry in root or a cached entry returned by findFile().
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeEntry(file *myFile) {
+    int slot = slotOf(myFile);
+    if (slot >= NUM_DIR_ENTRIES) {
+        return dirTransfer(dirEntryBlocks, (size_t) (slot - NUM_DIR_ENTRIES) * sizeof(file), myFile, sizeof(file),
+                           true);
+    }
+    size_t first = slot * sizeof(file) / sBlock.blockSize * sBlock.blockSize;
+    size_t end = std::min(ROOTSIZE, ((slot + 1) * sizeof(file) + sBlock.blockSize - 1) / sBlock.blockSize *
+                                    sBlock.blockSize);
+    return writeToDisc(sBlock.rootAddress + first / sBlock.blockSize, (char *) root + first, end - first);
+}
+
+/// @brief Transfer bytes between a buffer and a chain of the directory index.
+///
+/// The chain is read and written like file data, through the block cache or the memory mapping. In write-through mode
+/// the changed checksums are stored along with the blocks, as for the metadata regions.
+/// \param [in] blocks The blocks of the chain, by position.
+/// \param [in] pos Position of the first byte in the chain.
+/// \param [in,out] buf Source (isWrite) or destination of the bytes, at least size bytes.
+/// \param [in] size Number of bytes, the chain must hold all of them.
+/// \param [in] isWrite true to write buf to the chain, false to read from the chain into buf.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::dirTransfer(const std::vector<int> &blocks, size_t pos, void *buf, size_t size, bool isWrite) {
+    int ret = transferBlocks(&blocks[pos / sBlock.blockSize], pos % sBlock.blockSize, (char *) buf, size, isWrite);
+    if (ret == 0 && isWrite && checksumDevice != nullptr && !cache->isWriteBack()) {
+        ret = checksumDevice->writeChecksums();
+    }
+    return ret;
+}
+
+/// @brief Collect the data blocks of a chain.
+///
+/// \param [in] first First data block of the chain.
+/// \param [out] blocks The blocks of the chain, by position.
+/// \return 0 on success, -EIO if the chain leaves the data region, runs into a free block or loops.
+int MyOnDiskFS::readChain(int first, std::vector<int> &blocks) {
+    blocks.clear();
+    for (int index = first; index != EOF; index = fat[index]) {
+        if (index < 0 || index >= sBlock.dataSize || !isUsed(index) || blocks.size() >= (size_t) sBlock.dataSize) {
+            return -EIO;
+        }
+        blocks.push_back(index);
+    }
+    return 0;
+}
+
+/// @brief Append data blocks to a chain until it holds a number of bytes.
+///
+/// \param [in,out] first First data block of the chain, set if the chain was empty.
+/// \param [in,out] blocks The blocks of the chain, by position.
+/// \param [in] size Number of bytes the chain must hold.
+/// \return 0 on success, -ENOSPC if the container is full, -ERRNO on other failures.
+int MyOnDiskFS::growChain(int *first, std::vector<int> &blocks, size_t size) {
+    int ret = 0;
+    size_t oldCount = blocks.size();
+    while (blocks.size() * sBlock.blockSize < size) {
+        int count = 0;
+        int want = (int) ((size + sBlock.blockSize - 1) / sBlock.blockSize - blocks.size());
+        int index = findEmptyDataBlocks(blocks.empty() ? -1 : blocks.back() + 1, want, &count);
+        if (index < 0) {
+            ret = index;
+            break;
+        }
+        for (int k = index; k < index + count; k++) {
+            setFat(k, EOF);
+            setUsed(k, true);
+            if (blocks.empty()) {
+                *first = k;
+            } else {
+                setFat(blocks.back(), k);
+            }
+            blocks.push_back(k);
+        }
+    }
+    if (blocks.size() > oldCount) {
+        writeDmapToDisc();
+        writeFatToDisc();
+        writeDedupMapToDisc();
+    }
+    return ret;
+}
+
+/// @brief Create the directory index when root is full.
+///
+/// The index starts with one empty bucket and no entries. The superblock is written after the blocks of the index are
+/// stored.
+/// \return 0 on success, -ENOSPC if the container is full, -ERRNO on other failures.
+int MyOnDiskFS::createDirIndex() {
+    int first = -1;
+    dirHeader = dirIndexHeader();
+    dirHeader.magic = DIR_INDEX_MAGIC;
+    dirHeader.buckets = 1;
+    dirHeader.bucketChain = -1;
+    dirHeader.entryChain = -1;
+    dirHeader.freeSlot = -1;
+    dirIndexBlocks.clear();
+    dirBucketBlocks.clear();
+    dirEntryBlocks.clear();
+    dirBuckets.assign(1, 0);
+    int ret = growChain(&first, dirIndexBlocks, sBlock.blockSize + sizeof(int));
+    if (ret == 0) {
+        ret = growChain(&dirHeader.bucketChain, dirBucketBlocks, sBlock.blockSize);
+    }
+    std::vector<char> bucket(sBlock.blockSize, 0); // Tiefe 0, leer
+    if (ret == 0) {
+        ret = dirTransfer(dirBucketBlocks, 0, bucket.data(), sBlock.blockSize, true);
+    }
+    if (ret == 0) {
+        ret = dirTransfer(dirIndexBlocks, sBlock.blockSize, dirBuckets.data(), sizeof(int), true);
+    }
+    if (ret == 0) {
+        ret = writeDirHeader();
+    }
+    if (ret == 0) { // der Index muss gespeichert sein, bevor der Superblock auf ihn zeigt
+        ret = cache->flushAll();
+    }
+    if (ret == 0 && checksumDevice != nullptr) {
+        ret = checksumDevice->writeChecksums();
+    }
+    if (ret < 0) { // Container bleibt ohne Verzeichnisindex
+        for (int index : dirIndexBlocks) {
+            freeDataBlock(index);
+        }
+        for (int index : dirBucketBlocks) {
+            freeDataBlock(index);
+        }
+        writeDmapToDisc();
+        writeFatToDisc();
+        writeDedupMapToDisc();
+        punchHoles();
+        return ret;
+    }
+    sBlock.dirIndex = first;
+    LOG("Root is full, directory index created");
+    return writeSuperblock();
+}
+
+/// @brief Read the directory index of a container.
+///
+/// The chains of the index are collected and the bucket directory is read; buckets and entries are read when they are
+/// needed.
+/// \return 0 on success or if the container has no directory index, -EIO if the index is damaged, -ERRNO on other
+/// failures.
+int MyOnDiskFS::loadDirIndex() {
+    if (sBlock.dirIndex < 0) {
+        return 0;
+    }
+    int ret = readChain(sBlock.dirIndex, dirIndexBlocks);
+    if (ret == 0 && dirIndexBlocks.size() * sBlock.blockSize < sBlock.blockSize + sizeof(int)) {
+        ret = -EIO;
+    }
+    if (ret == 0) {
+        ret = dirTransfer(dirIndexBlocks, 0, &dirHeader, sizeof(dirIndexHeader), false);
+    }
+    if (ret == 0 && (dirHeader.magic != DIR_INDEX_MAGIC || dirHeader.depth > DIR_MAX_DEPTH ||
+                     dirIndexBlocks.size() * sBlock.blockSize < sBlock.blockSize + (sizeof(int) << dirHeader.depth) ||
+                     dirHeader.buckets < 1 || dirHeader.slots < 0 || dirHeader.files < 0 ||
+                     dirHeader.files > dirHeader.slots)) {
+        ret = -EIO;
+    }
+    if (ret == 0) {
+        ret = readChain(dirHeader.bucketChain, dirBucketBlocks);
+    }
+    if (ret == 0 && dirBucketBlocks.size() < (size_t) dirHeader.buckets) {
+        ret = -EIO;
+    }
+    if (ret == 0 && dirHeader.slots > 0) {
+        ret = readChain(dirHeader.entryChain, dirEntryBlocks);
+        if (ret == 0 && dirEntryBlocks.size() * sBlock.blockSize < (size_t) dirHeader.slots * sizeof(file)) {
+            ret = -EIO;
+        }
+    }
+    if (ret == 0) {
+        dirBuckets.resize((size_t) 1 << dirHeader.depth);
+        ret = dirTransfer(dirIndexBlocks, sBlock.blockSize, dirBuckets.data(), dirBuckets.size() * sizeof(int), false);
+    }
+    for (size_t d = 0; ret == 0 && d < dirBuckets.size(); d++) {
+        if (dirBuckets[d] < 0 || dirBuckets[d] >= dirHeader.buckets) {
+            ret = -EIO;
+        }
+    }
+    return ret;
+}
+
+/// @brief Store the header of the directory index.
+///
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::writeDirHeader() {
+    return dirTransfer(dirIndexBlocks, 0, &dirHeader, sizeof(dirIndexHeader), true);
+}
+
+/// @brief Look up a name in the directory index.
+///
+/// Only the bucket the hash of directory and name selects is read, and the entries in it with the same hash.
+/// \param [in] parent Slot of the directory.
+/// \param [in] name Name of the file in the directory.
+/// \return Slot of the file, -ENOENT if no file beyond the root region has this name, -EIO if the bucket cannot be
+/// read.
+int MyOnDiskFS::findInIndex(int parent, const char *name) {
+    uint32_t hash = PathIndex::hash(parent, name);
+    int bucket = dirBuckets[hash & ((1u << dirHeader.depth) - 1)];
+    std::vector<char> block(sBlock.blockSize);
+    if (dirTransfer(dirBucketBlocks, (size_t) bucket * sBlock.blockSize, block.data(), sBlock.blockSize, false) < 0) {
+        return -EIO;
+    }
+    dirBucketHeader *head = (dirBucketHeader *) block.data();
+    dirBucketEntry *entries = (dirBucketEntry *) (block.data() + sizeof(dirBucketHeader));
+    uint32_t capacity = (sBlock.blockSize - sizeof(dirBucketHeader)) / sizeof(dirBucketEntry);
+    for (uint32_t k = 0; k < head->count && k < capacity; k++) {
+        if (entries[k].hash == hash) {
+            file *myFile = loadEntry(entries[k].slot);
+            if (myFile == nullptr) {
+                return -EIO;
+            }
+            if (myFile->parent == parent && strcmp(myFile->name, name) == 0) {
+                return entries[k].slot;
+            }
+        }
+    }
+    return -ENOENT;
+}
+
+/// @brief Add a name to the directory index.
+///
+/// A full bucket is split first, doubling the bucket directory if the bucket is selected by all bits it has.
+/// \param [in] parent Slot of the directory.
+/// \param [in] name Name of the file in the directory, not in the index yet.
+/// \param [in] slot Its entry in the entry chain.
+/// \return 0 on success, -ENOSPC if the container is full or the names cannot be told apart by DIR_MAX_DEPTH bits of
+/// their hashes, -ERRNO on other failures.
+int MyOnDiskFS::insertName(int parent, const char *name, int slot) {
+    uint32_t hash = PathIndex::hash(parent, name);
+    uint32_t capacity = (sBlock.blockSize - sizeof(dirBucketHeader)) / sizeof(dirBucketEntry);
+    std::vector<char> block(sBlock.blockSize);
+    dirBucketHeader *head = (dirBucketHeader *) block.data();
+    dirBucketEntry *entries = (dirBucketEntry *) (block.data() + sizeof(dirBucketHeader));
+    while (true) {
+        int bucket = dirBuckets[hash & ((1u << dirHeader.depth) - 1)];
+        size_t pos = (size_t) bucket * sBlock.blockSize;
+        int ret = dirTransfer(dirBucketBlocks, pos, block.data(), sBlock.blockSize, false);
+        if (ret < 0) {
+            return ret;
+        }
+        if (head->count < capacity) {
+            entries[head->count].hash = hash;
+            entries[head->count].slot = slot;
+            head->count++;
+            return dirTransfer(dirBucketBlocks, pos, block.data(), sBlock.blockSize, true);
+        }
+        ret = splitBucket(bucket);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+}
+
+/// @brief Remove a name from the directory index.
+///
+/// The last entry of the bucket takes the place of the removed one; buckets are not merged.
+/// \param [in] parent Slot of the directory.
+/// \param [in] name Name of the file in the directory.
+/// \param [in] slot Its entry in the entry chain.
+/// \return 0 on success, -ENOENT if the name is not in the index, -ERRNO on other failures.
+int MyOnDiskFS::removeName(int parent, const char *name, int slot) {
+    uint32_t hash = PathIndex::hash(parent, name);
+    int bucket = dirBuckets[hash & ((1u << dirHeader.depth) - 1)];
+    size_t pos = (size_t) bucket * sBlock.blockSize;
+    std::vector<char> block(sBlock.blockSize);
+    int ret = dirTransfer(dirBucketBlocks, pos, block.data(), sBlock.blockSize, false);
+    if (ret < 0) {
+        return ret;
+    }
+    dirBucketHeader *head = (dirBucketHeader *) block.data();
+    dirBucketEntry *entries = (dirBucketEntry *) (block.data() + sizeof(dirBucketHeader));
+    for (uint32_t k = 0; k < head->count; k++) {
+        if (entries[k].slot == slot) {
+            entries[k] = entries[head->count - 1];
+            head->count--;
+            return dirTransfer(dirBucketBlocks, pos, block.data(), sBlock.blockSize, true);
+        }
+    }
+    return -ENOENT;
+}
+
+/// @brief Split a full bucket of the directory index.
+///
+/// The names whose hash has the next bit set move to a new bucket at the end of the bucket chain. If the bucket was
+/// selected by all bits of the bucket directory, the directory is doubled first and written as a whole; otherwise
+/// only the blocks of the directory pointing to the new bucket are written.
+/// \param [in] bucket Number of the bucket.
+/// \return 0 on success, -ENOSPC if the container is full or the directory cannot grow, -ERRNO on other failures.
+int MyOnDiskFS::splitBucket(int bucket) {
+    std::vector<char> block(sBlock.blockSize);
+    std::vector<char> other(sBlock.blockSize, 0);
+    int ret = dirTransfer(dirBucketBlocks, (size_t) bucket * sBlock.blockSize, block.data(), sBlock.blockSize, false);
+    if (ret < 0) {
+        return ret;
+    }
+    dirBucketHeader *head = (dirBucketHeader *) block.data();
+    dirBucketEntry *entries = (dirBucketEntry *) (block.data() + sizeof(dirBucketHeader));
+    dirBucketHeader *otherHead = (dirBucketHeader *) other.data();
+    dirBucketEntry *otherEntries = (dirBucketEntry *) (other.data() + sizeof(dirBucketHeader));
+    if (head->count == 0) {
+        return -EIO;
+    }
+
+    if (head->depth == dirHeader.depth) { // Verzeichnis verdoppeln
+        if (dirHeader.depth >= DIR_MAX_DEPTH) {
+            return -ENOSPC;
+        }
+        int first = sBlock.dirIndex;
+        ret = growChain(&first, dirIndexBlocks, sBlock.blockSize + dirBuckets.size() * 2 * sizeof(int));
+        if (ret < 0) {
+            return ret;
+        }
+        size_t size = dirBuckets.size();
+        dirBuckets.resize(2 * size);
+        std::copy(dirBuckets.begin(), dirBuckets.begin() + size, dirBuckets.begin() + size);
+        ret = dirTransfer(dirIndexBlocks, sBlock.blockSize, dirBuckets.data(), dirBuckets.size() * sizeof(int), true);
+        if (ret < 0) {
+            dirBuckets.resize(size);
+            return ret;
+        }
+        dirHeader.depth++;
+    }
+    ret = growChain(&dirHeader.bucketChain, dirBucketBlocks, (size_t) (dirHeader.buckets + 1) * sBlock.blockSize);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Namen mit gesetztem Bit in den neuen Bucket
+    uint32_t bit = 1u << head->depth;
+    uint32_t pattern = entries[0].hash & (bit - 1);
+    int newBucket = dirHeader.buckets;
+    uint32_t count = 0;
+    for (uint32_t k = 0; k < head->count; k++) {
+        if (entries[k].hash & bit) {
+            otherEntries[otherHead->count++] = entries[k];
+        } else {
+            entries[count++] = entries[k];
+        }
+    }
+    head->count = count;
+    head->depth++;
+    otherHead->depth = head->depth;
+    ret = dirTransfer(dirBucketBlocks, (size_t) newBucket * sBlock.blockSize, other.data(), sBlock.blockSize, true);
+    if (ret < 0) {
+        return ret;
+    }
+    dirHeader.buckets++;
+    ret = dirTransfer(dirBucketBlocks, (size_t) bucket * sBlock.blockSize, block.data(), sBlock.blockSize, true);
+
+    // Einträge des Verzeichnisses mit dem Muster des neuen Buckets umhängen, blockweise schreiben
+    size_t perBlock = sBlock.blockSize / sizeof(int);
+    size_t dirty = SIZE_MAX;
+    for (size_t d = pattern | bit; d < dirBuckets.size(); d += 2 * bit) {
+        dirBuckets[d] = newBucket;
+        if (ret == 0 && dirty != SIZE_MAX && d / perBlock != dirty) {
+            ret = dirTransfer(dirIndexBlocks, sBlock.blockSize + dirty * sBlock.blockSize, &dirBuckets[dirty * perBlock],
+                              std::min(perBlock, dirBuckets.size() - dirty * perBlock) * sizeof(int), true);
+        }
+        dirty = d / perBlock;
+    }
+    if (ret == 0 && dirty != SIZE_MAX) {
+        ret = dirTransfer(dirIndexBlocks, sBlock.blockSize + dirty * sBlock.blockSize, &dirBuckets[dirty * perBlock],
+                          std::min(perBlock, dirBuckets.size() - dirty * perBlock) * sizeof(int), true);
+    }
+    if (ret == 0) {
+        ret = writeDirHeader();
+    }
+    bucketSplits++;
+    return ret;
+}
+
+/// @brief Allocate an entry in the entry chain.
+///
+/// A freed entry is reused, otherwise the chain grows by one entry. The directory index is created with the first
+/// entry. The new entry is cached, its content is left to the caller.
+/// \return Slot of the entry, -ENOSPC if the container is full, -ERRNO on other failures.
+int MyOnDiskFS::allocSlot() {
+    if (sBlock.dirIndex < 0) {
+        int ret = createDirIndex();
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    int slot = dirHeader.freeSlot;
+    if (slot >= 0) {
+        file *myFile = loadEntry(slot);
+        if (myFile == nullptr) {
+            return -EIO;
+        }
+        dirHeader.freeSlot = myFile->fat_data;
+    } else {
+        int ret = growChain(&dirHeader.entryChain, dirEntryBlocks, (size_t) (dirHeader.slots + 1) * sizeof(file));
+        if (ret < 0) {
+            return ret;
+        }
+        slot = NUM_DIR_ENTRIES + dirHeader.slots;
+        loadEntry(slot); // neu, nicht lesen
+        dirHeader.slots++;
+    }
+    return slot;
+}
+
+/// @brief Free an entry of the entry chain.
+///
+/// The entry is linked into the list of free entries through fat_data and dropped from the cache.
+/// \param [in] slot Slot of the entry, its name must not be in the directory index.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::releaseSlot(int slot) {
+    file *myFile = loadEntry(slot);
+    if (myFile == nullptr) {
+        return -EIO;
+    }
+    myFile->name[0] = '\0';
+    myFile->dataSize = 0;
+    myFile->fat_data = dirHeader.freeSlot;
+    int ret = writeEntry(myFile);
+    entryCache.erase(slot);
+    if (ret < 0) {
+        return ret;
+    }
+    dirHeader.freeSlot = slot;
+    return writeDirHeader();
+}
+
+/// @brief Get the blocks of the directory index leading to the entry of a file.
+///
+/// \param [in] myFile The file.
+/// \param [out] blocks Data blocks holding the header, the part of the bucket directory and the bucket that select the
+/// file and its entry; none for a file in root.
+void MyOnDiskFS::dirBlocksOf(file *myFile, std::vector<int> &blocks) {
+    int slot = slotOf(myFile);
+    if (slot < NUM_DIR_ENTRIES) {
+        return;
+    }
+    uint32_t hash = PathIndex::hash(myFile->parent, myFile->name);
+    size_t d = hash & ((1u << dirHeader.depth) - 1);
+    size_t pos = (size_t) (slot - NUM_DIR_ENTRIES) * sizeof(file);
+    std::vector<int> chainBlocks = {dirIndexBlocks[0], dirIndexBlocks[1 + d * sizeof(int) / sBlock.blockSize],
+                                    dirBucketBlocks[dirBuckets[d]], dirEntryBlocks[pos / sBlock.blockSize],
+                                    dirEntryBlocks[(pos + sizeof(file) - 1) / sBlock.blockSize]};
+    for (int index : chainBlocks) {
+        if (dataBlockOf(index) >= 0) {
+            blocks.push_back(dataBlockOf(index));
+        }
+    }
+}
+
+/// @brief Drop cached entries of the entry chain if there are too many.
+///
+/// Entries of open files stay cached, their pointers are kept across operations.
+void MyOnDiskFS::trimEntryCache() {
+    if (entryCache.size() <= DIR_CACHE_ENTRIES) {
+        return;
+    }
+    for (auto it = entryCache.begin(); it != entryCache.end();) {
+        if (it->second.entry.open) {
+            ++it;
+        } else {
+            it = entryCache.erase(it);
+        }
+    }
+}
+
+/// @brief Get a directory entry by its slot.
+///
+/// \param [in] slot Slot of the entry.
+/// \return The entry in root or the cached entry of the entry chain, nullptr if it cannot be read.
+file *MyOnDiskFS::entryOf(int slot) {
+    return slot < NUM_DIR_ENTRIES ? &root[slot] : loadEntry(slot);
+}
+
+/// @brief Copy a directory entry without caching it.
+///
+/// \param [in] slot Slot of the entry.
+/// \param [out] myFile The copy.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::readEntry(int slot, file *myFile) {
+    if (slot < NUM_DIR_ENTRIES) {
+        *myFile = root[slot];
+        return 0;
+    }
+    auto found = entryCache.find(slot);
+    if (found != entryCache.end()) {
+        *myFile = found->second.entry;
+        return 0;
+    }
+    if (slot - NUM_DIR_ENTRIES >= dirHeader.slots) {
+        return -EIO;
+    }
+    return dirTransfer(dirEntryBlocks, (size_t) (slot - NUM_DIR_ENTRIES) * sizeof(file), myFile, sizeof(file), false);
+}
+
+/// @brief Look up a name in a directory.
+///
+/// The dentry cache answers first. Otherwise the name is searched in root and, if the container has one, in the
+/// directory index; the result is cached, also if the name does not exist.
+/// \param [in] parent Slot of the directory.
+/// \param [in] name Name in the directory.
+/// \param [out] isDir Whether the entry found is a directory.
+/// \return Slot of the entry, -ENOENT if the directory has no entry of this name, -ERRNO on other failures.
+int MyOnDiskFS::lookup(int parent, const char *name, bool *isDir) {
+    int slot;
+    if (dentries.lookup(parent, name, &slot, isDir)) {
+        return slot >= 0 ? slot : -ENOENT;
+    }
+    slot = pathIndex.find(root, parent, name);
+    if (slot < 0 && sBlock.dirIndex >= 0) {
+        slot = findInIndex(parent, name);
+        if (slot < 0 && slot != -ENOENT) {
+            return slot;
+        }
+    }
+    *isDir = slot >= 0 && S_ISDIR(entryOf(slot)->mode); // von findInIndex bereits geladen
+    dentries.insert(parent, name, slot >= 0 ? slot : -1, *isDir);
+    return slot >= 0 ? slot : -ENOENT;
+}
+
+/// @brief Find the directory a path leads into.
+///
+/// All components but the last are looked up, each in the directory named by the one before.
+/// \param [in] path Path starting with "/".
+/// \param [out] leaf The last component, pointing into path; empty for "/" or a path ending with "/".
+/// \return Slot of the directory holding the last component, -ENOENT if a directory on the way does not exist,
+/// -ENOTDIR if a component on the way is not a directory, -ERRNO on other failures.
+int MyOnDiskFS::resolveParent(const char *path, const char **leaf) {
+    int dir = ROOT_SLOT;
+    char component[NAME_LENGTH];
+    const char *name = path;
+    const char *slash;
+    while ((slash = strchr(name, '/')) != nullptr) {
+        size_t length = slash - name;
+        if (length >= NAME_LENGTH) {
+            return -ENAMETOOLONG;
+        }
+        if (length > 0) { // leere Komponenten ("//") überspringen
+            memcpy(component, name, length);
+            component[length] = '\0';
+            bool isDir;
+            int slot = lookup(dir, component, &isDir);
+            if (slot < 0) {
+                return slot;
+            }
+            if (!isDir) {
+                return -ENOTDIR;
+            }
+            dir = slot;
+        }
+        name = slash + 1;
+    }
+    *leaf = name;
+    return dir;
+}
+
+/// @brief Find the entry a path names.
+///
+/// \param [in] path Path starting with "/".
+/// \param [out] isDir Whether the entry is a directory.
+/// \return Slot of the entry, ROOT_SLOT for "/", -ENOENT if it does not exist, -ENOTDIR if a component on the way is
+/// not a directory, -ERRNO on other failures.
+int MyOnDiskFS::findSlot(const char *path, bool *isDir) {
+    const char *leaf;
+    int parent = resolveParent(path, &leaf);
+    if (parent < 0) {
+        return parent;
+    }
+    if (leaf[0] == '\0') {
+        *isDir = true;
+        return parent;
+    }
+    if (strlen(leaf) >= NAME_LENGTH) {
+        return -ENAMETOOLONG;
+    }
+    return lookup(parent, leaf, isDir);
+}
+
+/// @brief Create a file or directory.
+///
+/// The entry is taken from root if a slot is free there, otherwise from the entry chain, with its name in the
+/// directory index. It becomes the first entry of its directory.
+/// \param [in] path Path of the new entry, starting with "/".
+/// \param [in] mode Type and permissions of the new entry.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::createEntry(const char *path, mode_t mode) {
+    const char *leaf;
+    int parent = resolveParent(path, &leaf);
+    if (parent < 0) {
+        return parent;
+    }
+    if (leaf[0] == '\0') {
+        return -EEXIST;
+    }
+    if (strlen(leaf) >= NAME_LENGTH) {
+        return -ENAMETOOLONG;
+    }
+    bool isDir;
+    int ret = lookup(parent, leaf, &isDir);
+    if (ret >= 0) {
+        return -EEXIST;
+    } else if (ret != -ENOENT) {
+        return ret;
+    }
+
+    int slot = ROOT_SLOT + 1;
+    while (slot < NUM_DIR_ENTRIES && root[slot].name[0] != '\0') {
+        slot++;
+    }
+    if (slot == NUM_DIR_ENTRIES) { // root voll: Eintrag in der Eintragskette
+        slot = allocSlot();
+        if (slot < 0) {
+            return slot;
+        }
+    }
+    file *myFile = entryOf(slot);
+    *myFile = file();
+    strcpy(myFile->name, leaf);
+    myFile->parent = parent;
+    myFile->fat_data = -1;
+    myFile->dataSize = 0;
+    myFile->mode = mode;
+    myFile->atime = time(NULL);
+    myFile->mtime = time(NULL);
+    if (slot < NUM_DIR_ENTRIES) {
+        pathIndex.insert(parent, myFile->name, slot);
+    } else {
+        ret = insertName(parent, myFile->name, slot);
+        if (ret < 0) {
+            releaseSlot(slot);
+            return ret;
+        }
+        dirHeader.files++;
+        writeDirHeader();
+    }
+    ret = linkEntry(parent, slot); // schreibt auch den neuen Eintrag
+    if (ret < 0) { // nicht halb angelegt zurücklassen
+        file *dirFile = entryOf(parent);
+        if (dirFile != nullptr && dirFile->firstChild == slot) {
+            unlinkEntry(slot);
+        }
+        freeEntry(myFile);
+        return ret;
+    }
+    dentries.insert(parent, leaf, slot, S_ISDIR(mode));
+    actualFiles++;
+    return 0;
+}
+
+/// @brief Delete a file or an empty directory.
+///
+/// \param [in] myFile Entry of the file or directory, not open.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::removeEntry(file *myFile) {
+    cutBlocks(myFile, 0);
+
+    int slot = slotOf(myFile);
+    chunkBuffers.erase(slot);
+    extentMaps.erase(slot);
+    myFile->fat_data = -1;
+    myFile->dataSize = 0;
+
+    writeFatToDisc();
+
+    writeDedupMapToDisc();
+    writeDmapToDisc();
+    int ret = unlinkEntry(slot);
+    dentries.insert(myFile->parent, myFile->name, -1, false);
+    freeEntry(myFile);
+    punchHoles();
+
+    actualFiles--;
+    return ret;
+}
+
+/// @brief Give the slot of an entry back.
+///
+/// The name is removed from the path index or the directory index. A slot in root is marked free by its empty name, a
+/// slot in the entry chain goes back to the list of free slots.
+/// \param [in] myFile The entry, already removed from the list of its directory.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::freeEntry(file *myFile) {
+    int slot = slotOf(myFile);
+    if (slot < NUM_DIR_ENTRIES) {
+        pathIndex.remove(myFile->parent, myFile->name, slot);
+        myFile->name[0] = '\0';
+        return writeEntry(myFile);
+    }
+    int ret = removeName(myFile->parent, myFile->name, slot);
+    dirHeader.files--;
+    int releaseRet = releaseSlot(slot); // Eintrag wird wieder frei
+    return ret < 0 ? ret : releaseRet;
+}
+
+/// @brief Insert an entry at the head of the list of entries of a directory.
+///
+/// The entry, the directory and the entry that was first before are written.
+/// \param [in] dir Slot of the directory.
+/// \param [in] slot Slot of the entry, its parent must be dir already.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::linkEntry(int dir, int slot) {
+    file *dirFile = entryOf(dir);
+    file *myFile = entryOf(slot);
+    file *next = dirFile != nullptr && dirFile->firstChild >= 0 ? entryOf(dirFile->firstChild) : nullptr;
+    if (dirFile == nullptr || myFile == nullptr || (dirFile->firstChild >= 0 && next == nullptr)) {
+        return -EIO;
+    }
+    myFile->prevEntry = -1;
+    myFile->nextEntry = dirFile->firstChild;
+    int ret = writeEntry(myFile);
+    if (next != nullptr) {
+        next->prevEntry = slot;
+        ret = ret < 0 ? ret : writeEntry(next);
+    }
+    dirFile->firstChild = slot;
+    return ret < 0 ? ret : writeEntry(dirFile);
+}
+
+/// @brief Take an entry out of the list of entries of its directory.
+///
+/// Its neighbours, or the directory if it was the first entry, are written; the entry itself is left to the caller.
+/// \param [in] slot Slot of the entry.
+/// \return 0 on success, -ERRNO on failure.
+int MyOnDiskFS::unlinkEntry(int slot) {
+    file *myFile = entryOf(slot);
+    if (myFile == nullptr) {
+        return -EIO;
+    }
+    file *prev = entryOf(myFile->prevEntry >= 0 ? myFile->prevEntry : myFile->parent);
+    file *next = myFile->nextEntry >= 0 ? entryOf(myFile->nextEntry) : nullptr;
+    if (prev == nullptr || (myFile->nextEntry >= 0 && next == nullptr)) {
+        return -EIO;
+    }
+    if (myFile->prevEntry >= 0) {
+        prev->nextEntry = myFile->nextEntry;
+    } else {
+        prev->firstChild = myFile->nextEntry;
+    }
+    int ret = writeEntry(prev);
+    if (next != nullptr) {
+        next->prevEntry = myFile->prevEntry;
+        ret = ret < 0 ? ret : writeEntry(next);
+    }
+    myFile->prevEntry = -1;
+    myFile->nextEntry = -1;
+    return ret;
 }
 
 // DO NOT EDIT ANYTHING BELOW THIS LINE!!!
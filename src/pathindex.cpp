@@ -0,0 +1,106 @@
+//
+//  pathindex.cpp
+//  myfs
+//
+
+#include <cstring>
+
+#include "pathindex.h"
+#include "crc32c.h"
+
+#define PI_EMPTY (-1)
+#define PI_REMOVED (-2)
+#define PI_MIN_CAPACITY 16
+
+PathIndex::PathIndex() {
+    this->used = 0;
+    this->removed = 0;
+    resize(PI_MIN_CAPACITY);
+}
+
+uint32_t PathIndex::hash(int parent, const char *name) {
+    return crc32c(crc32c(0, &parent, sizeof(parent)), name, strlen(name));
+}
+
+// move the live entries into a table of the given capacity, dropping the tombstones
+void PathIndex::resize(uint32_t capacity) {
+    std::vector<Bucket> old;
+    old.swap(this->buckets);
+    this->buckets.assign(capacity, Bucket{0, PI_EMPTY});
+    this->removed = 0;
+    uint32_t mask = capacity - 1;
+    for (const Bucket &b : old) {
+        if (b.slot >= 0) {
+            uint32_t i = b.hash & mask;
+            while (this->buckets[i].slot != PI_EMPTY)
+                i = (i + 1) & mask;
+            this->buckets[i] = b;
+        }
+    }
+}
+
+void PathIndex::rebuild(const file *entries, int count) {
+    this->used = 0;
+    uint32_t capacity = PI_MIN_CAPACITY;
+    while (capacity * 3 < (uint32_t) count * 4)
+        capacity *= 2;
+    this->buckets.clear();
+    resize(capacity);
+    for (int i = 0; i < count; i++) {
+        if (entries[i].name[0] != '\0')
+            insert(entries[i].parent, entries[i].name, i);
+    }
+}
+
+int PathIndex::find(const file *entries, int parent, const char *name) const {
+    uint32_t hash = PathIndex::hash(parent, name);
+    uint32_t mask = (uint32_t) this->buckets.size() - 1;
+    for (uint32_t i = hash & mask; this->buckets[i].slot != PI_EMPTY; i = (i + 1) & mask) {
+        const Bucket &b = this->buckets[i];
+        if (b.slot >= 0 && b.hash == hash && entries[b.slot].parent == parent
+                && strcmp(entries[b.slot].name, name) == 0)
+            return b.slot;
+    }
+    return -1;
+}
+
+void PathIndex::insert(int parent, const char *name, int slot) {
+    // keep a bucket empty, a search for a missing name ends there
+    if ((this->used + this->removed + 1) * 4 > this->buckets.size() * 3) {
+        uint32_t capacity = (uint32_t) this->buckets.size();
+        while ((this->used + 1) * 2 > capacity)
+            capacity *= 2;
+        resize(capacity);
+    }
+    uint32_t hash = PathIndex::hash(parent, name);
+    uint32_t mask = (uint32_t) this->buckets.size() - 1;
+    uint32_t i = hash & mask;
+    while (this->buckets[i].slot >= 0)
+        i = (i + 1) & mask;
+    if (this->buckets[i].slot == PI_REMOVED)
+        this->removed--;
+    this->buckets[i] = Bucket{hash, slot};
+    this->used++;
+}
+
+void PathIndex::remove(int parent, const char *name, int slot) {
+    uint32_t hash = PathIndex::hash(parent, name);
+    uint32_t mask = (uint32_t) this->buckets.size() - 1;
+    for (uint32_t i = hash & mask; this->buckets[i].slot != PI_EMPTY; i = (i + 1) & mask) {
+        if (this->buckets[i].slot == slot) {
+            // no search continues past this bucket if the next one is empty
+            if (this->buckets[(i + 1) & mask].slot == PI_EMPTY) {
+                this->buckets[i].slot = PI_EMPTY;
+            } else {
+                this->buckets[i].slot = PI_REMOVED;
+                this->removed++;
+            }
+            this->used--;
+            return;
+        }
+    }
+}
+
+uint32_t PathIndex::size() const {
+    return this->used;
+}
@@ -0,0 +1,228 @@
+//
+//  replay.cpp
+//  myfs
+//
+
+// Replays a block I/O trace, recorded with the trace option of mount.myfs, against a container file. The requests
+// are issued to the selected block device implementation with their original timing or as fast as possible, and the
+// statistics of the device are printed at the end.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "blockdevice.h"
+#include "asyncblockdevice.h"
+#include "mappedblockdevice.h"
+#include "tracingblockdevice.h"
+#include "latencyblockdevice.h"
+
+static void usage(const char *progname) {
+    fprintf(stderr,
+            "usage: %s [options] TRACE CONTAINER\n"
+            "\n"
+            "Replay a block I/O trace against a container file. The container file is overwritten.\n"
+            "\n"
+            "options:\n"
+            "    -d DEVICE   block device: sync, async or mmap (default async)\n"
+            "    -q N        number of requests in flight for the async device (default 32)\n"
+            "    -D          open the container file with O_DIRECT\n"
+            "    -f          replay as fast as possible instead of with the original timing\n"
+            "    -l MODEL    delay the requests like storage MODEL: hdd, ssd or net\n"
+            "    -s SEED     seed of the random parts of the emulated timing (default 1)\n"
+            "    -h          print this help\n", progname);
+}
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) (ns / 1000000000ULL);
+    ts.tv_nsec = (long) (ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *deviceName = "async";
+    unsigned int queueDepth = BD_QUEUE_DEPTH;
+    bool directIO = false;
+    bool fast = false;
+    const char *latencyName = nullptr;
+    uint64_t seed = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:q:Dfl:s:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                deviceName = optarg;
+                break;
+            case 'q':
+                queueDepth = (unsigned int) atoi(optarg);
+                break;
+            case 'D':
+                directIO = true;
+                break;
+            case 'f':
+                fast = true;
+                break;
+            case 'l':
+                latencyName = optarg;
+                break;
+            case 's':
+                seed = strtoull(optarg, nullptr, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    TraceReader reader;
+    int ret = reader.open(argv[optind]);
+    if (ret < 0) {
+        fprintf(stderr, "Error: Cannot read trace %s: %s\n", argv[optind], strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    uint32_t blockCount = 0;
+    uint64_t largest = 0;
+    while (reader.next(record)) {
+        records.push_back(record);
+        uint32_t end = record.op == TRACE_GROW ? record.blockNo : record.blockNo + record.count;
+        blockCount = end > blockCount ? end : blockCount;
+        largest = record.count > largest ? record.count : largest;
+    }
+    uint32_t blockSize = reader.getBlockSize();
+
+    BlockDevice *device;
+    if (strcmp(deviceName, "sync") == 0) {
+        device = new BlockDevice(blockSize);
+    } else if (strcmp(deviceName, "async") == 0) {
+        device = new AsyncBlockDevice(blockSize, queueDepth);
+    } else if (strcmp(deviceName, "mmap") == 0) {
+        device = new MappedBlockDevice(blockSize, blockCount);
+    } else {
+        fprintf(stderr, "Error: Unknown block device %s (use sync, async or mmap)\n", deviceName);
+        return EXIT_FAILURE;
+    }
+    device->setDirectIO(directIO);
+    if (latencyName != nullptr) {
+        LatencyKind kind;
+        if (strcmp(latencyName, "hdd") == 0) {
+            kind = LATENCY_HDD;
+        } else if (strcmp(latencyName, "ssd") == 0) {
+            kind = LATENCY_SSD;
+        } else if (strcmp(latencyName, "net") == 0) {
+            kind = LATENCY_NETWORK;
+        } else {
+            fprintf(stderr, "Error: Unknown storage model %s (use hdd, ssd or net)\n", latencyName);
+            delete device;
+            return EXIT_FAILURE;
+        }
+        LatencyModel model = LatencyBlockDevice::getDefaultModel(kind);
+        model.seed = seed > 0 ? seed : model.seed;
+        device = new LatencyBlockDevice(device, model);
+    }
+    ret = device->create(argv[optind + 1]);
+    if (ret < 0) {
+        fprintf(stderr, "Error: Cannot create container file %s: %s\n", argv[optind + 1], strerror(-ret));
+        delete device;
+        return EXIT_FAILURE;
+    }
+
+    // the content does not matter, reads share one buffer and writes store random bytes
+    size_t bufferSize = (size_t) (largest > 0 ? largest : 1) * blockSize;
+    void *readBuffer = nullptr;
+    void *writeBuffer = nullptr;
+    if (posix_memalign(&readBuffer, 4096, bufferSize) != 0 || posix_memalign(&writeBuffer, 4096, bufferSize) != 0) {
+        fprintf(stderr, "Error: Cannot allocate %lu bytes\n", (unsigned long) bufferSize);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < bufferSize; i++) {
+        ((char *) writeBuffer)[i] = (char) rand();
+    }
+
+    uint64_t errors = 0;
+    BlockCompletion done[64];
+    uint64_t start = nowNs();
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord &r = records[i];
+        if (!fast) {
+            sleepUntil(start + r.timeNs);
+        }
+        BlockDevice::setCause(r.cause);
+
+        struct iovec iov;
+        iov.iov_base = r.op == TRACE_WRITE ? writeBuffer : readBuffer;
+        iov.iov_len = (size_t) r.count * blockSize;
+        switch (r.op) {
+            case TRACE_READ:
+            case TRACE_WRITE:
+                if (r.flags & TRACE_QUEUED) {
+                    ret = r.op == TRACE_WRITE ? device->queueWrite(r.blockNo, &iov, 1, i)
+                                              : device->queueRead(r.blockNo, &iov, 1, i);
+                    if (ret == 0) {
+                        ret = device->submit() < 0 ? -EIO : 0;
+                    }
+                } else {
+                    ret = r.op == TRACE_WRITE ? device->writeBlocks(r.blockNo, &iov, 1)
+                                              : device->readBlocks(r.blockNo, &iov, 1);
+                }
+                break;
+            case TRACE_FLUSH:
+                ret = device->flush(r.blockNo, r.count, (r.flags & TRACE_WAIT) != 0);
+                break;
+            case TRACE_DISCARD:
+                ret = device->discard(r.blockNo, r.count);
+                break;
+            case TRACE_GROW:
+                ret = device->grow(r.blockNo);
+                break;
+            default:
+                ret = -EINVAL;
+        }
+        if (ret < 0) {
+            errors++;
+        }
+
+        // collect finished queued requests on the way
+        int n;
+        while ((n = device->complete(done, 64, false)) > 0) {
+            for (int k = 0; k < n; k++) {
+                errors += done[k].result < 0;
+            }
+        }
+    }
+    if (device->drain() < 0) {
+        errors++;
+    }
+    uint64_t elapsed = nowNs() - start;
+
+    printf("Replayed %lu requests in %.3f s (traced: %.3f s), %lu failed\n", (unsigned long) records.size(),
+           elapsed / 1e9, records.empty() ? 0.0 : records.back().timeNs / 1e9, (unsigned long) errors);
+    std::vector<const char *> names;
+    for (const std::string &name : reader.getCauseNames()) {
+        names.push_back(name.c_str());
+    }
+    device->printStats(stdout, names.data(), (uint32_t) names.size());
+
+    device->close();
+    delete device;
+    free(readBuffer);
+    free(writeBuffer);
+    return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
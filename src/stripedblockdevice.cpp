@@ -0,0 +1,142 @@
+//
+//  stripedblockdevice.cpp
+//  myfs
+//
+
+#include <algorithm>
+#include <errno.h>
+
+#include "stripedblockdevice.h"
+
+StripedBlockDevice::StripedBlockDevice(const std::vector<BlockDevice *> &members, const std::vector<std::string> &paths,
+                                       uint32_t stripeSize) : CompositeBlockDevice(members, paths) {
+    this->stripeSize = stripeSize > 0 ? stripeSize : 1;
+}
+
+uint32_t StripedBlockDevice::memberBlockCount(uint32_t member, uint32_t blockCount) {
+    uint32_t n = (uint32_t) this->members.size();
+    uint32_t units = blockCount / this->stripeSize;     // complete stripe units
+    uint32_t count = units / n * this->stripeSize;      // complete rows of stripe units
+    if (member < units % n)
+        count += this->stripeSize;
+    else if (member == units % n)
+        count += blockCount % this->stripeSize;
+    return count;
+}
+
+// split a run of blocks into the parts stored on the members, in order
+void StripedBlockDevice::split(uint32_t firstBlockNo, uint32_t count, std::vector<Segment> &segments) {
+    uint32_t n = (uint32_t) this->members.size();
+    segments.clear();
+    while (count > 0) {
+        uint32_t unit = firstBlockNo / this->stripeSize;
+        uint32_t offset = firstBlockNo % this->stripeSize;
+        Segment s;
+        s.member = unit % n;
+        s.blockNo = unit / n * this->stripeSize + offset;
+        s.count = std::min(this->stripeSize - offset, count);
+        segments.push_back(s);
+        firstBlockNo += s.count;
+        count -= s.count;
+    }
+}
+
+// one part per stripe unit, with the pieces of the buffers holding it
+void StripedBlockDevice::queueParts(uint32_t index, const struct iovec *iov, int iovcnt) {
+    Request &r = this->requests[index];
+    std::vector<Segment> segments;
+    split(r.firstBlockNo, (uint32_t) (r.size / this->blockSize), segments);
+    std::vector<struct iovec> part;
+    int i = 0;              // current buffer
+    size_t used = 0;        // bytes of the current buffer in earlier parts
+    for (const Segment &s : segments) {
+        part.clear();
+        size_t bytes = (size_t) s.count * this->blockSize;
+        while (bytes > 0) {
+            size_t len = std::min(iov[i].iov_len - used, bytes);
+            struct iovec piece;
+            piece.iov_base = (char *) iov[i].iov_base + used;
+            piece.iov_len = len;
+            if (len > 0)
+                part.push_back(piece);
+            bytes -= len;
+            used += len;
+            if (used == iov[i].iov_len) {
+                i++;
+                used = 0;
+            }
+        }
+        queuePart(index, s.member, s.blockNo, part.data(), (int) part.size());
+    }
+}
+
+int StripedBlockDevice::grow(uint32_t blockCount) {
+    for (uint32_t m = 0; m < this->members.size(); m++) {
+        int ret = this->members[m]->grow(memberBlockCount(m, blockCount));
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+int StripedBlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    uint64_t start = clockNs();
+    std::vector<Segment> segments;
+    split(firstBlockNo, count, segments);
+    for (const Segment &s : segments) {
+        int ret = this->members[s.member]->discard(s.blockNo, s.count);
+        if (ret < 0)
+            return ret;
+    }
+    record(BD_OP_DISCARD, (off_t) firstBlockNo * this->blockSize, (size_t) count * this->blockSize, start, cause);
+    return 0;
+}
+
+int StripedBlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    holes.assign(count, false);
+    std::vector<Segment> segments;
+    split(firstBlockNo, count, segments);
+    std::vector<bool> part;
+    uint32_t offset = 0;
+    for (const Segment &s : segments) {
+        int ret = this->members[s.member]->findHoles(s.blockNo, s.count, part);
+        if (ret < 0) {
+            holes.assign(count, false);
+            return ret;
+        }
+        std::copy(part.begin(), part.end(), holes.begin() + offset);
+        offset += s.count;
+    }
+    return 0;
+}
+
+int StripedBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    uint64_t start = clockNs();
+    if (count == 0) {
+        for (BlockDevice *member : this->members) {
+            int ret = member->flush(0, 0, wait);
+            if (ret < 0)
+                return ret;
+        }
+    } else {
+        // one flush per member, covering all of its parts
+        std::vector<Segment> segments;
+        split(firstBlockNo, count, segments);
+        std::vector<uint32_t> first(this->members.size(), UINT32_MAX);
+        std::vector<uint32_t> end(this->members.size(), 0);
+        for (const Segment &s : segments) {
+            first[s.member] = std::min(first[s.member], s.blockNo);
+            end[s.member] = std::max(end[s.member], s.blockNo + s.count);
+        }
+        for (size_t m = 0; m < this->members.size(); m++) {
+            if (end[m] == 0)
+                continue;
+            int ret = this->members[m]->flush(first[m], end[m] - first[m], wait);
+            if (ret < 0)
+                return ret;
+        }
+    }
+    if (wait)
+        record(BD_OP_FLUSH, 0, 0, start, cause);
+    return 0;
+}
@@ -0,0 +1,192 @@
+//
+//  tracingblockdevice.cpp
+//  myfs
+//
+
+#include <cstring>
+#include <errno.h>
+
+#include "tracingblockdevice.h"
+
+TracingBlockDevice::TracingBlockDevice(BlockDevice *device, const char *tracePath, const char *const *causeNames,
+                                       uint32_t causeCount) : BlockDevice(device->getBlockSize()) {
+    this->device = device;
+    this->startNs = clockNs();
+    this->traceFile = fopen(tracePath, "wb");
+    if (this->traceFile == nullptr)
+        return;
+    setvbuf(this->traceFile, nullptr, _IOFBF, TRACE_BUFFER_SIZE);
+
+    // header: magic, version, block size, cause names with their lengths
+    uint32_t header[3] = { TRACE_VERSION, this->blockSize, causeNames != nullptr ? causeCount : 0 };
+    fwrite(TRACE_MAGIC, 1, 8, this->traceFile);
+    fwrite(header, sizeof(header), 1, this->traceFile);
+    for (uint32_t c = 0; c < header[2]; c++) {
+        uint8_t len = (uint8_t) strnlen(causeNames[c], 255);
+        fwrite(&len, 1, 1, this->traceFile);
+        fwrite(causeNames[c], 1, len, this->traceFile);
+    }
+}
+
+TracingBlockDevice::~TracingBlockDevice() {
+    if (this->traceFile != nullptr)
+        fclose(this->traceFile);
+    delete this->device;
+}
+
+bool TracingBlockDevice::isTracing() {
+    return this->traceFile != nullptr;
+}
+
+void TracingBlockDevice::trace(TraceOp op, uint32_t blockNo, uint64_t bytes, uint16_t flags) {
+    if (this->traceFile == nullptr)
+        return;
+    TraceRecord record;
+    record.timeNs = clockNs() - this->startNs;
+    record.blockNo = blockNo;
+    record.count = (uint32_t) (bytes / this->blockSize);
+    record.op = (uint8_t) op;
+    record.cause = (uint8_t) cause;
+    record.flags = flags;
+    record.reserved = 0;
+
+    std::lock_guard<std::mutex> lock(this->traceMutex);
+    fwrite(&record, sizeof(record), 1, this->traceFile);
+}
+
+// total length of the buffers in iov
+static uint64_t iovSize(const struct iovec *iov, int iovcnt) {
+    uint64_t size = 0;
+    for (int i = 0; i < iovcnt; i++)
+        size += iov[i].iov_len;
+    return size;
+}
+
+int TracingBlockDevice::open(const char *path) {
+    return this->device->open(path);
+}
+
+int TracingBlockDevice::create(const char *path) {
+    return this->device->create(path);
+}
+
+int TracingBlockDevice::close() {
+    if (this->traceFile != nullptr) {
+        std::lock_guard<std::mutex> lock(this->traceMutex);
+        fflush(this->traceFile);
+    }
+    return this->device->close();
+}
+
+int TracingBlockDevice::readBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    trace(TRACE_READ, firstBlockNo, (uint64_t) count * this->blockSize, 0);
+    return this->device->readBlocks(firstBlockNo, count, buffer);
+}
+
+int TracingBlockDevice::writeBlocks(uint32_t firstBlockNo, uint32_t count, char *buffer) {
+    trace(TRACE_WRITE, firstBlockNo, (uint64_t) count * this->blockSize, 0);
+    return this->device->writeBlocks(firstBlockNo, count, buffer);
+}
+
+int TracingBlockDevice::readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    trace(TRACE_READ, firstBlockNo, iovSize(iov, iovcnt), 0);
+    return this->device->readBlocks(firstBlockNo, iov, iovcnt);
+}
+
+int TracingBlockDevice::writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+    trace(TRACE_WRITE, firstBlockNo, iovSize(iov, iovcnt), 0);
+    return this->device->writeBlocks(firstBlockNo, iov, iovcnt);
+}
+
+int TracingBlockDevice::grow(uint32_t blockCount) {
+    trace(TRACE_GROW, blockCount, 0, 0);
+    return this->device->grow(blockCount);
+}
+
+int TracingBlockDevice::discard(uint32_t firstBlockNo, uint32_t count) {
+    trace(TRACE_DISCARD, firstBlockNo, (uint64_t) count * this->blockSize, 0);
+    return this->device->discard(firstBlockNo, count);
+}
+
+int TracingBlockDevice::findHoles(uint32_t firstBlockNo, uint32_t count, std::vector<bool> &holes) {
+    return this->device->findHoles(firstBlockNo, count, holes);
+}
+
+int TracingBlockDevice::flush(uint32_t firstBlockNo, uint32_t count, bool wait) {
+    trace(TRACE_FLUSH, firstBlockNo, (uint64_t) count * this->blockSize, wait ? TRACE_WAIT : 0);
+    return this->device->flush(firstBlockNo, count, wait);
+}
+
+int TracingBlockDevice::queueRead(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    trace(TRACE_READ, firstBlockNo, iovSize(iov, iovcnt), TRACE_QUEUED);
+    return this->device->queueRead(firstBlockNo, iov, iovcnt, tag);
+}
+
+int TracingBlockDevice::queueWrite(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt, uint64_t tag) {
+    trace(TRACE_WRITE, firstBlockNo, iovSize(iov, iovcnt), TRACE_QUEUED);
+    return this->device->queueWrite(firstBlockNo, iov, iovcnt, tag);
+}
+
+int TracingBlockDevice::submit() {
+    return this->device->submit();
+}
+
+int TracingBlockDevice::complete(BlockCompletion *done, int maxDone, bool wait) {
+    return this->device->complete(done, maxDone, wait);
+}
+
+int TracingBlockDevice::drain() {
+    return this->device->drain();
+}
+
+BlockDeviceStats TracingBlockDevice::getStats() {
+    return this->device->getStats();
+}
+
+void TracingBlockDevice::resetStats() {
+    if (this->device != nullptr)
+        this->device->resetStats();
+}
+
+TraceReader::TraceReader() {
+    this->traceFile = nullptr;
+    this->blockSize = 0;
+}
+
+TraceReader::~TraceReader() {
+    if (this->traceFile != nullptr)
+        fclose(this->traceFile);
+}
+
+int TraceReader::open(const char *path) {
+    this->traceFile = fopen(path, "rb");
+    if (this->traceFile == nullptr)
+        return -errno;
+
+    char magic[8];
+    uint32_t header[3];
+    if (fread(magic, 1, 8, this->traceFile) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+        fread(header, sizeof(header), 1, this->traceFile) != 1 || header[0] != TRACE_VERSION)
+        return -EINVAL;
+    this->blockSize = header[1];
+    for (uint32_t c = 0; c < header[2]; c++) {
+        uint8_t len;
+        char name[256];
+        if (fread(&len, 1, 1, this->traceFile) != 1 || fread(name, 1, len, this->traceFile) != len)
+            return -EINVAL;
+        this->causeNames.push_back(std::string(name, len));
+    }
+    return 0;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+    return this->traceFile != nullptr && fread(&record, sizeof(record), 1, this->traceFile) == 1;
+}
+
+uint32_t TraceReader::getBlockSize() {
+    return this->blockSize;
+}
+
+const std::vector<std::string> &TraceReader::getCauseNames() {
+    return this->causeNames;
+}
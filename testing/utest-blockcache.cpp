@@ -0,0 +1,291 @@
+//
+//  utest-blockcache.cpp
+//  testing
+//
+
+#include "../catch/catch.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tools.hpp"
+
+#include "blockdevice.h"
+#include "asyncblockdevice.h"
+#include "blockcache.h"
+
+#define BC_PATH "/tmp/bc.bin"
+#define BC_BLOCKS 64
+
+TEST_CASE( "BC_READ_WRITE", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    REQUIRE(bd.create(BC_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * BC_BLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * BC_BLOCKS);
+    char* r= new char[BD_BLOCK_SIZE];
+
+    BlockCachePolicy policies[2]= { CACHE_LRU, CACHE_ARC };
+    for (int p = 0; p < 2; p++) {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 16, policies[p]);
+
+        // writes go through to the device
+        for (int b = 0; b < BC_BLOCKS; b++) {
+            REQUIRE(cache.write(b, w + b * BD_BLOCK_SIZE) == 0);
+        }
+        for (int b = 0; b < BC_BLOCKS; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(cache.getStats().resident == 16);
+
+        // reads through the cache see the device content, whether cached or not
+        for (int b = 0; b < BC_BLOCKS; b++) {
+            REQUIRE(cache.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+        BlockCacheStats stats= cache.getStats();
+        REQUIRE(stats.hits + stats.misses == 2 * BC_BLOCKS);
+        REQUIRE(stats.resident <= 16);
+        REQUIRE(stats.pinned == 0);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BC_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BC_HITS_AND_EVICTION", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    REQUIRE(bd.create(BC_PATH) == 0);
+    char* r= new char[BD_BLOCK_SIZE];
+
+    SECTION("LRU evicts the least recently used block") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 4, CACHE_LRU);
+        for (int b = 0; b < 4; b++) {
+            REQUIRE(cache.read(b, r) == 0);
+        }
+        REQUIRE(cache.read(0, r) == 0);     // block 1 is now the oldest
+        REQUIRE(cache.read(10, r) == 0);
+        REQUIRE(cache.getStats().hits == 1);
+
+        REQUIRE(cache.read(0, r) == 0);
+        REQUIRE(cache.read(2, r) == 0);
+        REQUIRE(cache.getStats().hits == 3);
+        REQUIRE(cache.read(1, r) == 0);
+        REQUIRE(cache.getStats().hits == 3);
+        REQUIRE(cache.getStats().evictions == 2);
+    }
+
+    SECTION("ARC keeps frequently used blocks during a scan") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 8, CACHE_ARC);
+        for (int round = 0; round < 2; round++) {
+            for (int b = 0; b < 4; b++) {
+                REQUIRE(cache.read(b, r) == 0);
+            }
+        }
+        for (int b = 100; b < 100 + 3 * 8; b++) {
+            REQUIRE(cache.read(b, r) == 0);
+        }
+        uint64_t hits= cache.getStats().hits;
+        for (int b = 0; b < 4; b++) {
+            REQUIRE(cache.read(b, r) == 0);
+        }
+        REQUIRE(cache.getStats().hits == hits + 4);
+    }
+
+    SECTION("pinned blocks are not evicted") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 4, CACHE_LRU);
+        uint32_t blockNos[6]= { 20, 21, 22, 23, 24, 25 };
+        char* frames[6];
+        REQUIRE(cache.pin(blockNos, 6, frames) == 0);
+        REQUIRE(cache.getStats().resident == 6);
+        REQUIRE(cache.getStats().pinned == 6);
+
+        // pinned frames can be changed in place and committed
+        memset(frames[5], 'x', BD_BLOCK_SIZE);
+        REQUIRE(cache.commit(blockNos + 5, 1) == 0);
+        cache.unpin(blockNos, 6);
+        REQUIRE(cache.getStats().resident == 4);
+        REQUIRE(bd.read(25, r) == 0);
+        REQUIRE(r[0] == 'x');
+
+        // discarded blocks are read again
+        cache.discard(25);
+        REQUIRE(cache.read(25, r) == 0);
+        REQUIRE(r[BD_BLOCK_SIZE - 1] == 'x');
+        REQUIRE(cache.getStats().misses == 7);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BC_PATH);
+
+    delete [] r;
+}
+
+TEST_CASE( "BC_WRITE_BACK", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    REQUIRE(bd.create(BC_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * BC_BLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * BC_BLOCKS);
+    char* r= new char[BD_BLOCK_SIZE];
+    char* zero= new char[BD_BLOCK_SIZE];
+    memset(zero, 0, BD_BLOCK_SIZE);
+
+    SECTION("dirty blocks are written by flush") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 16, CACHE_ARC);
+        REQUIRE(cache.setWriteBack(true, 60000, 1000) == 0);
+        for (int round = 0; round < 3; round++) {
+            for (int b = 0; b < 8; b++) {
+                REQUIRE(cache.write(b, w + b * BD_BLOCK_SIZE) == 0);
+            }
+        }
+        REQUIRE(cache.getStats().dirty == 8);
+        REQUIRE(bd.read(3, r) == 0);
+        REQUIRE(memcmp(r, zero, BD_BLOCK_SIZE) == 0);
+
+        uint32_t some[2]= { 3, 5 };
+        REQUIRE(cache.flush(some, 2) == 0);
+        REQUIRE(cache.getStats().dirty == 6);
+        REQUIRE(bd.read(3, r) == 0);
+        REQUIRE(memcmp(r, w + 3 * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+
+        // freed blocks are never written
+        cache.discard(7);
+        REQUIRE(cache.flushAll() == 0);
+        BlockCacheStats stats= cache.getStats();
+        REQUIRE(stats.dirty == 0);
+        REQUIRE(stats.writebacks == 7);
+        for (int b = 0; b < 7; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bd.read(7, r) == 0);
+        REQUIRE(memcmp(r, zero, BD_BLOCK_SIZE) == 0);
+    }
+
+    SECTION("evicted dirty blocks are written") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 4, CACHE_LRU);
+        REQUIRE(cache.setWriteBack(true, 60000, 1000) == 0);
+        for (int b = 0; b < 8; b++) {
+            REQUIRE(cache.write(b, w + b * BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(cache.getStats().dirty == 4);
+        for (int b = 0; b < 4; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+
+        // switching to write-through writes the rest
+        REQUIRE(cache.setWriteBack(false) == 0);
+        REQUIRE(cache.getStats().dirty == 0);
+        for (int b = 4; b < 8; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+    }
+
+    SECTION("flusher writes old blocks and relieves pressure") {
+        BlockCache cache(&bd, BD_BLOCK_SIZE, 32, CACHE_ARC);
+        REQUIRE(cache.setWriteBack(true, 20, 8) == 0);
+        for (int b = 0; b < 16; b++) {
+            REQUIRE(cache.write(b, w + b * BD_BLOCK_SIZE) == 0);
+        }
+        for (int i = 0; i < 200 && cache.getStats().dirty > 0; i++) {
+            usleep(10000);
+        }
+        REQUIRE(cache.getStats().dirty == 0);
+        for (int b = 0; b < 16; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        }
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BC_PATH);
+
+    delete [] zero;
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BC_PREFETCH", "[blockcache]" ) {
+
+    remove(BC_PATH);
+
+    BlockDevice bd(BD_BLOCK_SIZE);
+    AsyncBlockDevice abd(BD_BLOCK_SIZE, 4);
+    BlockDevice* devices[2]= { &bd, &abd };
+
+    char* w= new char[BD_BLOCK_SIZE * BC_BLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * BC_BLOCKS);
+    char* r= new char[BD_BLOCK_SIZE];
+    uint32_t blockNos[BC_BLOCKS];
+    for (int b = 0; b < BC_BLOCKS; b++) {
+        blockNos[b]= b;
+    }
+
+    for (int d = 0; d < 2; d++) {
+        BlockDevice* dev= devices[d];
+        REQUIRE(dev->create(BC_PATH) == 0);
+        REQUIRE(dev->writeBlocks(0, BC_BLOCKS, w) == 0);
+
+        // prefetched blocks are hits
+        {
+            BlockCache cache(dev, BD_BLOCK_SIZE, 48, CACHE_ARC);
+            REQUIRE(cache.prefetch(blockNos, 32) == 32);
+            REQUIRE(cache.prefetch(blockNos, 32) == 0);
+            for (int b = 0; b < 32; b++) {
+                REQUIRE(cache.read(b, r) == 0);
+                REQUIRE(memcmp(r, w + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+            }
+            BlockCacheStats stats= cache.getStats();
+            REQUIRE(stats.misses == 0);
+            REQUIRE(stats.prefetched == 32);
+            REQUIRE(stats.prefetchHits == 32);
+            REQUIRE(stats.pinned == 0);
+        }
+
+        // prefetch stays within the capacity
+        {
+            BlockCache cache(dev, BD_BLOCK_SIZE, 8, CACHE_LRU);
+            uint32_t pinned[4]= { 40, 41, 42, 43 };
+            char* frames[4];
+            REQUIRE(cache.pin(pinned, 4, frames) == 0);
+            REQUIRE(cache.prefetch(blockNos, 32) == 4);
+            cache.unpin(pinned, 4);
+            REQUIRE(cache.getStats().resident == 8);
+        }
+
+        // writes wait for prefetches of the same block
+        {
+            BlockCache cache(dev, BD_BLOCK_SIZE, 48, CACHE_ARC);
+            REQUIRE(cache.prefetch(blockNos, 16) == 16);
+            memset(r, 'x', BD_BLOCK_SIZE);
+            REQUIRE(cache.write(5, r) == 0);
+            REQUIRE(cache.read(5, r) == 0);
+            REQUIRE(r[0] == 'x');
+            REQUIRE(dev->read(5, r) == 0);
+            REQUIRE(r[BD_BLOCK_SIZE - 1] == 'x');
+        }
+
+        REQUIRE(dev->close() == 0);
+    }
+    remove(BC_PATH);
+
+    delete [] r;
+    delete [] w;
+}
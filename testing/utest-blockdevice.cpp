@@ -10,17 +10,47 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "tools.hpp"
 
 #include "blockdevice.h"
+#include "asyncblockdevice.h"
+#include "mappedblockdevice.h"
+#include "tracingblockdevice.h"
+#include "stripedblockdevice.h"
+#include "mirroredblockdevice.h"
+#include "checksumblockdevice.h"
+#include "latencyblockdevice.h"
+#include "crc32c.h"
 
 #define BD_PATH "/tmp/bd.bin"
+#define TRACE_PATH "/tmp/bd.trace"
 #define NUM_TESTBLOCKS 1024
 #define BLOCK_SIZE 512
 
 // Declarations of helper functions
 void bdWriteRead(BlockDevice *bd, int noBlocks= 1);
+uint64_t nowNs();
+
+// Block device whose reads or writes fail on request
+class FailingBlockDevice : public BlockDevice {
+public:
+    bool failReads= false;
+    bool failWrites= false;
+
+    FailingBlockDevice(uint32_t blockSize) : BlockDevice(blockSize) {}
+
+    virtual int readBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+        return failReads ? -EIO : BlockDevice::readBlocks(firstBlockNo, iov, iovcnt);
+    }
+
+    virtual int writeBlocks(uint32_t firstBlockNo, const struct iovec *iov, int iovcnt) {
+        return failWrites ? -EIO : BlockDevice::writeBlocks(firstBlockNo, iov, iovcnt);
+    }
+};
 
 TEST_CASE( "BD_CREATE_WRITE_READ_NEW_FILE", "[blockdevice]" ) {
     
@@ -82,6 +112,788 @@ TEST_CASE( "BD_OPEN_NON-EXISTING_FILE", "[blockdevice]" ) {
     REQUIRE(bd.open(BD_PATH) < 0);
 }
 
+TEST_CASE( "BD_MULTI_BLOCK_READ_WRITE", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+    SECTION("contiguous buffer") {
+        REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+
+        // single blocks see the same content
+        REQUIRE(bd.read(NUM_TESTBLOCKS - 1, r) == 0);
+        REQUIRE(memcmp(w + (NUM_TESTBLOCKS - 1) * BD_BLOCK_SIZE, r, BD_BLOCK_SIZE) == 0);
+    }
+
+    SECTION("scattered buffers") {
+        // gather the blocks in reverse order from w, scatter them in order into r
+        struct iovec iov[NUM_TESTBLOCKS];
+        for (int b = 0; b < NUM_TESTBLOCKS; b++) {
+            iov[b].iov_base = w + (NUM_TESTBLOCKS - 1 - b) * BD_BLOCK_SIZE;
+            iov[b].iov_len = BD_BLOCK_SIZE;
+        }
+        REQUIRE(bd.writeBlocks(0, iov, NUM_TESTBLOCKS) == 0);
+
+        for (int b = 0; b < NUM_TESTBLOCKS; b++) {
+            REQUIRE(bd.read(b, r) == 0);
+            REQUIRE(memcmp(w + (NUM_TESTBLOCKS - 1 - b) * BD_BLOCK_SIZE, r, BD_BLOCK_SIZE) == 0);
+        }
+
+        // buffers do not have to be block sized, only their total
+        struct iovec iov2[2];
+        iov2[0].iov_base = r;
+        iov2[0].iov_len = 100;
+        iov2[1].iov_base = r + 100;
+        iov2[1].iov_len = 3 * BD_BLOCK_SIZE - 100;
+        REQUIRE(bd.readBlocks(NUM_TESTBLOCKS - 3, iov2, 2) == 0);
+        REQUIRE(memcmp(w + 2 * BD_BLOCK_SIZE, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(memcmp(w, r + 2 * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+
+        iov2[1].iov_len = BD_BLOCK_SIZE;
+        REQUIRE(bd.readBlocks(0, iov2, 2) == -EINVAL);
+    }
+
+    SECTION("read beyond end of container") {
+        REQUIRE(bd.writeBlocks(0, 2, w) == 0);
+        memset(r, 1, 4 * BD_BLOCK_SIZE);
+        REQUIRE(bd.readBlocks(1, 3, r) == 0);
+        REQUIRE(memcmp(w + BD_BLOCK_SIZE, r, BD_BLOCK_SIZE) == 0);
+        for (int i = BD_BLOCK_SIZE; i < 3 * BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_QUEUED_READ_WRITE", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    BlockDevice bd(BLOCK_SIZE);
+    AsyncBlockDevice abd(BLOCK_SIZE, 8);
+    BlockDevice* devices[2]= { &bd, &abd };
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS];
+    struct iovec iov[NUM_TESTBLOCKS];
+
+    for (int d = 0; d < 2; d++) {
+        BlockDevice* dev= devices[d];
+        REQUIRE(dev->create(BD_PATH) == 0);
+        memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS);
+
+        // more requests than the queue depth, in runs of 4 blocks
+        for (int b = 0; b < NUM_TESTBLOCKS; b += 4) {
+            iov[b].iov_base = w + b * BD_BLOCK_SIZE;
+            iov[b].iov_len = 4 * BD_BLOCK_SIZE;
+            REQUIRE(dev->queueWrite(b, &iov[b], 1, b) == 0);
+        }
+        REQUIRE(dev->drain() == 0);
+
+        for (int b = 0; b < NUM_TESTBLOCKS; b++) {
+            iov[b].iov_base = r + b * BD_BLOCK_SIZE;
+            iov[b].iov_len = BD_BLOCK_SIZE;
+            REQUIRE(dev->queueRead(b, &iov[b], 1, b) >= 0);
+        }
+        REQUIRE(dev->submit() >= 0);
+
+        // every request completes exactly once with its tag
+        bool* seen= new bool[NUM_TESTBLOCKS];
+        memset(seen, 0, NUM_TESTBLOCKS);
+        int finished= 0;
+        BlockCompletion done[16];
+        while (finished < NUM_TESTBLOCKS) {
+            int n= dev->complete(done, 16, true);
+            REQUIRE(n > 0);
+            for (int i = 0; i < n; i++) {
+                REQUIRE(done[i].result == 0);
+                REQUIRE(done[i].tag < NUM_TESTBLOCKS);
+                REQUIRE(!seen[done[i].tag]);
+                seen[done[i].tag]= true;
+            }
+            finished += n;
+        }
+        REQUIRE(dev->complete(done, 16, true) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE * NUM_TESTBLOCKS) == 0);
+        delete [] seen;
+
+        // reads beyond the end of the container complete with zeros
+        memset(r, 1, BD_BLOCK_SIZE);
+        iov[0].iov_base = r;
+        iov[0].iov_len = BD_BLOCK_SIZE;
+        REQUIRE(dev->queueRead(NUM_TESTBLOCKS + 10, iov, 1, 0) == 0);
+        REQUIRE(dev->drain() == 0);
+        for (int i = 0; i < BD_BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+
+        REQUIRE(dev->close() == 0);
+    }
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_DIRECT_IO", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    // direct I/O falls back to the page cache where the host file system does not support it,
+    // in both cases unaligned buffers must work
+    BlockDevice bd(BLOCK_SIZE);
+    bd.setDirectIO(true);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    char* w= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1];
+    gen_random(w, BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1);
+    char* r= new char[BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1];
+    memset(r, 0, BD_BLOCK_SIZE * NUM_TESTBLOCKS + 1);
+
+    REQUIRE(bd.writeBlocks(0, NUM_TESTBLOCKS, w + 1) == 0);
+    REQUIRE(bd.write(3, w) == 0);
+    REQUIRE(bd.readBlocks(0, NUM_TESTBLOCKS, r + 1) == 0);
+    REQUIRE(memcmp(w + 1, r + 1, 3 * BD_BLOCK_SIZE) == 0);
+    REQUIRE(memcmp(w + 4 * BD_BLOCK_SIZE + 1, r + 4 * BD_BLOCK_SIZE + 1, (NUM_TESTBLOCKS - 4) * BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd.read(3, r) == 0);
+    REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd.close() == 0);
+
+    BlockDevice bd2(BLOCK_SIZE);
+    bd2.setDirectIO(true);
+    REQUIRE(bd2.open(BD_PATH) == 0);
+    REQUIRE(bd2.read(NUM_TESTBLOCKS - 1, r) == 0);
+    REQUIRE(memcmp(w + (NUM_TESTBLOCKS - 1) * BD_BLOCK_SIZE + 1, r, BD_BLOCK_SIZE) == 0);
+    REQUIRE(bd2.read(NUM_TESTBLOCKS + 1, r) == 0);
+    for (int i = 0; i < BD_BLOCK_SIZE; i++) {
+        REQUIRE(r[i] == 0);
+    }
+    REQUIRE(bd2.close() == 0);
+
+    remove(BD_PATH);
+
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_MEMORY_MAPPED", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+
+    MappedBlockDevice bd(BLOCK_SIZE, NUM_TESTBLOCKS);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    SECTION("read and write") {
+        bdWriteRead(&bd, NUM_TESTBLOCKS);
+    }
+
+    SECTION("block pointers") {
+        char* p= bd.getBlockPointer(0, NUM_TESTBLOCKS);
+        REQUIRE(p != NULL);
+        REQUIRE(bd.getBlockPointer(NUM_TESTBLOCKS - 1, 2) == NULL);
+
+        // changes through the pointer are seen by reads and vice versa
+        char w[BD_BLOCK_SIZE];
+        char r[BD_BLOCK_SIZE];
+        gen_random(w, BD_BLOCK_SIZE);
+        memcpy(bd.getBlockPointer(7, 1), w, BD_BLOCK_SIZE);
+        REQUIRE(bd.read(7, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        gen_random(w, BD_BLOCK_SIZE);
+        REQUIRE(bd.write(8, w) == 0);
+        REQUIRE(memcmp(p + 8 * BD_BLOCK_SIZE, w, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.flush(7, 2, true) == 0);
+
+        // blocks beyond the mapping still work
+        REQUIRE(bd.write(NUM_TESTBLOCKS + 3, w) == 0);
+        REQUIRE(bd.read(NUM_TESTBLOCKS + 3, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.close() == 0);
+
+        // the content is in the container file
+        BlockDevice bd2(BLOCK_SIZE);
+        REQUIRE(bd2.open(BD_PATH) == 0);
+        REQUIRE(bd2.read(8, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd2.close() == 0);
+    }
+
+    bd.close();
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_GROW", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+    struct stat st;
+    char w[BD_BLOCK_SIZE];
+    char r[BD_BLOCK_SIZE];
+    gen_random(w, BD_BLOCK_SIZE);
+
+    SECTION("container file") {
+        BlockDevice bd(BLOCK_SIZE);
+        REQUIRE(bd.create(BD_PATH) == 0);
+        REQUIRE(bd.grow(NUM_TESTBLOCKS) == 0);
+        REQUIRE(stat(BD_PATH, &st) == 0);
+        REQUIRE(st.st_size == NUM_TESTBLOCKS * BLOCK_SIZE);
+
+        // shrinking is ignored
+        REQUIRE(bd.grow(NUM_TESTBLOCKS / 2) == 0);
+        REQUIRE(stat(BD_PATH, &st) == 0);
+        REQUIRE(st.st_size == NUM_TESTBLOCKS * BLOCK_SIZE);
+
+        REQUIRE(bd.write(NUM_TESTBLOCKS - 1, w) == 0);
+        REQUIRE(bd.read(NUM_TESTBLOCKS - 1, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.close() == 0);
+    }
+
+    SECTION("mapping grows in place") {
+        MappedBlockDevice bd(BLOCK_SIZE, NUM_TESTBLOCKS, 4 * NUM_TESTBLOCKS);
+        REQUIRE(bd.create(BD_PATH) == 0);
+        char *p= bd.getBlockPointer(0, NUM_TESTBLOCKS);
+        REQUIRE(p != NULL);
+        REQUIRE(bd.write(NUM_TESTBLOCKS - 1, w) == 0);
+
+        REQUIRE(bd.grow(2 * NUM_TESTBLOCKS + 1) == 0);
+        REQUIRE(bd.getBlockPointer(0, 2 * NUM_TESTBLOCKS + 1) == p);
+        REQUIRE(memcmp(p + (NUM_TESTBLOCKS - 1) * BD_BLOCK_SIZE, w, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd.write(2 * NUM_TESTBLOCKS, w) == 0);
+        REQUIRE(memcmp(p + 2 * NUM_TESTBLOCKS * BD_BLOCK_SIZE, w, BD_BLOCK_SIZE) == 0);
+
+        // the reserved address space is the limit
+        REQUIRE(bd.grow(4 * NUM_TESTBLOCKS + 1) == -ENOSPC);
+        REQUIRE(bd.close() == 0);
+
+        BlockDevice bd2(BLOCK_SIZE);
+        REQUIRE(bd2.open(BD_PATH) == 0);
+        REQUIRE(bd2.read(2 * NUM_TESTBLOCKS, r) == 0);
+        REQUIRE(memcmp(w, r, BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd2.close() == 0);
+    }
+
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_DISCARD", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+    // host file systems punch holes in units of their own blocks
+    const int blocks = 64 * 1024 / BLOCK_SIZE;
+    char *w= new char[blocks * BLOCK_SIZE];
+    char *r= new char[blocks * BLOCK_SIZE];
+    gen_random(w, blocks * BLOCK_SIZE);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+    REQUIRE(bd.writeBlocks(0, blocks, w) == 0);
+
+    int ret= bd.discard(blocks / 4, blocks / 2);
+    REQUIRE((ret == 0 || ret == -EOPNOTSUPP));
+    if (ret == 0) {
+        // discarded blocks read as zeros, the others are unchanged
+        REQUIRE(bd.readBlocks(0, blocks, r) == 0);
+        REQUIRE(memcmp(r, w, blocks / 4 * BLOCK_SIZE) == 0);
+        for (int i= blocks / 4 * BLOCK_SIZE; i < 3 * blocks / 4 * BLOCK_SIZE; i++) {
+            REQUIRE(r[i] == 0);
+        }
+        REQUIRE(memcmp(r + 3 * blocks / 4 * BLOCK_SIZE, w + 3 * blocks / 4 * BLOCK_SIZE, blocks / 4 * BLOCK_SIZE) == 0);
+
+        // holes are reported if the host file system keeps track of them, blocks beyond the end are holes
+        std::vector<bool> holes;
+        if (bd.findHoles(0, 2 * blocks, holes) == 0) {
+            REQUIRE(holes.size() == 2 * blocks);
+            REQUIRE(holes[0] == false);
+            REQUIRE(holes[blocks - 1] == false);
+            REQUIRE(holes[blocks] == true);
+            REQUIRE(holes[2 * blocks - 1] == true);
+        }
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_STATS", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+    char w[4 * BD_BLOCK_SIZE];
+    char r[BD_BLOCK_SIZE];
+    gen_random(w, 4 * BD_BLOCK_SIZE);
+
+    BlockDevice bd(BLOCK_SIZE);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    BlockDevice::setCause(3);
+    for (int b= 0; b < 4; b++) {
+        REQUIRE(bd.write(b, w + b * BD_BLOCK_SIZE) == 0);
+    }
+    BlockDevice::setCause(5);
+    REQUIRE(bd.read(2, r) == 0);
+    REQUIRE(bd.read(0, r) == 0);
+    REQUIRE(bd.read(1, r) == 0);
+    REQUIRE(bd.flush(0, 0, true) == 0);
+    BlockDevice::setCause(0);
+
+    BlockDeviceStats stats= bd.getStats();
+    REQUIRE(stats.requests[BD_OP_WRITE] == 4);
+    REQUIRE(stats.bytes[BD_OP_WRITE] == 4 * BD_BLOCK_SIZE);
+    REQUIRE(stats.sequential[BD_OP_WRITE] == 3);
+    REQUIRE(stats.requests[BD_OP_READ] == 3);
+    REQUIRE(stats.sequential[BD_OP_READ] == 1);
+    REQUIRE(stats.requests[BD_OP_FLUSH] == 1);
+    REQUIRE(stats.causeRequests[3] == 4);
+    REQUIRE(stats.causeRequests[5] == 3);
+
+    // every request is in the histogram
+    uint64_t counted= 0;
+    for (int b= 0; b < BD_LATENCY_BUCKETS; b++) {
+        counted += stats.latency[BD_OP_READ][b];
+    }
+    REQUIRE(counted == 3);
+
+    uint64_t histogram[BD_LATENCY_BUCKETS]= {};
+    REQUIRE(BlockDevice::latencyPercentile(histogram, 0.5) == 0);
+    histogram[3]= 90;
+    histogram[10]= 10;
+    REQUIRE(BlockDevice::latencyPercentile(histogram, 0.5) == 15);
+    REQUIRE(BlockDevice::latencyPercentile(histogram, 0.99) == 2047);
+
+    bd.resetStats();
+    REQUIRE(bd.getStats().requests[BD_OP_WRITE] == 0);
+
+    REQUIRE(bd.close() == 0);
+    remove(BD_PATH);
+}
+
+TEST_CASE( "BD_TRACE", "[blockdevice]" ) {
+
+    remove(BD_PATH);
+    remove(TRACE_PATH);
+    char w[2 * BD_BLOCK_SIZE];
+    char r[2 * BD_BLOCK_SIZE];
+    gen_random(w, 2 * BD_BLOCK_SIZE);
+
+    const char *names[]= { "background", "write", "read" };
+    TracingBlockDevice *bd= new TracingBlockDevice(new BlockDevice(BLOCK_SIZE), TRACE_PATH, names, 3);
+    REQUIRE(bd->isTracing());
+    REQUIRE(bd->create(BD_PATH) == 0);
+
+    // requests are passed on
+    BlockDevice::setCause(1);
+    REQUIRE(bd->writeBlocks(4, 2, w) == 0);
+    BlockDevice::setCause(2);
+    REQUIRE(bd->read(5, r) == 0);
+    REQUIRE(memcmp(r, w + BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+    struct iovec iov= { r, 2 * BD_BLOCK_SIZE };
+    REQUIRE(bd->queueRead(4, &iov, 1, 7) == 0);
+    REQUIRE(bd->drain() == 0);
+    REQUIRE(memcmp(r, w, 2 * BD_BLOCK_SIZE) == 0);
+    BlockDevice::setCause(0);
+    REQUIRE(bd->flush(0, 0, true) == 0);
+    REQUIRE(bd->getStats().requests[BD_OP_READ] == 2);
+    REQUIRE(bd->getBlockPointer(4, 1) == nullptr);
+
+    REQUIRE(bd->close() == 0);
+    delete bd;
+
+    // and recorded in order
+    TraceReader reader;
+    REQUIRE(reader.open(TRACE_PATH) == 0);
+    REQUIRE(reader.getBlockSize() == BLOCK_SIZE);
+    REQUIRE(reader.getCauseNames().size() == 3);
+    REQUIRE(reader.getCauseNames()[2] == "read");
+
+    TraceRecord record;
+    REQUIRE(reader.next(record));
+    REQUIRE(record.op == TRACE_WRITE);
+    REQUIRE(record.blockNo == 4);
+    REQUIRE(record.count == 2);
+    REQUIRE(record.cause == 1);
+    uint64_t start= record.timeNs;
+    REQUIRE(reader.next(record));
+    REQUIRE(record.op == TRACE_READ);
+    REQUIRE(record.blockNo == 5);
+    REQUIRE(record.count == 1);
+    REQUIRE(record.cause == 2);
+    REQUIRE(record.timeNs >= start);
+    REQUIRE(reader.next(record));
+    REQUIRE(record.op == TRACE_READ);
+    REQUIRE(record.count == 2);
+    REQUIRE(record.flags == TRACE_QUEUED);
+    REQUIRE(reader.next(record));
+    REQUIRE(record.op == TRACE_FLUSH);
+    REQUIRE(record.flags == TRACE_WAIT);
+    REQUIRE(record.cause == 0);
+    REQUIRE_FALSE(reader.next(record));
+
+    REQUIRE(reader.open(BD_PATH) == -EINVAL);
+
+    remove(BD_PATH);
+    remove(TRACE_PATH);
+}
+
+TEST_CASE( "BD_STRIPED", "[blockdevice]" ) {
+
+    const char *paths[]= { "/tmp/bd0.bin", "/tmp/bd1.bin", "/tmp/bd2.bin" };
+    std::vector<BlockDevice *> members;
+    std::vector<std::string> names;
+    for (int m= 0; m < 3; m++) {
+        remove(paths[m]);
+        members.push_back(new AsyncBlockDevice(BLOCK_SIZE, 4));
+        names.push_back(paths[m]);
+    }
+    StripedBlockDevice bd(members, names, 4);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    // block counts of the members: stripe units 0-4 on members 0, 1, 2, 0, 1, the last unit incomplete
+    REQUIRE(bd.memberBlockCount(0, 15) == 7);
+    REQUIRE(bd.memberBlockCount(1, 15) == 4);
+    REQUIRE(bd.memberBlockCount(2, 15) == 4);
+    REQUIRE(bd.memberBlockCount(0, 18) == 8);
+    REQUIRE(bd.memberBlockCount(1, 18) == 6);
+    REQUIRE(bd.memberBlockCount(2, 18) == 4);
+
+    const int count= 40;
+    char* w= new char[BD_BLOCK_SIZE * count];
+    char* r= new char[BD_BLOCK_SIZE * count];
+    gen_random(w, BD_BLOCK_SIZE * count);
+
+    SECTION("write and read across stripe units") {
+        REQUIRE(bd.writeBlocks(0, count, w) == 0);
+        memset(r, 0, BD_BLOCK_SIZE * count);
+        REQUIRE(bd.readBlocks(0, count, r) == 0);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+
+        // unaligned run from scattered buffers
+        struct iovec iov[3]= { { r, 3 * BD_BLOCK_SIZE }, { r + 3 * BD_BLOCK_SIZE, BD_BLOCK_SIZE },
+                               { r + 4 * BD_BLOCK_SIZE, 5 * BD_BLOCK_SIZE } };
+        memset(r, 0, BD_BLOCK_SIZE * count);
+        REQUIRE(bd.readBlocks(3, iov, 3) == 0);
+        REQUIRE(memcmp(r, w + 3 * BD_BLOCK_SIZE, 9 * BD_BLOCK_SIZE) == 0);
+
+        // block 21 is block 1 of stripe unit 5, stored on member 2 as its block 5
+        REQUIRE(bd.close() == 0);
+        BlockDevice member(BLOCK_SIZE);
+        REQUIRE(member.open(paths[2]) == 0);
+        REQUIRE(member.read(5, r) == 0);
+        REQUIRE(memcmp(r, w + 21 * BD_BLOCK_SIZE, BD_BLOCK_SIZE) == 0);
+        REQUIRE(member.close() == 0);
+        REQUIRE(bd.open(BD_PATH) == 0);
+    }
+
+    SECTION("queued requests") {
+        struct iovec iov[2]= { { w, 10 * BD_BLOCK_SIZE }, { w + 10 * BD_BLOCK_SIZE, 30 * BD_BLOCK_SIZE } };
+        REQUIRE(bd.queueWrite(2, &iov[0], 1, 1) == 0);
+        REQUIRE(bd.queueWrite(12, &iov[1], 1, 2) == 0);
+        REQUIRE(bd.submit() >= 0);
+        BlockCompletion done[4];
+        int n= 0;
+        while (n < 2) {
+            int k= bd.complete(done + n, 4 - n, true);
+            REQUIRE(k >= 0);
+            n += k;
+        }
+        REQUIRE(done[0].result == 0);
+        REQUIRE(done[1].result == 0);
+        REQUIRE(done[0].tag + done[1].tag == 3);
+
+        REQUIRE(bd.readBlocks(2, count, r) == 0);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(bd.getStats().requests[BD_OP_WRITE] == 2);
+    }
+
+    SECTION("grow and discard") {
+        REQUIRE(bd.grow(18) == 0);
+        struct stat st;
+        REQUIRE(stat(paths[0], &st) == 0);
+        REQUIRE(st.st_size == 8 * BLOCK_SIZE);
+        REQUIRE(stat(paths[1], &st) == 0);
+        REQUIRE(st.st_size == 6 * BLOCK_SIZE);
+
+        REQUIRE(bd.writeBlocks(0, count, w) == 0);
+        int ret= bd.discard(4, 8);
+        if (ret != -EOPNOTSUPP) {
+            REQUIRE(ret == 0);
+            REQUIRE(bd.readBlocks(0, count, r) == 0);
+            for (int i= 4 * BD_BLOCK_SIZE; i < 12 * BD_BLOCK_SIZE; i++) {
+                REQUIRE(r[i] == 0);
+            }
+            REQUIRE(memcmp(r + 12 * BD_BLOCK_SIZE, w + 12 * BD_BLOCK_SIZE, 28 * BD_BLOCK_SIZE) == 0);
+        }
+    }
+
+    REQUIRE(bd.flush(0, 0, true) == 0);
+    REQUIRE(bd.close() == 0);
+    for (int m= 0; m < 3; m++) {
+        remove(paths[m]);
+    }
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_MIRRORED", "[blockdevice]" ) {
+
+    const char *paths[]= { "/tmp/bd0.bin", "/tmp/bd1.bin" };
+    remove(paths[0]);
+    remove(paths[1]);
+    FailingBlockDevice *failing= new FailingBlockDevice(BLOCK_SIZE);
+    std::vector<BlockDevice *> members= { new AsyncBlockDevice(BLOCK_SIZE, 4), failing };
+    std::vector<std::string> names= { paths[0], paths[1] };
+    MirroredBlockDevice bd(members, names);
+    REQUIRE(bd.create(BD_PATH) == 0);
+
+    const int count= 16;
+    char* w= new char[BD_BLOCK_SIZE * count];
+    char* r= new char[BD_BLOCK_SIZE * count];
+    gen_random(w, BD_BLOCK_SIZE * count);
+
+    // writes go to all replicas
+    REQUIRE(bd.writeBlocks(0, count, w) == 0);
+    REQUIRE(bd.getReplicaStats(0).writes == 1);
+    REQUIRE(bd.getReplicaStats(1).writes == 1);
+    for (int m= 0; m < 2; m++) {
+        BlockDevice replica(BLOCK_SIZE);
+        REQUIRE(replica.open(paths[m]) == 0);
+        memset(r, 0, BD_BLOCK_SIZE * count);
+        REQUIRE(replica.readBlocks(0, count, r) == 0);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(replica.close() == 0);
+    }
+
+    SECTION("reads are spread over the replicas") {
+        for (int b= 0; b < count; b++) {
+            struct iovec iov= { r + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE };
+            REQUIRE(bd.queueRead(b, &iov, 1, b) == 0);
+        }
+        REQUIRE(bd.drain() == 0);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(bd.getReplicaStats(0).reads > 0);
+        REQUIRE(bd.getReplicaStats(1).reads > 0);
+        REQUIRE(bd.getReplicaStats(0).reads + bd.getReplicaStats(1).reads == count);
+    }
+
+    SECTION("failed reads are retried") {
+        failing->failReads= true;
+        memset(r, 0, BD_BLOCK_SIZE * count);
+        for (int b= 0; b < count; b++) {
+            struct iovec iov= { r + b * BD_BLOCK_SIZE, BD_BLOCK_SIZE };
+            REQUIRE(bd.queueRead(b, &iov, 1, b) == 0);
+        }
+        REQUIRE(bd.drain() == 0);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(bd.getReplicaStats(1).readErrors > 0);
+        REQUIRE_FALSE(bd.getReplicaStats(1).failed);
+    }
+
+    SECTION("a replica with a failed write is not used any more") {
+        failing->failWrites= true;
+        REQUIRE(bd.writeBlocks(0, count, w) == 0);
+        REQUIRE(bd.getReplicaStats(1).failed);
+        REQUIRE(bd.getReplicaStats(1).writeErrors == 1);
+        uint64_t reads= bd.getReplicaStats(1).reads;
+        for (int i= 0; i < 4; i++) {
+            REQUIRE(bd.readBlocks(0, count, r) == 0);
+        }
+        REQUIRE(bd.getReplicaStats(1).reads == reads);
+    }
+
+    REQUIRE(bd.close() == 0);
+    remove(paths[0]);
+    remove(paths[1]);
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_CHECKSUM", "[blockdevice]" ) {
+
+    const int count= 16;
+    char* w= new char[BD_BLOCK_SIZE * count];
+    char* r= new char[BD_BLOCK_SIZE * count];
+    gen_random(w, BD_BLOCK_SIZE * count);
+
+    // CRC32C check value, the CPU instructions agree with the tables at any length and alignment
+    REQUIRE(crc32c(0, "123456789", 9) == 0xe3069283);
+    REQUIRE(crc32cSoftware(0, "123456789", 9) == 0xe3069283);
+    for (size_t len : {0, 1, 7, 100, 1000, 4096, 8191}) {
+        for (int offset= 0; offset < 4; offset++) {
+            REQUIRE(crc32c(0, w + offset, len) == crc32cSoftware(0, w + offset, len));
+        }
+    }
+    REQUIRE(crc32c(crc32c(0, w, 100), w + 100, 300) == crc32c(0, w, 400));
+
+    remove(BD_PATH);
+    ChecksumBlockDevice *bd= new ChecksumBlockDevice(new BlockDevice(BLOCK_SIZE));
+    bd->setRegion(60, 2);
+    REQUIRE(bd->create(BD_PATH) == 0);
+    REQUIRE(bd->writeBlocks(1, count, w) == 0);
+    REQUIRE(bd->readBlocks(1, count, r) == 0);
+    REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+    REQUIRE(bd->getVerified() == count);
+    REQUIRE(bd->getBlockPointer(1, 1) == nullptr);
+
+    SECTION("damaged blocks fail to read") {
+        REQUIRE(bd->flush(0, 0, true) == 0);
+        BlockDevice raw(BLOCK_SIZE);
+        REQUIRE(raw.open(BD_PATH) == 0);
+        REQUIRE(raw.read(5, r) == 0);
+        r[17] ^= 1;
+        REQUIRE(raw.write(5, r) == 0);
+        REQUIRE(raw.close() == 0);
+
+        REQUIRE(bd->read(4, r) == 0);
+        REQUIRE(bd->read(5, r) == -EIO);
+        struct iovec iov= { r, BD_BLOCK_SIZE * count };
+        REQUIRE(bd->queueRead(1, &iov, 1, 42) == 0);
+        REQUIRE(bd->submit() >= 0);
+        BlockCompletion done;
+        REQUIRE(bd->complete(&done, 1, true) == 1);
+        REQUIRE(done.tag == 42);
+        REQUIRE(done.result == -EIO);
+        REQUIRE(bd->getMismatches() == 2);
+    }
+
+    SECTION("checksums are kept in their region") {
+        struct iovec iov= { w, 2 * BD_BLOCK_SIZE };
+        REQUIRE(bd->queueWrite(20, &iov, 1, 9) == 0);
+        REQUIRE(bd->drain() == 0);
+        REQUIRE(bd->discard(3, 1) == 0);
+        REQUIRE(bd->close() == 0);
+        delete bd;
+
+        bd= new ChecksumBlockDevice(new BlockDevice(BLOCK_SIZE));
+        bd->setRegion(60, 2);
+        REQUIRE(bd->open(BD_PATH) == 0);
+        REQUIRE(bd->loadChecksums() == 0);
+        REQUIRE(bd->readBlocks(1, count, r) == 0);
+        REQUIRE(memcmp(r, w, 2 * BD_BLOCK_SIZE) == 0);
+        REQUIRE(r[2 * BD_BLOCK_SIZE] == 0);
+        REQUIRE(bd->readBlocks(20, 2, r) == 0);
+        REQUIRE(memcmp(r, w, 2 * BD_BLOCK_SIZE) == 0);
+        REQUIRE(bd->getVerified() == count + 2);
+        REQUIRE(bd->getMismatches() == 0);
+    }
+
+    REQUIRE(bd->close() == 0);
+    delete bd;
+    delete [] r;
+    delete [] w;
+}
+
+TEST_CASE( "BD_LATENCY", "[blockdevice]" ) {
+
+    const int count= 4;
+    char* w= new char[BD_BLOCK_SIZE * count];
+    char* r= new char[BD_BLOCK_SIZE * count];
+    gen_random(w, BD_BLOCK_SIZE * count);
+    remove(BD_PATH);
+
+    SECTION("requests take the service time") {
+        LatencyModel model= LatencyBlockDevice::getDefaultModel(LATENCY_SSD);
+        model.serviceNs= 2000000;
+        model.jitterNs= 0;
+        model.bytesPerSec= 0;
+        LatencyBlockDevice *bd= new LatencyBlockDevice(new BlockDevice(BLOCK_SIZE), model);
+        REQUIRE(bd->create(BD_PATH) == 0);
+        REQUIRE(bd->getBlockPointer(0, 1) == nullptr);
+
+        uint64_t start= nowNs();
+        REQUIRE(bd->writeBlocks(1, count, w) == 0);
+        REQUIRE(bd->readBlocks(1, count, r) == 0);
+        REQUIRE(nowNs() - start >= 2 * model.serviceNs);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(bd->getDelayNs() >= 2 * model.serviceNs);
+        BlockDeviceStats stats= bd->getStats();
+        REQUIRE(stats.requests[BD_OP_READ] == 1);
+        REQUIRE(stats.latencyNs[BD_OP_READ] >= model.serviceNs);
+
+        // queued requests complete with their tags, not before their time
+        struct iovec iov[count];
+        start= nowNs();
+        for (int i= 0; i < count; i++) {
+            iov[i].iov_base= r + i * BD_BLOCK_SIZE;
+            iov[i].iov_len= BD_BLOCK_SIZE;
+            REQUIRE(bd->queueRead(1 + i, &iov[i], 1, 10 + i) == 0);
+        }
+        REQUIRE(bd->submit() >= 0);
+        BlockCompletion done[count];
+        int n= 0;
+        while (n < count) {
+            int ret= bd->complete(done + n, count - n, true);
+            REQUIRE(ret > 0);
+            n+= ret;
+        }
+        REQUIRE(nowNs() - start >= model.serviceNs);
+        uint64_t tags= 0;
+        for (int i= 0; i < count; i++) {
+            REQUIRE(done[i].result == 0);
+            tags|= 1ULL << done[i].tag;
+        }
+        REQUIRE(tags == 0xfULL << 10);
+        REQUIRE(memcmp(r, w, BD_BLOCK_SIZE * count) == 0);
+        REQUIRE(bd->getStats().requests[BD_OP_READ] == 1 + count);
+
+        REQUIRE(bd->close() == 0);
+        delete bd;
+    }
+
+    SECTION("sequential requests need no seek") {
+        LatencyModel model= LatencyBlockDevice::getDefaultModel(LATENCY_HDD);
+        model.seekMinNs= 1000000;
+        model.seekMaxNs= 1000000;
+        model.rotationNs= 0;
+        model.bytesPerSec= 0;
+        LatencyBlockDevice *bd= new LatencyBlockDevice(new BlockDevice(BLOCK_SIZE), model);
+        REQUIRE(bd->create(BD_PATH) == 0);
+        for (int i= 0; i < count; i++) {
+            REQUIRE(bd->write(i, w + i * BD_BLOCK_SIZE) == 0);
+        }
+        REQUIRE(bd->getDelayNs() == 0);
+        REQUIRE(bd->read(50, r) == 0);
+        REQUIRE(bd->getDelayNs() == model.seekMaxNs);
+        REQUIRE(bd->close() == 0);
+        delete bd;
+    }
+
+    SECTION("the same seed gives the same timing") {
+        uint64_t delay[2];
+        for (int k= 0; k < 2; k++) {
+            LatencyModel model= LatencyBlockDevice::getDefaultModel(LATENCY_HDD);
+            model.seed= 7;
+            LatencyBlockDevice *bd= new LatencyBlockDevice(new BlockDevice(BLOCK_SIZE), model);
+            REQUIRE(bd->create(BD_PATH) == 0);
+            for (uint32_t blockNo : {0, 40, 10}) {
+                REQUIRE(bd->read(blockNo, r) == 0);
+            }
+            delay[k]= bd->getDelayNs();
+            REQUIRE(bd->close() == 0);
+            delete bd;
+        }
+        REQUIRE(delay[0] > 0);
+        REQUIRE(delay[0] == delay[1]);
+    }
+
+    delete [] r;
+    delete [] w;
+}
+
 // ***
 // *** Helper functions
 // ***
@@ -108,3 +920,9 @@ void bdWriteRead(BlockDevice *bd, int noBlocks) {
     delete [] r;
     delete [] w;
 }
+
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
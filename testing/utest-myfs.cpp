@@ -11,7 +11,324 @@
 #include "tools.hpp"
 #include "myfs.h"
 #include "myinmemoryfs.h"
+#include "myondiskfs.h"
+#include "lz.h"
+#include "pathindex.h"
+#include "dentrycache.h"
+#include "extentallocator.h"
+#include "extentmap.h"
 #include "fuse_common.h"
 
 // TODO: Implement your helper functions here!
 
+TEST_CASE( "FS_CONTAINER_LAYOUT", "[myfs]" ) {
+    superblock sb;
+
+    SECTION("default geometry") {
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE) == 0);
+        REQUIRE(sb.magic == SUPERBLOCK_MAGIC);
+        REQUIRE(sb.blockSize == BLOCK_SIZE);
+        REQUIRE(sb.dmapAddress == 1);
+        REQUIRE(sb.dmapBlocks == 1); // one bit per data block
+        REQUIRE(sb.blockDeviceSize == BLOCK_DEVICE_SIZE);
+        REQUIRE(sb.dirIndex == -1);
+        REQUIRE(sb.version == SUPERBLOCK_VERSION);
+    }
+
+    SECTION("directory index") {
+        // header and a bucket with some entries fit into the smallest block
+        REQUIRE(sizeof(dirIndexHeader) <= MIN_BLOCK_SIZE);
+        REQUIRE((MIN_BLOCK_SIZE - sizeof(dirBucketHeader)) / sizeof(dirBucketEntry) >= 32);
+    }
+
+    SECTION("all block sizes") {
+        for (uint32_t blockSize = MIN_BLOCK_SIZE; blockSize <= MAX_BLOCK_SIZE; blockSize *= 2) {
+            for (int deviceSize : {64, 1024, 100000}) {
+                REQUIRE(MyOnDiskFS::computeLayout(&sb, blockSize, deviceSize) == 0);
+                REQUIRE(sb.blockSize == blockSize);
+
+                // regions in order, each large enough for its array
+                REQUIRE(sb.dmapAddress == 1);
+                REQUIRE(sb.fatAddress == sb.dmapAddress + sb.dmapBlocks);
+                REQUIRE(sb.sumAddress == sb.fatAddress + sb.fatBlocks);
+                REQUIRE(sb.rootAddress == sb.sumAddress + sb.sumBlocks);
+                REQUIRE((size_t) sb.sumBlocks * blockSize >= deviceSize * sizeof(uint32_t));
+                REQUIRE((size_t) (sb.fatAddress - sb.dmapAddress) * blockSize * 8 >= (size_t) sb.dataSize);
+                REQUIRE((size_t) (sb.rootAddress - sb.fatAddress) * blockSize >= sb.dataSize * sizeof(int));
+                REQUIRE((size_t) (sb.dataAddress - sb.rootAddress) * blockSize >= NUM_DIR_ENTRIES * sizeof(file));
+                REQUIRE(sb.dataAddress + sb.dataSize <= deviceSize);
+                REQUIRE(sb.dataSize > 0);
+            }
+        }
+    }
+
+    SECTION("without checksums") {
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, false) == 0);
+        REQUIRE(sb.sumBlocks == 0);
+        REQUIRE(sb.rootAddress == sb.fatAddress + sb.fatBlocks);
+    }
+
+    SECTION("with compression") {
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, true, CHUNK_SIZE) == 0);
+        REQUIRE(sb.chunkSize == CHUNK_SIZE);
+        REQUIRE(sb.cmapAddress == sb.fatAddress + sb.fatBlocks);
+        REQUIRE((size_t) sb.cmapBlocks * BLOCK_SIZE >= sb.dataSize * sizeof(uint32_t));
+        REQUIRE(sb.sumAddress == sb.cmapAddress + sb.cmapBlocks);
+        REQUIRE(sb.rootAddress == sb.sumAddress + sb.sumBlocks);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, true, BLOCK_SIZE + 1) == -EINVAL);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, true, 2 * MAX_CHUNK_SIZE) == -EINVAL);
+    }
+
+    SECTION("with deduplication") {
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, true, 0, true) == 0);
+        REQUIRE(sb.cmapBlocks == 0);
+        REQUIRE(sb.dedupAddress == sb.fatAddress + sb.fatBlocks);
+        REQUIRE((size_t) sb.dedupBlocks * BLOCK_SIZE >= sb.dataSize * sizeof(dedupEntry));
+        REQUIRE(sb.sumAddress == sb.dedupAddress + sb.dedupBlocks);
+        REQUIRE(sb.dataAddress + sb.dataSize <= sb.blockDeviceSize);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, BLOCK_DEVICE_SIZE, true, CHUNK_SIZE, true) == 0);
+        REQUIRE(sb.dedupAddress == sb.cmapAddress + sb.cmapBlocks);
+        REQUIRE(sb.sumAddress == sb.dedupAddress + sb.dedupBlocks);
+    }
+
+    SECTION("invalid geometry") {
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, 256, BLOCK_DEVICE_SIZE) == -EINVAL);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, 3000, BLOCK_DEVICE_SIZE) == -EINVAL);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, 2 * MAX_BLOCK_SIZE, BLOCK_DEVICE_SIZE) == -EINVAL);
+        REQUIRE(MyOnDiskFS::computeLayout(&sb, BLOCK_SIZE, 10) == -EINVAL);
+    }
+}
+
+TEST_CASE( "FS_LZ_CODEC", "[myfs]" ) {
+    std::vector<char> text(CHUNK_SIZE);
+    for (size_t i = 0; i < text.size(); i++) {
+        text[i] = "the quick brown fox jumps over the lazy dog "[(i * 7 / 5) % 44] ^ (char) (i % 97 == 0);
+    }
+    std::vector<char> packed(2 * CHUNK_SIZE);
+    std::vector<char> unpacked(CHUNK_SIZE);
+
+    SECTION("round trip") {
+        size_t n = lzCompress(text.data(), text.size(), packed.data(), packed.size());
+        REQUIRE(n > 0);
+        REQUIRE(n < text.size() / 2);
+        REQUIRE(lzDecompress(packed.data(), n, unpacked.data(), unpacked.size()) == (int) text.size());
+        REQUIRE(memcmp(text.data(), unpacked.data(), text.size()) == 0);
+    }
+
+    SECTION("incompressible data") {
+        for (auto &c : text) {
+            c = (char) rand();
+        }
+        REQUIRE(lzCompress(text.data(), text.size(), packed.data(), text.size() - BLOCK_SIZE) == 0);
+        size_t n = lzCompress(text.data(), text.size(), packed.data(), packed.size());
+        if (n > 0) {
+            REQUIRE(lzDecompress(packed.data(), n, unpacked.data(), unpacked.size()) == (int) text.size());
+            REQUIRE(memcmp(text.data(), unpacked.data(), text.size()) == 0);
+        }
+    }
+
+    SECTION("damaged input") {
+        size_t n = lzCompress(text.data(), text.size(), packed.data(), packed.size());
+        REQUIRE(n > 0);
+        REQUIRE(lzDecompress(packed.data(), n, unpacked.data(), text.size() / 2) == -EIO);
+        const char badOffset[] = {0x10, 'a', 0x00, 0x00, 0x00};
+        REQUIRE(lzDecompress(badOffset, sizeof(badOffset), unpacked.data(), unpacked.size()) == -EIO);
+        const char badLength[] = {(char) 0xf0, (char) 0xff, 0x10, 'a'};
+        REQUIRE(lzDecompress(badLength, sizeof(badLength), unpacked.data(), unpacked.size()) == -EIO);
+    }
+}
+
+TEST_CASE( "FS_PATH_INDEX", "[myfs]" ) {
+    const int count = 1000;
+    std::vector<file> entries(count);
+    PathIndex index;
+    for (int i = 0; i < count; i += 2) {
+        snprintf(entries[i].name, NAME_LENGTH, "/file%d", i);
+        index.insert(ROOT_SLOT, entries[i].name, i);
+    }
+    REQUIRE(index.size() == count / 2);
+    for (int i = 0; i < count; i++) {
+        char name[NAME_LENGTH];
+        snprintf(name, NAME_LENGTH, "/file%d", i);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, name) == (i % 2 == 0 ? i : -1));
+    }
+
+    SECTION("remove and rename") {
+        for (int i = 0; i < count; i += 4) {
+            index.remove(ROOT_SLOT, entries[i].name, i);
+            entries[i].name[0] = '\0';
+        }
+        index.remove(ROOT_SLOT, entries[2].name, 2);
+        snprintf(entries[2].name, NAME_LENGTH, "/renamed");
+        index.insert(ROOT_SLOT, entries[2].name, 2);
+        REQUIRE(index.size() == count / 4);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file0") == -1);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file2") == -1);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/renamed") == 2);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file6") == 6);
+
+        // tombstones are reused and dropped, the table stays usable after many changes
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < count; i += 4) {
+                snprintf(entries[i].name, NAME_LENGTH, "/round%d-%d", round, i);
+                index.insert(ROOT_SLOT, entries[i].name, i);
+            }
+            for (int i = 0; i < count; i += 4) {
+                index.remove(ROOT_SLOT, entries[i].name, i);
+                entries[i].name[0] = '\0';
+            }
+        }
+        REQUIRE(index.size() == count / 4);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file998") == 998);
+    }
+
+    SECTION("rebuild") {
+        PathIndex other;
+        other.rebuild(entries.data(), count);
+        REQUIRE(other.size() == count / 2);
+        REQUIRE(other.find(entries.data(), ROOT_SLOT, "/file500") == 500);
+        REQUIRE(other.find(entries.data(), ROOT_SLOT, "/file501") == -1);
+    }
+
+    SECTION("same name in different directories") {
+        entries[1].parent = 3;
+        snprintf(entries[1].name, NAME_LENGTH, "/file0");
+        index.insert(3, entries[1].name, 1);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file0") == 0);
+        REQUIRE(index.find(entries.data(), 3, "/file0") == 1);
+        REQUIRE(index.find(entries.data(), 5, "/file0") == -1);
+        index.remove(3, entries[1].name, 1);
+        REQUIRE(index.find(entries.data(), 3, "/file0") == -1);
+        REQUIRE(index.find(entries.data(), ROOT_SLOT, "/file0") == 0);
+    }
+}
+
+TEST_CASE( "FS_DENTRY_CACHE", "[myfs]" ) {
+    DentryCache cache(4);
+    int slot;
+    bool isDir;
+    REQUIRE(!cache.lookup(ROOT_SLOT, "a", &slot, &isDir));
+
+    cache.insert(ROOT_SLOT, "a", 5, true);
+    cache.insert(5, "a", 7, false);
+    cache.insert(ROOT_SLOT, "missing", -1, false);
+    REQUIRE(cache.lookup(ROOT_SLOT, "a", &slot, &isDir));
+    REQUIRE(slot == 5);
+    REQUIRE(isDir);
+    REQUIRE(cache.lookup(5, "a", &slot, &isDir));
+    REQUIRE(slot == 7);
+    REQUIRE(!isDir);
+    REQUIRE(cache.lookup(ROOT_SLOT, "missing", &slot, &isDir));
+    REQUIRE(slot == -1);
+
+    SECTION("least recently used entry is evicted") {
+        cache.insert(ROOT_SLOT, "b", 8, false);
+        REQUIRE(cache.lookup(5, "a", &slot, &isDir));
+        cache.insert(ROOT_SLOT, "c", 9, false);
+        REQUIRE(!cache.lookup(ROOT_SLOT, "a", &slot, &isDir));
+        REQUIRE(cache.lookup(5, "a", &slot, &isDir));
+        REQUIRE(cache.getStats().evictions == 1);
+        REQUIRE(cache.getStats().resident == 4);
+    }
+
+    SECTION("update and remove") {
+        cache.insert(ROOT_SLOT, "missing", 3, false);
+        REQUIRE(cache.lookup(ROOT_SLOT, "missing", &slot, &isDir));
+        REQUIRE(slot == 3);
+        cache.remove(5, "a");
+        REQUIRE(!cache.lookup(5, "a", &slot, &isDir));
+        cache.clear();
+        REQUIRE(!cache.lookup(ROOT_SLOT, "a", &slot, &isDir));
+        REQUIRE(cache.getStats().resident == 0);
+    }
+
+    DentryCacheStats stats = cache.getStats();
+    REQUIRE(stats.hits >= 2);
+    REQUIRE(stats.negativeHits == 1);
+}
+
+TEST_CASE( "FS_EXTENT_ALLOCATOR", "[myfs]" ) {
+    // blocks 0-9 used, 10-19 free, 20-29 used, 30-99 free
+    uint64_t bitmap[2] = {0x3ff003ffULL, 0};
+    ExtentAllocator extents;
+    extents.rebuild(bitmap, 100);
+    REQUIRE(extents.freeBlocks() == 80);
+    REQUIRE(extents.extents() == 2);
+    REQUIRE(extents.largest() == 70);
+
+    int count = 0;
+    REQUIRE(extents.find(-1, 100, &count) == 30);
+    REQUIRE(count == 70);
+    REQUIRE(extents.find(-1, 5, &count) == 30);
+    REQUIRE(count == 5);
+
+    SECTION("growing at the end stays contiguous") {
+        REQUIRE(extents.find(15, 20, &count) == 15);
+        REQUIRE(count == 5);
+        REQUIRE(extents.find(20, 5, &count) == 30); // used, the largest extent instead
+    }
+
+    SECTION("reserve splits, release merges") {
+        extents.reserve(40, 10);
+        REQUIRE(extents.extents() == 3);
+        REQUIRE(extents.freeBlocks() == 70);
+        REQUIRE(extents.largest() == 50);
+        REQUIRE(extents.find(-1, 100, &count) == 50);
+
+        extents.release(20, 10);
+        REQUIRE(extents.extents() == 2);
+        REQUIRE(extents.find(-1, 100, &count) == 50);
+        REQUIRE(count == 50);
+        extents.release(40, 10);
+        REQUIRE(extents.extents() == 1);
+        REQUIRE(extents.largest() == 90);
+        REQUIRE(extents.find(-1, 100, &count) == 10);
+    }
+
+    SECTION("full") {
+        extents.reserve(0, 100);
+        REQUIRE(extents.freeBlocks() == 0);
+        REQUIRE(extents.largest() == 0);
+        REQUIRE(extents.find(-1, 1, &count) == -1);
+        extents.release(99, 1);
+        REQUIRE(extents.find(98, 1, &count) == 99);
+        REQUIRE(count == 1);
+    }
+}
+
+TEST_CASE( "FS_EXTENT_MAP", "[myfs]" ) {
+    ExtentMap extents;
+    int run = 0;
+    REQUIRE(extents.lookup(0, &run) == -1);
+    REQUIRE(extents.last() == -1);
+
+    // blocks 10-19, 40-44 and 20 in the container
+    extents.append(10, 5);
+    extents.append(15, 5);
+    extents.append(40, 5);
+    extents.append(20, 1);
+    REQUIRE(extents.size() == 3);
+    REQUIRE(extents.blocks() == 16);
+    REQUIRE(extents.last() == 20);
+
+    REQUIRE(extents.lookup(0, &run) == 10);
+    REQUIRE(run == 10);
+    REQUIRE(extents.lookup(9, &run) == 19);
+    REQUIRE(run == 1);
+    REQUIRE(extents.lookup(12, &run) == 42);
+    REQUIRE(run == 3);
+    REQUIRE(extents.lookup(15, &run) == 20);
+    REQUIRE(extents.lookup(16, &run) == -1);
+
+    SECTION("truncate") {
+        extents.truncate(12);
+        REQUIRE(extents.size() == 2);
+        REQUIRE(extents.blocks() == 12);
+        REQUIRE(extents.last() == 41);
+        extents.append(42, 1); // continues the last run again
+        REQUIRE(extents.size() == 2);
+        extents.truncate(0);
+        REQUIRE(extents.size() == 0);
+        REQUIRE(extents.blocks() == 0);
+    }
+}